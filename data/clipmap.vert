@@ -0,0 +1,67 @@
+#version 150 core
+// vertex shader for geometry clipmap terrain
+
+// per-frame data
+layout(std140)                  // standard layout
+uniform SceneData {             // like a class name
+    mat4 modelViewMatrix, modelViewInverse;
+    mat4 projectionMatrix, projectionInverse;
+    vec4 fog;
+	vec4 normRelief;
+};
+
+// shader settings
+uniform sampler2DArray heightTexture; // one toroidal layer per level
+uniform vec2 mapSize;           // half width of map, for color texture
+uniform vec3 clipSize;          // x = grid quads, y = texture size, z = blend width
+uniform int numLevels;          // levels in height texture
+uniform int level;              // level being drawn
+uniform vec3 levelGrid;         // xy = grid low corner, z = sample spacing
+
+// per-vertex input: integer position in level grid
+in vec2 vGrid;
+
+// output to fragment shader (view space)
+out vec3 normal;
+out vec2 texcoord;
+out vec3 normalMap;
+out vec4 position;
+out vec4 overlay;               // no overlay tint
+
+// height at world xy from samples of level l with given spacing
+// sample i is stored at texel i mod size, so repeat wrap does the rest
+float height(vec2 xy, int l, float spacing) {
+    vec2 uv = (xy / spacing + 0.5) / clipSize.y;
+    return textureLod(heightTexture, vec3(uv, l), 0).r;
+}
+
+// height and unnormalized normal at xy from level l
+vec4 surface(vec2 xy, int l, float spacing) {
+    vec3 N = vec3(height(xy - vec2(spacing,0), l, spacing)
+                - height(xy + vec2(spacing,0), l, spacing),
+                  height(xy - vec2(0,spacing), l, spacing)
+                - height(xy + vec2(0,spacing), l, spacing),
+                  2 * spacing);
+    return vec4(normalize(N), height(xy, l, spacing));
+}
+
+void main() {
+    float spacing = levelGrid.z;
+    vec2 xy = levelGrid.xy + vGrid * spacing;
+    vec4 S = surface(xy, level, spacing);
+
+    // blend to the next coarser level approaching the outer edge, so
+    // vertices on the edge lie exactly on the coarser level's triangles
+    vec2 d = abs(vGrid - 0.5 * clipSize.x);
+    float edge = 0.5 * clipSize.x - max(d.x, d.y);
+    float alpha = clamp(1 - edge / clipSize.z, 0, 1);
+    if (level < numLevels-1 && alpha > 0)
+        S = mix(S, surface(xy, level+1, 2*spacing), alpha);
+
+    position = modelViewMatrix * vec4(xy, S.w, 1);
+    normal = normalize(S.xyz * mat3(modelViewInverse));
+    normalMap = normal;
+    overlay = vec4(0);
+    texcoord = (xy + mapSize) / (2 * mapSize);
+    gl_Position = projectionMatrix * position;
+}
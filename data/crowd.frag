@@ -0,0 +1,33 @@
+#version 150 core
+// fragment shader for crowd agents
+
+// per-frame data
+layout(std140)                  // standard layout
+uniform SceneData {             // like a class name
+    mat4 modelViewMatrix, modelViewInverse;
+    mat4 projectionMatrix, projectionInverse;
+    vec4 fog;
+	vec4 normRelief;
+};
+
+// input from vertex shader
+in vec3 normal;
+in vec4 position;
+
+// output to frame buffer
+out vec4 fragColor;
+
+void main() {
+    vec3 N = normalize(normal);      // surface normal
+    vec3 L = normalize(vec3(-1,1,1)); // light direction
+    float diff = max(0., dot(N,L));  // diffuse lighting
+
+    // orange, to stand out from the ground
+    vec3 color = vec3(.9, .4, .1) * (.3 + .7*diff);
+
+    // fade to white with fog
+    if (fog.a != 0)
+        color = mix(fog.rgb, color, exp2(.005 * position.z));
+
+    fragColor = vec4(color, 1);
+}
@@ -0,0 +1,41 @@
+#version 150 core
+// vertex shader for crowd agents: one marker instance per agent
+
+// per-frame data
+layout(std140)                  // standard layout
+uniform SceneData {             // like a class name
+    mat4 modelViewMatrix, modelViewInverse;
+    mat4 projectionMatrix, projectionInverse;
+    vec4 fog;
+	vec4 normRelief;
+};
+
+// agent state: all x, then all y, z, and x and y velocity
+uniform samplerBuffer agentTexture;
+uniform int agentCount;
+uniform float agentSize;        // world size of each marker
+
+// per-vertex input, marker pointing along +x
+in vec3 vPosition;
+in vec3 vNormal;
+
+// output to fragment shader (view space)
+out vec3 normal;
+out vec4 position;
+
+void main() {
+    int i = gl_InstanceID;
+    vec3 P = vec3(texelFetch(agentTexture, i).r,
+                  texelFetch(agentTexture, i + agentCount).r,
+                  texelFetch(agentTexture, i + 2*agentCount).r);
+    vec2 V = vec2(texelFetch(agentTexture, i + 3*agentCount).r,
+                  texelFetch(agentTexture, i + 4*agentCount).r);
+
+    // turn the marker to face the way the agent walks
+    vec2 f = dot(V, V) > 0 ? normalize(V) : vec2(1, 0);
+    mat3 turn = mat3(f.x, f.y, 0,  -f.y, f.x, 0,  0, 0, 1);
+
+    position = modelViewMatrix * vec4(P + turn * (agentSize * vPosition), 1);
+    normal = normalize((turn * vNormal) * mat3(modelViewInverse));
+    gl_Position = projectionMatrix * position;
+}
@@ -0,0 +1,65 @@
+#version 150 core
+// vertex shader for terrain patches over a height texture
+
+// per-frame data
+layout(std140)                  // standard layout
+uniform SceneData {             // like a class name
+    mat4 modelViewMatrix, modelViewInverse;
+    mat4 projectionMatrix, projectionInverse;
+    vec4 fog;
+	vec4 normRelief;
+};
+
+// shader settings
+// texel (c,row) holds the height at grid x = 2c + row - 3(level+1)
+uniform sampler2D heightTexture;
+uniform int level;              // grid rows in each half of the hexagon
+uniform int patchSize;          // grid cells across each patch
+uniform int patches;            // patches across the height texture
+uniform vec3 gridSize;          // elevation grid size
+uniform vec3 mapSize;           // size of terrain in world space
+
+// per-vertex input: texel offset in patch
+in vec2 vGrid;
+
+// output to fragment shader (view space)
+out vec3 normal;
+out vec2 texcoord;
+out vec3 normalMap;
+out vec4 position;
+out vec4 overlay;               // no overlay tint
+
+// height at texel, clamped to the texture
+float height(ivec2 t) {
+    return texelFetch(heightTexture, clamp(t, ivec2(0), ivec2(2*level + 2)), 0).r;
+}
+
+void main() {
+    int n = level + 1;
+    ivec2 t = ivec2(gl_InstanceID % patches, gl_InstanceID / patches)
+        * patchSize + ivec2(vGrid);
+
+    // move texels outside the hexagon onto its edge, collapsing the
+    // triangles there
+    t.y = min(t.y, 2*n);
+    t.x = clamp(t.x, max(0, n - t.y), min(2*n, 3*n - t.y));
+
+    int x = 2*t.x + t.y - 3*n;
+    vec2 xy = vec2(0.5 * x, sqrt(0.75) * (t.y - n)) / gridSize.xy * mapSize.xy;
+    vec3 P = vec3(xy, height(t));
+
+    // normal from central differences: left and right neighbors in the
+    // row, and the average of the two neighbors above and below
+    vec2 step = mapSize.xy / gridSize.xy;
+    float dx = height(t + ivec2(1,0)) - height(t - ivec2(1,0));
+    float dy = height(t + ivec2(0,1)) + height(t + ivec2(-1,1))
+             - height(t - ivec2(0,1)) - height(t + ivec2(1,-1));
+    vec3 N = vec3(-dx / (2 * step.x), -dy / (4 * sqrt(0.75) * step.y), 1);
+
+    position = modelViewMatrix * vec4(P, 1);
+    normal = normalize(N * mat3(modelViewInverse));
+    normalMap = normal;
+    overlay = vec4(0);
+    texcoord = P.xy / mapSize.xy * 0.5 + 0.5;
+    gl_Position = projectionMatrix * position;
+}
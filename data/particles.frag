@@ -0,0 +1,35 @@
+#version 150 core
+// fragment shader for particles
+
+// per-frame data
+layout(std140)                  // standard layout
+uniform SceneData {             // like a class name
+    mat4 modelViewMatrix, modelViewInverse;
+    mat4 projectionMatrix, projectionInverse;
+    vec4 fog;
+	vec4 normRelief;
+};
+
+uniform vec4 color;             // color and opacity for this emitter
+
+// input from vertex shader
+in vec2 corner;
+in float fade;
+in vec4 position;
+
+// output to frame buffer
+out vec4 fragColor;
+
+void main() {
+    // round, softening toward the edge, and fading out with age
+    float r = length(corner);
+    if (r > 1) discard;
+    float alpha = color.a * (1 - r*r) * min(1., 4. * fade);
+
+    // fade to white with fog
+    vec3 lit = color.rgb;
+    if (fog.a != 0)
+        lit = mix(fog.rgb, lit, exp2(.005 * position.z));
+
+    fragColor = vec4(lit, alpha);
+}
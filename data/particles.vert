@@ -0,0 +1,31 @@
+#version 150 core
+// vertex shader for particles: a square facing the viewer per instance
+
+// per-frame data
+layout(std140)                  // standard layout
+uniform SceneData {             // like a class name
+    mat4 modelViewMatrix, modelViewInverse;
+    mat4 projectionMatrix, projectionInverse;
+    vec4 fog;
+	vec4 normRelief;
+};
+
+// live particles: position, and the fraction of life left
+uniform samplerBuffer particleTexture;
+uniform int first;              // this emitter's first particle
+uniform vec2 size;              // world width and height of each square
+
+// output to fragment shader
+out vec2 corner;                // -1 to 1 across the square
+out float fade;
+out vec4 position;              // view space
+
+void main() {
+    vec4 p = texelFetch(particleTexture, first + gl_InstanceID);
+
+    // four corners as a strip, from the vertex number
+    corner = 2. * vec2(gl_VertexID & 1, gl_VertexID >> 1) - 1.;
+    position = modelViewMatrix * vec4(p.xyz, 1) + vec4(0.5 * size * corner, 0, 0);
+    fade = p.w;
+    gl_Position = projectionMatrix * position;
+}
@@ -0,0 +1,102 @@
+#version 150 core
+// vertex shader for terrain computed entirely on the GPU
+// no vertex buffers: each instance is one band between two grid rows of
+// the hexagon, drawn as a triangle strip zig-zagging between them
+
+// per-frame data
+layout(std140)                  // standard layout
+uniform SceneData {             // like a class name
+    mat4 modelViewMatrix, modelViewInverse;
+    mat4 projectionMatrix, projectionInverse;
+    vec4 fog;
+	vec4 normRelief;
+};
+
+// shader settings, matching the Terrain constructor
+uniform int level;              // grid rows in each half of the hexagon
+uniform int octaves;            // noise octaves for height function
+uniform vec3 gridSize;          // elevation grid size
+uniform vec3 mapSize;           // size of terrain in world space
+
+// output to fragment shader (view space)
+out vec3 normal;
+out vec2 texcoord;
+out vec3 normalMap;
+out vec4 position;
+out vec4 overlay;               // no overlay tint
+
+// Unreal's 3DPCG16 hash, as in Noise.cpp
+uint hash(ivec2 i) {
+    uvec3 v = uvec3(uvec2(i), 0u) * 1664525u + 1013904223u;
+    v.x += v.y*v.z;
+    v.y += v.z*v.x;
+    v.z += v.x*v.y;
+    v.x += v.y*v.z;
+    return v.x >> 16u;
+}
+
+// smooth fade from 1 to 0 as t goes from 0 to 1
+float fade(float t) {
+    return t * t * t * (t * (t * 6 - 15) + 10);
+}
+
+// convert low two bits of hash code to gradient
+float grad(uint h, float x, float y) {
+    return ((h & 1u) != 0u ? x : -x) + ((h & 2u) != 0u ? y : -y);
+}
+
+// 2D noise function, as Noise::Noise2
+float noise2(vec2 v) {
+    vec2 vi = floor(v);
+    vec2 vf = v - vi;
+    ivec2 i = ivec2(vi);
+    float fx = fade(vf.x), fy = fade(vf.y);
+    return mix(mix(grad(hash(i          ), vf.x  , vf.y  ),
+                   grad(hash(i + ivec2(1,0)), vf.x-1, vf.y  ), fx),
+               mix(grad(hash(i + ivec2(0,1)), vf.x  , vf.y-1),
+                   grad(hash(i + ivec2(1,1)), vf.x-1, vf.y-1), fx),
+               fy);
+}
+
+// world position at grid point g = (x/2, row y), as Terrain::elevation
+vec3 elevation(vec2 g) {
+    vec3 P = vec3(g / gridSize.xy, 0);
+    float s = 1;
+    for(int i=0; i < octaves; ++i, s *= 2)
+        P.z += noise2(s * P.xy) / s;
+    return P * mapSize;
+}
+
+void main() {
+    // the longer row of the band has vertices at x = -m, -m+2, ... m
+    // the shorter one in between, so the strip steps x by one
+    int band = gl_InstanceID;
+    int y0 = level + 1 - abs(band - (level + 1));
+    int y1 = level + 1 - abs(band + 1 - (level + 1));
+    int m = max(y0, y1) + level + 1;
+    int longRow = y1 > y0 ? band + 1 : band;
+
+    // extra vertices past the end of shorter bands repeat the last one
+    int k = min(gl_VertexID, 2*m);
+
+    // walk the upper half right to left, so every band winds the same
+    int x = longRow == band ? m - k : k - m;
+    int row = (k & 1) == 0 ? longRow : 2*band + 1 - longRow;
+    vec2 g = vec2(0.5 * x, sqrt(0.75) * (row - (level + 1)));
+    vec3 P = elevation(g);
+
+    // normal from central differences one grid step away
+    vec2 step = mapSize.xy / gridSize.xy;
+    vec3 N = vec3((elevation(g - vec2(1,0)).z - elevation(g + vec2(1,0)).z)
+                      * step.y,
+                  (elevation(g - vec2(0,1)).z - elevation(g + vec2(0,1)).z)
+                      * step.x,
+                  2 * step.x * step.y);
+
+    position = modelViewMatrix * vec4(P, 1);
+    normal = normalize(N * mat3(modelViewInverse));
+    normalMap = normal;
+    overlay = vec4(0);
+    texcoord = P.xy / mapSize.xy * 0.5 + 0.5;
+    gl_Position = projectionMatrix * position;
+}
@@ -0,0 +1,148 @@
+#version 150 core
+// fragment shader for terrain ray marched through a height texture
+
+// per-frame data
+layout(std140)                  // standard layout
+uniform SceneData {             // like a class name
+    mat4 modelViewMatrix, modelViewInverse;
+    mat4 projectionMatrix, projectionInverse;
+    vec4 fog;
+	vec4 normRelief;
+};
+
+// shader settings
+uniform sampler2D colorTexture;
+uniform sampler2D heightTexture;    // heights at cell corners
+uniform sampler2D maxTexture;       // highest corner per cell, max mipmaps
+uniform vec3 mapSize;               // half size of height texture square
+uniform int cells;                  // height texture cells across
+uniform int maxLevel;               // 1x1 level of maxTexture
+
+// input from vertex shader
+in vec2 ndc;
+
+// output to frame buffer
+out vec4 fragColor;
+
+// most cells visited by one ray
+const int MAX_STEPS = 1024;
+
+// steps checking the bilinear surface across one finest cell
+const int CELL_STEPS = 4;
+
+// bilinear height at cell coordinate u
+float height(vec2 u) {
+    return textureLod(heightTexture, (u + 0.5) / (cells + 1), 0).r;
+}
+
+// lower bound on distance outside the terrain hexagon, in map units
+float hexagonDistance(vec2 P) {
+    P = abs(P);
+    return max(P.y - sqrt(0.75), 0.5 * (sqrt(3) * P.x + P.y) - sqrt(0.75));
+}
+
+void main() {
+    // view ray in world space, then in cell coordinates: xy in cells
+    // across the square, z in world units
+    vec4 far = projectionInverse * vec4(ndc, 1, 1);
+    vec3 eye = modelViewInverse[3].xyz;
+    vec3 dir = normalize(mat3(modelViewInverse) * (far.xyz / far.w));
+    vec2 scale = cells / (2 * mapSize.xy);
+    vec3 o = vec3((eye.xy + mapSize.xy) * scale, eye.z);
+    vec3 d = vec3(dir.xy * scale, dir.z);
+
+    // clip to the texture square and below the highest terrain
+    vec2 inv = 1 / max(abs(d.xy), 1e-8) * sign(d.xy + 1e-20);
+    vec2 t0 = (vec2(0) - o.xy) * inv, t1 = (vec2(cells) - o.xy) * inv;
+    float tmin = max(max(min(t0.x, t1.x), min(t0.y, t1.y)), 0);
+    float tmax = min(max(t0.x, t1.x), max(t0.y, t1.y));
+    float top = texelFetch(maxTexture, ivec2(0), maxLevel).r;
+    if (o.z > top) {
+        if (d.z >= 0) discard;
+        tmin = max(tmin, (top - o.z) / d.z);
+    }
+    else if (d.z > 0)
+        tmax = min(tmax, (top - o.z) / d.z);
+
+    // walk down the pyramid where the ray may be under the maximum, and
+    // back up after leaving a cell it passes over
+    // cells are picked a little ahead along the ray, so a ray leaving
+    // one cell is already in the next even when that barely moves p
+    float t = tmin;
+    vec2 ahead = 1e-3 * sign(d.xy);
+    int level = maxLevel;
+    bool hit = false;
+    for(int i=0; i < MAX_STEPS && t < tmax && ! hit; ++i) {
+        vec3 p = o + t * d;
+        float size = exp2(level);
+        ivec2 cell = clamp(ivec2(floor((p.xy + ahead) / size)), ivec2(0),
+                           ivec2(cells / int(size) - 1));
+
+        // where the ray leaves this cell
+        vec2 lo = vec2(cell) * size, hi = lo + size;
+        vec2 exit = (mix(lo, hi, step(0, d.xy)) - o.xy) * inv;
+        float tExit = min(min(exit.x, exit.y), tmax);
+
+        float zRay = min(p.z, o.z + tExit * d.z);
+        if (zRay > texelFetch(maxTexture, cell, level).r) {
+            t = tExit;
+            level = min(level + 1, maxLevel);
+            continue;
+        }
+        if (level > 0) {
+            --level;
+            continue;
+        }
+
+        // finest cell: find where the ray crosses the bilinear surface
+        float ta = t, tb = t;
+        for(int s=1; s <= CELL_STEPS; ++s) {
+            tb = mix(t, tExit, float(s) / CELL_STEPS);
+            vec3 q = o + tb * d;
+            if (q.z <= height(q.xy)) {
+                hit = true;
+                break;
+            }
+            ta = tb;
+        }
+        if (hit) {
+            for(int s=0; s < 6; ++s) {
+                float tm = 0.5 * (ta + tb);
+                vec3 q = o + tm * d;
+                if (q.z <= height(q.xy)) tb = tm; else ta = tm;
+            }
+            t = tb;
+
+            // parts of cells off the edge of the map do not count
+            vec2 uv = (o.xy + t * d.xy) / scale / mapSize.xy - 1;
+            if (hexagonDistance(uv) > 0) {
+                hit = false;
+                t = tExit;
+            }
+        }
+        else
+            t = tExit;
+    }
+    if (! hit) discard;
+
+    // surface point, normal from central differences, both in view space
+    vec3 u = o + t * d;
+    vec3 P = vec3(u.xy / scale - mapSize.xy, height(u.xy));
+    vec3 N = vec3((height(u.xy - vec2(1,0)) - height(u.xy + vec2(1,0))) * scale.x,
+                  (height(u.xy - vec2(0,1)) - height(u.xy + vec2(0,1))) * scale.y,
+                  2);
+    vec4 position = modelViewMatrix * vec4(P, 1);
+    N = normalize(N * mat3(modelViewInverse));
+
+    // shade as terrain.frag does
+    vec3 L = normalize(vec3(-1,1,1));
+    float diff = max(0., dot(N,L));
+    vec3 color = texture(colorTexture, P.xy / mapSize.xy * 0.5 + 0.5).rgb * diff;
+    if (fog.a != 0)
+        color = mix(fog.rgb, color, exp2(.005 * position.z));
+    fragColor = vec4(color, 1);
+
+    // depth of the hit point, for the default depth range
+    vec4 clip = projectionMatrix * position;
+    gl_FragDepth = 0.5 * clip.z / clip.w + 0.5;
+}
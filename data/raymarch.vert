@@ -0,0 +1,10 @@
+#version 150 core
+// vertex shader for ray marched terrain: one triangle covering the screen
+
+// output to fragment shader: normalized device coordinates
+out vec2 ndc;
+
+void main() {
+    ndc = vec2(gl_VertexID == 1 ? 3 : -1, gl_VertexID == 2 ? 3 : -1);
+    gl_Position = vec4(ndc, 0, 1);
+}
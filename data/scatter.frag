@@ -0,0 +1,34 @@
+#version 150 core
+// fragment shader for scattered objects
+
+// per-frame data
+layout(std140)                  // standard layout
+uniform SceneData {             // like a class name
+    mat4 modelViewMatrix, modelViewInverse;
+    mat4 projectionMatrix, projectionInverse;
+    vec4 fog;
+	vec4 normRelief;
+};
+
+uniform vec3 color;             // color for this kind of object
+
+// input from vertex shader
+in vec3 normal;
+in vec4 position;
+
+// output to frame buffer
+out vec4 fragColor;
+
+void main() {
+    vec3 N = normalize(normal);      // surface normal
+    vec3 L = normalize(vec3(-1,1,1)); // light direction
+    float diff = max(0., dot(N,L));  // diffuse lighting
+
+    vec3 lit = color * (.3 + .7*diff);
+
+    // fade to white with fog
+    if (fog.a != 0)
+        lit = mix(fog.rgb, lit, exp2(.005 * position.z));
+
+    fragColor = vec4(lit, 1);
+}
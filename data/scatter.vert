@@ -0,0 +1,40 @@
+#version 150 core
+// vertex shader for scattered objects: one mesh instance per object
+
+// per-frame data
+layout(std140)                  // standard layout
+uniform SceneData {             // like a class name
+    mat4 modelViewMatrix, modelViewInverse;
+    mat4 projectionMatrix, projectionInverse;
+    vec4 fog;
+	vec4 normRelief;
+};
+
+// instances in view, two texels each: position and size, then cosine
+// and sine of the turn about z, and ground normal x and y
+uniform samplerBuffer instanceTexture;
+uniform float lean;             // 0 to stand upright, 1 to follow the ground
+
+// per-vertex input, standing on z=0
+in vec3 vPosition;
+in vec3 vNormal;
+
+// output to fragment shader (view space)
+out vec3 normal;
+out vec4 position;
+
+void main() {
+    vec4 place = texelFetch(instanceTexture, 2*gl_InstanceID);
+    vec4 pose = texelFetch(instanceTexture, 2*gl_InstanceID + 1);
+
+    // turn about z, then tip z part way toward the ground normal
+    vec3 N = vec3(pose.zw, sqrt(max(0., 1. - dot(pose.zw, pose.zw))));
+    vec3 up = normalize(mix(vec3(0, 0, 1), N, lean));
+    vec3 side = normalize(cross(up, vec3(pose.y, -pose.x, 0)));
+    vec3 front = cross(up, side);
+    mat3 frame = mat3(side, front, up);
+
+    position = modelViewMatrix * vec4(place.xyz + frame * (place.w * vPosition), 1);
+    normal = normalize((frame * vNormal) * mat3(modelViewInverse));
+    gl_Position = projectionMatrix * position;
+}
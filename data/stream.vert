@@ -0,0 +1,34 @@
+#version 150 core
+// vertex shader for streamed terrain tiles
+
+// per-frame data
+layout(std140)                  // standard layout
+uniform SceneData {             // like a class name
+    mat4 modelViewMatrix, modelViewInverse;
+    mat4 projectionMatrix, projectionInverse;
+    vec4 fog;
+	vec4 normRelief;
+};
+
+// shader settings
+uniform vec2 mapSize;           // half width of one color texture repeat
+
+// per-vertex input
+in vec3 vPosition;
+in vec3 vNormal;
+
+// output to fragment shader (view space)
+out vec3 normal;
+out vec2 texcoord;
+out vec3 normalMap;
+out vec4 position;
+out vec4 overlay;               // no overlay tint
+
+void main() {
+    position = modelViewMatrix * vec4(vPosition, 1);
+    normal = normalize(vNormal * mat3(modelViewInverse));
+    normalMap = normal;
+    overlay = vec4(0);
+    texcoord = (vPosition.xy + mapSize) / (2 * mapSize);
+    gl_Position = projectionMatrix * position;
+}
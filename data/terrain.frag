@@ -19,6 +19,7 @@ in vec2 texcoord;
 in vec3 normalMap;
 in vec4 position;
 in mat3 TBNMat;
+in vec4 overlay;                // tint color and amount
 
 // output to frame buffer
 out vec4 fragColor;
@@ -35,6 +36,9 @@ void main() {
     // color from texture and diffuse
     vec3 color = texture(colorTexture, texcoord).rgb * diff;
 
+    // overlay tint from drainage or viewshed
+    color = mix(color, overlay.rgb * (.3 + .7*diff), overlay.a);
+
     // fade to white with fog
     if (fog.a != 0)
         color = mix(fog.rgb, color, exp2(.005 * position.z));
@@ -15,6 +15,8 @@ in vec3 vPosition;
 in vec3 vNormal;
 in vec3 vNormalMap;
 in vec2 vUV;
+in float vFlow;                 // fraction of the map draining here
+in float vHidden;               // 1 where hidden from the viewshed observer
 
 // output to fragment shader (view space)
 out vec3 normal;
@@ -22,6 +24,7 @@ out vec2 texcoord;
 out vec3 normalMap;
 out vec4 position;
 out mat3 TBNMat;
+out vec4 overlay;               // tint color and amount
 
 void main() {
     position = modelViewMatrix * vec4(vPosition, 1);
@@ -34,5 +37,10 @@ void main() {
 
 	normalMap = vNormalMap * TBNMat; 
     texcoord = vUV;
+
+    // blue along drainage channels, from 1/4096 of the map draining
+    // through a point to 1/16, or dark red where hidden from view
+    float river = clamp((log2(max(vFlow, 1e-10)) + 12.) / 8., 0., 1.);
+    overlay = mix(vec4(.1, .3, .6, river), vec4(.4, .05, .05, .6), vHidden);
     gl_Position = projectionMatrix * position;
 }
@@ -0,0 +1,67 @@
+#version 150 core
+// vertex shader for quadtree level-of-detail terrain
+
+// per-frame data
+layout(std140)                  // standard layout
+uniform SceneData {             // like a class name
+    mat4 modelViewMatrix, modelViewInverse;
+    mat4 projectionMatrix, projectionInverse;
+    vec4 fog;
+	vec4 normRelief;
+};
+
+// quadtree nodes to draw: xy = low corner, z = size, w = LOD level
+layout(std140)
+uniform NodeData {
+    vec4 node[1024];
+};
+
+// shader settings
+uniform sampler2D heightTexture;
+uniform vec4 heightMap;         // xy = low corner, z = width, w = texels-1
+uniform float patchSize;        // grid quads across each node
+uniform vec2 morph[16];         // per level: x = morph start, y = 1/length
+uniform int nodeBase;           // first node for this draw
+
+// per-vertex input: position in node patch, 0 to 1
+in vec2 vGrid;
+
+// output to fragment shader (view space)
+out vec3 normal;
+out vec2 texcoord;
+out vec3 normalMap;
+out vec4 position;
+out vec4 overlay;               // no overlay tint
+
+// terrain height at world xy
+float height(vec2 xy) {
+    vec2 uv = ((xy - heightMap.xy) / heightMap.z * heightMap.w + 0.5)
+        / (heightMap.w + 1);
+    return textureLod(heightTexture, uv, 0).r;
+}
+
+void main() {
+    vec4 n = node[nodeBase + gl_InstanceID];
+    vec3 eye = (modelViewInverse * vec4(0,0,0,1)).xyz;
+
+    // morph odd grid vertices onto even ones near the end of LOD range
+    vec2 xy = n.xy + vGrid * n.z;
+    vec2 m = morph[int(n.w)];
+    float k = clamp((distance(eye, vec3(xy, height(xy))) - m.x) * m.y, 0, 1);
+    vec2 grid = vGrid * patchSize;
+    grid -= fract(grid * 0.5) * 2 * k;
+    xy = n.xy + grid / patchSize * n.z;
+
+    // normal from central differences of height texture
+    float d = heightMap.z / heightMap.w;
+    vec3 N = vec3(height(xy - vec2(d,0)) - height(xy + vec2(d,0)),
+                  height(xy - vec2(0,d)) - height(xy + vec2(0,d)),
+                  2 * d);
+
+    position = modelViewMatrix * vec4(xy, height(xy), 1);
+    normal = normalize(N * mat3(modelViewInverse));
+    normalMap = normal;
+    overlay = vec4(0);
+    texcoord = (xy - heightMap.xy) / heightMap.z;
+    gl_Position = projectionMatrix * position;
+}
@@ -0,0 +1,39 @@
+#version 150 core
+// fragment shader for water drawn over the terrain
+
+// per-frame data
+layout(std140)                  // standard layout
+uniform SceneData {             // like a class name
+    mat4 modelViewMatrix, modelViewInverse;
+    mat4 projectionMatrix, projectionInverse;
+    vec4 fog;
+	vec4 normRelief;
+};
+
+// input from vertex shader
+in vec3 normal;
+in vec2 texcoord;
+in vec3 normalMap;
+in vec4 position;
+
+// output to frame buffer
+out vec4 fragColor;
+
+void main() {
+    vec3 N = normalize(normal);      // surface normal
+    vec3 L = normalize(vec3(-1,1,1)); // light direction
+    vec3 V = normalize(-position.xyz); // view direction
+    vec3 H = normalize(L + V);       // half way vector
+    float diff = max(0., dot(N,L));  // diffuse lighting
+    float spec = pow(max(0., dot(N,H)), 64.);
+
+    // blue water, more opaque at glancing angles
+    vec3 color = vec3(.1, .3, .5) * (.3 + .7*diff) + spec;
+    float alpha = mix(.5, .9, pow(1. - max(0., dot(N,V)), 3.));
+
+    // fade to white with fog
+    if (fog.a != 0)
+        color = mix(fog.rgb, color, exp2(.005 * position.z));
+
+    fragColor = vec4(color, alpha);
+}
@@ -8,12 +8,22 @@ public:
     class Scene *scene;         // viewing data
     class Input *input;         // user interface data
     class Terrain *terrain;     // terrain geometry
+    class TerrainLOD *lod;      // level of detail terrain, if in use
+    class Clipmap *clipmap;     // clipmap terrain, if in use
+    class StreamTerrain *stream;// streamed terrain, if in use
+    class TerrainROAM *roam;    // split/merge terrain, if in use
+    class TerrainRaymarch *raymarch; // ray marched terrain, if in use
+    class Crowd *crowd;         // agents walking the terrain, if any
+    class Scatter *scatter;     // objects scattered over the terrain, if any
+    class Particles *particles; // rain, debris and dust, if any
 
     // uniform matrix block indices
-    enum { SCENE_UNIFORMS, NUM_UNIFORMS };
+    enum { SCENE_UNIFORMS, NODE_UNIFORMS, NUM_UNIFORMS };
 
     // initialize all pointers to NULL to allow delete in destructor
-    AppContext() : scene(0), input(0), terrain(0) {}
+    AppContext() : scene(0), input(0), terrain(0), lod(0), clipmap(0),
+        stream(0), roam(0), raymarch(0), crowd(0), scatter(0),
+        particles(0) {}
 
     // clean up any context data
     ~AppContext();
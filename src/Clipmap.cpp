@@ -0,0 +1,268 @@
+// geometry clipmap terrain centered on the viewer
+// after Losasso and Hoppe, "Geometry Clipmaps: Terrain Rendering Using
+// Nested Regular Grids"
+
+#include "Clipmap.hpp"
+#include "Terrain.hpp"
+#include "Scene.hpp"
+#include "AppContext.hpp"
+#include "ImagePPM.hpp"
+#include "Vec.inl"
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+// height texture samples across each level: power of two
+// each level grid is 4 quads smaller, leaving a sample on each side for
+// normals, and divisible by 4 so the inner level sits on whole quads
+const int TEX_SIZE = 256;
+const int GRID_SIZE = TEX_SIZE - 4;
+
+// world distance between samples of the finest level
+const float SPACING = 1;
+
+// non-negative remainder for toroidal addressing
+static int wrap(int i, int n)
+{
+    return ((i % n) + n) % n;
+}
+
+//
+// create clipmap textures and grids; heights fill on first draw
+//
+Clipmap::Clipmap(Vec3f size, int octaves)
+    : mapSize(size), octaves(octaves), spacing(SPACING),
+      texSize(TEX_SIZE), gridSize(GRID_SIZE)
+{
+    for(int l=0; l < NUM_LEVELS; ++l)
+        valid[l] = false;
+
+    // buffer objects to be used later
+    glGenTextures(NUM_TEXTURES, textureIDs);
+    glGenBuffers(NUM_BUFFERS, bufferIDs);
+    glGenVertexArrays(1, &varrayID);
+
+    // load color image into a named texture
+    ImagePPM textureImage("pebbles.ppm");
+    textureImage.loadTexture(textureIDs[COLOR_TEXTURE]);
+
+    // one layer per level; repeat wrap matches toroidal addressing
+    glBindTexture(GL_TEXTURE_2D_ARRAY, textureIDs[HEIGHT_TEXTURE]);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R32F, texSize, texSize,
+            NUM_LEVELS, 0, GL_RED, GL_FLOAT, 0);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+    // level grid: (gridSize+1)^2 vertices at integer sample positions
+    std::vector<Vec2f> grid;
+    for(int y=0; y <= gridSize; ++y)
+        for(int x=0; x <= gridSize; ++x)
+            grid.push_back(vec2<float>(float(x), float(y)));
+
+    // full grid for the finest level, then rings for coarser levels with
+    // a hole for the level inside, shifted 0 or 1 quad in x and y
+    std::vector<unsigned short> index;
+    int hole = gridSize/2;
+    for(int ring=-1; ring < 4; ++ring) {
+        int hx = gridSize/4 + (ring & 1), hy = gridSize/4 + (ring >> 1);
+        for(int y=0; y < gridSize; ++y) {
+            for(int x=0; x < gridSize; ++x) {
+                if (ring >= 0 && x >= hx && x < hx + hole
+                              && y >= hy && y < hy + hole)
+                    continue;
+                unsigned short v00 = y*(gridSize+1) + x, v10 = v00 + 1;
+                unsigned short v01 = v00 + gridSize+1, v11 = v01 + 1;
+                index.push_back(v00); index.push_back(v10); index.push_back(v11);
+                index.push_back(v00); index.push_back(v11); index.push_back(v01);
+            }
+        }
+    }
+    fullCount = 6 * gridSize * gridSize;
+    ringCount = fullCount - 6 * hole * hole;
+
+    glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[GRID_BUFFER]);
+    glBufferData(GL_ARRAY_BUFFER, grid.size()*sizeof(Vec2f), &grid[0],
+            GL_STATIC_DRAW);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferIDs[INDEX_BUFFER]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, index.size()*sizeof(unsigned short),
+            &index[0], GL_STATIC_DRAW);
+
+    // initial shader load
+    shaderParts[0].id = glCreateShader(GL_VERTEX_SHADER);
+    shaderParts[0].file = "clipmap.vert";
+    shaderParts[1].id = glCreateShader(GL_FRAGMENT_SHADER);
+    shaderParts[1].file = "terrain.frag";
+    shaderID = glCreateProgram();
+    updateShaders();
+
+    printf("Clipmap terrain: %d levels of %d triangles, %d octaves\n",
+           NUM_LEVELS, 2*gridSize*gridSize, octaves);
+}
+
+//
+// Delete clipmap data
+//
+Clipmap::~Clipmap()
+{
+    glDeleteShader(shaderParts[0].id);
+    glDeleteShader(shaderParts[1].id);
+    glDeleteProgram(shaderID);
+    glDeleteTextures(NUM_TEXTURES, textureIDs);
+    glDeleteBuffers(NUM_BUFFERS, bufferIDs);
+    glDeleteVertexArrays(1, &varrayID);
+}
+
+//
+// load (or replace) clipmap shaders
+//
+void Clipmap::updateShaders()
+{
+    loadShaders(shaderID, sizeof(shaderParts)/sizeof(*shaderParts),
+            shaderParts);
+    glUseProgram(shaderID);
+
+    // (re)connect view and projection matrices
+    glUniformBlockBinding(shaderID,
+            glGetUniformBlockIndex(shaderID,"SceneData"),
+            AppContext::SCENE_UNIFORMS);
+
+    // map shader name for textures to glActiveTexture number used in draw
+    glUniform1i(glGetUniformLocation(shaderID, "colorTexture"), 0);
+    glUniform1i(glGetUniformLocation(shaderID, "heightTexture"), 1);
+
+    // fixed sizes, then per-level locations set in draw
+    glUniform2f(glGetUniformLocation(shaderID, "mapSize"),
+            mapSize.x, mapSize.y);
+    glUniform3f(glGetUniformLocation(shaderID, "clipSize"),
+            float(gridSize), float(texSize), float(gridSize/10));
+    glUniform1i(glGetUniformLocation(shaderID, "numLevels"), NUM_LEVELS);
+    levelUniform = glGetUniformLocation(shaderID, "level");
+    gridUniform = glGetUniformLocation(shaderID, "levelGrid");
+
+    // re-connect attribute arrays
+    glBindVertexArray(varrayID);
+
+    GLint gridAttrib = glGetAttribLocation(shaderID, "vGrid");
+    glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[GRID_BUFFER]);
+    glVertexAttribPointer(gridAttrib, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(gridAttrib);
+}
+
+//
+// compute and upload heights for samples x0..x1-1, y0..y1-1 of level
+// split where the range wraps around the edge of the texture
+//
+void Clipmap::fill(int level, int x0, int y0, int x1, int y1)
+{
+    float step = spacing * float(1 << level);
+    for(int y=y0; y < y1; ) {
+        int ty = wrap(y, texSize), ny = std::min(y1 - y, texSize - ty);
+        for(int x=x0; x < x1; ) {
+            int tx = wrap(x, texSize), nx = std::min(x1 - x, texSize - tx);
+
+            scratch.resize(nx*ny);
+            for(int j=0; j < ny; ++j) {
+                for(int i=0; i < nx; ++i) {
+                    Vec3f P = vec3<float>((x+i) * step / mapSize.x,
+                                          (y+j) * step / mapSize.y, 0);
+                    scratch[j*nx + i] =
+                        Terrain::elevation(P, octaves).z * mapSize.z;
+                }
+            }
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, tx, ty, level, nx, ny, 1,
+                    GL_RED, GL_FLOAT, &scratch[0]);
+            x += nx;
+        }
+        y += ny;
+    }
+}
+
+//
+// move levels to follow the viewer, updating newly exposed samples
+//
+void Clipmap::update(Vec3f eye)
+{
+    glBindTexture(GL_TEXTURE_2D_ARRAY, textureIDs[HEIGHT_TEXTURE]);
+
+    // finest level centered on the viewer, on even samples so it lines
+    // up with the next level's grid
+    int inner[2];
+    for(int i=0; i < 2; ++i)
+        inner[i] = 2*int(floorf((eye[i]/spacing - gridSize/2) / 2));
+
+    // each coarser level places the previous one in its hole
+    int size = gridSize + 3;
+    for(int l=0; l < NUM_LEVELS; ++l) {
+        int hole[2] = {0, 0};
+        for(int i=0; i < 2; ++i) {
+            if (l == 0)
+                origin[l][i] = inner[i];
+            else {
+                int c = origin[l-1][i] / 2;
+                origin[l][i] = 2*int(floorf((c - gridSize/4) / 2.f));
+                hole[i] = c - origin[l][i] - gridSize/4;
+            }
+        }
+        ringVariant[l] = l == 0 ? -1 : hole[0] + 2*hole[1];
+
+        // valid samples cover the grid plus one on each side
+        int nx = origin[l][0] - 1, ny = origin[l][1] - 1;
+        int ox = window[l][0], oy = window[l][1];
+        window[l][0] = nx;
+        window[l][1] = ny;
+
+        if (! valid[l] || abs(nx - ox) >= size || abs(ny - oy) >= size) {
+            fill(l, nx, ny, nx + size, ny + size);
+            valid[l] = true;
+            continue;
+        }
+
+        // columns scrolled into view, full height
+        if (nx > ox) fill(l, ox + size, ny, nx + size, ny + size);
+        if (nx < ox) fill(l, nx, ny, ox, ny + size);
+
+        // rows scrolled into view, over columns kept from before
+        int kx0 = std::max(nx, ox), kx1 = std::min(nx, ox) + size;
+        if (ny > oy) fill(l, kx0, oy + size, kx1, ny + size);
+        if (ny < oy) fill(l, kx0, ny, kx1, oy);
+    }
+}
+
+//
+// draw clipmap levels around the scene viewer
+//
+void Clipmap::draw(Scene &scene)
+{
+    update(scene.position);
+
+    // enable shaders, vertex arrays and textures
+    glUseProgram(shaderID);
+    glBindVertexArray(varrayID);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, textureIDs[COLOR_TEXTURE]);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, textureIDs[HEIGHT_TEXTURE]);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferIDs[INDEX_BUFFER]);
+
+    // same index ranges every frame, just placed differently
+    for(int l=0; l < NUM_LEVELS; ++l) {
+        float step = spacing * float(1 << l);
+        glUniform1i(levelUniform, l);
+        glUniform3f(gridUniform, origin[l][0] * step, origin[l][1] * step, step);
+
+        int count = l == 0 ? fullCount : ringCount;
+        size_t offset = l == 0 ? 0 :
+            (fullCount + ringVariant[l] * ringCount) * sizeof(unsigned short);
+        glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_SHORT,
+                (const void*)offset);
+        scene.stats.triangles += count/3;
+    }
+    scene.stats.tilesDrawn += NUM_LEVELS;
+}
@@ -0,0 +1,77 @@
+// geometry clipmap terrain centered on the viewer
+#ifndef Clipmap_hpp
+#define Clipmap_hpp
+
+#include "Vec.hpp"
+#include "Shader.hpp"
+#include <vector>
+
+class Scene;
+
+// nested square grids of the same vertex count, each twice the spacing of
+// the one inside it, all following the viewer. Heights for each level
+// live in one layer of a texture array, addressed toroidally so moving
+// only computes and uploads the rows and columns that scroll into view.
+class Clipmap {
+// private data
+private:
+    enum {NUM_LEVELS = 6};      // nested grid levels
+
+    Vec3f mapSize;              // size of terrain in world space
+    int octaves;                // noise octaves for height function
+    float spacing;              // world distance between finest samples
+    int texSize;                // height texture samples across
+    int gridSize;               // grid quads across each level
+
+    // per-level grid placement, in samples of that level
+    int origin[NUM_LEVELS][2];  // low corner of level grid
+    int window[NUM_LEVELS][2];  // low corner of valid texture samples
+    bool valid[NUM_LEVELS];     // false until first fill
+    int ringVariant[NUM_LEVELS];// which ring index range to draw
+
+    std::vector<float> scratch; // heights being uploaded
+
+    // GL vertex array object IDs
+    unsigned int varrayID;
+
+    // GL texture IDs
+    enum {COLOR_TEXTURE, HEIGHT_TEXTURE, NUM_TEXTURES};
+    unsigned int textureIDs[NUM_TEXTURES];
+
+    // GL buffer object IDs
+    enum {GRID_BUFFER, INDEX_BUFFER, NUM_BUFFERS};
+    unsigned int bufferIDs[NUM_BUFFERS];
+
+    // index buffer holds the full grid, then four versions of a ring with
+    // the inner level's hole shifted by 0 or 1 quad in x and y
+    int fullCount, ringCount;   // indices in each
+
+    // GL shaders
+    unsigned int shaderID;      // ID for shader program
+    ShaderInfo shaderParts[2];  // vertex & fragment shader info
+    int levelUniform, gridUniform; // per-level uniform locations
+
+// private methods
+private:
+    // compute and upload heights for samples x0..x1-1, y0..y1-1 of level
+    void fill(int level, int x0, int y0, int x1, int y1);
+
+    // move levels to follow the viewer, updating newly exposed samples
+    void update(Vec3f eye);
+
+// public methods
+public:
+    // create clipmap textures and grids; heights fill on first draw
+    Clipmap(Vec3f mapSize, int octaves);
+
+    // clean up allocated memory
+    ~Clipmap();
+
+    // load/reload shaders
+    void updateShaders();
+
+    // draw clipmap levels around the scene viewer
+    void draw(Scene &scene);
+};
+
+#endif
@@ -0,0 +1,381 @@
+// many walkers moving over the terrain at once
+
+#include "Crowd.hpp"
+#include "Terrain.hpp"
+#include "Scene.hpp"
+#include "AppContext.hpp"
+#include "Parallel.hpp"
+#include "Vec.inl"
+
+#include <GL/glew.h>
+#include <algorithm>
+#include <stdio.h>
+#include <math.h>
+
+#ifndef F_PI
+#define F_PI 3.1415926f
+#endif
+
+// agents handed to a thread at a time, and heights queried at once
+const unsigned int AGENT_BLOCK = 1024;
+
+// seconds per step, and most steps run by one update
+const float STEP = 1.f / 30;
+const int MAX_STEPS = 4;
+
+// world units per second: walking, and fastest when pushed
+const float WALK_SPEED = 10;
+const float MAX_SPEED = 15;
+
+// world distance agents keep apart, also the spatial hash cell size
+const float AGENT_RADIUS = 1.5f;
+
+// most neighbors each agent steers away from in a step
+const int AVOID_NEIGHBORS = 8;
+
+// fraction of the way to the wanted velocity per second, and velocity per
+// unit of overlap with neighbors
+const float STEER = 4;
+const float AVOID = 2;
+
+// world size of the marker drawn for each agent
+const float AGENT_SIZE = 2;
+
+// marker: three sloped sides of a pyramid pointing along +x
+const int MARKER_VERTS = 9;
+
+//
+// count agents at random points on the terrain, each walking a random way.
+// Points are drawn over the square around the map, and those off the
+// terrain drawn again, with heights found in parallel blocks
+//
+Crowd::Crowd(Terrain &terrain, unsigned int count)
+    : terrain(terrain), numagents(count), numthreads(parallelThreads()),
+      px(count), py(count), pz(count), vx(count), vy(count), face(count, -1),
+      nextX(count), nextY(count), nextZ(count), nextVX(count), nextVY(count),
+      nextFace(count), hashSize(32), cellKey(count), cellAgent(count),
+      hasGoal(false), goalFace(0), varrayID(0),
+      agentTextureID(0), shaderID(0)
+{
+    // at least a bucket per agent
+    while (hashSize * hashSize < count) hashSize *= 2;
+    cellStart.resize(hashSize * hashSize + 1);
+
+    // the same agents every time, for comparing runs
+    unsigned int state = 1;
+    auto random = [&]() {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) / float(1 << 24);
+    };
+
+    Vec3f size = terrain.size();
+    for(unsigned int placed = 0; placed < count; ) {
+        for(unsigned int i = placed; i < count; ++i) {
+            px[i] = (2 * random() - 1) * size.x;
+            py[i] = (2 * random() - 1) * size.y;
+            float angle = 2 * F_PI * random();
+            vx[i] = WALK_SPEED * cosf(angle);
+            vy[i] = WALK_SPEED * sinf(angle);
+            face[i] = -1;
+        }
+
+        int blocks = (count - placed + AGENT_BLOCK - 1) / AGENT_BLOCK;
+        parallelFor(blocks, numthreads, [&](int b) {
+            unsigned int begin = placed + b * AGENT_BLOCK;
+            unsigned int end = std::min(begin + AGENT_BLOCK, count);
+            Terrain::SurfaceBatch batch = {end - begin, &px[begin], &py[begin],
+                                           &pz[begin], 0, 0, 0, &face[begin]};
+            terrain.surfaceQuery(batch);
+        });
+
+        // keep those on the terrain
+        for(unsigned int i = placed; i < count; ++i) {
+            if (face[i] < 0) continue;
+            px[placed] = px[i];
+            py[placed] = py[i];
+            pz[placed] = pz[i];
+            vx[placed] = vx[i];
+            vy[placed] = vy[i];
+            face[placed] = face[i];
+            ++placed;
+        }
+    }
+}
+
+//
+// clean up GL objects, if ever drawn
+//
+Crowd::~Crowd()
+{
+    if (! shaderID) return;
+    glDeleteShader(shaderParts[0].id);
+    glDeleteShader(shaderParts[1].id);
+    glDeleteProgram(shaderID);
+    glDeleteTextures(1, &agentTextureID);
+    glDeleteBuffers(NUM_BUFFERS, bufferIDs);
+    glDeleteVertexArrays(1, &varrayID);
+}
+
+//
+// walk toward goal along a flow field. Procedural terrain has no faces
+// for one, so agents there keep wandering
+//
+void Crowd::setGoal(Vec2f goal)
+{
+    int f = terrain.isProcedural() ? -1 : terrain.faceAt(goal);
+    hasGoal = f >= 0;
+    goalFace = hasGoal ? f : 0;
+}
+
+//
+// bucket of cell x, y, wrapping the grid of cells around the table, so
+// any number of cells fit the buckets
+//
+unsigned int Crowd::bucket(int x, int y) const
+{
+    return (unsigned(y) & (hashSize - 1)) * hashSize + (unsigned(x) & (hashSize - 1));
+}
+
+//
+// sort agents into bucket order by counting sort: buckets are found in
+// parallel, then counted and filled in agent order, so the agents of each
+// bucket come out in the same order every time. Then the state is
+// gathered into that order in parallel
+//
+void Crowd::hashAgents()
+{
+    int blocks = (numagents + AGENT_BLOCK - 1) / AGENT_BLOCK;
+    parallelFor(blocks, numthreads, [&](int b) {
+        unsigned int end = std::min((b+1) * AGENT_BLOCK, numagents);
+        for(unsigned int i = b * AGENT_BLOCK; i < end; ++i)
+            cellKey[i] = bucket(int(floorf(px[i] / AGENT_RADIUS)),
+                                int(floorf(py[i] / AGENT_RADIUS)));
+    });
+
+    // filling leaves each start at the next bucket's, so shift them back
+    std::fill(cellStart.begin(), cellStart.end(), 0);
+    for(unsigned int i=0; i < numagents; ++i)
+        ++cellStart[cellKey[i] + 1];
+    for(size_t b=1; b < cellStart.size(); ++b)
+        cellStart[b] += cellStart[b-1];
+    for(unsigned int i=0; i < numagents; ++i)
+        cellAgent[cellStart[cellKey[i]]++] = i;
+    for(size_t b = cellStart.size() - 1; b > 0; --b)
+        cellStart[b] = cellStart[b-1];
+    cellStart[0] = 0;
+
+    parallelFor(blocks, numthreads, [&](int b) {
+        unsigned int end = std::min((b+1) * AGENT_BLOCK, numagents);
+        for(unsigned int k = b * AGENT_BLOCK; k < end; ++k) {
+            unsigned int i = cellAgent[k];
+            nextX[k] = px[i];
+            nextY[k] = py[i];
+            nextZ[k] = pz[i];
+            nextVX[k] = vx[i];
+            nextVY[k] = vy[i];
+            nextFace[k] = face[i];
+        }
+    });
+    px.swap(nextX);
+    py.swap(nextY);
+    pz.swap(nextZ);
+    vx.swap(nextVX);
+    vy.swap(nextVY);
+    face.swap(nextFace);
+}
+
+//
+// new velocity and position for a block of agents: toward the wanted
+// velocity, and away from close neighbors. Then heights for the whole
+// block in one query. Agents stepping off the terrain stay put and turn
+// back
+//
+void Crowd::moveBlock(int b, float dt, const FlowFields::Field *field)
+{
+    unsigned int begin = b * AGENT_BLOCK;
+    unsigned int end = std::min(begin + AGENT_BLOCK, numagents);
+    float radius2 = AGENT_RADIUS * AGENT_RADIUS;
+    int lastFace[AGENT_BLOCK];
+
+    for(unsigned int i = begin; i < end; ++i) {
+        Vec2f P = vec2<float>(px[i], py[i]), V = vec2<float>(vx[i], vy[i]);
+
+        // along the field toward the goal, or straight on when wandering
+        Vec2f want = V;
+        if (field)
+            want = face[i] >= 0 ? WALK_SPEED * field->direction(face[i])
+                                : vec2<float>(0, 0);
+
+        // neighbors in the buckets of the 3x3 cells around, visiting each
+        // bucket once even if cells share one
+        Vec2f push = vec2<float>(0, 0);
+        unsigned int seen[9];
+        int numseen = 0, near = 0;
+        int cx = int(floorf(P.x / AGENT_RADIUS)), cy = int(floorf(P.y / AGENT_RADIUS));
+        for(int k=0; k < 9 && near < AVOID_NEIGHBORS; ++k) {
+            unsigned int key = bucket(cx + k%3 - 1, cy + k/3 - 1);
+            if (std::find(seen, seen + numseen, key) != seen + numseen) continue;
+            seen[numseen++] = key;
+
+            for(unsigned int j = cellStart[key];
+                j < cellStart[key+1] && near < AVOID_NEIGHBORS; ++j) {
+                Vec2f d = P - vec2<float>(px[j], py[j]);
+                float d2 = dot(d, d);
+                if (j == i || d2 >= radius2) continue;
+
+                // agents on the same spot part by their order
+                if (d2 == 0) {
+                    d = vec2<float>(i < j ? 1e-3f : -1e-3f, 0);
+                    d2 = dot(d, d);
+                }
+                push += d * (AGENT_RADIUS / sqrtf(d2) - 1);
+                ++near;
+            }
+        }
+
+        V += (want - V) * std::min(1.f, STEER * dt) + AVOID * push;
+        float speed = length(V);
+        if (speed > MAX_SPEED)
+            V *= MAX_SPEED / speed;
+
+        nextX[i] = P.x + V.x * dt;
+        nextY[i] = P.y + V.y * dt;
+        nextVX[i] = V.x;
+        nextVY[i] = V.y;
+        lastFace[i - begin] = face[i];
+    }
+
+    Terrain::SurfaceBatch batch = {end - begin, &nextX[begin], &nextY[begin],
+                                   &pz[begin], 0, 0, 0, &face[begin]};
+    if (terrain.surfaceQuery(batch) == end - begin) return;
+    for(unsigned int i = begin; i < end; ++i) {
+        if (face[i] >= 0) continue;
+        nextX[i] = px[i];
+        nextY[i] = py[i];
+        nextVX[i] = -nextVX[i];
+        nextVY[i] = -nextVY[i];
+        face[i] = lastFace[i - begin];
+    }
+}
+
+//
+// one fixed step: sort, move every block, then swap in the new state
+//
+void Crowd::step()
+{
+    const FlowFields::Field *field = 0;
+    if (hasGoal) {
+        FlowFields *flows = terrain.flowFields();
+        if (flows) field = flows->field(goalFace);
+    }
+
+    hashAgents();
+    int blocks = (numagents + AGENT_BLOCK - 1) / AGENT_BLOCK;
+    parallelFor(blocks, numthreads, [&](int b) {
+        moveBlock(b, STEP, field);
+    });
+
+    px.swap(nextX);
+    py.swap(nextY);
+    vx.swap(nextVX);
+    vy.swap(nextVY);
+}
+
+//
+// fixed steps for the time since the last update
+//
+int Crowd::update(double now)
+{
+    return clock.update(now, STEP, MAX_STEPS, [&]() { step(); });
+}
+
+//
+// vertex array, marker and agent buffers, and shaders
+//
+void Crowd::buildGL()
+{
+    glGenVertexArrays(1, &varrayID);
+    glGenBuffers(NUM_BUFFERS, bufferIDs);
+    glGenTextures(1, &agentTextureID);
+
+    // each side of the marker with its own flat normal
+    Vec3f tip = vec3<float>(0, 0, 1), base[3] = {
+        vec3<float>(1, 0, 0), vec3<float>(-0.5f, 0.5f, 0),
+        vec3<float>(-0.5f, -0.5f, 0)};
+    Vec3f marker[2*MARKER_VERTS];
+    for(int s=0; s < 3; ++s) {
+        Vec3f a = base[s], b = base[(s+1) % 3];
+        Vec3f N = normalize((b - a) ^ (tip - a));
+        marker[6*s + 0] = a;   marker[6*s + 1] = N;
+        marker[6*s + 2] = b;   marker[6*s + 3] = N;
+        marker[6*s + 4] = tip; marker[6*s + 5] = N;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[MARKER_BUFFER]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(marker), marker, GL_STATIC_DRAW);
+
+    // five arrays of agent state, read through a buffer texture
+    glBindBuffer(GL_TEXTURE_BUFFER, bufferIDs[AGENT_BUFFER]);
+    glBufferData(GL_TEXTURE_BUFFER, 5 * numagents * sizeof(float), 0,
+            GL_STREAM_DRAW);
+    glBindTexture(GL_TEXTURE_BUFFER, agentTextureID);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, bufferIDs[AGENT_BUFFER]);
+
+    shaderParts[0].id = glCreateShader(GL_VERTEX_SHADER);
+    shaderParts[0].file = "crowd.vert";
+    shaderParts[1].id = glCreateShader(GL_FRAGMENT_SHADER);
+    shaderParts[1].file = "crowd.frag";
+    shaderID = glCreateProgram();
+    updateShaders();
+}
+
+//
+// load (or replace) crowd shaders, and connect the marker attributes
+//
+void Crowd::updateShaders()
+{
+    if (! shaderID) return;
+    loadShaders(shaderID, sizeof(shaderParts)/sizeof(*shaderParts),
+            shaderParts);
+    glUseProgram(shaderID);
+
+    // (re)connect view and projection matrices
+    glUniformBlockBinding(shaderID,
+            glGetUniformBlockIndex(shaderID,"SceneData"),
+            AppContext::SCENE_UNIFORMS);
+    glUniform1i(glGetUniformLocation(shaderID, "agentTexture"), 0);
+    glUniform1i(glGetUniformLocation(shaderID, "agentCount"), numagents);
+    glUniform1f(glGetUniformLocation(shaderID, "agentSize"), AGENT_SIZE);
+
+    glBindVertexArray(varrayID);
+    glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[MARKER_BUFFER]);
+    GLint posAttrib = glGetAttribLocation(shaderID, "vPosition");
+    glVertexAttribPointer(posAttrib, 3, GL_FLOAT, GL_FALSE, 2*sizeof(Vec3f), 0);
+    glEnableVertexAttribArray(posAttrib);
+    GLint normAttrib = glGetAttribLocation(shaderID, "vNormal");
+    glVertexAttribPointer(normAttrib, 3, GL_FLOAT, GL_FALSE, 2*sizeof(Vec3f),
+            (void*)sizeof(Vec3f));
+    glEnableVertexAttribArray(normAttrib);
+}
+
+//
+// send this frame's agent state, then draw a marker for each agent
+//
+void Crowd::draw(Scene &scene)
+{
+    if (! shaderID) buildGL();
+
+    // orphan last frame's copy rather than wait for it to be drawn
+    size_t bytes = numagents * sizeof(float);
+    const std::vector<float> *state[5] = {&px, &py, &pz, &vx, &vy};
+    glBindBuffer(GL_TEXTURE_BUFFER, bufferIDs[AGENT_BUFFER]);
+    glBufferData(GL_TEXTURE_BUFFER, 5 * bytes, 0, GL_STREAM_DRAW);
+    for(int k=0; k < 5; ++k)
+        glBufferSubData(GL_TEXTURE_BUFFER, k * bytes, bytes, &(*state[k])[0]);
+
+    glUseProgram(shaderID);
+    glBindVertexArray(varrayID);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, agentTextureID);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, MARKER_VERTS, numagents);
+    scene.stats.triangles += numagents * MARKER_VERTS / 3;
+}
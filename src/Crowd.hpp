@@ -0,0 +1,109 @@
+// many walkers moving over the terrain at once
+#ifndef Crowd_hpp
+#define Crowd_hpp
+
+#include "FlowFields.hpp"
+#include "Shader.hpp"
+#include "FixedStep.hpp"
+#include <vector>
+
+class Terrain;
+class Scene;
+
+// agents walking over the terrain, kept as separate arrays for each part
+// of their state, so each pass streams through just the arrays it needs.
+// Steps are a fixed time apart however often update is called, and run
+// across threads in blocks of agents. Agents head along the flow field
+// toward a shared goal when there is one, steer apart from neighbors
+// found through a uniform spatial hash, and then find their heights in
+// one batched surface query per block. Each reads only last step's
+// positions of the others, so the order agents are done in never matters.
+// The hash wraps a grid of cells over a square table, so nearby cells
+// are nearby buckets, and agents are stored in bucket order, sorted again
+// each step, so agents near each other are near in memory too.
+// All agents are drawn by one instanced draw call.
+class Crowd {
+// private data
+private:
+    Terrain &terrain;           // surface walked on, must outlive this
+    unsigned int numagents;     // total agents
+    unsigned int numthreads;    // threads used by each step
+
+    // agent state, one entry per agent in each
+    std::vector<float> px, py, pz; // position on the surface
+    std::vector<float> vx, vy;  // velocity in xy
+    std::vector<int> face;      // face under each, -1 if not known
+
+    // next step's state, swapped in after each step, and after sorting
+    std::vector<float> nextX, nextY, nextZ, nextVX, nextVY;
+    std::vector<int> nextFace;
+
+    // spatial hash of square cells, one agent radius across, into a
+    // square table of buckets, a power of two across. Once sorted, agents
+    // in bucket b are cellStart[b] up to cellStart[b+1]
+    unsigned int hashSize;      // buckets across the table
+    std::vector<unsigned int> cellKey; // bucket of each agent
+    std::vector<unsigned int> cellStart;
+    std::vector<unsigned int> cellAgent; // agent for each place in order
+
+    bool hasGoal;               // false to wander
+    unsigned int goalFace;      // face the flow field leads to
+
+    FixedStep clock;            // steps run to keep up with the time
+
+    // GL vertex array, buffers and shaders, made on first draw. Agent
+    // state is copied each frame, one array after another, to a buffer
+    // texture the vertex shader reads by instance
+    enum {MARKER_BUFFER, AGENT_BUFFER, NUM_BUFFERS};
+    unsigned int varrayID;
+    unsigned int bufferIDs[NUM_BUFFERS];
+    unsigned int agentTextureID;
+    unsigned int shaderID;      // 0 until first drawn
+    ShaderInfo shaderParts[2];
+
+// private methods
+private:
+    // bucket of cell x, y, counting cells from the origin
+    unsigned int bucket(int x, int y) const;
+
+    // sort agents into bucket order by position
+    void hashAgents();
+
+    // step block b of agents dt seconds, following field if not null
+    void moveBlock(int b, float dt, const FlowFields::Field *field);
+
+    // vertex array, buffers and shaders
+    void buildGL();
+
+// public methods
+public:
+    // count agents spread at random over the terrain, wandering
+    Crowd(Terrain &terrain, unsigned int count);
+
+    // clean up
+    ~Crowd();
+
+    // walk toward xy along a flow field, if on mesh terrain
+    void setGoal(Vec2f goal);
+
+    // run as many fixed steps as fit the time since the last update,
+    // up to a few. Returns the number run
+    int update(double now);
+
+    // run one fixed step
+    void step();
+
+    // load/reload shaders
+    void updateShaders();
+
+    // draw every agent with one instanced draw call
+    void draw(Scene &scene);
+
+    // total agents
+    unsigned int agents() const { return numagents; }
+
+    // threads used by each step
+    unsigned int threads() const { return numthreads; }
+};
+
+#endif
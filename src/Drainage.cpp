@@ -0,0 +1,119 @@
+// flow directions and accumulation over the terrain mesh
+// steepest descent flow after O'Callaghan and Mark, "The Extraction of
+// Drainage Networks from Digital Elevation Data"
+
+#include "Drainage.hpp"
+#include "Parallel.hpp"
+#include "Vec.inl"
+
+#include <atomic>
+#include <algorithm>
+#include <math.h>
+
+// vertices handed to a thread at a time
+const int DRAINAGE_BLOCK = 4096;
+
+//
+// neighbors from the half-edges, and areas from the triangles
+//
+Drainage::Drainage(unsigned int numvert, const Vec3f *vert,
+                   unsigned int numtri, const unsigned int (*indices)[3],
+                   unsigned int numedge, const HalfEdge *edge)
+    : numvert(numvert), vert(vert), neighborStart(numvert + 1, 0),
+      ownArea(numvert, 0.f), totalArea(0), down(numvert, -1),
+      accum(numvert, 0.f), numpits(0)
+{
+    numthreads = parallelThreads();
+
+    // each half-edge adds its far vertex to the list of its own vertex,
+    // so every edge appears once in the list at each end
+    for(unsigned int e=0; e < numedge; ++e)
+        if (edge[e].vert >= 0 && edge[e].pair)
+            ++neighborStart[edge[e].vert + 1];
+    for(unsigned int v=0; v < numvert; ++v)
+        neighborStart[v+1] += neighborStart[v];
+    neighbor.resize(neighborStart[numvert]);
+    std::vector<unsigned int> fill(neighborStart.begin(), neighborStart.end() - 1);
+    for(unsigned int e=0; e < numedge; ++e)
+        if (edge[e].vert >= 0 && edge[e].pair)
+            neighbor[fill[edge[e].vert]++] = edge[e].pair->vert;
+
+    double sum = 0;
+    for(unsigned int t=0; t < numtri; ++t) {
+        Vec2f v0 = vert[indices[t][0]].xy, v1 = vert[indices[t][1]].xy;
+        Vec2f v2 = vert[indices[t][2]].xy;
+        Vec2f e1 = v1 - v0, e2 = v2 - v0;
+        float a = fabsf(e1.x * e2.y - e1.y * e2.x) / 6;
+        for(int k=0; k < 3; ++k)
+            ownArea[indices[t][k]] += a;
+        sum += 3*a;
+    }
+    totalArea = float(sum);
+}
+
+//
+// find flow directions and accumulate areas for the current heights
+//
+void Drainage::update()
+{
+    int blocks = (numvert + DRAINAGE_BLOCK - 1) / DRAINAGE_BLOCK;
+
+    // steepest descent: largest drop per unit of xy distance
+    parallelFor(blocks, numthreads, [&](int b) {
+        unsigned int end = std::min((b+1) * DRAINAGE_BLOCK, int(numvert));
+        for(unsigned int v = b * DRAINAGE_BLOCK; v < end; ++v) {
+            int best = -1;
+            float bestSlope = 0;
+            for(unsigned int i = neighborStart[v]; i < neighborStart[v+1]; ++i) {
+                unsigned int n = neighbor[i];
+                float slope = (vert[v].z - vert[n].z) / length(vert[n].xy - vert[v].xy);
+                if (slope > bestSlope) {
+                    best = n;
+                    bestSlope = slope;
+                }
+            }
+            down[v] = best;
+        }
+    });
+
+    // neighbors draining into each vertex
+    std::vector<std::atomic<int> > pending(numvert);
+    std::vector<unsigned char> source(numvert);
+    parallelFor(blocks, numthreads, [&](int b) {
+        unsigned int end = std::min((b+1) * DRAINAGE_BLOCK, int(numvert));
+        for(unsigned int v = b * DRAINAGE_BLOCK; v < end; ++v) {
+            int count = 0;
+            for(unsigned int i = neighborStart[v]; i < neighborStart[v+1]; ++i)
+                count += down[neighbor[i]] == int(v);
+            pending[v].store(count, std::memory_order_relaxed);
+            source[v] = count == 0;
+        }
+    });
+
+    // start at every source and follow the flow downstream, stopping at a
+    // vertex still waiting for other inflows. The thread that delivers the
+    // last inflow continues from there, so each vertex is summed once,
+    // after everything upstream of it
+    std::atomic<unsigned int> pitCount(0);
+    parallelFor(blocks, numthreads, [&](int b) {
+        unsigned int end = std::min((b+1) * DRAINAGE_BLOCK, int(numvert));
+        unsigned int pitsFound = 0;
+        for(unsigned int s = b * DRAINAGE_BLOCK; s < end; ++s) {
+            if (! source[s]) continue;
+            for(int v = s; v >= 0; v = down[v]) {
+                float sum = ownArea[v];
+                for(unsigned int i = neighborStart[v]; i < neighborStart[v+1]; ++i)
+                    if (down[neighbor[i]] == v)
+                        sum += accum[neighbor[i]];
+                accum[v] = sum;
+
+                if (down[v] < 0)
+                    ++pitsFound;
+                else if (pending[down[v]].fetch_sub(1, std::memory_order_acq_rel) != 1)
+                    break;
+            }
+        }
+        pitCount += pitsFound;
+    });
+    numpits = pitCount;
+}
@@ -0,0 +1,60 @@
+// flow directions and accumulation over the terrain mesh
+#ifndef Drainage_hpp
+#define Drainage_hpp
+
+#include "Vec.hpp"
+#include "HalfEdge.hpp"
+#include <vector>
+
+// each vertex drains to its steepest downhill neighbor, and the area
+// draining through a vertex is its own share of the surface plus the
+// areas of all vertices draining to it. Vertices with no lower neighbor
+// are pits, and keep what drains into them.
+// Accumulation is a parallel topological pass: every vertex counts the
+// neighbors draining into it, and a thread finishing a vertex carries on
+// downstream only once the last of those is done, so there is no
+// recursion or sort, and each vertex sums its inflows in a fixed order.
+class Drainage {
+// private data
+private:
+    unsigned int numvert;       // total vertices
+    const Vec3f *vert;          // vertex positions, heights may change
+    unsigned int numthreads;    // threads used by each pass
+
+    // neighbors of vertex v are neighbor[neighborStart[v]] up to
+    // neighbor[neighborStart[v+1]]
+    std::vector<unsigned int> neighborStart, neighbor;
+
+    std::vector<float> ownArea; // a third of the xy area of each triangle
+    float totalArea;            // sum of ownArea
+    std::vector<int> down;      // downstream neighbor, -1 for pits
+    std::vector<float> accum;   // area draining through each vertex
+    unsigned int numpits;       // vertices with no lower neighbor
+
+// public methods
+public:
+    // neighbors from the half-edges, and areas from the triangles
+    Drainage(unsigned int numvert, const Vec3f *vert,
+             unsigned int numtri, const unsigned int (*indices)[3],
+             unsigned int numedge, const HalfEdge *edge);
+
+    // find flow directions and accumulate areas for the current heights
+    void update();
+
+    // steepest downhill neighbor of vertex v, -1 if it is a pit
+    int downstream(unsigned int v) const { return down[v]; }
+
+    // xy area draining through vertex v, in world units
+    float area(unsigned int v) const { return accum[v]; }
+
+    // xy area of the whole mesh
+    float total() const { return totalArea; }
+
+    // vertices with no lower neighbor
+    unsigned int pits() const { return numpits; }
+
+    // threads used by each pass
+    unsigned int threads() const { return numthreads; }
+};
+
+#endif
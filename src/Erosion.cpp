@@ -0,0 +1,264 @@
+// hydraulic and thermal erosion of terrain heights
+// particle erosion after Beyer, "Implementation of a method for hydraulic
+// erosion"; thermal erosion after Musgrave et al., "The Synthesis and
+// Rendering of Eroded Fractal Terrains"
+
+#include "Erosion.hpp"
+#include "Parallel.hpp"
+#include "Simd.hpp"
+
+#include <algorithm>
+#include <math.h>
+
+// particles are confined to square tiles of this many cells, with the
+// tile grid shifted each iteration so tile edges do not show
+const int TILE = 32;
+
+// particles dropped per tile per iteration
+const int PARTICLES = TILE*TILE / 64;
+
+// particle settings, with heights in units of grid spacing
+const int LIFETIME = 30;                // most steps for one particle
+const float INERTIA = 0.05f;            // how much direction persists
+const float CAPACITY = 0.5f;            // sediment per unit slope*speed*water
+const float MIN_SLOPE = 0.01f;          // keeps capacity up on flat ground
+const float ERODE = 0.1f;               // fraction of spare capacity taken
+const float DEPOSIT = 0.3f;             // fraction of excess sediment dropped
+const float EVAPORATE = 0.01f;          // fraction of water lost per step
+const float GRAVITY = 1.f;              // speed gained per unit drop
+
+// thermal settings: steepest stable slope, and fraction of the excess
+// moved to each neighbor, small enough that a cell never gives away half
+// its difference from the lowest neighbor
+const float TALUS = 0.6f;
+const float THERMAL_RATE = 0.5f / 6;
+
+// PCG-style integer hash, for per-tile random seeds
+static unsigned int hash(unsigned int a, unsigned int b)
+{
+    unsigned int v = a * 747796405u + b * 2891336453u + 1013904223u;
+    v = ((v >> ((v >> 28u) + 4u)) ^ v) * 277803737u;
+    return (v >> 22u) ^ v;
+}
+
+// next random number from 0 to 1, advancing the state
+static float nextRandom(unsigned int &state)
+{
+    state = state * 1664525u + 1013904223u;
+    return (state >> 8) * (1.f / 16777216);
+}
+
+//
+// empty grid of size x size cells, neighbors spacing apart
+//
+Erosion::Erosion(int size, float spacing)
+    : size(size), width(size + 2), spacing(spacing), iteration(0),
+      height(width*width, 0.f), mask(width*width, 0.f)
+{
+    for(int k=0; k < 6; ++k)
+        flow[k].resize(width*width, 0.f);
+
+    numthreads = parallelThreads();
+}
+
+//
+// add terrain cell c,r with world height h
+//
+void Erosion::set(int c, int r, float h)
+{
+    height[index(c,r)] = h / spacing;
+    mask[index(c,r)] = 1;
+}
+
+//
+// height and gradient at cell position x,y, from the triangle there:
+// cell c,r is split along its c+r diagonal into a lower triangle with
+// corners c,r  c+1,r  c,r+1 and an upper one with c+1,r+1  c,r+1  c+1,r
+// returns false unless all three corners are terrain
+//
+bool Erosion::surface(float x, float y, int corner[3], float weight[3],
+                      float &h, float &gx, float &gy) const
+{
+    // axial coordinates from positions in units of grid spacing
+    float b = y / sqrtf(0.75f), a = x - 0.5f * b;
+    int c = int(floorf(a)), r = int(floorf(b));
+    if (c < 0 || r < 0 || c >= size-1 || r >= size-1) return false;
+    float fa = a - c, fb = b - r;
+
+    float ga, gb;
+    if (fa + fb <= 1) {
+        corner[0] = index(c, r);
+        corner[1] = index(c+1, r);
+        corner[2] = index(c, r+1);
+        weight[0] = 1 - fa - fb; weight[1] = fa; weight[2] = fb;
+        ga = height[corner[1]] - height[corner[0]];
+        gb = height[corner[2]] - height[corner[0]];
+    }
+    else {
+        corner[0] = index(c+1, r+1);
+        corner[1] = index(c, r+1);
+        corner[2] = index(c+1, r);
+        weight[0] = fa + fb - 1; weight[1] = 1 - fa; weight[2] = 1 - fb;
+        ga = height[corner[0]] - height[corner[1]];
+        gb = height[corner[0]] - height[corner[2]];
+    }
+    if (mask[corner[0]] * mask[corner[1]] * mask[corner[2]] == 0)
+        return false;
+
+    h = weight[0] * height[corner[0]] + weight[1] * height[corner[1]]
+      + weight[2] * height[corner[2]];
+    gx = ga;
+    gy = (gb - 0.5f * ga) / sqrtf(0.75f);
+    return true;
+}
+
+//
+// particles starting in one tile of cells x0..x1 by y0..y1, each dying
+// when it would leave, so every cell it touches is in the tile
+//
+void Erosion::hydraulicTile(int x0, int y0, int x1, int y1, unsigned int seed)
+{
+    unsigned int state = seed;
+    for(int p=0; p < PARTICLES; ++p) {
+        // random start, in axial cell coordinates then in spacing units
+        float a = x0 + nextRandom(state) * (x1 - 1 - x0);
+        float b = y0 + nextRandom(state) * (y1 - 1 - y0);
+        float x = a + 0.5f * b, y = sqrtf(0.75f) * b;
+        float dx = 0, dy = 0, speed = 1, water = 1, sediment = 0;
+
+        int corner[3];
+        float weight[3], h, gx, gy;
+        if (! surface(x, y, corner, weight, h, gx, gy)) continue;
+
+        for(int step=0; step < LIFETIME; ++step) {
+            // turn downhill, keeping some of the old direction
+            dx = dx * INERTIA - gx * (1 - INERTIA);
+            dy = dy * INERTIA - gy * (1 - INERTIA);
+            float len = sqrtf(dx*dx + dy*dy);
+            if (len == 0) break;
+            dx /= len;
+            dy /= len;
+
+            // move one cell, stopping at the tile or terrain edge
+            int next[3];
+            float nextWeight[3], nh, ngx, ngy;
+            float nb = (y + dy) / sqrtf(0.75f), na = x + dx - 0.5f * nb;
+            if (na < x0 || nb < y0 || na >= x1 - 1 || nb >= y1 - 1) break;
+            if (! surface(x + dx, y + dy, next, nextWeight, nh, ngx, ngy))
+                break;
+
+            // uphill: fill the step with sediment
+            // downhill: drop excess sediment, or erode up to capacity
+            float dh = nh - h;
+            float capacity = std::max(-dh, MIN_SLOPE) * speed * water * CAPACITY;
+            float change;
+            if (dh > 0)
+                change = std::min(dh, sediment);
+            else if (sediment > capacity)
+                change = (sediment - capacity) * DEPOSIT;
+            else
+                change = -std::min((capacity - sediment) * ERODE, -dh);
+            for(int i=0; i < 3; ++i)
+                height[corner[i]] += change * weight[i];
+            sediment -= change;
+
+            speed = sqrtf(std::max(speed*speed - dh * GRAVITY, 0.f));
+            water *= 1 - EVAPORATE;
+
+            x += dx;
+            y += dy;
+            for(int i=0; i < 3; ++i) {
+                corner[i] = next[i];
+                weight[i] = nextWeight[i];
+            }
+            h = nh;
+            gx = ngx;
+            gy = ngy;
+        }
+
+        // leave any remaining sediment where the particle stopped
+        for(int i=0; i < 3; ++i)
+            height[corner[i]] += sediment * weight[i];
+    }
+}
+
+//
+// one pass of particles over every tile
+// tiles are colored in a 2x2 pattern, and a particle stays in its tile,
+// so tiles of one color run at once without touching the same cells
+//
+void Erosion::hydraulic()
+{
+    int ox = hash(iteration, 0) % TILE, oy = hash(iteration, 1) % TILE;
+    int tiles = (size + TILE - 1) / TILE + 1;
+    for(int color=0; color < 4; ++color) {
+        parallelFor((tiles/2 + 1) * (tiles/2 + 1), numthreads, [&](int i) {
+            int tx = 2*(i % (tiles/2 + 1)) + (color & 1);
+            int ty = 2*(i / (tiles/2 + 1)) + (color >> 1);
+            int x0 = std::max(tx*TILE - ox, 0), x1 = std::min((tx+1)*TILE - ox, size);
+            int y0 = std::max(ty*TILE - oy, 0), y1 = std::min((ty+1)*TILE - oy, size);
+            if (x1 - x0 > 1 && y1 - y0 > 1)
+                hydraulicTile(x0, y0, x1, y1, hash(iteration, ty*tiles + tx + 2));
+        });
+    }
+}
+
+//
+// move material down slopes steeper than the talus angle
+// every cell first finds its outflows, then gathers its inflows, so the
+// rows can be split among threads, four cells at a time within a row
+//
+void Erosion::thermal()
+{
+    const int offset[6] = {1, -1, width, -width, width-1, -width+1};
+
+    parallelFor(size, numthreads, [&](int r) {
+        for(int k=0; k < 6; ++k) {
+            float *out = &flow[k][index(0, r)];
+            const float *h = &height[index(0, r)], *m = &mask[index(0, r)];
+            const float *hn = h + offset[k], *mn = m + offset[k];
+            int c = 0;
+#if USE_SSE
+            __m128 rate4 = _mm_set1_ps(THERMAL_RATE), talus4 = _mm_set1_ps(TALUS);
+            __m128 zero = _mm_setzero_ps();
+            for(; c + 4 <= size; c += 4) {
+                __m128 excess = _mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(h + c),
+                        _mm_loadu_ps(hn + c)), talus4);
+                __m128 M = _mm_mul_ps(_mm_loadu_ps(m + c), _mm_loadu_ps(mn + c));
+                _mm_storeu_ps(out + c, _mm_mul_ps(_mm_mul_ps(M, rate4),
+                        _mm_max_ps(excess, zero)));
+            }
+#endif
+            for(; c < size; ++c)
+                out[c] = m[c] * mn[c] * THERMAL_RATE
+                       * std::max(h[c] - hn[c] - TALUS, 0.f);
+        }
+    });
+
+    parallelFor(size, numthreads, [&](int r) {
+        float *h = &height[index(0, r)];
+        for(int k=0; k < 6; ++k) {
+            // what this cell sends, and what the neighbor sends back
+            const float *out = &flow[k][index(0, r)];
+            const float *in = &flow[k^1][index(0, r) + offset[k]];
+            int c = 0;
+#if USE_SSE
+            for(; c + 4 <= size; c += 4)
+                _mm_storeu_ps(h + c, _mm_add_ps(_mm_loadu_ps(h + c),
+                        _mm_sub_ps(_mm_loadu_ps(in + c), _mm_loadu_ps(out + c))));
+#endif
+            for(; c < size; ++c)
+                h[c] += in[c] - out[c];
+        }
+    });
+}
+
+//
+// run one iteration of the given Kind bits
+//
+void Erosion::iterate(int kinds)
+{
+    if (kinds & HYDRAULIC) hydraulic();
+    if (kinds & THERMAL) thermal();
+    ++iteration;
+}
@@ -0,0 +1,72 @@
+// hydraulic and thermal erosion of terrain heights
+#ifndef Erosion_hpp
+#define Erosion_hpp
+
+#include <vector>
+
+// erosion of heights on the terrain's triangular grid, stored in axial
+// coordinates: cell (c,r) has neighbors (c+-1,r), (c,r+-1), (c-1,r+1) and
+// (c+1,r-1). Each iteration drops water particles that carry sediment
+// downhill (after Beyer, "Implementation of a method for hydraulic
+// erosion"), and moves material down slopes steeper than the talus angle.
+// Work is split over threads by tiles or rows, so that no two threads
+// touch the same cell, and results do not depend on the thread count.
+class Erosion {
+// public types
+public:
+    // kinds of erosion, combined as bits
+    enum Kind {HYDRAULIC = 1, THERMAL = 2};
+
+// private data
+private:
+    int size;                   // cells across the axial square
+    int width;                  // row length with one cell padding each side
+    float spacing;              // world distance between neighbors
+    unsigned int numthreads;    // threads used by each pass
+    int iteration;              // iterations so far, seeds the particles
+
+    // padded grid, heights in units of spacing so slopes are unitless
+    std::vector<float> height;
+    std::vector<float> mask;    // 1 for terrain cells, 0 elsewhere
+    std::vector<float> flow[6]; // thermal outflow toward each neighbor
+
+// private methods
+private:
+    // index of cell c,r in padded arrays
+    int index(int c, int r) const { return (r+1)*width + c+1; }
+
+    // height and gradient at xy in cell units, with the corners of the
+    // triangle there and their weights
+    // returns false unless all three corners are terrain
+    bool surface(float x, float y, int corner[3], float weight[3],
+                 float &h, float &gx, float &gy) const;
+
+    // particles starting in one tile, kept inside it so tiles of the same
+    // color can run at once
+    void hydraulicTile(int x0, int y0, int x1, int y1, unsigned int seed);
+
+    // one pass of particles over every tile
+    void hydraulic();
+
+    // move material down steep slopes
+    void thermal();
+
+// public methods
+public:
+    // empty grid of size x size cells, neighbors spacing apart
+    Erosion(int size, float spacing);
+
+    // add terrain cell c,r with world height h
+    void set(int c, int r, float h);
+
+    // world height of cell c,r
+    float get(int c, int r) const { return height[index(c,r)] * spacing; }
+
+    // run one iteration of the given Kind bits
+    void iterate(int kinds);
+
+    // threads used by each pass
+    unsigned int threads() const { return numthreads; }
+};
+
+#endif
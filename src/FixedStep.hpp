@@ -0,0 +1,38 @@
+// fixed time steps kept in pace with a clock
+#ifndef FixedStep_hpp
+#define FixedStep_hpp
+
+#include <algorithm>
+
+// time since the last update, run off in steps of a fixed length. After a
+// slow frame it falls behind rather than running more and more steps to
+// catch up, so one slow frame cannot make the next ones slower
+class FixedStep {
+// private data
+private:
+    double lastTime;            // time of the last update, -1 before any
+    double lag;                 // time not yet stepped
+
+// public methods
+public:
+    FixedStep() : lastTime(-1), lag(0) {}
+
+    // call step() once for each dt seconds since the last update, up to
+    // maxSteps times. Returns the number of steps run
+    template <class F>
+    int update(double now, double dt, int maxSteps, F step) {
+        if (lastTime < 0) lastTime = now;
+        lag += now - lastTime;
+        lastTime = now;
+
+        int steps = 0;
+        for(; lag >= dt && steps < maxSteps; ++steps) {
+            step();
+            lag -= dt;
+        }
+        lag = std::min(lag, dt);
+        return steps;
+    }
+};
+
+#endif
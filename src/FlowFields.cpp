@@ -0,0 +1,341 @@
+// directions toward shared goals over the faces of the terrain mesh
+// after Emerson, "Crowd Pathfinding and Steering Using Flow Field Tiles"
+
+#include "FlowFields.hpp"
+#include "Parallel.hpp"
+#include "Vec.inl"
+
+#include <atomic>
+#include <algorithm>
+#include <functional>
+#include <float.h>
+
+// id for the goal in the portal search, which is never a face
+const unsigned int GOAL_ID = NavMesh::NO_GOAL - 1;
+
+//
+// faces that can get to the goal, summed over clusters
+//
+unsigned int FlowFields::Field::reached() const
+{
+    unsigned int count = 0;
+    for(size_t c=0; c < reach.size(); ++c)
+        count += reach[c];
+    return count + numpatched;
+}
+
+//
+// empty fields, and one search per thread
+//
+FlowFields::FlowFields(const NavMesh &nav, const NavHierarchy &tree,
+                       unsigned int capacity)
+    : nav(nav), tree(tree), numthreads(parallelThreads()), clock(0),
+      fields(std::max(capacity, 1u))
+{
+    workers.resize(numthreads);
+}
+
+//
+// field toward face goal. A kept field is brought up to date if marked
+// dirty; otherwise the least recently used one is rebuilt for goal
+//
+const FlowFields::Field *FlowFields::field(unsigned int goal)
+{
+    Field *use = 0;
+    for(size_t i=0; i < fields.size() && ! use; ++i)
+        if (fields[i].built && fields[i].target == goal)
+            use = &fields[i];
+
+    if (! use) {
+        use = &fields[0];
+        for(size_t i=1; i < fields.size(); ++i)
+            if (fields[i].lastUse < use->lastUse)
+                use = &fields[i];
+        use->target = goal;
+        use->built = false;
+    }
+
+    use->lastUse = ++clock;
+    if (! use->built || use->stale)
+        refresh(*use);
+    return use;
+}
+
+//
+// mark the clusters of the listed faces in every kept field
+//
+void FlowFields::changed(const std::vector<unsigned int> &faces)
+{
+    for(size_t i=0; i < fields.size(); ++i) {
+        Field &field = fields[i];
+        if (! field.built || faces.empty()) continue;
+        for(size_t j=0; j < faces.size(); ++j)
+            field.dirty[tree.cluster[faces[j]]] = 1;
+        field.stale = true;
+    }
+}
+
+//
+// forget every field, keeping their storage
+//
+void FlowFields::clear()
+{
+    for(size_t i=0; i < fields.size(); ++i) {
+        fields[i].built = fields[i].stale = false;
+        fields[i].lastUse = 0;
+    }
+}
+
+//
+// Dijkstra outward from the goal over the portal graph, as
+// NavHierarchy::findWaypoints searches it, gives the cost from every
+// portal to the goal. A portal reached from a portal of another cluster
+// is where paths leave its cluster, and seeds the search inside it.
+// Every cluster whose seeds differ from last time, or that is dirty, is
+// searched again, spread among threads
+//
+void FlowFields::refresh(Field &field)
+{
+    typedef std::pair<float, unsigned int> Entry;
+    std::greater<Entry> later;
+
+    size_t numclusters = tree.clusters.size();
+    if (! field.built) {
+        unsigned int numtri = nav.faces();
+        field.total.assign(numtri, FLT_MAX);
+        field.nextFace.assign(numtri, -1);
+        field.heading.assign(numtri, vec2<float>(0, 0));
+        field.patched.assign(numtri, 0);
+        field.numpatched = 0;
+        field.exits.resize(numclusters);
+        for(size_t c=0; c < numclusters; ++c)
+            field.exits[c].clear();
+        field.dirty.assign(numclusters, 1);
+        field.reach.assign(numclusters, 0);
+        field.built = true;
+    }
+
+    // costs to the goal from the portals of its own cluster
+    unsigned int goal = field.target;
+    const int *label = &tree.cluster[0];
+    int cg = tree.cluster[goal];
+    const NavHierarchy::Cluster &home = tree.clusters[cg];
+    NavMesh::Search &search = workers[0].search;
+    nav.spread(goal, search, label, cg);
+    search.toGoal.resize(home.portal.size());
+    for(size_t i=0; i < home.portal.size(); ++i)
+        search.toGoal[i] = search.cost(home.portal[i]);
+
+    // then out across the portals. Costs within a cluster are kept from
+    // each portal to the others, so they are read backward, from j to i
+    search.reset();
+    unsigned int n = search.find(GOAL_ID);
+    search.node[n].cost = 0;
+    search.open.push_back(Entry(0, n));
+
+    auto relax = [&](unsigned int id, float cost) {
+        unsigned int m = search.find(id);
+        if (search.node[m].closed || cost >= search.node[m].cost) return;
+        search.node[m].cost = cost;
+        search.node[m].parent = n;
+        search.open.push_back(Entry(cost, m));
+        std::push_heap(search.open.begin(), search.open.end(), later);
+    };
+
+    while (! search.open.empty()) {
+        std::pop_heap(search.open.begin(), search.open.end(), later);
+        n = search.open.back().second;
+        search.open.pop_back();
+        if (search.node[n].closed) continue;
+        search.node[n].closed = true;
+        ++search.numclosed;
+
+        unsigned int id = search.node[n].face;
+        float cost = search.node[n].cost;
+        if (id == GOAL_ID) {
+            for(size_t i=0; i < home.portal.size(); ++i)
+                if (search.toGoal[i] < FLT_MAX)
+                    relax(home.portal[i], search.toGoal[i]);
+            continue;
+        }
+
+        int c = tree.cluster[id];
+        const NavHierarchy::Cluster &cl = tree.clusters[c];
+        size_t i = tree.portalIndex[id], k = cl.portal.size();
+        for(size_t j=0; j < k; ++j)
+            if (j != i && cl.cost[j*k + i] < FLT_MAX)
+                relax(cl.portal[j], cost + cl.cost[j*k + i]);
+        for(int e=0; e < 3; ++e) {
+            int g = nav.neighborOf(id, e);
+            if (g >= 0 && tree.cluster[g] != c && tree.portalIndex[g] >= 0 &&
+                nav.walkable(g))
+                relax(g, cost + nav.stepCost(id, g));
+        }
+    }
+
+    // exits of each cluster, in face order to compare with the last ones
+    found.resize(numclusters);
+    for(size_t c=0; c < numclusters; ++c)
+        found[c].clear();
+    for(size_t m=0; m < search.node.size(); ++m) {
+        const NavMesh::Search::Node &node = search.node[m];
+        if (node.face == GOAL_ID || node.parent < 0) continue;
+        unsigned int across = search.node[node.parent].face;
+        if (across == GOAL_ID || tree.cluster[across] == tree.cluster[node.face])
+            continue;
+        Field::Exit x = {node.face, across, node.cost};
+        found[tree.cluster[node.face]].push_back(x);
+    }
+
+    std::vector<int> redo;
+    for(size_t c=0; c < numclusters; ++c) {
+        std::vector<Field::Exit> &now = found[c], &was = field.exits[c];
+        std::sort(now.begin(), now.end(),
+                  [](const Field::Exit &a, const Field::Exit &b) {
+            return a.face < b.face;
+        });
+        bool same = now.size() == was.size() &&
+            std::equal(now.begin(), now.end(), was.begin(),
+                       [](const Field::Exit &a, const Field::Exit &b) {
+            return a.face == b.face && a.across == b.across && a.cost == b.cost;
+        });
+        if (! same) {
+            now.swap(was);
+            field.dirty[c] = 1;
+        }
+        if (field.dirty[c]) redo.push_back(c);
+    }
+
+    // clusters only write their own faces
+    std::atomic<int> next(0);
+    parallelFor(numthreads, numthreads, [&](int t) {
+        for(int i; (i = next++) < int(redo.size()); )
+            fillCluster(field, redo[i], workers[t]);
+    });
+    for(size_t i=0; i < redo.size(); ++i)
+        field.dirty[redo[i]] = 0;
+    if (! redo.empty())
+        patch(field);
+    field.stale = false;
+}
+
+//
+// costs and next faces in cluster c, by one search inside it from all
+// of its exits at once, and from the goal if it is here. Faces a search
+// started from step across their exit, or stop at the goal
+//
+void FlowFields::fillCluster(Field &field, int c, Worker &worker)
+{
+    const std::vector<Field::Exit> &exits = field.exits[c];
+    worker.face.clear();
+    worker.cost.clear();
+    if (tree.cluster[field.target] == c) {
+        worker.face.push_back(field.target);
+        worker.cost.push_back(0);
+    }
+    for(size_t i=0; i < exits.size(); ++i) {
+        worker.face.push_back(exits[i].face);
+        worker.cost.push_back(exits[i].cost);
+    }
+
+    for(unsigned int i = tree.clusterStart[c]; i < tree.clusterStart[c+1]; ++i) {
+        unsigned int f = tree.clusterFace[i];
+        field.total[f] = FLT_MAX;
+        field.nextFace[f] = -1;
+        field.heading[f] = vec2<float>(0, 0);
+        field.patched[f] = 0;
+    }
+    field.reach[c] = 0;
+    if (worker.face.empty()) return;
+
+    NavMesh::Search &search = worker.search;
+    nav.spread(&worker.face[0], &worker.cost[0], worker.face.size(), search,
+               &tree.cluster[0], c);
+    for(size_t m=0; m < search.node.size(); ++m) {
+        const NavMesh::Search::Node &node = search.node[m];
+        unsigned int f = node.face;
+        int next = -1;
+        if (node.parent >= 0)
+            next = search.node[node.parent].face;
+        else if (f != field.target) {
+            Field::Exit key = {f, 0, 0};
+            next = std::lower_bound(exits.begin(), exits.end(), key,
+                                    [](const Field::Exit &a, const Field::Exit &b) {
+                return a.face < b.face;
+            })->across;
+        }
+
+        field.total[f] = node.cost;
+        field.nextFace[f] = next;
+        if (next >= 0)
+            field.heading[f] = normalize(nav.centroid(next).xy - nav.centroid(f).xy);
+        ++field.reach[c];
+    }
+}
+
+//
+// faces the cluster searches could not reach, though a neighbor was
+// reached. That happens where a cluster is split in pieces, and its
+// portals are all on one piece. One more search starts from all of them
+// at once, each stepping to its cheapest reached neighbor, and covers just
+// the faces still unreached. Faces reached this way last time are redone
+//
+void FlowFields::patch(Field &field)
+{
+    unsigned int numtri = nav.faces();
+    gap.resize(numtri);
+    for(unsigned int f=0; f < numtri; ++f) {
+        if (field.patched[f]) {
+            field.total[f] = FLT_MAX;
+            field.nextFace[f] = -1;
+            field.heading[f] = vec2<float>(0, 0);
+            field.patched[f] = 0;
+        }
+        gap[f] = field.total[f] < FLT_MAX;
+    }
+
+    // reached neighbor of face f with the lowest cost through it
+    auto bestNeighbor = [&](unsigned int f, float &best) {
+        int next = -1;
+        best = FLT_MAX;
+        for(int k=0; k < 3; ++k) {
+            int g = nav.neighborOf(f, k);
+            if (g < 0 || ! gap[g]) continue;
+            float cost = field.total[g] + nav.stepCost(f, g);
+            if (cost < best) {
+                best = cost;
+                next = g;
+            }
+        }
+        return next;
+    };
+
+    Worker &worker = workers[0];
+    worker.face.clear();
+    worker.cost.clear();
+    for(unsigned int f=0; f < numtri; ++f) {
+        float best;
+        if (! gap[f] && nav.walkable(f) && bestNeighbor(f, best) >= 0) {
+            worker.face.push_back(f);
+            worker.cost.push_back(best);
+        }
+    }
+    field.numpatched = 0;
+    if (worker.face.empty()) return;
+
+    NavMesh::Search &search = worker.search;
+    nav.spread(&worker.face[0], &worker.cost[0], worker.face.size(), search,
+               &gap[0], 0);
+    for(size_t m=0; m < search.node.size(); ++m) {
+        const NavMesh::Search::Node &node = search.node[m];
+        unsigned int f = node.face;
+        float best;
+        int next = node.parent >= 0 ? int(search.node[node.parent].face)
+                                    : bestNeighbor(f, best);
+        field.total[f] = node.cost;
+        field.nextFace[f] = next;
+        field.heading[f] = normalize(nav.centroid(next).xy - nav.centroid(f).xy);
+        field.patched[f] = 1;
+        ++field.numpatched;
+    }
+}
@@ -0,0 +1,126 @@
+// directions toward shared goals over the faces of the terrain mesh
+#ifndef FlowFields_hpp
+#define FlowFields_hpp
+
+#include "NavHierarchy.hpp"
+#include <vector>
+
+// a flow field gives every face the next face along a cheap path to one
+// goal, so any number of walkers heading there just look up the face they
+// are on. Fields are built in two passes, after Emerson, "Crowd Pathfinding
+// and Steering Using Flow Field Tiles": first a search outward from the
+// goal across the portals of the NavHierarchy, then, in parallel, one
+// search inside each cluster, starting from the goal or from the portals
+// where the first pass left the cluster, each with its cost so far. Faces
+// left over, in pieces of clusters with no portal, are filled by one last
+// search from their reached neighbors.
+// The last few fields are kept by goal. After height changes, a field
+// repeats the portal pass, and redoes only the clusters that changed or
+// whose starting portals or costs did.
+class FlowFields {
+// public types
+public:
+    // next face and direction from every face toward one goal
+    class Field {
+        friend class FlowFields;
+
+        // portal where a cheapest path leaves a cluster for the next
+        struct Exit {
+            unsigned int face;      // portal face on this side
+            unsigned int across;    // portal face it steps to
+            float cost;             // cost from face to the goal
+        };
+
+        unsigned int target;        // goal face
+        bool built;                 // false until first built for target
+        bool stale;                 // some clusters marked dirty
+        unsigned long lastUse;      // for dropping the least recent
+
+        std::vector<float> total;   // cost to the goal, FLT_MAX if none
+        std::vector<int> nextFace;  // next face along the path, -1 if none
+        std::vector<Vec2f> heading; // unit xy toward the next centroid
+        std::vector<unsigned char> patched; // 1 if reached by patch
+        unsigned int numpatched;    // faces reached by patch
+
+        // by cluster: exits leaving it, changed faces, faces reached
+        std::vector<std::vector<Exit> > exits;
+        std::vector<unsigned char> dirty;
+        std::vector<unsigned int> reach;
+
+    public:
+        Field() : target(0), built(false), stale(false), lastUse(0),
+                  numpatched(0) {}
+
+        // goal face
+        unsigned int goal() const { return target; }
+
+        // cost from face f to the goal, FLT_MAX if it cannot get there
+        float cost(unsigned int f) const { return total[f]; }
+
+        // face to step to from face f, -1 at the goal or if unreachable
+        int next(unsigned int f) const { return nextFace[f]; }
+
+        // unit xy direction from the centroid of face f to the next
+        // face's, 0 at the goal or if unreachable
+        Vec2f direction(unsigned int f) const { return heading[f]; }
+
+        // faces that can get to the goal
+        unsigned int reached() const;
+    };
+
+// private types
+private:
+    // state for one thread's cluster searches
+    struct Worker {
+        NavMesh::Search search;
+        std::vector<unsigned int> face; // faces the search starts from
+        std::vector<float> cost;        // and their costs to the goal
+    };
+
+// private data
+private:
+    const NavMesh &nav;         // faces and costs, must outlive this
+    const NavHierarchy &tree;   // clusters and portals, kept up to date
+    unsigned int numthreads;    // threads used by builds
+    unsigned long clock;        // count of field lookups
+
+    std::vector<Field> fields;  // storage kept when a goal is replaced
+    std::vector<Worker> workers; // one per thread
+    std::vector<std::vector<Field::Exit> > found; // exits from portal pass
+    std::vector<int> gap;       // 0 for faces the clusters did not reach
+
+// private methods
+private:
+    // search out from the goal over portals, then redo the clusters
+    // that are dirty or whose exits changed
+    void refresh(Field &field);
+
+    // cluster c of field by a search from its exits, using worker
+    void fillCluster(Field &field, int c, Worker &worker);
+
+    // faces next to reached ones that the cluster searches missed
+    void patch(Field &field);
+
+// public methods
+public:
+    // fields over nav and its clusters, keeping up to capacity goals
+    FlowFields(const NavMesh &nav, const NavHierarchy &tree,
+               unsigned int capacity);
+
+    // field toward face goal, built if not kept, and brought up to date
+    // if heights changed. The pointer stays good until goals beyond the
+    // capacity have been asked for
+    const Field *field(unsigned int goal);
+
+    // mark the clusters holding the listed faces dirty in every field,
+    // after the tree has been updated for them
+    void changed(const std::vector<unsigned int> &faces);
+
+    // forget every field, after all heights changed
+    void clear();
+
+    // threads used by builds
+    unsigned int threads() const { return numthreads; }
+};
+
+#endif
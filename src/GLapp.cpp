@@ -7,12 +7,23 @@
 #include "Input.hpp"
 #include "Scene.hpp"
 #include "Terrain.hpp"
+#include "TerrainTracer.hpp"
+#include "TerrainLOD.hpp"
+#include "Clipmap.hpp"
+#include "StreamTerrain.hpp"
+#include "TerrainROAM.hpp"
+#include "TerrainRaymarch.hpp"
+#include "Crowd.hpp"
+#include "Scatter.hpp"
+#include "Particles.hpp"
 
 // using core modern OpenGL
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 ///////
@@ -23,6 +34,14 @@ AppContext::~AppContext()
     delete scene;
     delete input;
     delete terrain;
+    delete lod;
+    delete clipmap;
+    delete stream;
+    delete roam;
+    delete raymarch;
+    delete crowd;
+    delete scatter;
+    delete particles;
 }
 
 ///////
@@ -140,8 +159,37 @@ GLFWwindow *initGLFW(AppContext &appctx)
     return win;
 }
 
+// trace the starting view on the CPU with no window or GL, for
+//   GLapp --trace out.ppm level octaves width height
+int traceHeadless(int argc, char *argv[])
+{
+    int level = 0, octaves = -1, width = 0, height = 0;
+    if (argc == 7) {
+        level = atoi(argv[3]);
+        octaves = atoi(argv[4]);
+        width = atoi(argv[5]);
+        height = atoi(argv[6]);
+    }
+    if (level < 1 || octaves < 0 || width < 1 || height < 1) {
+        fprintf(stderr, "usage: %s --trace out.ppm level octaves width height\n",
+                argv[0]);
+        return 1;
+    }
+
+    Terrain terrain(level, octaves, Terrain::HEADLESS);
+    Scene scene(width, height, terrain);
+    ImagePPM image(width, height);
+    TerrainTracer(terrain).render(scene, image);
+    image.write(argv[2]);
+    printf("wrote %s\n", argv[2]);
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
+    if (argc > 1 && strcmp(argv[1], "--trace") == 0)
+        return traceHeadless(argc, argv);
+
     // collected data about application for use in callbacks
     AppContext appctx;
 
@@ -173,7 +221,55 @@ int main(int argc, char *argv[])
 
             // draw something
             appctx.scene->update();
-            appctx.terrain->draw();
+            switch (appctx.input->drawMode) {
+            case Input::DRAW_MESH:
+                appctx.terrain->draw(*appctx.scene);
+                appctx.terrain->drawWater(*appctx.scene);
+                // keep drawing while erosion runs or water flows
+                if (appctx.terrain->eroding() || appctx.terrain->flowing())
+                    appctx.input->redraw = true;
+                break;
+            case Input::DRAW_LOD:  appctx.lod->draw(*appctx.scene);     break;
+            case Input::DRAW_CLIPMAP: appctx.clipmap->draw(*appctx.scene); break;
+            case Input::DRAW_STREAM:
+                appctx.stream->draw(*appctx.scene);
+                // keep drawing while tiles arrive
+                if (appctx.stream->loading())
+                    appctx.input->redraw = true;
+                break;
+            case Input::DRAW_ROAM:
+                appctx.roam->draw(*appctx.scene);
+                // keep refining until the mesh fits the view
+                if (appctx.roam->refining())
+                    appctx.input->redraw = true;
+                break;
+            case Input::DRAW_RAYMARCH:
+                appctx.raymarch->draw(*appctx.scene);
+                break;
+            }
+
+            // objects and agents over whichever terrain was drawn
+            if (appctx.scatter) {
+                appctx.scatter->draw(*appctx.scene);
+                // keep drawing while tiles are sent
+                if (appctx.scatter->loading())
+                    appctx.input->redraw = true;
+            }
+            if (appctx.crowd)
+                appctx.crowd->draw(*appctx.scene);
+
+            // particles last, blended over everything else
+            if (appctx.particles)
+                appctx.particles->draw(*appctx.scene);
+
+            // report culling results in the window title
+            const Scene::Stats &stats = appctx.scene->stats;
+            char title[128];
+            snprintf(title, sizeof(title),
+                "Terrain: %u tiles drawn, %u frustum culled, %u horizon culled, %u triangles",
+                stats.tilesDrawn, stats.frustumCulled, stats.horizonCulled,
+                stats.triangles);
+            glfwSetWindowTitle(win, title);
 
             // show what we drew
             glfwSwapBuffers(win);
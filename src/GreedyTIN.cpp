@@ -0,0 +1,314 @@
+// triangulated irregular network by greedy insertion
+// after Garland and Heckbert, "Fast Polygonal Approximation of Terrains
+// and Height Fields"
+
+#include "GreedyTIN.hpp"
+#include "Vec.inl"
+
+#include <algorithm>
+#include <math.h>
+
+//
+// start with triangles fanning from center to the convex corners
+//
+GreedyTIN::GreedyTIN(unsigned int numsample, const int (*grid)[2],
+                     const Vec3f *pos, unsigned int numcorner,
+                     const int *corner, int center)
+    : numsample(numsample), grid(grid), pos(pos), inserted(numsample, 0),
+      maxError(0)
+{
+    used.push_back(center);
+    inserted[center] = 1;
+    for(unsigned int i=0; i < numcorner; ++i) {
+        used.push_back(corner[i]);
+        inserted[corner[i]] = 1;
+    }
+
+    // triangle i shares its first edge with i-1 and its last with i+1
+    for(unsigned int i=0; i < numcorner; ++i) {
+        int t = newTriangle(center, corner[i], corner[(i+1) % numcorner],
+                            (i + numcorner - 1) % numcorner, -1,
+                            (i + 1) % numcorner);
+        changed.push_back(t);
+    }
+
+    for(unsigned int s=0; s < numsample; ++s)
+        if (! inserted[s]) pool.push_back(s);
+    distribute();
+}
+
+//
+// twice the signed area of a,b,c in grid units
+// x is doubled grid units, so this is a positive multiple of world area
+//
+long long GreedyTIN::orient(int a, int b, int c) const
+{
+    long long ax = grid[b][0] - grid[a][0], ay = grid[b][1] - grid[a][1];
+    long long bx = grid[c][0] - grid[a][0], by = grid[c][1] - grid[a][1];
+    return ax*by - ay*bx;
+}
+
+//
+// > 0 if d is inside the circle through counter-clockwise a,b,c
+// world x and y are x/2 and y*sqrt(3)/2 grid units, so squared world
+// distances are (x^2 + 3y^2)/4, and the sqrt(3) scale on y only scales
+// the determinant
+//
+long long GreedyTIN::inCircle(int a, int b, int c, int d) const
+{
+    long long p[3][3];
+    int v[3] = {a, b, c};
+    for(int i=0; i < 3; ++i) {
+        long long x = grid[v[i]][0] - grid[d][0];
+        long long y = grid[v[i]][1] - grid[d][1];
+        p[i][0] = x;
+        p[i][1] = y;
+        p[i][2] = x*x + 3*y*y;
+    }
+    return p[0][0] * (p[1][1]*p[2][2] - p[1][2]*p[2][1])
+         - p[0][1] * (p[1][0]*p[2][2] - p[1][2]*p[2][0])
+         + p[0][2] * (p[1][0]*p[2][1] - p[1][1]*p[2][0]);
+}
+
+//
+// new triangle with no samples
+//
+int GreedyTIN::newTriangle(int a, int b, int c, int n0, int n1, int n2)
+{
+    Triangle t;
+    t.vert[0] = a; t.vert[1] = b; t.vert[2] = c;
+    t.nbr[0] = n0; t.nbr[1] = n1; t.nbr[2] = n2;
+    t.worst = -1;
+    t.error = 0;
+    t.stamp = 0;
+    tri.push_back(t);
+    return int(tri.size()) - 1;
+}
+
+//
+// point neighbor n's link to old at replacement instead
+//
+void GreedyTIN::relink(int n, int old, int replacement)
+{
+    if (n < 0) return;
+    for(int k=0; k < 3; ++k)
+        if (tri[n].nbr[k] == old) tri[n].nbr[k] = replacement;
+}
+
+//
+// vertical distance from sample s to the plane of triangle t
+//
+float GreedyTIN::sampleError(int s, int t) const
+{
+    const int *v = tri[t].vert;
+    Vec3f a = pos[v[0]], b = pos[v[1]], c = pos[v[2]], p = pos[s];
+    double e1x = b.x - a.x, e1y = b.y - a.y, e2x = c.x - a.x, e2y = c.y - a.y;
+    double px = p.x - a.x, py = p.y - a.y;
+    double d = e1x*e2y - e1y*e2x;
+    double u = (px*e2y - py*e2x) / d, w = (e1x*py - e1y*px) / d;
+    double z = a.z + u*(b.z - a.z) + w*(c.z - a.z);
+    return float(fabs(p.z - z));
+}
+
+//
+// move samples of t into the pool, and remember t changed
+//
+void GreedyTIN::release(int t)
+{
+    if (std::find(changed.begin(), changed.end(), t) != changed.end())
+        return;
+    changed.push_back(t);
+    pool.insert(pool.end(), tri[t].samples.begin(), tri[t].samples.end());
+    tri[t].samples.clear();
+}
+
+//
+// hand pooled samples to the changed triangles containing them, and
+// queue their new worst samples
+// changed triangles cover the same area as the released ones did
+//
+void GreedyTIN::distribute()
+{
+    for(size_t i=0; i < pool.size(); ++i) {
+        int s = pool[i];
+        if (inserted[s]) continue;
+        for(size_t c=0; c < changed.size(); ++c) {
+            const int *v = tri[changed[c]].vert;
+            if (orient(v[0], v[1], s) >= 0 && orient(v[1], v[2], s) >= 0 &&
+                orient(v[2], v[0], s) >= 0) {
+                tri[changed[c]].samples.push_back(s);
+                break;
+            }
+        }
+    }
+
+    for(size_t c=0; c < changed.size(); ++c) {
+        Triangle &t = tri[changed[c]];
+        t.worst = -1;
+        t.error = 0;
+        ++t.stamp;
+        for(size_t i=0; i < t.samples.size(); ++i) {
+            float e = sampleError(t.samples[i], changed[c]);
+            if (t.worst < 0 || e > t.error) {
+                t.worst = t.samples[i];
+                t.error = e;
+            }
+        }
+        if (t.worst >= 0) {
+            Candidate cand = {t.error, changed[c], t.stamp};
+            queue.push(cand);
+        }
+    }
+
+    changed.clear();
+    pool.clear();
+}
+
+//
+// flip edge 0 of t, opposite its newest vertex, until Delaunay
+//
+void GreedyTIN::legalize(int t)
+{
+    int n = tri[t].nbr[0];
+    if (n < 0) return;
+
+    int a = tri[t].vert[0], b = tri[t].vert[1], s = tri[t].vert[2];
+    int j = 0;
+    while (tri[n].vert[j] != b) ++j;
+    int d = tri[n].vert[(j+2) % 3];
+    if (inCircle(a, b, s, d) <= 0) return;
+
+    // a,b,s and b,a,d become a,d,s and d,b,s
+    release(t);
+    release(n);
+    int nad = tri[n].nbr[(j+1) % 3], ndb = tri[n].nbr[(j+2) % 3];
+    int nbs = tri[t].nbr[1], nsa = tri[t].nbr[2];
+
+    Triangle &T = tri[t];
+    T.vert[0] = a; T.vert[1] = d; T.vert[2] = s;
+    T.nbr[0] = nad; T.nbr[1] = n; T.nbr[2] = nsa;
+
+    Triangle &N = tri[n];
+    N.vert[0] = d; N.vert[1] = b; N.vert[2] = s;
+    N.nbr[0] = ndb; N.nbr[1] = nbs; N.nbr[2] = t;
+
+    relink(nad, n, t);
+    relink(nbs, t, n);
+
+    legalize(t);
+    legalize(n);
+}
+
+//
+// add sample s, which is inside or on an edge of triangle t
+// new triangles all have s as their last vertex, so edge 0 is the one
+// that may need flipping
+//
+void GreedyTIN::insert(int s, int t)
+{
+    used.push_back(s);
+    inserted[s] = 1;
+    release(t);
+
+    int e = -1;
+    for(int i=0; i < 3; ++i)
+        if (orient(tri[t].vert[i], tri[t].vert[(i+1) % 3], s) == 0)
+            e = i;
+
+    if (e < 0) {
+        // inside: split into three around s
+        int a = tri[t].vert[0], b = tri[t].vert[1], c = tri[t].vert[2];
+        int n1 = tri[t].nbr[1], n2 = tri[t].nbr[2];
+        int t1 = newTriangle(b, c, s, n1, -1, t);
+        int t2 = newTriangle(c, a, s, n2, t, t1);
+        tri[t1].nbr[1] = t2;
+        tri[t].vert[2] = s;
+        tri[t].nbr[1] = t1;
+        tri[t].nbr[2] = t2;
+        relink(n1, t, t1);
+        relink(n2, t, t2);
+        changed.push_back(t1);
+        changed.push_back(t2);
+
+        legalize(t);
+        legalize(t1);
+        legalize(t2);
+    }
+    else {
+        // on edge a,b: split t and the neighbor across that edge in two
+        int a = tri[t].vert[e], b = tri[t].vert[(e+1) % 3];
+        int c = tri[t].vert[(e+2) % 3];
+        int nbc = tri[t].nbr[(e+1) % 3], nca = tri[t].nbr[(e+2) % 3];
+        int n = tri[t].nbr[e];
+
+        int tb = newTriangle(c, a, s, nca, -1, t);
+        changed.push_back(tb);
+        relink(nca, t, tb);
+
+        int td = -1;
+        if (n >= 0) {
+            release(n);
+            int j = 0;
+            while (tri[n].vert[j] != b) ++j;
+            int d = tri[n].vert[(j+2) % 3];
+            int nad = tri[n].nbr[(j+1) % 3], ndb = tri[n].nbr[(j+2) % 3];
+
+            td = newTriangle(d, b, s, ndb, t, n);
+            changed.push_back(td);
+            relink(ndb, n, td);
+
+            Triangle &N = tri[n];
+            N.vert[0] = a; N.vert[1] = d; N.vert[2] = s;
+            N.nbr[0] = nad; N.nbr[1] = td; N.nbr[2] = tb;
+            tri[tb].nbr[1] = n;
+        }
+
+        Triangle &T = tri[t];
+        T.vert[0] = b; T.vert[1] = c; T.vert[2] = s;
+        T.nbr[0] = nbc; T.nbr[1] = tb; T.nbr[2] = td;
+
+        legalize(t);
+        legalize(tb);
+        if (n >= 0) {
+            legalize(n);
+            legalize(td);
+        }
+    }
+
+    distribute();
+}
+
+//
+// insert samples until none is more than error from the surface
+//
+void GreedyTIN::refine(float error)
+{
+    while (! queue.empty()) {
+        Candidate c = queue.top();
+        if (c.stamp != tri[c.tri].stamp) {
+            queue.pop();
+            continue;
+        }
+        if (c.error <= error) break;
+        queue.pop();
+        insert(tri[c.tri].worst, c.tri);
+    }
+    maxError = queue.empty() ? 0 : queue.top().error;
+}
+
+//
+// inserted samples, and triangles indexing into that list
+//
+void GreedyTIN::mesh(std::vector<int> &sample,
+                     std::vector<unsigned int> &indices) const
+{
+    std::vector<int> index(numsample, -1);
+    sample = used;
+    for(size_t i=0; i < used.size(); ++i)
+        index[used[i]] = int(i);
+
+    indices.clear();
+    for(size_t t=0; t < tri.size(); ++t)
+        for(int k=0; k < 3; ++k)
+            indices.push_back(index[tri[t].vert[k]]);
+}
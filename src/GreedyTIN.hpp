@@ -0,0 +1,96 @@
+// triangulated irregular network by greedy insertion
+#ifndef GreedyTIN_hpp
+#define GreedyTIN_hpp
+
+#include "Vec.hpp"
+#include <vector>
+#include <queue>
+
+// Delaunay triangulation of a subset of height samples, adding the sample
+// farthest from the current surface until all are within an error bound
+// (Garland and Heckbert, "Fast Polygonal Approximation of Terrains and
+// Height Fields"). Samples lie on the terrain's triangular grid, so the
+// orientation and in-circle tests are exact in integer grid coordinates.
+class GreedyTIN {
+// private types
+private:
+    struct Triangle {
+        int vert[3];            // sample indices, counter-clockwise
+        int nbr[3];             // across vert[i]-vert[i+1], -1 at boundary
+        std::vector<int> samples; // samples not yet inserted inside
+        int worst;              // sample farthest from triangle, or -1
+        float error;            // vertical distance of worst
+        int stamp;              // bumped to invalidate queued candidates
+    };
+
+    // worst sample of one triangle, largest error first in the queue
+    struct Candidate {
+        float error;
+        int tri, stamp;
+        bool operator<(const Candidate &c) const { return error < c.error; }
+    };
+
+// private data
+private:
+    unsigned int numsample;
+    const int (*grid)[2];       // grid x (doubled) and y of each sample
+    const Vec3f *pos;           // world position of each sample
+
+    std::vector<Triangle> tri;
+    std::vector<int> used;      // inserted samples, in order
+    std::vector<char> inserted; // true for samples in used
+    std::priority_queue<Candidate> queue;
+    float maxError;             // largest error left
+
+    // scratch for one insertion
+    std::vector<int> changed, pool;
+
+// private methods
+private:
+    // twice the signed area of a,b,c in grid units, > 0 if counter-clockwise
+    long long orient(int a, int b, int c) const;
+
+    // > 0 if d is inside the circle through counter-clockwise a,b,c
+    long long inCircle(int a, int b, int c, int d) const;
+
+    // new triangle with no samples
+    int newTriangle(int a, int b, int c, int n0, int n1, int n2);
+
+    // point neighbor n's link to old at replacement instead
+    void relink(int n, int old, int replacement);
+
+    // vertical distance from sample s to the plane of triangle t
+    float sampleError(int s, int t) const;
+
+    // move samples of t into the pool, and remember t changed
+    void release(int t);
+
+    // hand pooled samples to the changed triangles containing them, and
+    // queue their new worst samples
+    void distribute();
+
+    // flip edge 0 of t, opposite its newest vertex, until Delaunay
+    void legalize(int t);
+
+    // add sample s, which is inside or on an edge of triangle t
+    void insert(int s, int t);
+
+// public methods
+public:
+    // start with triangles fanning from center to the convex corners,
+    // given in counter-clockwise order. Every sample must be inside.
+    GreedyTIN(unsigned int numsample, const int (*grid)[2], const Vec3f *pos,
+              unsigned int numcorner, const int *corner, int center);
+
+    // insert samples until none is more than error from the surface
+    void refine(float error);
+
+    // largest vertical distance from a sample to the surface
+    float error() const { return maxError; }
+
+    // inserted samples, and triangles indexing into that list
+    void mesh(std::vector<int> &sample,
+              std::vector<unsigned int> &indices) const;
+};
+
+#endif
@@ -4,6 +4,21 @@
 #include "AppContext.hpp"
 #include "Scene.hpp"
 #include "Terrain.hpp"
+#include "TerrainLOD.hpp"
+#include "Clipmap.hpp"
+#include "StreamTerrain.hpp"
+#include "TerrainROAM.hpp"
+#include "TerrainRaymarch.hpp"
+#include "TerrainTracer.hpp"
+#include "ImagePPM.hpp"
+#include "Erosion.hpp"
+#include "ShallowWater.hpp"
+#include "NavMesh.hpp"
+#include "NavHierarchy.hpp"
+#include "FlowFields.hpp"
+#include "Crowd.hpp"
+#include "Scatter.hpp"
+#include "Particles.hpp"
 #include "Vec.inl"
 
 // using core modern OpenGL
@@ -11,11 +26,334 @@
 #include <GLFW/glfw3.h>
 
 #include <math.h>
+#include <stdio.h>
+#include <float.h>
 
 #ifndef F_PI
 #define F_PI 3.1415926f
 #endif
 
+// distance from the focus of graded terrain with full detail
+const float FOCUS_RADIUS = 20;
+
+// largest height error of TIN terrain, in world units
+const float TIN_ERROR = 1;
+
+// erosion iterations run by each 'e' press, one per frame
+const int EROSION_ITERATIONS = 100;
+
+// world depth of rain from each 'u' press
+const float RAIN_DEPTH = 2;
+
+// mesh levels and frames timed for each by the benchmark
+const int BENCH_LEVELS[] = {25, 50, 100, 200, 400};
+const int BENCH_FRAMES = 20;
+
+// terrain level for the water benchmark, 1025 cells across, and steps timed
+const int BENCH_WATER_LEVEL = 511;
+const int BENCH_WATER_STEPS = 20;
+
+// random start and goal faces timed by the path benchmark
+const int BENCH_PATHS = 1000;
+
+// agents in the crowd from each '3' press
+const unsigned int CROWD_AGENTS = 10000;
+
+// crowd sizes and steps timed for each by the crowd benchmark
+const unsigned int BENCH_AGENTS[] = {10000, 100000, 1000000};
+const int BENCH_CROWD_STEPS = 10;
+
+// particles from each '6' press: rain, and debris and dust at the pick
+const unsigned int RAIN_PARTICLES = 200000;
+const unsigned int DEBRIS_PARTICLES = 20000;
+const unsigned int DUST_PARTICLES = 20000;
+
+// particles and steps timed by the particle benchmark
+const unsigned int BENCH_PARTICLES = 1 << 20;
+const int BENCH_PARTICLE_STEPS = 20;
+
+//
+// set viewer height and normal from the terrain being drawn
+// streamed terrain has no edge; the others stop at the mesh boundary
+//
+bool Input::setHeight(const AppContext &ctx, Vec3f &P, Vec3f &N) const
+{
+    if (drawMode == DRAW_STREAM)
+        return ctx.stream->setHeight(P, N);
+    return ctx.terrain->setHeight(P, N);
+}
+
+//
+// update pick from a ray through the cursor, or through the window center
+// while the cursor is hidden for rotating
+// streamed terrain has no mesh to pick from
+//
+void Input::pickTerrain(const AppContext &ctx)
+{
+    Scene *scene = ctx.scene;
+    Vec3f dir = button < 0 ? scene->pickRay(oldX, oldY)
+                           : scene->pickRay(0.5 * scene->width, 0.5 * scene->height);
+    Terrain::RayHit hit;
+    picked = drawMode != DRAW_STREAM
+          && ctx.terrain->raycast(scene->position, dir, hit);
+    if (picked)
+        pick = hit.position;
+}
+
+//
+// milliseconds per frame drawing terrain, waiting for each to finish
+//
+template <class T>
+static double frameTime(Scene &scene, T &terrain)
+{
+    terrain.draw(scene);        // first frame may include setup
+    glFinish();
+
+    double start = glfwGetTime();
+    for(int f=0; f < BENCH_FRAMES; ++f) {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        terrain.draw(scene);
+        glFinish();
+    }
+    return 1000 * (glfwGetTime() - start) / BENCH_FRAMES;
+}
+
+//
+// time mesh drawing at several levels against ray marching, from the
+// current view. Meshes draw with one glDrawElements, without culling.
+// Then time shallow water steps on a 1025x1025 grid
+//
+void Input::benchmark(AppContext &ctx)
+{
+    Scene *scene = ctx.scene;
+    scene->update();
+
+    TerrainRaymarch *ray = ctx.raymarch;
+    if (! ray) ray = new TerrainRaymarch(ctx.terrain->size(), octaves);
+    double rayTime = frameTime(*scene, *ray);
+    if (ray != ctx.raymarch) delete ray;
+
+    printf("%dx%d pixels: ray marched %.2f ms per frame\n",
+           scene->width, scene->height, rayTime);
+    for(size_t i=0; i < sizeof(BENCH_LEVELS)/sizeof(*BENCH_LEVELS); ++i) {
+        Terrain mesh(BENCH_LEVELS[i], octaves);
+        mesh.toggleCulling();
+        double meshTime = frameTime(*scene, mesh);
+        printf("level %d: mesh %.2f ms per frame, %.2fx ray marched\n",
+               BENCH_LEVELS[i], meshTime, meshTime / rayTime);
+    }
+
+    // water over the axial square of level BENCH_WATER_LEVEL terrain
+    int n = BENCH_WATER_LEVEL + 1, cells = 2*n + 1;
+    Vec3f mapSize = ctx.terrain->size();
+    ShallowWater water(cells, mapSize.x / n);
+    for(int r=0; r < cells; ++r) {
+        for(int c=0; c < cells; ++c) {
+            if (c + r < n || c + r > 3*n) continue;     // off the hexagon
+            Vec3f P = vec3<float>(0.5f*(2*c + r - 3*n), sqrtf(0.75f)*(r - n), 0);
+            water.setGround(c, r, Terrain::elevation(P / float(n), octaves).z
+                                  * mapSize.z);
+        }
+    }
+    water.rain(RAIN_DEPTH);
+    water.step();               // first step touches all the memory
+
+    double start = glfwGetTime();
+    for(int i=0; i < BENCH_WATER_STEPS; ++i)
+        water.step();
+    double waterTime = (glfwGetTime() - start) / BENCH_WATER_STEPS;
+    printf("water %dx%d: %.2f ms per step, %.1f million cell updates per "
+           "second on %u threads\n", cells, cells, 1000 * waterTime,
+           1e-6 * cells * cells / waterTime, water.threads());
+}
+
+//
+// time A* paths between random faces of the mesh, one at a time and as
+// one batch across threads, then the same paths planned over clusters
+//
+void Input::pathBenchmark(AppContext &ctx)
+{
+    const NavMesh *nav = ctx.terrain->navigation();
+    if (! nav) return;
+
+    // the same pairs every time, for comparing runs
+    std::vector<unsigned int> start(BENCH_PATHS), goal(BENCH_PATHS);
+    unsigned int state = 1;
+    for(int i=0; i < BENCH_PATHS; ++i) {
+        state = state * 1664525u + 1013904223u;
+        start[i] = (state >> 8) % nav->faces();
+        state = state * 1664525u + 1013904223u;
+        goal[i] = (state >> 8) % nav->faces();
+    }
+
+    NavMesh::Search search;
+    std::vector<unsigned int> path;
+    unsigned long expanded = 0;
+    double begin = glfwGetTime();
+    for(int i=0; i < BENCH_PATHS; ++i) {
+        nav->findPath(start[i], goal[i], path, search);
+        expanded += search.expanded();
+    }
+    double single = glfwGetTime() - begin;
+
+    std::vector<float> cost(BENCH_PATHS);
+    std::vector<std::vector<unsigned int> > paths(BENCH_PATHS);
+    begin = glfwGetTime();
+    unsigned int found = nav->findPaths(BENCH_PATHS, &start[0], &goal[0],
+                                        &cost[0], &paths[0]);
+    double batch = glfwGetTime() - begin;
+
+    printf("paths: %d random queries over %u faces, %u found, %lu faces "
+           "expanded per query\n", BENCH_PATHS, nav->faces(), found,
+           expanded / BENCH_PATHS);
+    printf("paths: %.0f queries per second on one thread, %.0f on %u threads\n",
+           BENCH_PATHS / single, BENCH_PATHS / batch, nav->threads());
+
+    // hierarchical paths cost a little more than the cheapest
+    const NavHierarchy *tree = ctx.terrain->navigationHierarchy();
+    double extra = 0, total = 0;
+    begin = glfwGetTime();
+    for(int i=0; i < BENCH_PATHS; ++i) {
+        float treeCost = tree->findPath(start[i], goal[i], path, search);
+        if (treeCost < FLT_MAX && cost[i] < FLT_MAX) {
+            extra += treeCost - cost[i];
+            total += cost[i];
+        }
+    }
+    double treeSingle = glfwGetTime() - begin;
+
+    begin = glfwGetTime();
+    tree->findPaths(BENCH_PATHS, &start[0], &goal[0], &cost[0], &paths[0]);
+    double treeBatch = glfwGetTime() - begin;
+
+    printf("hierarchy: %.0f queries per second on one thread, %.1fx flat, "
+           "%.0f on %u threads, paths %.1f%% costlier\n", BENCH_PATHS / treeSingle,
+           single / treeSingle, BENCH_PATHS / treeBatch, tree->threads(),
+           total > 0 ? 100 * extra / total : 0.);
+}
+
+//
+// build a flow field toward the picked point, or the viewer, from
+// scratch, and search the whole map from the same goal on one thread
+//
+void Input::flowBenchmark(AppContext &ctx)
+{
+    FlowFields *flows = ctx.terrain->flowFields();
+    if (! flows) return;
+
+    pickTerrain(ctx);
+    int goal = ctx.terrain->faceAt(picked ? pick.xy : ctx.scene->position.xy);
+    if (goal < 0) {
+        printf("flow field: goal is off the mesh\n");
+        return;
+    }
+
+    flows->clear();
+    double begin = glfwGetTime();
+    const FlowFields::Field *field = flows->field(goal);
+    double build = glfwGetTime() - begin;
+
+    const NavMesh *nav = ctx.terrain->navigation();
+    NavMesh::Search search;
+    begin = glfwGetTime();
+    nav->spread(goal, search, 0, 0);
+    double single = glfwGetTime() - begin;
+
+    printf("flow field: %u of %u faces reach face %d, built in %.1f ms on %u "
+           "threads, one search over the map %.1f ms\n", field->reached(),
+           nav->faces(), goal, 1000 * build, flows->threads(), 1000 * single);
+}
+
+//
+// time fixed steps of crowds of several sizes walking toward the viewer,
+// after one step to build the flow field and settle the hash
+//
+void Input::crowdBenchmark(AppContext &ctx)
+{
+    for(size_t s=0; s < sizeof(BENCH_AGENTS)/sizeof(*BENCH_AGENTS); ++s) {
+        Crowd crowd(*ctx.terrain, BENCH_AGENTS[s]);
+        crowd.setGoal(ctx.scene->position.xy);
+        crowd.step();
+
+        double begin = glfwGetTime();
+        for(int i=0; i < BENCH_CROWD_STEPS; ++i)
+            crowd.step();
+        double seconds = (glfwGetTime() - begin) / BENCH_CROWD_STEPS;
+
+        printf("crowd: %u agents, %.2f ms per step on %u threads, "
+               "%.1f M agent updates per second\n", crowd.agents(),
+               1000 * seconds, crowd.threads(),
+               crowd.agents() / seconds * 1e-6);
+    }
+}
+
+//
+// rain falling around the viewer from above the terrain, about three
+// seconds to the ground, and at the pick, a burst of debris thrown up and
+// dust drifting off
+//
+void Input::startParticles(AppContext &ctx)
+{
+    Vec3f size = ctx.terrain->size();
+    ctx.particles = new Particles(*ctx.terrain,
+            RAIN_PARTICLES + DEBRIS_PARTICLES + DUST_PARTICLES);
+
+    Vec3f over = vec3<float>(ctx.scene->position.x, ctx.scene->position.y, size.z);
+    Particles::Emitter rain = {Particles::RAIN, over, 100, size.z,
+        vec3<float>(3, 0, -20), 1, RAIN_PARTICLES / 3.f, 6};
+    ctx.particles->addEmitter(rain, RAIN_PARTICLES);
+    if (! picked) return;
+
+    Particles::Emitter debris = {Particles::DEBRIS, pick, 1, 1,
+        vec3<float>(0, 0, 15), 8, 0, 10};
+    int burst = ctx.particles->addEmitter(debris, DEBRIS_PARTICLES);
+    ctx.particles->burst(burst, DEBRIS_PARTICLES);
+
+    Particles::Emitter dust = {Particles::DUST, pick, 5, 1,
+        vec3<float>(1, 0, 1), 1.5f, DUST_PARTICLES / 6.f, 6};
+    ctx.particles->addEmitter(dust, DUST_PARTICLES);
+}
+
+//
+// time fixed steps of a million particles spread over the map: half rain
+// falling from above it, and the rest debris and dust started anywhere
+// from below the ground to above it, so every kind meets the ground. One
+// step first starts them all
+//
+void Input::particleBenchmark(AppContext &ctx)
+{
+    Vec3f size = ctx.terrain->size();
+    float radius = sqrtf(0.75f) * size.x;     // circle inside the hexagon
+    Particles particles(*ctx.terrain, BENCH_PARTICLES);
+
+    Particles::Emitter rain = {Particles::RAIN, vec3<float>(0, 0, size.z),
+        radius, size.z, vec3<float>(0, 0, -20), 1, BENCH_PARTICLES / 6.f, 10};
+    int e = particles.addEmitter(rain, BENCH_PARTICLES / 2);
+    particles.burst(e, BENCH_PARTICLES / 2);
+
+    Particles::Emitter debris = {Particles::DEBRIS, vec3<float>(0, 0, -size.z),
+        radius, 2 * size.z, vec3<float>(0, 0, 5), 5, 0, 30};
+    e = particles.addEmitter(debris, BENCH_PARTICLES / 4);
+    particles.burst(e, BENCH_PARTICLES / 4);
+
+    Particles::Emitter dust = debris;
+    dust.kind = Particles::DUST;
+    dust.velocity = vec3<float>(1, 0, 0);
+    e = particles.addEmitter(dust, BENCH_PARTICLES / 4);
+    particles.burst(e, BENCH_PARTICLES / 4);
+    particles.step();
+
+    double begin = glfwGetTime();
+    for(int i=0; i < BENCH_PARTICLE_STEPS; ++i)
+        particles.step();
+    double seconds = (glfwGetTime() - begin) / BENCH_PARTICLE_STEPS;
+
+    printf("particles: %u live, %.2f ms per step on %u threads, "
+           "%.1f M particle updates per second\n", particles.count(),
+           1000 * seconds, particles.threads(),
+           particles.count() / seconds * 1e-6);
+}
+
 //
 // set view, respecting alignview setting
 //
@@ -72,6 +410,8 @@ void Input::mouseMove(const AppContext &ctx, double x, double y)
     oldButton = button;
     oldX = x;
     oldY = y;
+
+    pickTerrain(ctx);
 }
 
 //
@@ -106,14 +446,48 @@ void Input::keyPress(GLFWwindow &win, AppContext &ctx, int key)
 
         case 'R':                   // reload shaders
             ctx.terrain->updateShaders();
+            if (ctx.lod) ctx.lod->updateShaders();
+            if (ctx.clipmap) ctx.clipmap->updateShaders();
+            if (ctx.stream) ctx.stream->updateShaders();
+            if (ctx.roam) ctx.roam->updateShaders();
+            if (ctx.raymarch) ctx.raymarch->updateShaders();
+            if (ctx.crowd) ctx.crowd->updateShaders();
+            if (ctx.scatter) ctx.scatter->updateShaders();
+            if (ctx.particles) ctx.particles->updateShaders();
             redraw = true;          // need to redraw
             break;
 
+        case 'M': {                 // cycle terrain drawing mode
+            static const char *names[] = {
+                "mesh", "level of detail", "clipmap", "streaming", "ROAM",
+                "ray marched"};
+            drawMode = (drawMode + 1) % NUM_DRAW_MODES;
+            printf("drawing %s terrain\n", names[drawMode]);
+            prepareMode(ctx);
+            redraw = true;
+            break;
+        }
+
         case 'F':                   // toggle fog on or off
             ctx.scene->sdata.fog.a = 1 - ctx.scene->sdata.fog.a;
             redraw = true;          // need to redraw
             break;
 
+        case 'C':                   // toggle tile culling
+            ctx.terrain->toggleCulling();
+            redraw = true;
+            break;
+
+        case 'Q':                   // toggle simplified tiles by distance
+            ctx.terrain->toggleSimplified();
+            redraw = true;
+            break;
+
+        case 'X':                   // toggle drawing from height texture
+            ctx.terrain->toggleHeightTexture();
+            redraw = true;
+            break;
+
         case 'L':                   // toggle line drawing on or off
             wireframe = !wireframe;
             if (wireframe) {
@@ -143,31 +517,172 @@ void Input::keyPress(GLFWwindow &win, AppContext &ctx, int key)
 			redraw = true;
 			break;
             
+        case 'B': {                 // apply terrain brush where picked
+            Scene *scene = ctx.scene;
+            pickTerrain(ctx);
+            ctx.terrain->applyBrush(picked ? pick.xy : scene->position.xy, 20,
+                    Terrain::BrushProfile(brush));
+            setHeight(ctx, scene->position, scene->up);
+            setView(*scene, alignview);
+            redraw = true;
+            break;
+        }
+
+        case 'G':                   // toggle terrain graded around viewer
+            meshType = meshType == MESH_GRADED ? MESH_UNIFORM : MESH_GRADED;
+            focus = ctx.scene->position.xy;
+            rebuild(ctx);
+            redraw = true;
+            break;
+
+        case 'T':                   // toggle irregular network terrain
+            meshType = meshType == MESH_TIN ? MESH_UNIFORM : MESH_TIN;
+            rebuild(ctx);
+            redraw = true;
+            break;
+
+        case 'P':                   // toggle terrain computed on the GPU
+            meshType = meshType == MESH_PROCEDURAL ? MESH_UNIFORM
+                                                   : MESH_PROCEDURAL;
+            rebuild(ctx);
+            redraw = true;
+            break;
+
+        case 'K':                   // time mesh against ray marching
+            benchmark(ctx);
+            redraw = true;
+            break;
+
+        case '1':                   // time paths between random faces
+            pathBenchmark(ctx);
+            break;
+
+        case '2':                   // time a flow field toward the pick
+            flowBenchmark(ctx);
+            break;
+
+        case '3':                   // toggle a crowd walking to the pick
+            if (ctx.crowd) {
+                delete ctx.crowd;
+                ctx.crowd = 0;
+            }
+            else {
+                pickTerrain(ctx);
+                ctx.crowd = new Crowd(*ctx.terrain, CROWD_AGENTS);
+                if (picked) ctx.crowd->setGoal(pick.xy);
+            }
+            redraw = true;
+            break;
+
+        case '4':                   // time crowd steps at several sizes
+            crowdBenchmark(ctx);
+            break;
+
+        case '5':                   // toggle trees, rocks and bushes
+            if (ctx.scatter) {
+                delete ctx.scatter;
+                ctx.scatter = 0;
+            }
+            else {
+                double start = glfwGetTime();
+                ctx.scatter = new Scatter(*ctx.terrain);
+                printf("scatter: %u trees, %u rocks, %u bushes from %u points "
+                       "in %u tiles, %.1f ms on %u threads\n",
+                       ctx.scatter->instances(Scatter::TREE),
+                       ctx.scatter->instances(Scatter::ROCK),
+                       ctx.scatter->instances(Scatter::BUSH),
+                       ctx.scatter->points(), ctx.scatter->tiles(),
+                       1000 * (glfwGetTime() - start), ctx.scatter->threads());
+            }
+            redraw = true;
+            break;
+
+        case '6':                   // toggle rain, debris and dust
+            if (ctx.particles) {
+                delete ctx.particles;
+                ctx.particles = 0;
+            }
+            else {
+                pickTerrain(ctx);
+                startParticles(ctx);
+            }
+            redraw = true;
+            break;
+
+        case '7':                   // time a million particles
+            particleBenchmark(ctx);
+            break;
+
+        case 'E':                   // erode terrain over the next frames
+            ctx.terrain->erode(EROSION_ITERATIONS, erosion);
+            redraw = true;
+            break;
+
+        case 'J':                   // toggle drainage channel overlay
+            ctx.terrain->toggleDrainage();
+            redraw = true;
+            break;
+
+        case 'I':                   // toggle what the viewer can see
+            if (ctx.terrain->viewshedVisible())
+                ctx.terrain->hideViewshed();
+            else
+                ctx.terrain->viewshed(ctx.scene->position,
+                                      2 * ctx.terrain->size().x);
+            redraw = true;
+            break;
+
+        case 'Z': {                 // trace the view on the CPU to a file
+            ImagePPM image(ctx.scene->width, ctx.scene->height);
+            TerrainTracer(*ctx.terrain).render(*ctx.scene, image);
+            image.write("trace.ppm");
+            break;
+        }
+
+        case 'U':                   // rain on the terrain, or drain it
+            if (ctx.terrain->flowing())
+                ctx.terrain->drain();
+            else
+                ctx.terrain->rain(RAIN_DEPTH);
+            redraw = true;
+            break;
+
+        case 'Y': {                 // cycle through kinds of erosion
+            static const char *names[] = {"hydraulic", "thermal",
+                "hydraulic and thermal"};
+            erosion = erosion % 3 + 1;
+            printf("erosion: %s\n", names[erosion-1]);
+            break;
+        }
+
+        case 'V': {                 // cycle through terrain brushes
+            static const char *names[] = {"raise","lower","flatten","crater"};
+            brush = (brush + 1) % Terrain::NUM_BRUSHES;
+            printf("brush: %s\n", names[brush]);
+            break;
+        }
+
         case '+': case '=':         // increase number of triangles
             ++level;
-            delete ctx.terrain;
-            ctx.terrain = new Terrain(level, octaves);
+            rebuild(ctx);
             redraw = true;
             break;
             
         case '-': case '_':         // decrease number of triangles
             if (level > 0) --level;
-            delete ctx.terrain;
-            ctx.terrain = new Terrain(level, octaves);
+            rebuild(ctx);
             redraw = true;
             break;
 
         case '>': case '.':         // increase noise octaves
             ++octaves;
-            delete ctx.terrain;
-            ctx.terrain = new Terrain(level, octaves);
+            rebuild(ctx);
             redraw = true;
             break;
             
         case '<': case ',':         // decrease number of triangles
             if (octaves > 0) --octaves;
-            delete ctx.terrain;
-            ctx.terrain = new Terrain(level, octaves);
+            rebuild(ctx);
             redraw = true;
             break;
              
@@ -199,7 +714,6 @@ void Input::keyUpdate(const AppContext &ctx)
 {
     if (moveRate != 0 || strafeRate != 0) {
         Scene *scene = ctx.scene;
-        Terrain *terrain = ctx.terrain;
 
         double now = glfwGetTime();
         double dt = (now - updateTime);
@@ -212,7 +726,7 @@ void Input::keyUpdate(const AppContext &ctx)
         Vec3f P = scene->position, N;
         P += float(  moveRate * dt) * vec3<float>(s, c, 0);
         P += float(strafeRate * dt) * vec3<float>(c,-s, 0);
-        if (terrain->setHeight(P, N)) {
+        if (setHeight(ctx, P, N)) {
             scene->position = P;
             scene->up = N;
             setView(*scene, alignview);
@@ -222,4 +736,74 @@ void Input::keyUpdate(const AppContext &ctx)
         // remember time for next update
         updateTime = now;
     }
+
+    // agents walk on their own time
+    if (ctx.crowd && ctx.crowd->update(glfwGetTime()))
+        redraw = true;
+    if (ctx.particles && ctx.particles->update(glfwGetTime()))
+        redraw = true;
+}
+
+//
+// create terrain representation needed by drawMode, if not already
+//
+void Input::prepareMode(AppContext &ctx)
+{
+    if (drawMode == DRAW_LOD && ! ctx.lod)
+        ctx.lod = new TerrainLOD(ctx.terrain->size(), octaves);
+    if (drawMode == DRAW_CLIPMAP && ! ctx.clipmap)
+        ctx.clipmap = new Clipmap(ctx.terrain->size(), octaves);
+    if (drawMode == DRAW_STREAM && ! ctx.stream)
+        ctx.stream = new StreamTerrain(ctx.terrain->size(), octaves);
+    if (drawMode == DRAW_ROAM && ! ctx.roam)
+        ctx.roam = new TerrainROAM(ctx.terrain->size(), octaves);
+    if (drawMode == DRAW_RAYMARCH && ! ctx.raymarch)
+        ctx.raymarch = new TerrainRaymarch(ctx.terrain->size(), octaves);
+}
+
+//
+// rebuild all terrain for new level or octaves
+// only the representation in use is rebuilt now, others when needed
+// procedural terrain just changes its shader settings
+//
+void Input::rebuild(AppContext &ctx)
+{
+    if (meshType == MESH_PROCEDURAL && ctx.terrain->isProcedural())
+        ctx.terrain->setDetail(level, octaves);
+    else {
+        delete ctx.terrain;
+        switch (meshType) {
+        case MESH_GRADED:
+            ctx.terrain = new Terrain(level, octaves, focus, FOCUS_RADIUS);
+            break;
+        case MESH_TIN:
+            ctx.terrain = new Terrain(level, octaves, TIN_ERROR);
+            break;
+        case MESH_PROCEDURAL:
+            ctx.terrain = new Terrain(level, octaves, Terrain::PROCEDURAL);
+            break;
+        default:
+            ctx.terrain = new Terrain(level, octaves);
+            break;
+        }
+    }
+
+    delete ctx.lod;
+    ctx.lod = 0;
+    delete ctx.clipmap;
+    ctx.clipmap = 0;
+    delete ctx.stream;
+    ctx.stream = 0;
+    delete ctx.roam;
+    ctx.roam = 0;
+    delete ctx.raymarch;
+    ctx.raymarch = 0;
+    delete ctx.crowd;
+    ctx.crowd = 0;
+    delete ctx.scatter;
+    ctx.scatter = 0;
+    delete ctx.particles;
+    ctx.particles = 0;
+
+    prepareMode(ctx);
 }
@@ -2,6 +2,8 @@
 #ifndef Input_hpp
 #define Input_hpp
 
+#include "Vec.hpp"
+
 class AppContext;
 class Scene;
 struct GLFWwindow;
@@ -17,20 +19,64 @@ private:
 
     bool wireframe;             // toggle wireframe drawing
     bool alignview;             // toggle aligning view with normal
-    
+    int brush;                  // Terrain::BrushProfile for 'b' key
+    int erosion;                // Erosion::Kind bits for 'e' key
+    int meshType;               // MeshType for terrain rebuilds
+    Vec2f focus;                // center of graded terrain detail
+    Vec3f pick;                 // terrain point under the cursor
+    bool picked;                // false if the cursor ray missed the terrain
+
+// private methods
+private:
+    // set viewer height and normal from the terrain being drawn
+    bool setHeight(const AppContext &ctx, Vec3f &P, Vec3f &N) const;
+
+    // update pick from a ray through the cursor, or through the window
+    // center while the cursor is hidden for rotating
+    void pickTerrain(const AppContext &ctx);
+
+    // time mesh drawing at several levels against ray marching, from the
+    // current view, and shallow water steps on a large grid
+    void benchmark(AppContext &ctx);
+
+    // time A* paths between random faces, one at a time and in a batch
+    void pathBenchmark(AppContext &ctx);
+
+    // time a flow field toward the picked point against one search over
+    // the whole map
+    void flowBenchmark(AppContext &ctx);
+
+    // time crowd steps at several sizes, in agent updates per second
+    void crowdBenchmark(AppContext &ctx);
+
+    // rain over the viewer, and debris and dust at the picked point
+    void startParticles(AppContext &ctx);
+
+    // time steps of a million particles, in particle updates per second
+    void particleBenchmark(AppContext &ctx);
+
 // directly accessable public data
 public:
+    // ways to build the terrain mesh
+    enum MeshType {MESH_UNIFORM, MESH_GRADED, MESH_TIN, MESH_PROCEDURAL};
+
+    // ways to draw the terrain
+    enum DrawMode {DRAW_MESH, DRAW_LOD, DRAW_CLIPMAP, DRAW_STREAM, DRAW_ROAM,
+        DRAW_RAYMARCH, NUM_DRAW_MODES};
+
     bool redraw;                // true if we need to redraw
     int level;                  // terrain levels
     int octaves;                  // terrain levels
+    int drawMode;               // current DrawMode
 
 // public methods
 public:
     // initialize
     Input() : button(-1), oldButton(-1), oldX(0), oldY(0), 
         moveRate(0), strafeRate(0),
-        wireframe(false), alignview(false), redraw(true),
-        level(30), octaves(4) {}
+        wireframe(false), alignview(false), brush(0), erosion(3),
+        meshType(MESH_UNIFORM), picked(false), redraw(true),
+        level(30), octaves(4), drawMode(DRAW_MESH) {}
 
     // handle mouse press / release
     void mousePress(GLFWwindow &win, int button, int action);
@@ -46,6 +92,12 @@ public:
 
     // update view (if necessary) based on key input
     void keyUpdate(const AppContext &ctx);
+
+    // create terrain representation needed by drawMode, if not already
+    void prepareMode(AppContext &ctx);
+
+    // rebuild all terrain for new level or octaves
+    void rebuild(AppContext &ctx);
 };
 
 #endif
@@ -0,0 +1,300 @@
+// quadric error metric mesh simplification
+// after Garland and Heckbert, "Surface Simplification Using Quadric
+// Error Metrics"
+
+#include "MeshSimplify.hpp"
+#include "Vec.inl"
+
+#include <unordered_map>
+#include <math.h>
+
+//
+// copy connectivity of the range, and of the faces around its locked
+// vertices, and accumulate face plane quadrics at each vertex
+//
+MeshSimplify::MeshSimplify(const Vec3f *pos, const unsigned int (*indices)[3],
+                           HalfEdge *const *triEdge, unsigned int first,
+                           unsigned int end, const bool *lock)
+    : numrange(end - first), faceLive(end - first, 1), numlive(end - first)
+{
+    // faces of the range, then those outside it around its locked vertices
+    std::vector<unsigned int> face;
+    std::unordered_map<unsigned int, unsigned int> faceIndex;
+    for(unsigned int f = first; f < end; ++f) {
+        faceIndex[f] = face.size();
+        face.push_back(f);
+    }
+    auto add = [&](int f) {
+        if (faceIndex.insert(std::make_pair(unsigned(f), unsigned(face.size()))).second)
+            face.push_back(f);
+    };
+    for(unsigned int f = first; f < end; ++f) {
+        HalfEdge *e = triEdge[f];
+        for(int k=0; k < 3; ++k, e = e->next) {
+            if (! lock[e->vert]) continue;
+            for(HalfEdge *a = e; a->pair->face >= 0 && (a = a->pair->next) != e; )
+                add(a->face);
+            for(HalfEdge *a = e; (a = a->next->next->pair)->face >= 0 && a != e; )
+                add(a->face);
+        }
+    }
+
+    // vertices numbered in order of first use, and faces' half-edges three
+    // at a time, with a boundary half-edge wherever the pair is not copied
+    std::unordered_map<unsigned int, unsigned int> vertIndex;
+    std::unordered_map<const HalfEdge*, unsigned int> edgeIndex;
+    tri.resize(3 * face.size());
+    for(unsigned int f=0; f < face.size(); ++f) {
+        const HalfEdge *e = triEdge[face[f]];
+        for(int k=0; k < 3; ++k, e = e->next) {
+            unsigned int v = indices[face[f]][k];
+            auto found = vertIndex.insert(std::make_pair(v, unsigned(global.size())));
+            if (found.second) global.push_back(v);
+            tri[3*f + k] = found.first->second;
+            edgeIndex[e] = 3*f + k;
+        }
+    }
+    unsigned int numedge = 3 * face.size();
+    for(unsigned int f=0; f < face.size(); ++f) {
+        const HalfEdge *e = triEdge[face[f]];
+        for(int k=0; k < 3; ++k, e = e->next)
+            if (! edgeIndex.count(e->pair)) ++numedge;
+    }
+
+    edge.resize(numedge);
+    unsigned int border = 3 * face.size();
+    for(unsigned int f=0; f < face.size(); ++f) {
+        const HalfEdge *e = triEdge[face[f]];
+        for(int k=0; k < 3; ++k, e = e->next) {
+            HalfEdge &h = edge[3*f + k];
+            h.vert = tri[3*f + k];
+            h.face = f;
+            h.next = &edge[3*f + (k+1)%3];
+            auto pair = edgeIndex.find(e->pair);
+            if (pair != edgeIndex.end())
+                h.pair = &edge[pair->second];
+            else {
+                HalfEdge &b = edge[border++];
+                b.vert = tri[3*f + (k+1)%3];
+                b.pair = &h;
+                h.pair = &b;
+            }
+        }
+    }
+
+    // positions, locks and outgoing edges by local vertex; faces outside
+    // the range may bring in vertices of other tiles, locked here
+    unsigned int numvert = global.size();
+    vert.resize(numvert);
+    locked.resize(numvert);
+    vertEdge.assign(numvert, (HalfEdge*)0);
+    for(unsigned int i=0; i < numvert; ++i) {
+        vert[i] = pos[global[i]];
+        locked[i] = true;
+    }
+    for(unsigned int i=0; i < 3 * numrange; ++i)
+        locked[tri[i]] = lock[global[tri[i]]];
+    for(unsigned int i=0; i < 3 * face.size(); ++i)
+        vertEdge[edge[i].vert] = &edge[i];
+    quadric.resize(numvert);
+    target.assign(numvert, -1);
+    stamp.assign(numvert, 0);
+
+    // unweighted plane quadric of each face, so the cost is a sum of
+    // squared distances to the original planes
+    for(unsigned int i=0; i < numvert; ++i)
+        for(int k=0; k < 10; ++k)
+            quadric[i].q[k] = 0;
+    for(unsigned int f=0; f < face.size(); ++f) {
+        Vec3f v0 = vert[tri[3*f]], v1 = vert[tri[3*f+1]], v2 = vert[tri[3*f+2]];
+        Vec3f n = normalize((v1 - v0) ^ (v2 - v0));
+        double a = n.x, b = n.y, c = n.z, d = -dot(n, v0);
+        double plane[10] = {a*a, a*b, a*c, a*d, b*b, b*c, b*d, c*c, c*d, d*d};
+        for(int j=0; j < 3; ++j)
+            for(int k=0; k < 10; ++k)
+                quadric[tri[3*f+j]].q[k] += plane[k];
+    }
+
+    for(unsigned int i=0; i < numvert; ++i)
+        consider(i);
+}
+
+//
+// outgoing half-edges with faces around the origin of h
+// boundary half-edges have no next, so stop there and go back the
+// other way from h
+//
+void MeshSimplify::ring(HalfEdge *h, std::vector<HalfEdge*> &out) const
+{
+    out.clear();
+    HalfEdge *e = h;
+    do {
+        out.push_back(e);
+        e = e->pair->face >= 0 ? e->pair->next : 0;
+    } while (e && e != h);
+    if (e) return;
+
+    for(e = h->next->next->pair; e->face >= 0; e = e->next->next->pair)
+        out.push_back(e);
+}
+
+//
+// quadric error of moving vertex u onto v
+//
+float MeshSimplify::cost(int u, int v) const
+{
+    const double *a = quadric[u].q, *b = quadric[v].q;
+    double x = vert[v].x, y = vert[v].y, z = vert[v].z;
+    double e =
+        (a[0]+b[0])*x*x + 2*(a[1]+b[1])*x*y + 2*(a[2]+b[2])*x*z + 2*(a[3]+b[3])*x
+      + (a[4]+b[4])*y*y + 2*(a[5]+b[5])*y*z + 2*(a[6]+b[6])*y
+      + (a[7]+b[7])*z*z + 2*(a[8]+b[8])*z
+      + (a[9]+b[9]);
+    return float(e > 0 ? e : 0);
+}
+
+//
+// true if collapsing h onto its far vertex keeps the mesh manifold and no
+// triangle flips over in xy
+//
+bool MeshSimplify::canCollapse(HalfEdge *h)
+{
+    int u = h->vert, v = h->pair->vert;
+    if (locked[u]) return false;
+
+    // only the two faces on the edge may share both vertices
+    ring(h, ringU);
+    ring(vertEdge[v], ringV);
+    int common = 0;
+    for(size_t i=0; i < ringU.size(); ++i) {
+        int w = ringU[i]->pair->vert;
+        for(size_t j=0; j < ringV.size(); ++j) {
+            if (ringV[j]->pair->vert == w ||
+                ringV[j]->next->next->vert == w) {
+                ++common;
+                break;
+            }
+        }
+    }
+    if (common != 2) return false;
+
+    // remaining faces around u must stay counter-clockwise with v for u
+    Vec2f V = vert[v].xy;
+    HalfEdge *skip = h->pair->next;
+    for(size_t i=0; i < ringU.size(); ++i) {
+        HalfEdge *e = ringU[i];
+        if (e == h || e == skip) continue;
+        Vec2f a = vert[e->pair->vert].xy - V;
+        Vec2f b = vert[e->next->next->vert].xy - V;
+        float area = a.x*b.y - a.y*b.x;
+        if (area <= 1e-6f * (dot(a, a) + dot(b, b)))
+            return false;
+    }
+    return true;
+}
+
+//
+// find the cheapest valid collapse for u and queue it
+//
+void MeshSimplify::consider(int u)
+{
+    ++stamp[u];
+    target[u] = -1;
+    if (locked[u] || ! vertEdge[u]) return;
+
+    Candidate best = {0, u, stamp[u]};
+    std::vector<HalfEdge*> around;
+    ring(vertEdge[u], around);
+    for(size_t i=0; i < around.size(); ++i) {
+        int v = around[i]->pair->vert;
+        float c = cost(u, v);
+        if ((target[u] < 0 || c < best.cost) && canCollapse(around[i])) {
+            best.cost = c;
+            target[u] = v;
+        }
+    }
+    if (target[u] >= 0)
+        queue.push(best);
+}
+
+//
+// move origin of h onto its far vertex, removing h's two faces
+//
+void MeshSimplify::collapse(HalfEdge *h)
+{
+    HalfEdge *p = h->pair;
+    HalfEdge *hn = h->next, *hp = hn->next, *pn = p->next, *pp = pn->next;
+    int u = h->vert, v = p->vert;
+
+    // faces around u now use v
+    ring(h, ringU);
+    for(size_t i=0; i < ringU.size(); ++i) {
+        HalfEdge *e = ringU[i];
+        e->vert = v;
+        unsigned int *t = &tri[3*e->face];
+        for(int k=0; k < 3; ++k)
+            if (t[k] == unsigned(u)) t[k] = v;
+    }
+
+    // close up the two removed faces by pairing their outer edges
+    HalfEdge *a1 = hn->pair, *a2 = hp->pair, *b1 = pn->pair, *b2 = pp->pair;
+    a1->pair = a2; a2->pair = a1;
+    b1->pair = b2; b2->pair = b1;
+    faceLive[h->face] = faceLive[p->face] = 0;
+    numlive -= 2;
+
+    // replace any outgoing edges that were removed
+    vertEdge[v] = a2;
+    vertEdge[a2->next->vert] = a2->next;
+    vertEdge[b1->vert] = b1;
+    vertEdge[u] = 0;
+
+    for(int k=0; k < 10; ++k)
+        quadric[v].q[k] += quadric[u].q[k];
+    ++stamp[u];
+
+    // costs and validity change for v and everything around it
+    consider(v);
+    std::vector<HalfEdge*> around;
+    ring(vertEdge[v], around);
+    for(size_t i=0; i < around.size(); ++i) {
+        consider(around[i]->pair->vert);
+        consider(around[i]->next->next->vert);
+    }
+}
+
+//
+// collapse edges until the cheapest costs more than error
+//
+void MeshSimplify::simplify(float error)
+{
+    float limit = error * error;
+    while (! queue.empty() && queue.top().cost <= limit) {
+        Candidate c = queue.top();
+        queue.pop();
+        if (c.stamp != stamp[c.vert]) continue;   // out of date
+
+        // find the chosen edge, and check it is still valid
+        HalfEdge *h = 0;
+        ring(vertEdge[c.vert], ringV);
+        for(size_t i=0; i < ringV.size() && ! h; ++i)
+            if (ringV[i]->pair->vert == target[c.vert])
+                h = ringV[i];
+
+        if (h && canCollapse(h))
+            collapse(h);
+        else
+            consider(c.vert);
+    }
+}
+
+//
+// append mesh vertex indices of the live triangles of the range
+//
+void MeshSimplify::triangles(std::vector<unsigned int> &out) const
+{
+    for(unsigned int f=0; f < numrange; ++f)
+        if (faceLive[f])
+            for(int k=0; k < 3; ++k)
+                out.push_back(global[tri[3*f + k]]);
+}
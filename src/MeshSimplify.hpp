@@ -0,0 +1,91 @@
+// quadric error metric mesh simplification
+#ifndef MeshSimplify_hpp
+#define MeshSimplify_hpp
+
+#include "Vec.hpp"
+#include "HalfEdge.hpp"
+#include <vector>
+#include <queue>
+
+// half-edge collapses ordered by quadric error (Garland and Heckbert).
+// Each collapse moves one vertex onto a neighbor, so every simplified mesh
+// uses a subset of the original vertices and can share their buffers.
+// Works on its own copy of the half-edge connectivity of one range of
+// triangles, such as a tile, with the faces around its locked vertices so
+// their rings are whole, and numbers those faces and their vertices from
+// 0. Only faces in the range are ever removed.
+class MeshSimplify {
+// private types
+private:
+    // symmetric 4x4 plane quadric, upper triangle
+    struct Quadric {
+        double q[10];
+    };
+
+    // cheapest collapse for one vertex, lowest cost first in the queue
+    struct Candidate {
+        float cost;
+        int vert, stamp;
+        bool operator<(const Candidate &c) const { return cost > c.cost; }
+    };
+
+// private data
+private:
+    std::vector<Vec3f> vert;    // vertex positions, not changed
+    std::vector<unsigned int> global; // mesh index of each vertex
+    unsigned int numrange;      // faces from the range, first in tri
+    std::vector<unsigned int> tri; // current 3 vertex indices per triangle
+    std::vector<char> faceLive; // false once collapsed away
+    unsigned int numlive;       // live triangles
+
+    std::vector<HalfEdge> edge; // copy of half-edge connectivity
+    std::vector<HalfEdge*> vertEdge; // an outgoing half-edge with a face
+    std::vector<char> locked;   // vertices that cannot be removed
+    std::vector<Quadric> quadric;
+
+    std::vector<int> target;    // best neighbor to collapse onto
+    std::vector<int> stamp;     // bumped to invalidate queued candidates
+    std::priority_queue<Candidate> queue;
+
+    std::vector<HalfEdge*> ringU, ringV; // scratch for collapse tests
+
+// private methods
+private:
+    // outgoing half-edges with faces around the origin of h
+    void ring(HalfEdge *h, std::vector<HalfEdge*> &out) const;
+
+    // quadric error of moving vertex u onto v
+    float cost(int u, int v) const;
+
+    // true if collapsing h onto its far vertex keeps the mesh manifold
+    // and no triangle flips over in xy
+    bool canCollapse(HalfEdge *h);
+
+    // find the cheapest valid collapse for u and queue it
+    void consider(int u);
+
+    // move origin of h onto its far vertex, removing h's two faces
+    void collapse(HalfEdge *h);
+
+// public methods
+public:
+    // copy connectivity of mesh triangles first..end-1; locked vertices
+    // are never removed, and must include every vertex on the mesh
+    // boundary and every vertex shared with triangles outside the range
+    MeshSimplify(const Vec3f *vert, const unsigned int (*indices)[3],
+                 HalfEdge *const *triEdge, unsigned int first,
+                 unsigned int end, const bool *locked);
+
+    // collapse edges until the cheapest costs more than error, in world
+    // units of distance from the original surface. Can be called again
+    // with larger errors to continue simplifying.
+    void simplify(float error);
+
+    // number of triangles of the range left
+    unsigned int triangles() const { return numlive; }
+
+    // append mesh vertex indices of the live triangles of the range
+    void triangles(std::vector<unsigned int> &out) const;
+};
+
+#endif
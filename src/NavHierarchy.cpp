@@ -0,0 +1,431 @@
+// hierarchical paths over the faces of the terrain mesh
+// after Botea, Mueller and Schaeffer, "Near Optimal Hierarchical
+// Path-Finding"
+
+#include "NavHierarchy.hpp"
+#include "Parallel.hpp"
+#include "Vec.inl"
+
+#include <atomic>
+#include <algorithm>
+#include <functional>
+#include <float.h>
+#include <math.h>
+
+// faces in each cluster, on average
+const float CLUSTER_FACES = 1024;
+
+// longest stretch of border served by one portal, in cluster widths
+const float ENTRANCE = 1.f / 3;
+
+// ids for the start and goal of a portal search, which are never faces
+const unsigned int START_ID = NavMesh::NO_GOAL - 1;
+const unsigned int GOAL_ID = NavMesh::NO_GOAL - 2;
+
+// root of crossing i in a disjoint set forest, compressing the path
+static int findRoot(std::vector<int> &parent, int i)
+{
+    while (parent[i] != i)
+        i = parent[i] = parent[parent[i]];
+    return i;
+}
+
+//
+// clusters, portals and costs for the current faces of nav
+//
+NavHierarchy::NavHierarchy(const NavMesh &nav)
+    : nav(nav), numthreads(parallelThreads()), numportals(0)
+{
+    unsigned int numtri = nav.faces();
+
+    // grid squares sized to hold CLUSTER_FACES of the average face area
+    Vec2f lo = vec2<float>(FLT_MAX, FLT_MAX), hi = -lo;
+    for(unsigned int f=0; f < numtri; ++f) {
+        Vec2f c = nav.centroid(f).xy;
+        lo = vec2<float>(std::min(lo.x, c.x), std::min(lo.y, c.y));
+        hi = vec2<float>(std::max(hi.x, c.x), std::max(hi.y, c.y));
+    }
+    Vec2f size = hi - lo;
+    origin = lo;
+    cellSize = std::max(sqrtf(CLUSTER_FACES * size.x * size.y / numtri), 1e-3f);
+    gridX = int(size.x / cellSize) + 1;
+    gridY = int(size.y / cellSize) + 1;
+
+    // faces of each cluster, by counting sort
+    cluster.resize(numtri);
+    clusterStart.assign(gridX*gridY + 1, 0);
+    for(unsigned int f=0; f < numtri; ++f) {
+        Vec2f c = (nav.centroid(f).xy - origin) / cellSize;
+        int cx = std::min(int(c.x), gridX - 1), cy = std::min(int(c.y), gridY - 1);
+        cluster[f] = cy*gridX + cx;
+        ++clusterStart[cluster[f] + 1];
+    }
+    for(int c=0; c < gridX*gridY; ++c)
+        clusterStart[c+1] += clusterStart[c];
+    clusterFace.resize(numtri);
+    std::vector<unsigned int> fill(clusterStart.begin(), clusterStart.end() - 1);
+    for(unsigned int f=0; f < numtri; ++f)
+        clusterFace[fill[cluster[f]]++] = f;
+
+    portalIndex.assign(numtri, -1);
+    clusters.resize(gridX*gridY);
+    update();
+}
+
+//
+// portal faces of cluster c. Walkable edges across the border to each
+// other cluster are chained into stretches by shared vertices, and each
+// stretch is cut into pieces no longer than ENTRANCE, with a portal at the
+// middle edge of each. Both clusters see the same edges in the same order,
+// so they pick the two faces of the same edge, without talking to each
+// other
+//
+void NavHierarchy::findPortals(int c)
+{
+    Cluster &cl = clusters[c];
+    for(size_t i=0; i < cl.portal.size(); ++i)
+        portalIndex[cl.portal[i]] = -1;
+    cl.portal.clear();
+
+    // walkable edges from here into other clusters
+    struct Crossing {
+        int other;              // cluster across the edge
+        unsigned int face;      // face on this side
+        unsigned int across;    // face on the other side
+        float key;              // position along the border
+        unsigned int root;      // stretch of connected crossings
+    };
+    std::vector<Crossing> cross;
+    for(unsigned int i = clusterStart[c]; i < clusterStart[c+1]; ++i) {
+        unsigned int f = clusterFace[i];
+        if (! nav.walkable(f)) continue;
+        for(int k=0; k < 3; ++k) {
+            int g = nav.neighborOf(f, k);
+            if (g < 0 || cluster[g] == c || ! nav.walkable(g)) continue;
+            Crossing x = {cluster[g], f, unsigned(g), 0, 0};
+            cross.push_back(x);
+        }
+    }
+    std::sort(cross.begin(), cross.end(), [](const Crossing &a, const Crossing &b) {
+        return a.other < b.other;
+    });
+
+    for(size_t begin = 0, end; begin < cross.size(); begin = end) {
+        int n = cross[begin].other;
+        for(end = begin; end < cross.size() && cross[end].other == n; ++end) {}
+
+        // order along the border, the same seen from either side
+        int a = std::min(c, n), b = std::max(c, n);
+        Vec2f d = vec2<float>(b % gridX - a % gridX, b / gridX - a / gridX);
+        Vec2f along = vec2<float>(-d.y, d.x);
+        for(size_t i = begin; i < end; ++i) {
+            Crossing &x = cross[i];
+            x.key = dot(0.5f * (nav.centroid(x.face).xy + nav.centroid(x.across).xy),
+                        along);
+        }
+
+        // crossings sharing a vertex are in the same stretch
+        std::vector<int> parent(end - begin);
+        std::vector<std::pair<unsigned int, int> > corner;
+        for(size_t i = begin; i < end; ++i) {
+            parent[i - begin] = i - begin;
+            const unsigned int *v = nav.corners(cross[i].face);
+            const unsigned int *w = nav.corners(cross[i].across);
+            for(int j=0; j < 3; ++j)
+                if (v[j] == w[0] || v[j] == w[1] || v[j] == w[2])
+                    corner.push_back(std::make_pair(v[j], int(i - begin)));
+        }
+        std::sort(corner.begin(), corner.end());
+        for(size_t i=1; i < corner.size(); ++i)
+            if (corner[i].first == corner[i-1].first)
+                parent[findRoot(parent, corner[i].second)] =
+                    findRoot(parent, corner[i-1].second);
+
+        // name each stretch by its lowest face on either side, which
+        // both clusters agree on, and sort stretches into runs
+        std::vector<unsigned int> name(end - begin, ~0u);
+        for(size_t i = begin; i < end; ++i) {
+            unsigned int &r = name[findRoot(parent, i - begin)];
+            r = std::min(r, std::min(cross[i].face, cross[i].across));
+        }
+        for(size_t i = begin; i < end; ++i)
+            cross[i].root = name[findRoot(parent, i - begin)];
+        std::sort(cross.begin() + begin, cross.begin() + end,
+                  [](const Crossing &a, const Crossing &b) {
+            if (a.root != b.root) return a.root < b.root;
+            if (a.key != b.key) return a.key < b.key;
+            return std::min(a.face, a.across) < std::min(b.face, b.across);
+        });
+
+        // portals at the middle of pieces of each stretch
+        for(size_t p = begin, q; p < end; p = q) {
+            for(q = p; q < end && cross[q].root == cross[p].root &&
+                cross[q].key - cross[p].key <= ENTRANCE * cellSize; ++q) {}
+            unsigned int f = cross[(p + q - 1) / 2].face;
+            if (portalIndex[f] < 0) {
+                portalIndex[f] = cl.portal.size();
+                cl.portal.push_back(f);
+            }
+        }
+    }
+}
+
+//
+// cheapest costs between the portals of cluster c, staying inside it, by
+// one search from each portal out to the whole cluster
+//
+void NavHierarchy::portalCosts(int c, NavMesh::Search &search)
+{
+    Cluster &cl = clusters[c];
+    size_t k = cl.portal.size();
+    cl.cost.assign(k*k, FLT_MAX);
+    for(size_t i=0; i < k; ++i) {
+        nav.spread(cl.portal[i], search, &cluster[0], c);
+        for(size_t j=0; j < k; ++j)
+            cl.cost[i*k + j] = search.cost(cl.portal[j]);
+    }
+}
+
+//
+// rebuild the listed clusters and their neighbors: portals of all of them
+// first, since costs in any one depend on where the borders put them
+//
+void NavHierarchy::rebuild(const std::vector<int> &dirty)
+{
+    std::vector<unsigned char> mark(clusters.size(), 0);
+    std::vector<int> affected;
+    for(size_t i=0; i < dirty.size(); ++i) {
+        int c = dirty[i];
+        if (! mark[c]) affected.push_back(c);
+        mark[c] = 1;
+        for(unsigned int j = clusterStart[c]; j < clusterStart[c+1]; ++j) {
+            for(int k=0; k < 3; ++k) {
+                int g = nav.neighborOf(clusterFace[j], k);
+                if (g >= 0 && ! mark[cluster[g]]) {
+                    mark[cluster[g]] = 1;
+                    affected.push_back(cluster[g]);
+                }
+            }
+        }
+    }
+
+    // clusters only write portal indices of their own faces
+    parallelFor(affected.size(), numthreads, [&](int i) {
+        findPortals(affected[i]);
+    });
+
+    if (searches.size() < numthreads)
+        searches.resize(numthreads);
+    std::atomic<int> next(0);
+    parallelFor(numthreads, numthreads, [&](int t) {
+        for(int i; (i = next++) < int(affected.size()); )
+            portalCosts(affected[i], searches[t]);
+    });
+
+    numportals = 0;
+    for(size_t c=0; c < clusters.size(); ++c)
+        numportals += clusters[c].portal.size();
+}
+
+//
+// rebuild every cluster
+//
+void NavHierarchy::update()
+{
+    std::vector<int> all(clusters.size());
+    for(size_t c=0; c < clusters.size(); ++c)
+        all[c] = c;
+    rebuild(all);
+}
+
+//
+// rebuild the clusters holding the listed faces, and their neighbors
+//
+void NavHierarchy::update(const std::vector<unsigned int> &faces)
+{
+    std::vector<int> dirty;
+    for(size_t i=0; i < faces.size(); ++i)
+        dirty.push_back(cluster[faces[i]]);
+    std::sort(dirty.begin(), dirty.end());
+    dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+    if (! dirty.empty())
+        rebuild(dirty);
+}
+
+//
+// portals crossed by a cheapest path between them. Start and goal in one
+// cluster try a path inside it first. Otherwise, searches from each out to
+// the portals of its own cluster join them to the portal graph, where
+// portals connect to the others of their cluster through the kept costs,
+// and to portals of other clusters across one mesh edge
+//
+float NavHierarchy::findWaypoints(unsigned int start, unsigned int goal,
+                                  std::vector<unsigned int> &waypoints,
+                                  NavMesh::Search &search) const
+{
+    typedef std::pair<float, unsigned int> Entry;
+    std::greater<Entry> later;
+
+    waypoints.clear();
+    if (! nav.walkable(start) || ! nav.walkable(goal))
+        return FLT_MAX;
+
+    const int *label = &cluster[0];
+    int cs = cluster[start], cg = cluster[goal];
+    if (cs == cg) {
+        float cost = nav.findPath(start, goal, search.segment, search, label, cs);
+        if (cost < FLT_MAX) {
+            waypoints.push_back(start);
+            if (goal != start) waypoints.push_back(goal);
+            return cost;
+        }
+    }
+
+    const Cluster &from = clusters[cs], &to = clusters[cg];
+    nav.spread(start, search, label, cs);
+    search.fromStart.resize(from.portal.size());
+    for(size_t i=0; i < from.portal.size(); ++i)
+        search.fromStart[i] = search.cost(from.portal[i]);
+    nav.spread(goal, search, label, cg);
+    search.toGoal.resize(to.portal.size());
+    for(size_t i=0; i < to.portal.size(); ++i)
+        search.toGoal[i] = search.cost(to.portal[i]);
+
+    // A* over the portals, with the same estimate as for faces
+    Vec3f target = nav.centroid(goal);
+    search.reset();
+    unsigned int n = search.find(START_ID);
+    search.node[n].cost = 0;
+    search.open.push_back(Entry(length(target - nav.centroid(start)), n));
+
+    auto relax = [&](unsigned int id, float cost) {
+        unsigned int m = search.find(id);
+        if (search.node[m].closed || cost >= search.node[m].cost) return;
+        search.node[m].cost = cost;
+        search.node[m].parent = n;
+        float estimate = id == GOAL_ID ? 0 : length(target - nav.centroid(id));
+        search.open.push_back(Entry(cost + estimate, m));
+        std::push_heap(search.open.begin(), search.open.end(), later);
+    };
+
+    while (! search.open.empty()) {
+        std::pop_heap(search.open.begin(), search.open.end(), later);
+        n = search.open.back().second;
+        search.open.pop_back();
+        if (search.node[n].closed) continue;
+        search.node[n].closed = true;
+        ++search.numclosed;
+
+        unsigned int id = search.node[n].face;
+        float cost = search.node[n].cost;
+        if (id == GOAL_ID) {
+            for(int i = n; i >= 0; i = search.node[i].parent) {
+                unsigned int f = search.node[i].face;
+                f = f == GOAL_ID ? goal : f == START_ID ? start : f;
+                if (waypoints.empty() || waypoints.back() != f)
+                    waypoints.push_back(f);
+            }
+            std::reverse(waypoints.begin(), waypoints.end());
+            return cost;
+        }
+
+        if (id == START_ID) {
+            for(size_t i=0; i < from.portal.size(); ++i)
+                if (search.fromStart[i] < FLT_MAX)
+                    relax(from.portal[i], search.fromStart[i]);
+            continue;
+        }
+
+        int c = cluster[id];
+        const Cluster &cl = clusters[c];
+        size_t i = portalIndex[id], k = cl.portal.size();
+        for(size_t j=0; j < k; ++j)
+            if (j != i && cl.cost[i*k + j] < FLT_MAX)
+                relax(cl.portal[j], cost + cl.cost[i*k + j]);
+        if (c == cg && search.toGoal[i] < FLT_MAX)
+            relax(GOAL_ID, cost + search.toGoal[i]);
+        for(int e=0; e < 3; ++e) {
+            int g = nav.neighborOf(id, e);
+            if (g >= 0 && cluster[g] != c && portalIndex[g] >= 0 && nav.walkable(g))
+                relax(g, cost + nav.stepCost(id, g));
+        }
+    }
+    return FLT_MAX;
+}
+
+//
+// add the faces from waypoint from to waypoint to onto the end of path,
+// leaving out from if path already ends there. Waypoints in one cluster
+// are joined by a search inside it; others are neighbors across a border
+//
+float NavHierarchy::refine(unsigned int from, unsigned int to,
+                           std::vector<unsigned int> &path,
+                           NavMesh::Search &search) const
+{
+    if (path.empty() || path.back() != from)
+        path.push_back(from);
+    if (from == to) return 0;
+
+    if (cluster[from] != cluster[to]) {
+        path.push_back(to);
+        return nav.stepCost(from, to);
+    }
+
+    float cost = nav.findPath(from, to, search.segment, search,
+                              &cluster[0], cluster[from]);
+    if (cost < FLT_MAX)
+        path.insert(path.end(), search.segment.begin() + 1, search.segment.end());
+    return cost;
+}
+
+//
+// every face along the path from findWaypoints
+//
+float NavHierarchy::findPath(unsigned int start, unsigned int goal,
+                             std::vector<unsigned int> &path,
+                             NavMesh::Search &search) const
+{
+    path.clear();
+    float cost = findWaypoints(start, goal, search.waypoint, search);
+    if (cost == FLT_MAX) return cost;
+
+    path.push_back(start);
+    for(size_t i=0; i+1 < search.waypoint.size(); ++i)
+        refine(search.waypoint[i], search.waypoint[i+1], path, search);
+    return cost;
+}
+
+//
+// cost of each of count paths, split among threads, each with its own
+// Search, kept for the next batch
+//
+unsigned int NavHierarchy::findPaths(unsigned int count, const unsigned int *start,
+                                     const unsigned int *goal, float *cost,
+                                     std::vector<unsigned int> *path) const
+{
+    if (searches.size() < numthreads)
+        searches.resize(numthreads);
+
+    std::atomic<int> next(0);
+    std::atomic<unsigned int> found(0);
+    parallelFor(numthreads, numthreads, [&](int t) {
+        for(int i; (i = next++) < int(count); ) {
+            NavMesh::Search &search = searches[t];
+            cost[i] = path ? findPath(start[i], goal[i], path[i], search)
+                           : findWaypoints(start[i], goal[i], search.waypoint, search);
+            if (cost[i] < FLT_MAX) ++found;
+        }
+    });
+    return found;
+}
+
+//
+// clusters with any faces
+//
+unsigned int NavHierarchy::clusterCount() const
+{
+    unsigned int count = 0;
+    for(size_t c=0; c < clusters.size(); ++c)
+        count += clusterStart[c+1] > clusterStart[c];
+    return count;
+}
@@ -0,0 +1,108 @@
+// hierarchical paths over the faces of the terrain mesh
+#ifndef NavHierarchy_hpp
+#define NavHierarchy_hpp
+
+#include "NavMesh.hpp"
+#include <vector>
+
+// paths planned first between portals of clusters, then refined to faces
+// one cluster at a time, after Botea et al., "Near Optimal Hierarchical
+// Path-Finding". Faces are grouped into clusters by a square grid over
+// their centroids. Where two clusters meet, each stretch of walkable
+// border gets a portal face on both sides, and the cheapest cost between
+// every two portals of a cluster, staying inside it, is kept. A query
+// searches from its start and goal to the portals of their clusters, then
+// across the small graph of portals, and only the stretches of path
+// between consecutive portals are searched face by face.
+// Height changes rebuild just the clusters with changed faces, and the
+// costs of their neighbors, whose portals may have moved.
+class NavHierarchy {
+    // flow fields search the same portal graph
+    friend class FlowFields;
+
+// private types
+private:
+    // portal faces of one cluster, and the costs between them
+    struct Cluster {
+        std::vector<unsigned int> portal; // faces, in no particular order
+        std::vector<float> cost;          // cost[i*portals + j], i to j
+    };
+
+// private data
+private:
+    const NavMesh &nav;         // faces and costs, must outlive this
+    unsigned int numthreads;    // threads used by builds and batches
+
+    // square grid of clusters over the face centroids
+    Vec2f origin;               // low corner of the grid
+    float cellSize;             // world width of each cluster square
+    int gridX, gridY;           // clusters across and down
+
+    std::vector<int> cluster;   // cluster of each face
+    std::vector<unsigned int> clusterStart, clusterFace; // faces by cluster
+    std::vector<int> portalIndex; // index in its cluster's portals, or -1
+    std::vector<Cluster> clusters;
+    unsigned int numportals;    // total portal faces
+
+    mutable std::vector<NavMesh::Search> searches; // one per thread
+
+// private methods
+private:
+    // portal faces of cluster c from its borders with other clusters
+    void findPortals(int c);
+
+    // costs between the portals of cluster c, using search
+    void portalCosts(int c, NavMesh::Search &search);
+
+    // rebuild the listed clusters, portals first, then costs
+    void rebuild(const std::vector<int> &dirty);
+
+// public methods
+public:
+    // clusters, portals and costs for the current faces of nav
+    NavHierarchy(const NavMesh &nav);
+
+    // rebuild every cluster, after all heights changed
+    void update();
+
+    // rebuild clusters after the listed faces changed, with their
+    // neighbors' costs
+    void update(const std::vector<unsigned int> &faces);
+
+    // portals crossed by a cheapest path between them from face start to
+    // face goal, replacing the contents of waypoints, which start with
+    // start and end with goal. Returns the cost, or FLT_MAX if none
+    float findWaypoints(unsigned int start, unsigned int goal,
+                        std::vector<unsigned int> &waypoints,
+                        NavMesh::Search &search) const;
+
+    // add faces after from up to waypoint to, the next along a path from
+    // findWaypoints, to the end of path. Returns the cost of that stretch
+    float refine(unsigned int from, unsigned int to,
+                 std::vector<unsigned int> &path,
+                 NavMesh::Search &search) const;
+
+    // every face along the path from findWaypoints, replacing the
+    // contents of path. Returns the cost, or FLT_MAX if none
+    float findPath(unsigned int start, unsigned int goal,
+                   std::vector<unsigned int> &path,
+                   NavMesh::Search &search) const;
+
+    // cost of each of count paths, split among threads, with the faces
+    // of each path too if path is not null
+    // returns the number of paths found; others cost FLT_MAX
+    unsigned int findPaths(unsigned int count, const unsigned int *start,
+                           const unsigned int *goal, float *cost,
+                           std::vector<unsigned int> *path = 0) const;
+
+    // clusters with any faces
+    unsigned int clusterCount() const;
+
+    // total portal faces
+    unsigned int portals() const { return numportals; }
+
+    // threads used by builds and batches
+    unsigned int threads() const { return numthreads; }
+};
+
+#endif
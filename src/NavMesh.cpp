@@ -0,0 +1,301 @@
+// paths over the faces of the terrain mesh
+// A* after Hart, Nilsson and Raphael, "A Formal Basis for the Heuristic
+// Determination of Minimum Cost Paths"
+
+#include "NavMesh.hpp"
+#include "Parallel.hpp"
+#include "Vec.inl"
+
+#include <atomic>
+#include <algorithm>
+#include <functional>
+#include <float.h>
+#include <math.h>
+
+// faces handed to a thread at a time by update
+const int NAV_BLOCK = 4096;
+
+// extra cost per unit of distance for each unit of rise over run, so
+// paths go around hills when that is not much longer
+const float SLOPE_COST = 2;
+
+// steepest walkable rise over run at first, 45 degrees
+const float MAX_SLOPE = 1;
+
+// smallest node table, a power of two
+const unsigned int MIN_SLOTS = 1024;
+
+//
+// new search, emptying the arena and open list but keeping their storage
+// slots stamped by earlier searches count as empty
+//
+void NavMesh::Search::reset()
+{
+    node.clear();
+    open.clear();
+    numclosed = 0;
+    if (++stamp == 0) {
+        for(size_t s=0; s < slot.size(); ++s)
+            slot[s].stamp = 0;
+        stamp = 1;
+    }
+}
+
+//
+// index of the node for face, adding one if there is none
+// the table stays at most half full, and doubles when it would not be
+//
+unsigned int NavMesh::Search::find(unsigned int face)
+{
+    if (2*(node.size() + 1) > slot.size()) {
+        Slot empty = {0, 0};
+        slot.assign(std::max(2*slot.size(), size_t(MIN_SLOTS)), empty);
+        for(unsigned int n=0; n < node.size(); ++n) {
+            unsigned int s = (node[n].face * 2654435761u) & (slot.size() - 1);
+            while (slot[s].stamp == stamp)
+                s = (s + 1) & (slot.size() - 1);
+            slot[s].node = n;
+            slot[s].stamp = stamp;
+        }
+    }
+
+    unsigned int s = (face * 2654435761u) & (slot.size() - 1);
+    for(; slot[s].stamp == stamp; s = (s + 1) & (slot.size() - 1))
+        if (node[slot[s].node].face == face)
+            return slot[s].node;
+
+    Node fresh = {face, -1, FLT_MAX, false};
+    slot[s].node = node.size();
+    slot[s].stamp = stamp;
+    node.push_back(fresh);
+    return slot[s].node;
+}
+
+//
+// cost of face from the last search, FLT_MAX if not reached
+//
+float NavMesh::Search::cost(unsigned int face) const
+{
+    if (slot.empty()) return FLT_MAX;
+    unsigned int s = (face * 2654435761u) & (slot.size() - 1);
+    for(; slot[s].stamp == stamp; s = (s + 1) & (slot.size() - 1))
+        if (node[slot[s].node].face == face)
+            return node[slot[s].node].cost;
+    return FLT_MAX;
+}
+
+//
+// neighbors from the half-edges, and centroids and slopes from the
+// current heights
+//
+NavMesh::NavMesh(const Vec3f *vert, unsigned int numtri,
+                 const unsigned int (*indices)[3],
+                 unsigned int numedge, const HalfEdge *edge)
+    : numtri(numtri), vert(vert), indices(indices), maxSlope(MAX_SLOPE),
+      neighbor(3*numtri, -1), center(numtri), slope(numtri)
+{
+    numthreads = parallelThreads();
+
+    // each half-edge of a face gives the face across it
+    std::vector<unsigned char> count(numtri, 0);
+    for(unsigned int e=0; e < numedge; ++e) {
+        int f = edge[e].face;
+        if (f >= 0 && edge[e].pair)
+            neighbor[3*f + count[f]++] = edge[e].pair->face;
+    }
+
+    update();
+}
+
+//
+// centroid and slope of face f for the current heights
+//
+void NavMesh::updateFace(unsigned int f)
+{
+    Vec3f v0 = vert[indices[f][0]], v1 = vert[indices[f][1]];
+    Vec3f v2 = vert[indices[f][2]];
+    center[f] = (v0 + v1 + v2) / 3.f;
+
+    Vec3f N = (v1 - v0) ^ (v2 - v0);
+    float run = fabsf(N.z), rise = sqrtf(N.x*N.x + N.y*N.y);
+    slope[f] = run > 0 ? rise / run : FLT_MAX;
+}
+
+//
+// centroids and slopes for the current heights
+//
+void NavMesh::update()
+{
+    int blocks = (numtri + NAV_BLOCK - 1) / NAV_BLOCK;
+    parallelFor(blocks, numthreads, [&](int b) {
+        unsigned int end = std::min((b+1) * NAV_BLOCK, int(numtri));
+        for(unsigned int f = b * NAV_BLOCK; f < end; ++f)
+            updateFace(f);
+    });
+}
+
+//
+// centroids and slopes of just the listed faces
+//
+void NavMesh::update(const std::vector<unsigned int> &faces)
+{
+    for(size_t i=0; i < faces.size(); ++i)
+        updateFace(faces[i]);
+}
+
+//
+// cost of stepping from face f to neighboring face g: centroid distance,
+// raised by the average slope of the two
+//
+float NavMesh::stepCost(unsigned int f, unsigned int g) const
+{
+    return length(center[g] - center[f])
+         * (1 + SLOPE_COST * 0.5f * (slope[f] + slope[g]));
+}
+
+//
+// A* from start to goal. The estimate, straight-line distance between
+// centroids, is never more than the cost between two neighbors, so a node
+// is never reopened once closed, and stale open list entries are skipped.
+// With no goal, the estimate is 0, and the search runs until every face
+// it can reach is closed
+//
+float NavMesh::astar(unsigned int start, unsigned int goal, Search &search,
+                     std::vector<unsigned int> *path,
+                     const int *label, int within) const
+{
+    typedef std::pair<float, unsigned int> Entry;
+
+    search.reset();
+    if (path) path->clear();
+    if (! walkable(start) || (goal != NO_GOAL && ! walkable(goal)))
+        return FLT_MAX;
+
+    unsigned int n = search.find(start);
+    search.node[n].cost = 0;
+    search.open.push_back(Entry(0, n));
+    return expand(goal, search, path, label, within);
+}
+
+//
+// carry on a search from the nodes already open, closing the cheapest
+// estimate each time, until goal is closed or nothing is left open
+//
+float NavMesh::expand(unsigned int goal, Search &search,
+                      std::vector<unsigned int> *path,
+                      const int *label, int within) const
+{
+    typedef std::pair<float, unsigned int> Entry;
+    std::greater<Entry> later;
+    Vec3f target = goal != NO_GOAL ? center[goal] : vec3<float>(0, 0, 0);
+    float estimate = goal != NO_GOAL ? 1.f : 0.f;
+
+    while (! search.open.empty()) {
+        std::pop_heap(search.open.begin(), search.open.end(), later);
+        unsigned int n = search.open.back().second;
+        search.open.pop_back();
+        if (search.node[n].closed) continue;
+        search.node[n].closed = true;
+        ++search.numclosed;
+
+        unsigned int f = search.node[n].face;
+        float cost = search.node[n].cost;
+        if (f == goal) {
+            if (path) {
+                for(int i = n; i >= 0; i = search.node[i].parent)
+                    path->push_back(search.node[i].face);
+                std::reverse(path->begin(), path->end());
+            }
+            return cost;
+        }
+
+        for(int k=0; k < 3; ++k) {
+            int g = neighbor[3*f + k];
+            if (g < 0 || ! walkable(g) || (label && label[g] != within))
+                continue;
+
+            float c = cost + stepCost(f, g);
+            unsigned int m = search.find(g);
+            if (search.node[m].closed || c >= search.node[m].cost) continue;
+            search.node[m].cost = c;
+            search.node[m].parent = n;
+            search.open.push_back(Entry(c + estimate * length(target - center[g]), m));
+            std::push_heap(search.open.begin(), search.open.end(), later);
+        }
+    }
+    return FLT_MAX;
+}
+
+//
+// cheapest path from face start to face goal
+//
+float NavMesh::findPath(unsigned int start, unsigned int goal,
+                        std::vector<unsigned int> &path, Search &search) const
+{
+    return astar(start, goal, search, &path);
+}
+
+//
+// cheapest path from face start to face goal through faces labeled within
+//
+float NavMesh::findPath(unsigned int start, unsigned int goal,
+                        std::vector<unsigned int> &path, Search &search,
+                        const int *label, int within) const
+{
+    return astar(start, goal, search, &path, label, within);
+}
+
+//
+// cheapest costs from face start to every face labeled within
+//
+void NavMesh::spread(unsigned int start, Search &search,
+                     const int *label, int within) const
+{
+    astar(start, NO_GOAL, search, 0, label, within);
+}
+
+//
+// cheapest costs from the nearest of several start faces, counting the
+// cost each starts with
+//
+void NavMesh::spread(const unsigned int *start, const float *cost,
+                     unsigned int count, Search &search,
+                     const int *label, int within) const
+{
+    typedef std::pair<float, unsigned int> Entry;
+    std::greater<Entry> later;
+
+    search.reset();
+    for(unsigned int i=0; i < count; ++i) {
+        if (! walkable(start[i])) continue;
+        unsigned int n = search.find(start[i]);
+        if (cost[i] >= search.node[n].cost) continue;
+        search.node[n].cost = cost[i];
+        search.open.push_back(Entry(cost[i], n));
+        std::push_heap(search.open.begin(), search.open.end(), later);
+    }
+    expand(NO_GOAL, search, 0, label, within);
+}
+
+//
+// cost of each of count paths, split among threads
+// each thread takes the next query as it finishes the last, always with
+// its own Search, kept for the next batch
+//
+unsigned int NavMesh::findPaths(unsigned int count, const unsigned int *start,
+                                const unsigned int *goal, float *cost,
+                                std::vector<unsigned int> *path) const
+{
+    if (searches.size() < numthreads)
+        searches.resize(numthreads);
+
+    std::atomic<int> next(0);
+    std::atomic<unsigned int> found(0);
+    parallelFor(numthreads, numthreads, [&](int t) {
+        for(int i; (i = next++) < int(count); ) {
+            cost[i] = astar(start[i], goal[i], searches[t], path ? &path[i] : 0);
+            if (cost[i] < FLT_MAX) ++found;
+        }
+    });
+    return found;
+}
@@ -0,0 +1,170 @@
+// paths over the faces of the terrain mesh
+#ifndef NavMesh_hpp
+#define NavMesh_hpp
+
+#include "Vec.hpp"
+#include "HalfEdge.hpp"
+#include <vector>
+
+// A* over the graph of mesh faces, where faces sharing an edge are
+// neighbors. Stepping between faces costs the distance between their
+// centroids, raised by the slope of the two faces, and faces steeper than
+// the walkable slope are never entered. The straight-line distance to
+// the goal never overestimates that, so paths found are the cheapest.
+// Searches keep their nodes in a reusable Search, so once it has grown to
+// fit, queries do not allocate, and batches run one Search per thread.
+class NavMesh {
+// public types
+public:
+    // state for one search at a time. Nodes come from an arena that is
+    // emptied, not freed, between searches, and are found by face through
+    // an open-addressed table. Slots are stamped with the search that
+    // filled them, so the table only needs clearing when stamps wrap
+    class Search {
+        friend class NavMesh;
+        friend class NavHierarchy;
+        friend class FlowFields;
+
+        struct Node {
+            unsigned int face;  // face this node stands for
+            int parent;         // node reached from, -1 for the start
+            float cost;         // cheapest cost found from the start
+            bool closed;        // cost is final
+        };
+
+        struct Slot {
+            unsigned int node;  // index in the node arena
+            unsigned int stamp; // search that filled the slot
+        };
+
+        std::vector<Node> node;         // nodes of the current search
+        std::vector<Slot> slot;         // node index by hash of face
+        std::vector<std::pair<float, unsigned int> > open; // heap by estimate
+        unsigned int stamp;             // current search, 0 before the first
+        unsigned int numclosed;         // nodes closed so far
+
+        // kept for hierarchical searches: costs from the start to the
+        // portals of its cluster and from them to the goal, portals along
+        // the path, and faces of one stretch of it
+        std::vector<float> fromStart, toGoal;
+        std::vector<unsigned int> waypoint, segment;
+
+        // new search, emptying the arena and open list but keeping their
+        // storage
+        void reset();
+
+        // index of the node for face, adding one if there is none
+        unsigned int find(unsigned int face);
+
+    public:
+        Search() : stamp(0), numclosed(0) {}
+
+        // nodes closed by the last search
+        unsigned int expanded() const { return numclosed; }
+
+        // cost of face from the last search, FLT_MAX if not reached
+        float cost(unsigned int face) const;
+    };
+
+    // goal for a search that reaches every face it can
+    enum {NO_GOAL = ~0u};
+
+// private data
+private:
+    unsigned int numtri;        // total faces
+    const Vec3f *vert;          // vertex positions, heights may change
+    const unsigned int (*indices)[3]; // 3 vertex indices per face
+    unsigned int numthreads;    // threads used by batches and updates
+    float maxSlope;             // steepest walkable rise over run
+
+    std::vector<int> neighbor;  // 3 per face, across each edge, -1 at border
+    std::vector<Vec3f> center;  // centroid of each face
+    std::vector<float> slope;   // rise over run of each face
+
+    mutable std::vector<Search> searches; // one per thread for batches
+
+// private methods
+private:
+    // centroid and slope of face f for the current heights
+    void updateFace(unsigned int f);
+
+    // A* from start to goal, with the faces along the path into path if
+    // it is not null, through faces with label equal to within if label
+    // is not null. Returns the cost, or FLT_MAX if there is no path
+    float astar(unsigned int start, unsigned int goal, Search &search,
+                std::vector<unsigned int> *path,
+                const int *label = 0, int within = 0) const;
+
+    // carry on a search from the nodes already open, as for astar
+    float expand(unsigned int goal, Search &search,
+                 std::vector<unsigned int> *path,
+                 const int *label, int within) const;
+
+// public methods
+public:
+    // neighbors from the half-edges, and centroids and slopes from the
+    // current heights
+    NavMesh(const Vec3f *vert, unsigned int numtri,
+            const unsigned int (*indices)[3],
+            unsigned int numedge, const HalfEdge *edge);
+
+    // centroids and slopes for the current heights
+    void update();
+
+    // centroids and slopes of just the listed faces
+    void update(const std::vector<unsigned int> &faces);
+
+    // set the steepest walkable rise over run
+    void setMaxSlope(float s) { maxSlope = s; }
+
+    // true if face f is not too steep to walk on
+    bool walkable(unsigned int f) const { return slope[f] <= maxSlope; }
+
+    // centroid of face f
+    Vec3f centroid(unsigned int f) const { return center[f]; }
+
+    // 3 vertex indices of face f
+    const unsigned int *corners(unsigned int f) const { return indices[f]; }
+
+    // face across edge k of face f, -1 at the border
+    int neighborOf(unsigned int f, int k) const { return neighbor[3*f + k]; }
+
+    // cost of stepping from face f to neighboring face g
+    float stepCost(unsigned int f, unsigned int g) const;
+
+    // total faces
+    unsigned int faces() const { return numtri; }
+
+    // cheapest path from face start to face goal, using search for the
+    // nodes. Faces along it replace the contents of path, from start to
+    // goal. Returns the cost, or FLT_MAX with an empty path if none
+    float findPath(unsigned int start, unsigned int goal,
+                   std::vector<unsigned int> &path, Search &search) const;
+
+    // findPath through only the faces whose label is within
+    float findPath(unsigned int start, unsigned int goal,
+                   std::vector<unsigned int> &path, Search &search,
+                   const int *label, int within) const;
+
+    // cheapest costs from face start to every face whose label is within,
+    // left in search for Search::cost
+    void spread(unsigned int start, Search &search,
+                const int *label, int within) const;
+
+    // spread from count faces at once, each starting at the given cost
+    void spread(const unsigned int *start, const float *cost,
+                unsigned int count, Search &search,
+                const int *label, int within) const;
+
+    // cost of each of count paths, split among threads, with the faces
+    // of each path too if path is not null
+    // returns the number of paths found; others cost FLT_MAX
+    unsigned int findPaths(unsigned int count, const unsigned int *start,
+                           const unsigned int *goal, float *cost,
+                           std::vector<unsigned int> *path = 0) const;
+
+    // threads used by batches and updates
+    unsigned int threads() const { return numthreads; }
+};
+
+#endif
@@ -0,0 +1,36 @@
+// simple parallel loop over worker threads
+#ifndef Parallel_hpp
+#define Parallel_hpp
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+// threads to use for parallel loops: one per core
+inline unsigned int parallelThreads()
+{
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+// run f(i) for i from 0 to count-1 across the given number of threads,
+// each taking the next i as it finishes the last, and wait for all
+template <class F>
+void parallelFor(int count, unsigned int threads, F f)
+{
+    std::atomic<int> next(0);
+    std::vector<std::thread> workers;
+    for(unsigned int t=1; t < threads; ++t)
+        workers.push_back(std::thread([&]() {
+            for(int i; (i = next++) < count; )
+                f(i);
+        }));
+
+    // this thread works too
+    for(int i; (i = next++) < count; )
+        f(i);
+    for(size_t t=0; t < workers.size(); ++t)
+        workers[t].join();
+}
+
+#endif
@@ -0,0 +1,421 @@
+// debris, rain and dust falling onto the terrain
+
+#include "Particles.hpp"
+#include "Terrain.hpp"
+#include "Scene.hpp"
+#include "AppContext.hpp"
+#include "Parallel.hpp"
+#include "Simd.hpp"
+#include "Vec.inl"
+
+#include <GL/glew.h>
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+
+#ifndef F_PI
+#define F_PI 3.1415926f
+#endif
+
+// particles in each block of the pool, a multiple of four
+const unsigned int PARTICLE_BLOCK = 1024;
+
+// seconds per step, and most steps run by one update
+const float STEP = 1.f / 60;
+const int MAX_STEPS = 4;
+
+// downward acceleration, world units per second squared
+const float GRAVITY = 20;
+
+// for each kind: share of gravity felt, fraction of speed lost per second
+// in the air, and on touching the ground, the share of speed into it
+// bounced back and of speed along it lost
+const float KIND_GRAVITY[Particles::NUM_KINDS] = {1, 1, 0.05f};
+const float KIND_DRAG[Particles::NUM_KINDS] = {0.1f, 0, 1};
+const float KIND_BOUNCE[Particles::NUM_KINDS] = {0.4f, 0, 0};
+const float KIND_FRICTION[Particles::NUM_KINDS] = {0.3f, 0, 0.2f};
+
+// for each kind, whether it ends on touching the ground
+const bool KIND_LANDS[Particles::NUM_KINDS] = {false, true, false};
+
+// for each kind: world width and height drawn, and color and opacity
+const float KIND_SIZE[Particles::NUM_KINDS][2] = {{0.3f, 0.3f}, {0.05f, 0.8f}, {2, 2}};
+const float KIND_COLOR[Particles::NUM_KINDS][4] = {
+    {.35f, .28f, .2f, 1}, {.6f, .7f, .9f, .6f}, {.75f, .68f, .55f, .3f}};
+
+//
+// all state for the pool allocated here, once
+//
+Particles::Particles(Terrain &terrain, unsigned int capacity)
+    : terrain(terrain),
+      numblocks((capacity + PARTICLE_BLOCK - 1) / PARTICLE_BLOCK),
+      numthreads(parallelThreads()), usedBlocks(0),
+      varrayID(0), shaderID(0)
+{
+    unsigned int size = numblocks * PARTICLE_BLOCK;
+    px.resize(size); py.resize(size); pz.resize(size);
+    vx.resize(size); vy.resize(size); vz.resize(size);
+    life.resize(size);
+    face.assign(size, -1);
+
+    alive.assign(numblocks, 0);
+    blockSource.assign(numblocks, -1);
+    spawn.assign(numblocks, 0);
+    seed.resize(numblocks);
+    for(unsigned int b=0; b < numblocks; ++b)
+        seed[b] = (b + 1) * 2654435761u;
+}
+
+//
+// clean up GL objects, if ever drawn
+//
+Particles::~Particles()
+{
+    if (! shaderID) return;
+    glDeleteShader(shaderParts[0].id);
+    glDeleteShader(shaderParts[1].id);
+    glDeleteProgram(shaderID);
+    glDeleteTextures(1, &textureID);
+    glDeleteBuffers(1, &bufferID);
+    glDeleteVertexArrays(1, &varrayID);
+}
+
+//
+// give the emitter the next free blocks of the pool
+//
+int Particles::addEmitter(const Emitter &emitter, unsigned int capacity)
+{
+    unsigned int blocks = std::max((capacity + PARTICLE_BLOCK - 1) / PARTICLE_BLOCK, 1u);
+    if (usedBlocks + blocks > numblocks) return -1;
+
+    Source src = {emitter, usedBlocks, blocks, 0, 0};
+    for(unsigned int b = usedBlocks; b < usedBlocks + blocks; ++b)
+        blockSource[b] = sources.size();
+    usedBlocks += blocks;
+    sources.push_back(src);
+    return sources.size() - 1;
+}
+
+//
+// move emitter e's starting area
+//
+void Particles::moveEmitter(int e, Vec3f center)
+{
+    sources[e].emit.center = center;
+}
+
+//
+// particles to start from emitter e next step, on top of its rate
+//
+void Particles::burst(int e, unsigned int count)
+{
+    sources[e].pending += count;
+}
+
+//
+// live particles in every block
+//
+unsigned int Particles::count() const
+{
+    unsigned int total = 0;
+    for(unsigned int b=0; b < usedBlocks; ++b)
+        total += alive[b];
+    return total;
+}
+
+//
+// room in the pool, whether given to emitters or not
+//
+unsigned int Particles::capacity() const
+{
+    return numblocks * PARTICLE_BLOCK;
+}
+
+//
+// start new particles in the free space at the end of block b, then move
+// every live one: fall and slow in the air, find the ground, and meet it.
+// Particles below the ground are put back on it, and lose the part of
+// their velocity into it, bounced back in part, and some of the rest.
+// Then those ended, landed or off the terrain are replaced by the last
+// live ones. The arrays run on to the end of the block, so the last group
+// of four may take in places past the live particles, and those are
+// moved too, harmlessly, as they are never read
+//
+void Particles::stepBlock(unsigned int b, float dt)
+{
+    const Emitter &e = sources[blockSource[b]].emit;
+    unsigned int base = b * PARTICLE_BLOCK;
+    unsigned int n = alive[b];
+
+    unsigned int &state = seed[b];
+    auto random = [&]() {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) / float(1 << 24);
+    };
+
+    unsigned int end = std::min(n + spawn[b], PARTICLE_BLOCK);
+    for(unsigned int i = base + n; i < base + end; ++i) {
+        float r = e.radius * sqrtf(random()), angle = 2 * F_PI * random();
+        px[i] = e.center.x + r * cosf(angle);
+        py[i] = e.center.y + r * sinf(angle);
+        pz[i] = e.center.z + e.height * random();
+        vx[i] = e.velocity.x + e.spread * (2 * random() - 1);
+        vy[i] = e.velocity.y + e.spread * (2 * random() - 1);
+        vz[i] = e.velocity.z + e.spread * (2 * random() - 1);
+        life[i] = e.life;
+        face[i] = -1;
+    }
+    n = end;
+    alive[b] = n;
+    if (! n) return;
+
+    float *x = &px[base], *y = &py[base], *z = &pz[base];
+    float *u = &vx[base], *v = &vy[base], *w = &vz[base];
+    float *left = &life[base];
+    int *under = &face[base];
+
+    float fall = -GRAVITY * KIND_GRAVITY[e.kind] * dt;
+    float keep = std::max(0.f, 1 - KIND_DRAG[e.kind] * dt);
+#if USE_SSE
+    __m128 dt4 = _mm_set1_ps(dt), fall4 = _mm_set1_ps(fall);
+    __m128 keep4 = _mm_set1_ps(keep);
+    for(unsigned int i=0; i < n; i += 4) {
+        __m128 U = _mm_mul_ps(_mm_loadu_ps(u + i), keep4);
+        __m128 V = _mm_mul_ps(_mm_loadu_ps(v + i), keep4);
+        __m128 W = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(w + i), fall4), keep4);
+        _mm_storeu_ps(u + i, U);
+        _mm_storeu_ps(v + i, V);
+        _mm_storeu_ps(w + i, W);
+        _mm_storeu_ps(x + i, _mm_add_ps(_mm_loadu_ps(x + i), _mm_mul_ps(U, dt4)));
+        _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(V, dt4)));
+        _mm_storeu_ps(z + i, _mm_add_ps(_mm_loadu_ps(z + i), _mm_mul_ps(W, dt4)));
+        _mm_storeu_ps(left + i, _mm_sub_ps(_mm_loadu_ps(left + i), dt4));
+    }
+#else
+    for(unsigned int i=0; i < n; ++i) {
+        u[i] *= keep;
+        v[i] *= keep;
+        w[i] = (w[i] + fall) * keep;
+        x[i] += u[i] * dt;
+        y[i] += v[i] * dt;
+        z[i] += w[i] * dt;
+        left[i] -= dt;
+    }
+#endif
+
+    // ground under each. Those off the terrain end, and like the places
+    // past the last live one, get ground far below so they never meet it
+    float ground[PARTICLE_BLOCK], nx[PARTICLE_BLOCK], ny[PARTICLE_BLOCK];
+    float nz[PARTICLE_BLOCK];
+    Terrain::SurfaceBatch batch = {n, x, y, ground, nx, ny, nz, under};
+    bool off = terrain.surfaceQuery(batch) < n;
+    unsigned int padded = std::min((n + 3) & ~3u, PARTICLE_BLOCK);
+    for(unsigned int i = off ? 0 : n; i < padded; ++i) {
+        if (i < n && under[i] >= 0) continue;
+        ground[i] = -FLT_MAX;
+        nx[i] = ny[i] = 0;
+        nz[i] = 1;
+        if (i < n) left[i] = 0;
+    }
+
+    float slide = 1 - KIND_FRICTION[e.kind], bounce = KIND_BOUNCE[e.kind];
+    bool lands = KIND_LANDS[e.kind];
+#if USE_SSE
+    __m128 zero = _mm_setzero_ps();
+    __m128 slide4 = _mm_set1_ps(slide), turn4 = _mm_set1_ps(slide + bounce);
+    __m128 lands4 = lands ? _mm_cmpeq_ps(zero, zero) : zero;
+    for(unsigned int i=0; i < n; i += 4) {
+        __m128 Z = _mm_loadu_ps(z + i), G = _mm_loadu_ps(ground + i);
+        __m128 below = _mm_cmplt_ps(Z, G);
+        if (! _mm_movemask_ps(below)) continue;
+
+        // unit normals, to the precision of the reciprocal square root
+        __m128 Nx = _mm_loadu_ps(nx + i), Ny = _mm_loadu_ps(ny + i);
+        __m128 Nz = _mm_loadu_ps(nz + i);
+        __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(Nx, Nx), _mm_mul_ps(Ny, Ny)),
+                                 _mm_mul_ps(Nz, Nz));
+        __m128 inv = _mm_rsqrt_ps(len2);
+        Nx = _mm_mul_ps(Nx, inv);
+        Ny = _mm_mul_ps(Ny, inv);
+        Nz = _mm_mul_ps(Nz, inv);
+
+        // V*slide - (V.N)(slide + bounce)N keeps slide of the part along
+        // the ground and turns the part into it back out, times bounce
+        __m128 U = _mm_loadu_ps(u + i), V = _mm_loadu_ps(v + i);
+        __m128 W = _mm_loadu_ps(w + i);
+        __m128 into = _mm_add_ps(_mm_add_ps(_mm_mul_ps(U, Nx), _mm_mul_ps(V, Ny)),
+                                 _mm_mul_ps(W, Nz));
+        __m128 hit = _mm_and_ps(below, _mm_cmplt_ps(into, zero));
+        __m128 k = _mm_mul_ps(into, turn4);
+        _mm_storeu_ps(u + i, select(hit, _mm_sub_ps(_mm_mul_ps(U, slide4), _mm_mul_ps(k, Nx)), U));
+        _mm_storeu_ps(v + i, select(hit, _mm_sub_ps(_mm_mul_ps(V, slide4), _mm_mul_ps(k, Ny)), V));
+        _mm_storeu_ps(w + i, select(hit, _mm_sub_ps(_mm_mul_ps(W, slide4), _mm_mul_ps(k, Nz)), W));
+        _mm_storeu_ps(z + i, select(below, G, Z));
+        __m128 L = _mm_loadu_ps(left + i);
+        _mm_storeu_ps(left + i, select(_mm_and_ps(below, lands4), zero, L));
+    }
+#else
+    for(unsigned int i=0; i < n; ++i) {
+        if (z[i] >= ground[i]) continue;
+        Vec3f N = normalize(vec3<float>(nx[i], ny[i], nz[i]));
+        float into = u[i] * N.x + v[i] * N.y + w[i] * N.z;
+        if (into < 0) {
+            float k = into * (slide + bounce);
+            u[i] = u[i] * slide - k * N.x;
+            v[i] = v[i] * slide - k * N.y;
+            w[i] = w[i] * slide - k * N.z;
+        }
+        z[i] = ground[i];
+        if (lands) left[i] = 0;
+    }
+#endif
+
+    // replace ended particles by the last live one
+    for(unsigned int i=0; i < n; ) {
+        if (left[i] > 0) {
+            ++i;
+            continue;
+        }
+        --n;
+        x[i] = x[n]; y[i] = y[n]; z[i] = z[n];
+        u[i] = u[n]; v[i] = v[n]; w[i] = w[n];
+        left[i] = left[n];
+        under[i] = under[n];
+    }
+    alive[b] = n;
+}
+
+//
+// one fixed step: share each emitter's new particles among its blocks,
+// then step every block
+//
+void Particles::step()
+{
+    for(size_t s=0; s < sources.size(); ++s) {
+        Source &src = sources[s];
+        float want = src.emit.rate * STEP + src.carry;
+        unsigned int total = unsigned(want);
+        src.carry = want - total;
+        total += src.pending;
+        src.pending = 0;
+        for(unsigned int j=0; j < src.numblocks; ++j)
+            spawn[src.firstBlock + j] = total / src.numblocks
+                                      + (j < total % src.numblocks);
+    }
+
+    parallelFor(usedBlocks, numthreads, [&](int b) {
+        stepBlock(b, STEP);
+    });
+}
+
+//
+// fixed steps for the time since the last update
+//
+int Particles::update(double now)
+{
+    return clock.update(now, STEP, MAX_STEPS, [&]() { step(); });
+}
+
+//
+// empty vertex array, since corners come from the vertex number, the
+// particle buffer, and shaders
+//
+void Particles::buildGL()
+{
+    glGenVertexArrays(1, &varrayID);
+    glGenBuffers(1, &bufferID);
+    glGenTextures(1, &textureID);
+
+    packed.resize(4 * capacity());
+    packStart.resize(numblocks + 1);
+    glBindBuffer(GL_TEXTURE_BUFFER, bufferID);
+    glBufferData(GL_TEXTURE_BUFFER, packed.size() * sizeof(float), 0,
+            GL_STREAM_DRAW);
+    glBindTexture(GL_TEXTURE_BUFFER, textureID);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, bufferID);
+
+    shaderParts[0].id = glCreateShader(GL_VERTEX_SHADER);
+    shaderParts[0].file = "particles.vert";
+    shaderParts[1].id = glCreateShader(GL_FRAGMENT_SHADER);
+    shaderParts[1].file = "particles.frag";
+    shaderID = glCreateProgram();
+    updateShaders();
+}
+
+//
+// load (or replace) particle shaders
+//
+void Particles::updateShaders()
+{
+    if (! shaderID) return;
+    loadShaders(shaderID, sizeof(shaderParts)/sizeof(*shaderParts),
+            shaderParts);
+    glUseProgram(shaderID);
+
+    // (re)connect view and projection matrices
+    glUniformBlockBinding(shaderID,
+            glGetUniformBlockIndex(shaderID,"SceneData"),
+            AppContext::SCENE_UNIFORMS);
+    glUniform1i(glGetUniformLocation(shaderID, "particleTexture"), 0);
+    firstUniform = glGetUniformLocation(shaderID, "first");
+    sizeUniform = glGetUniformLocation(shaderID, "size");
+    colorUniform = glGetUniformLocation(shaderID, "color");
+}
+
+//
+// pack each block's live particles after those of the blocks before, in
+// parallel, with how much life each has left, and send them. Emitters'
+// blocks are in order, so each emitter's particles are together, and are
+// drawn with one call, blended over the scene
+//
+void Particles::draw(Scene &scene)
+{
+    if (! shaderID) buildGL();
+
+    packStart[0] = 0;
+    for(unsigned int b=0; b < usedBlocks; ++b)
+        packStart[b+1] = packStart[b] + alive[b];
+    unsigned int total = packStart[usedBlocks];
+    parallelFor(usedBlocks, numthreads, [&](int b) {
+        unsigned int base = b * PARTICLE_BLOCK;
+        float *out = &packed[4 * packStart[b]];
+        float full = sources[blockSource[b]].emit.life;
+        for(unsigned int i = base; i < base + alive[b]; ++i, out += 4) {
+            out[0] = px[i];
+            out[1] = py[i];
+            out[2] = pz[i];
+            out[3] = life[i] / full;
+        }
+    });
+    if (! total) return;
+
+    // orphan last frame's copy rather than wait for it to be drawn
+    glBindBuffer(GL_TEXTURE_BUFFER, bufferID);
+    glBufferData(GL_TEXTURE_BUFFER, packed.size() * sizeof(float), 0,
+            GL_STREAM_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, 4 * total * sizeof(float), &packed[0]);
+
+    glUseProgram(shaderID);
+    glBindVertexArray(varrayID);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, textureID);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glDepthMask(GL_FALSE);
+
+    for(size_t s=0; s < sources.size(); ++s) {
+        const Source &src = sources[s];
+        unsigned int first = packStart[src.firstBlock];
+        unsigned int count = packStart[src.firstBlock + src.numblocks] - first;
+        if (! count) continue;
+
+        glUniform1i(firstUniform, first);
+        glUniform2fv(sizeUniform, 1, KIND_SIZE[src.emit.kind]);
+        glUniform4fv(colorUniform, 1, KIND_COLOR[src.emit.kind]);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+        scene.stats.triangles += 2 * count;
+    }
+
+    glDepthMask(GL_TRUE);
+    glDisable(GL_BLEND);
+}
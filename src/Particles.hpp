@@ -0,0 +1,140 @@
+// debris, rain and dust falling onto the terrain
+#ifndef Particles_hpp
+#define Particles_hpp
+
+#include "Shader.hpp"
+#include "FixedStep.hpp"
+#include "Vec.hpp"
+#include <vector>
+
+class Terrain;
+class Scene;
+
+// particles kept as separate arrays for each part of their state, in a
+// pool of fixed blocks allocated once. Each emitter owns a run of blocks,
+// and every block holds its live particles packed at its start, so
+// particles that end are replaced by the last live one in their block,
+// and new ones fill the free space at its end, with no allocation.
+// Steps are a fixed time apart, and run across threads a block at a time:
+// each block starts its share of its emitter's new particles, moves them
+// all four at a time with SSE, finds the ground under them in one batched
+// surface query, then bounces, slides or ends those below it, again four
+// at a time. Blocks share nothing, and each has its own random numbers,
+// so the order blocks are done in never matters.
+// Particles are drawn as camera-facing squares, one instanced draw per
+// emitter, reading positions through a buffer texture.
+class Particles {
+// public types
+public:
+    // kinds of particle, each moving and drawn its own way
+    enum Kind {DEBRIS, RAIN, DUST, NUM_KINDS};
+
+    // where and how fast an emitter starts particles
+    struct Emitter {
+        Kind kind;
+        Vec3f center;           // center of the base of the starting area
+        float radius;           // xy radius of the starting area
+        float height;           // height of the starting area above center
+        Vec3f velocity;         // starting velocity
+        float spread;           // most random speed added on each axis
+        float rate;             // particles started per second
+        float life;             // seconds each lasts
+    };
+
+// private types
+private:
+    // an emitter with the blocks it owns
+    struct Source {
+        Emitter emit;
+        unsigned int firstBlock, numblocks;
+        float carry;            // fraction of a particle not yet started
+        unsigned int pending;   // particles to start at once next step
+    };
+
+// private data
+private:
+    Terrain &terrain;           // surface landed on, must outlive this
+    unsigned int numblocks;     // blocks in the pool
+    unsigned int numthreads;    // threads used by each step
+
+    // particle state, one entry per place in the pool
+    std::vector<float> px, py, pz; // position
+    std::vector<float> vx, vy, vz; // velocity
+    std::vector<float> life;    // seconds left
+    std::vector<int> face;      // face under each, -1 if not known
+
+    // by block: live particles, owning source, random state, and new
+    // particles to start this step
+    std::vector<unsigned int> alive;
+    std::vector<int> blockSource;
+    std::vector<unsigned int> seed;
+    std::vector<unsigned int> spawn;
+    unsigned int usedBlocks;    // blocks given to emitters so far
+
+    std::vector<Source> sources;
+
+    FixedStep clock;            // steps run to keep up with the time
+
+    // GL vertex array, buffer and shaders, made on first draw. Each
+    // frame's live particles are packed, four floats each, into a buffer
+    // texture the vertex shader reads by instance
+    unsigned int varrayID;
+    unsigned int bufferID;
+    unsigned int textureID;
+    unsigned int shaderID;      // 0 until first drawn
+    int firstUniform, sizeUniform, colorUniform; // per-emitter locations
+    ShaderInfo shaderParts[2];
+    std::vector<float> packed;  // live particles sent for drawing
+    std::vector<unsigned int> packStart; // where each block's are packed
+
+// private methods
+private:
+    // start block b's new particles, then move them all dt seconds
+    void stepBlock(unsigned int b, float dt);
+
+    // vertex array, buffer and shaders
+    void buildGL();
+
+// public methods
+public:
+    // pool with room for at least capacity particles, and no emitters
+    Particles(Terrain &terrain, unsigned int capacity);
+
+    // clean up
+    ~Particles();
+
+    // emitter with room for capacity particles from the pool. Returns its
+    // index, or -1 if the pool has too little room left
+    int addEmitter(const Emitter &emitter, unsigned int capacity);
+
+    // move emitter e's starting area to center
+    void moveEmitter(int e, Vec3f center);
+
+    // start count more particles from emitter e in the next step, as far
+    // as it has room
+    void burst(int e, unsigned int count);
+
+    // run as many fixed steps as fit the time since the last update,
+    // up to a few. Returns the number run
+    int update(double now);
+
+    // run one fixed step
+    void step();
+
+    // load/reload shaders
+    void updateShaders();
+
+    // draw every live particle, one instanced draw call per emitter
+    void draw(Scene &scene);
+
+    // live particles
+    unsigned int count() const;
+
+    // room in the pool
+    unsigned int capacity() const;
+
+    // threads used by each step
+    unsigned int threads() const { return numthreads; }
+};
+
+#endif
@@ -0,0 +1,528 @@
+// trees, rocks and bushes scattered over the terrain
+// Poisson-disk sampling after Bridson, "Fast Poisson Disk Sampling in
+// Arbitrary Dimensions", with candidates placed as in Roberts, "An improved
+// version of Bridson's algorithm for Poisson disc sampling", run in
+// parallel by tile after Wei, "Parallel Poisson Disk Sampling"
+
+#include "Scatter.hpp"
+#include "Terrain.hpp"
+#include "Scene.hpp"
+#include "AppContext.hpp"
+#include "Parallel.hpp"
+#include "Vec.inl"
+
+#include <GL/glew.h>
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+
+#ifndef F_PI
+#define F_PI 3.1415926f
+#endif
+
+// world distance kept between any two points
+const float SPACING = 0.32f;
+
+// world size of each square tile
+const float TILE_SIZE = 32;
+
+// candidates tried around a point before it is retired, and random
+// starting points tried in each tile
+const int TRIES = 12;
+const int SEEDS = 4;
+
+// points in a square this many across sample heights to find tiles that
+// miss the terrain entirely
+const int PROBES = 9;
+
+// surface normal z below which nothing stays, and below which only rocks do
+const float CLIFF_UPRIGHT = 0.6f;
+const float ROCKY_UPRIGHT = 0.8f;
+
+// fraction of the height range above which only rocks stay, and nothing
+const float TREE_LINE = 0.7f;
+const float SNOW_LINE = 0.9f;
+
+// chance of a point becoming a tree or a rock on level ground, and of
+// staying as a rock on steep or high ground
+const float TREE_SHARE = 0.03f;
+const float ROCK_SHARE = 0.05f;
+const float ROCKY_SHARE = 0.3f;
+
+// for each kind: smallest and largest world size, color, and how far it
+// leans with the ground, from 0 for upright to 1 for along the normal
+const float KIND_SIZE[Scatter::NUM_KINDS][2] = {{3, 6}, {0.2f, 0.6f}, {0.3f, 0.7f}};
+const float KIND_COLOR[Scatter::NUM_KINDS][3] = {
+    {.15f, .35f, .12f}, {.45f, .43f, .4f}, {.35f, .5f, .15f}};
+const float KIND_LEAN[Scatter::NUM_KINDS] = {0, 1, 0.6f};
+
+// floats stored for each instance
+const int INSTANCE_FLOATS = 8;
+
+// tiles sent to the GPU in one frame
+const int SEND_TILES = 16;
+
+// true if any part of box lo..hi may be inside the frustum planes
+static bool boxInFrustum(const Vec4f plane[6], Vec3f lo, Vec3f hi)
+{
+    for(int p=0; p < 6; ++p) {
+        Vec4f P = plane[p];
+        if (P.x * (P.x > 0 ? hi.x : lo.x) +
+            P.y * (P.y > 0 ? hi.y : lo.y) +
+            P.z * (P.z > 0 ? hi.z : lo.z) + P.w < 0)
+            return false;
+    }
+    return true;
+}
+
+//
+// sample every tile, a phase at a time, then find the surface under each
+// tile's points, keep those on gentle enough ground, and choose what each
+// becomes. The same objects come out every time for the same terrain
+//
+Scatter::Scatter(Terrain &terrain)
+    : terrain(terrain), numthreads(parallelThreads()), numpoints(0),
+      varrayID(0), waiting(false), shaderID(0)
+{
+    Vec3f size = terrain.size();
+    tilesX = unsigned(ceilf(2 * size.x / TILE_SIZE));
+    tilesY = unsigned(ceilf(2 * size.y / TILE_SIZE));
+    origin = -0.5f * TILE_SIZE * vec2<float>(tilesX, tilesY);
+    unsigned int numtiles = tilesX * tilesY;
+
+    // tiles touching the terrain, from a square of probes over each
+    std::vector<unsigned char> used(numtiles, 0);
+    parallelFor(numtiles, numthreads, [&](int t) {
+        float px[PROBES * PROBES], py[PROBES * PROBES];
+        int pface[PROBES * PROBES];
+        Vec2f corner = origin + TILE_SIZE * vec2<float>(t % tilesX, t / tilesX);
+        for(int i=0; i < PROBES * PROBES; ++i) {
+            px[i] = corner.x + TILE_SIZE * (i % PROBES) / (PROBES - 1);
+            py[i] = corner.y + TILE_SIZE * (i / PROBES) / (PROBES - 1);
+            pface[i] = -1;
+        }
+        Terrain::SurfaceBatch batch = {PROBES * PROBES, px, py, 0, 0, 0, 0,
+                                       pface};
+        used[t] = terrain.surfaceQuery(batch) > 0;
+    });
+
+    // tiles in phase p have x parity p&1 and y parity p>>1
+    std::vector<std::vector<float> > x(numtiles), y(numtiles);
+    std::vector<std::vector<int> > grid(numtiles);
+    std::vector<unsigned char> done(numtiles, 0);
+    std::vector<unsigned int> phase;
+    for(unsigned int p=0; p < 4; ++p) {
+        phase.clear();
+        for(unsigned int t=0; t < numtiles; ++t)
+            if (used[t] && ((t % tilesX) & 1) + 2 * ((t / tilesX) & 1) == p)
+                phase.push_back(t);
+        parallelFor(phase.size(), numthreads, [&](int i) {
+            sampleTile(phase[i], &x[0], &y[0], &grid[0], done);
+        });
+        for(size_t i=0; i < phase.size(); ++i)
+            done[phase[i]] = 1;
+    }
+    std::vector<std::vector<int> >().swap(grid);
+
+    // surface under each point, then the height range of those on it
+    std::vector<std::vector<float> > z(numtiles), nx(numtiles), ny(numtiles),
+        nz(numtiles);
+    std::vector<std::vector<int> > face(numtiles);
+    std::vector<float> low(numtiles, FLT_MAX), high(numtiles, -FLT_MAX);
+    parallelFor(numtiles, numthreads, [&](int t) {
+        unsigned int count = x[t].size();
+        if (! count) return;
+        z[t].resize(count); nx[t].resize(count); ny[t].resize(count);
+        nz[t].resize(count); face[t].assign(count, -1);
+        Terrain::SurfaceBatch batch = {count, &x[t][0], &y[t][0], &z[t][0],
+                                       &nx[t][0], &ny[t][0], &nz[t][0],
+                                       &face[t][0]};
+        terrain.surfaceQuery(batch);
+        for(unsigned int k=0; k < count; ++k) {
+            if (face[t][k] < 0) continue;
+            low[t] = std::min(low[t], z[t][k]);
+            high[t] = std::max(high[t], z[t][k]);
+        }
+    });
+    float lo = *std::min_element(low.begin(), low.end());
+    float hi = *std::max_element(high.begin(), high.end());
+    float range = hi > lo ? hi - lo : 1;
+
+    // keep the points on gentle, low enough ground, each tile into its
+    // own lists, with bounds padded by the largest object
+    std::vector<std::vector<float> > kept(numtiles * NUM_KINDS);
+    tileLo.assign(numtiles, vec3<float>(0, 0, FLT_MAX));
+    tileHi.assign(numtiles, vec3<float>(0, 0, -FLT_MAX));
+    parallelFor(numtiles, numthreads, [&](int t) {
+        unsigned int state = (t + 1) * 2246822519u;
+        auto random = [&]() {
+            state = state * 1664525u + 1013904223u;
+            return (state >> 8) / float(1 << 24);
+        };
+
+        for(size_t k=0; k < x[t].size(); ++k) {
+            if (face[t][k] < 0) continue;
+            Vec3f N = normalize(vec3<float>(nx[t][k], ny[t][k], nz[t][k]));
+            float height = (z[t][k] - lo) / range;
+            float u = random();
+            if (N.z < CLIFF_UPRIGHT || height > SNOW_LINE) continue;
+
+            int kind;
+            if (N.z < ROCKY_UPRIGHT || height > TREE_LINE) {
+                if (u >= ROCKY_SHARE) continue;
+                kind = ROCK;
+            }
+            else
+                kind = u < TREE_SHARE ? TREE
+                     : u < TREE_SHARE + ROCK_SHARE ? ROCK : BUSH;
+
+            float scale = KIND_SIZE[kind][0]
+                        + (KIND_SIZE[kind][1] - KIND_SIZE[kind][0]) * random();
+            float angle = 2 * F_PI * random();
+            float record[INSTANCE_FLOATS] = {x[t][k], y[t][k], z[t][k], scale,
+                cosf(angle), sinf(angle), N.x, N.y};
+            std::vector<float> &list = kept[t * NUM_KINDS + kind];
+            list.insert(list.end(), record, record + INSTANCE_FLOATS);
+            tileLo[t].z = std::min(tileLo[t].z, z[t][k] - scale);
+            tileHi[t].z = std::max(tileHi[t].z, z[t][k] + scale);
+        }
+
+        float pad = KIND_SIZE[TREE][1];
+        Vec2f corner = origin + TILE_SIZE * vec2<float>(t % tilesX, t / tilesX);
+        tileLo[t].xy = corner - vec2<float>(pad, pad);
+        tileHi[t].xy = corner + vec2<float>(TILE_SIZE + pad, TILE_SIZE + pad);
+    });
+
+    // then each kind's lists one after another in tile order
+    for(unsigned int t=0; t < numtiles; ++t)
+        numpoints += x[t].size();
+    for(int kind=0; kind < NUM_KINDS; ++kind) {
+        first[kind].resize(numtiles + 1);
+        first[kind][0] = 0;
+        for(unsigned int t=0; t < numtiles; ++t)
+            first[kind][t+1] = first[kind][t]
+                             + kept[t * NUM_KINDS + kind].size() / INSTANCE_FLOATS;
+        instance[kind].resize(first[kind][numtiles] * INSTANCE_FLOATS);
+        parallelFor(numtiles, numthreads, [&](int t) {
+            const std::vector<float> &list = kept[t * NUM_KINDS + kind];
+            std::copy(list.begin(), list.end(),
+                      instance[kind].begin() + first[kind][t] * INSTANCE_FLOATS);
+        });
+    }
+}
+
+//
+// clean up GL objects, if ever drawn
+//
+Scatter::~Scatter()
+{
+    if (! shaderID) return;
+    glDeleteShader(shaderParts[0].id);
+    glDeleteShader(shaderParts[1].id);
+    glDeleteProgram(shaderID);
+    glDeleteTextures(NUM_KINDS, textureIDs);
+    glDeleteBuffers(NUM_KINDS, drawIDs);
+    glDeleteBuffers(NUM_KINDS, storeIDs);
+    glDeleteBuffers(NUM_MESH_BUFFERS, meshIDs);
+    glDeleteVertexArrays(1, &varrayID);
+}
+
+//
+// instances of every kind
+//
+unsigned int Scatter::instances() const
+{
+    unsigned int count = 0;
+    for(int kind=0; kind < NUM_KINDS; ++kind)
+        count += instances(Kind(kind));
+    return count;
+}
+
+//
+// dart throwing from each point already placed: candidates just over one
+// spacing out, evenly around the point from a random start, are kept if
+// no point, in this tile or a finished neighbor, is within the spacing.
+// A point is retired once all its candidates fail. The spacing is less
+// than a tile, so only the eight tiles around can hold points near enough
+// to matter, and none of those is sampled at the same time as this one.
+// Points are left in the order of their grid cells, in rows alternating
+// direction, so each is near the one before when finding the surface
+//
+void Scatter::sampleTile(unsigned int t, std::vector<float> *x,
+                         std::vector<float> *y, std::vector<int> *grid,
+                         const std::vector<unsigned char> &done) const
+{
+    // cells no more than the spacing across their diagonal
+    const int cells = int(ceilf(TILE_SIZE * sqrtf(2.f) / SPACING));
+    const float cell = TILE_SIZE / cells;
+    int tx = t % tilesX, ty = t / tilesX;
+    Vec2f corner = origin + TILE_SIZE * vec2<float>(tx, ty);
+
+    std::vector<float> &px = x[t], &py = y[t];
+    grid[t].assign(cells * cells, -1);
+    std::vector<unsigned int> active;
+
+    unsigned int state = (t + 1) * 2654435761u;
+    auto random = [&]() {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) / float(1 << 24);
+    };
+
+    // true if no point in this tile or a finished neighbor is too near,
+    // looking only in tiles within the spacing
+    auto clear = [&](float qx, float qy) {
+        int nx0 = std::max(int(floorf((qx - SPACING - origin.x) / TILE_SIZE)), 0);
+        int nx1 = std::min(int(floorf((qx + SPACING - origin.x) / TILE_SIZE)),
+                           int(tilesX)-1);
+        int ny0 = std::max(int(floorf((qy - SPACING - origin.y) / TILE_SIZE)), 0);
+        int ny1 = std::min(int(floorf((qy + SPACING - origin.y) / TILE_SIZE)),
+                           int(tilesY)-1);
+        for(int ny = ny0; ny <= ny1; ++ny)
+            for(int nx = nx0; nx <= nx1; ++nx) {
+                unsigned int n = ny * tilesX + nx;
+                if (n != t && (! done[n] || x[n].empty())) continue;
+                float lx = qx - (origin.x + nx * TILE_SIZE);
+                float ly = qy - (origin.y + ny * TILE_SIZE);
+                int x0 = std::max(int(floorf((lx - SPACING) / cell)), 0);
+                int x1 = std::min(int(floorf((lx + SPACING) / cell)), cells-1);
+                int y0 = std::max(int(floorf((ly - SPACING) / cell)), 0);
+                int y1 = std::min(int(floorf((ly + SPACING) / cell)), cells-1);
+                for(int cy = y0; cy <= y1; ++cy)
+                    for(int cx = x0; cx <= x1; ++cx) {
+                        int i = grid[n][cy * cells + cx];
+                        if (i < 0) continue;
+                        float dx = x[n][i] - qx, dy = y[n][i] - qy;
+                        if (dx*dx + dy*dy < SPACING * SPACING) return false;
+                    }
+            }
+        return true;
+    };
+
+    // add a point at qx, qy if it is in this tile and clear
+    auto add = [&](float qx, float qy) {
+        if (qx < corner.x || qx >= corner.x + TILE_SIZE ||
+            qy < corner.y || qy >= corner.y + TILE_SIZE || ! clear(qx, qy))
+            return false;
+        int cx = std::min(int((qx - corner.x) / cell), cells-1);
+        int cy = std::min(int((qy - corner.y) / cell), cells-1);
+        grid[t][cy * cells + cx] = px.size();
+        active.push_back(px.size());
+        px.push_back(qx);
+        py.push_back(qy);
+        return true;
+    };
+
+    for(int s=0; s < SEEDS; ++s)
+        add(corner.x + TILE_SIZE * random(), corner.y + TILE_SIZE * random());
+
+    // turn between candidates, and their distance out, a little over the
+    // spacing so rounding never puts them too near
+    const float turnC = cosf(2 * F_PI / TRIES), turnS = sinf(2 * F_PI / TRIES);
+    const float reach = 1.001f * SPACING;
+
+    while (! active.empty()) {
+        unsigned int a = std::min(unsigned(random() * active.size()),
+                                  unsigned(active.size()) - 1);
+        float ax = px[active[a]], ay = py[active[a]];
+        float angle = 2 * F_PI * random();
+        float dx = reach * cosf(angle), dy = reach * sinf(angle);
+        bool placed = false;
+        for(int k=0; k < TRIES && ! placed; ++k) {
+            placed = add(ax + dx, ay + dy);
+            float turned = turnC * dx - turnS * dy;
+            dy = turnS * dx + turnC * dy;
+            dx = turned;
+        }
+        if (! placed) {
+            active[a] = active.back();
+            active.pop_back();
+        }
+    }
+
+    // reorder by cell, renumbering the grid to match
+    std::vector<float> sx, sy;
+    sx.reserve(px.size());
+    sy.reserve(py.size());
+    for(int cy=0; cy < cells; ++cy)
+        for(int c=0; c < cells; ++c) {
+            int &i = grid[t][cy * cells + (cy & 1 ? cells-1 - c : c)];
+            if (i < 0) continue;
+            sx.push_back(px[i]);
+            sy.push_back(py[i]);
+            i = sx.size() - 1;
+        }
+    px.swap(sx);
+    py.swap(sy);
+}
+
+//
+// vertex array, meshes for each kind, instance buffers, and shaders
+//
+void Scatter::buildGL()
+{
+    glGenVertexArrays(1, &varrayID);
+    glGenBuffers(NUM_MESH_BUFFERS, meshIDs);
+    glGenBuffers(NUM_KINDS, storeIDs);
+    glGenBuffers(NUM_KINDS, drawIDs);
+    glGenTextures(NUM_KINDS, textureIDs);
+
+    // each mesh is a ring of sides points between a top and bottom point,
+    // standing on z=0 and about one unit across or tall, with positions
+    // and normals interleaved
+    std::vector<Vec3f> vertex;
+    std::vector<unsigned short> index;
+    auto spindle = [&](int kind, int sides, float radius, float ring,
+                       float top, float bottom) {
+        unsigned short base = vertex.size() / 2;
+        for(int s=0; s < sides; ++s) {
+            float angle = 2 * F_PI * s / sides;
+            Vec3f out = vec3<float>(cosf(angle), sinf(angle), 0);
+            vertex.push_back(radius * out + vec3<float>(0, 0, ring));
+            vertex.push_back(normalize((top - ring) * out + vec3<float>(0, 0, radius)));
+        }
+        vertex.push_back(vec3<float>(0, 0, top));
+        vertex.push_back(vec3<float>(0, 0, 1));
+        vertex.push_back(vec3<float>(0, 0, bottom));
+        vertex.push_back(vec3<float>(0, 0, -1));
+
+        meshFirst[kind] = index.size();
+        for(int s=0; s < sides; ++s) {
+            unsigned short a = base + s, b = base + (s+1) % sides;
+            unsigned short up = base + sides, down = base + sides + 1;
+            unsigned short tri[6] = {a, b, up, b, a, down};
+            index.insert(index.end(), tri, tri + 6);
+        }
+        meshCount[kind] = index.size() - meshFirst[kind];
+    };
+    spindle(TREE, 6, 0.3f, 0, 1, 0);
+    spindle(ROCK, 4, 0.5f, 0, 0.5f, -0.25f);
+    spindle(BUSH, 5, 0.5f, 0.35f, 0.7f, 0);
+
+    glBindVertexArray(varrayID);
+    glBindBuffer(GL_ARRAY_BUFFER, meshIDs[VERTEX_BUFFER]);
+    glBufferData(GL_ARRAY_BUFFER, vertex.size() * sizeof(Vec3f), &vertex[0],
+            GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshIDs[INDEX_BUFFER]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, index.size() * sizeof(unsigned short),
+            &index[0], GL_STATIC_DRAW);
+
+    // room for every instance, filled in as tiles come into view, and for
+    // the copies of those in view, as four floats to a texel
+    for(int kind=0; kind < NUM_KINDS; ++kind) {
+        size_t bytes = instance[kind].size() * sizeof(float);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, storeIDs[kind]);
+        glBufferData(GL_COPY_WRITE_BUFFER, bytes, 0, GL_STATIC_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, drawIDs[kind]);
+        glBufferData(GL_TEXTURE_BUFFER, bytes, 0, GL_STREAM_COPY);
+        glBindTexture(GL_TEXTURE_BUFFER, textureIDs[kind]);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, drawIDs[kind]);
+    }
+    sent.assign(tiles(), 0);
+
+    shaderParts[0].id = glCreateShader(GL_VERTEX_SHADER);
+    shaderParts[0].file = "scatter.vert";
+    shaderParts[1].id = glCreateShader(GL_FRAGMENT_SHADER);
+    shaderParts[1].file = "scatter.frag";
+    shaderID = glCreateProgram();
+    updateShaders();
+}
+
+//
+// load (or replace) scatter shaders, and connect the mesh attributes
+//
+void Scatter::updateShaders()
+{
+    if (! shaderID) return;
+    loadShaders(shaderID, sizeof(shaderParts)/sizeof(*shaderParts),
+            shaderParts);
+    glUseProgram(shaderID);
+
+    // (re)connect view and projection matrices
+    glUniformBlockBinding(shaderID,
+            glGetUniformBlockIndex(shaderID,"SceneData"),
+            AppContext::SCENE_UNIFORMS);
+    glUniform1i(glGetUniformLocation(shaderID, "instanceTexture"), 0);
+    colorUniform = glGetUniformLocation(shaderID, "color");
+    leanUniform = glGetUniformLocation(shaderID, "lean");
+
+    glBindVertexArray(varrayID);
+    glBindBuffer(GL_ARRAY_BUFFER, meshIDs[VERTEX_BUFFER]);
+    GLint posAttrib = glGetAttribLocation(shaderID, "vPosition");
+    glVertexAttribPointer(posAttrib, 3, GL_FLOAT, GL_FALSE, 2*sizeof(Vec3f), 0);
+    glEnableVertexAttribArray(posAttrib);
+    GLint normAttrib = glGetAttribLocation(shaderID, "vNormal");
+    glVertexAttribPointer(normAttrib, 3, GL_FLOAT, GL_FALSE, 2*sizeof(Vec3f),
+            (void*)sizeof(Vec3f));
+    glEnableVertexAttribArray(normAttrib);
+}
+
+//
+// cull tiles against the view, sending a few new ones to the GPU each
+// frame. Then for each kind, copy the instances of tiles in view together,
+// one copy for each run of neighboring tiles, and draw them all at once
+//
+void Scatter::draw(Scene &scene)
+{
+    if (! shaderID) buildGL();
+
+    const size_t INSTANCE_BYTES = INSTANCE_FLOATS * sizeof(float);
+    std::vector<unsigned int> visible;
+    int budget = SEND_TILES;
+    waiting = false;
+    for(unsigned int t=0; t < tiles(); ++t) {
+        if (tileLo[t].z > tileHi[t].z ||
+            ! boxInFrustum(scene.frustum, tileLo[t], tileHi[t]))
+            continue;
+
+        if (! sent[t]) {
+            if (budget == 0) {
+                waiting = true;
+                continue;
+            }
+            --budget;
+            for(int kind=0; kind < NUM_KINDS; ++kind) {
+                unsigned int begin = first[kind][t], end = first[kind][t+1];
+                if (end == begin) continue;
+                glBindBuffer(GL_COPY_WRITE_BUFFER, storeIDs[kind]);
+                glBufferSubData(GL_COPY_WRITE_BUFFER, begin * INSTANCE_BYTES,
+                        (end - begin) * INSTANCE_BYTES,
+                        &instance[kind][begin * INSTANCE_FLOATS]);
+            }
+            sent[t] = 1;
+        }
+        visible.push_back(t);
+    }
+
+    glUseProgram(shaderID);
+    glBindVertexArray(varrayID);
+    glActiveTexture(GL_TEXTURE0);
+    for(int kind=0; kind < NUM_KINDS; ++kind) {
+        // orphan last frame's copy rather than wait for it to be drawn
+        glBindBuffer(GL_COPY_READ_BUFFER, storeIDs[kind]);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, drawIDs[kind]);
+        glBufferData(GL_COPY_WRITE_BUFFER, instance[kind].size() * sizeof(float),
+                0, GL_STREAM_COPY);
+
+        unsigned int count = 0;
+        for(size_t i=0, j; i < visible.size(); i = j) {
+            j = i + 1;
+            while (j < visible.size() && visible[j] == visible[j-1] + 1)
+                ++j;
+            unsigned int begin = first[kind][visible[i]];
+            unsigned int end = first[kind][visible[j-1] + 1];
+            if (end == begin) continue;
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                    begin * INSTANCE_BYTES, count * INSTANCE_BYTES,
+                    (end - begin) * INSTANCE_BYTES);
+            count += end - begin;
+        }
+        if (! count) continue;
+
+        glUniform3fv(colorUniform, 1, KIND_COLOR[kind]);
+        glUniform1f(leanUniform, KIND_LEAN[kind]);
+        glBindTexture(GL_TEXTURE_BUFFER, textureIDs[kind]);
+        glDrawElementsInstanced(GL_TRIANGLES, meshCount[kind], GL_UNSIGNED_SHORT,
+                (void*)(meshFirst[kind] * sizeof(unsigned short)), count);
+        scene.stats.triangles += count * meshCount[kind] / 3;
+    }
+}
@@ -0,0 +1,106 @@
+// trees, rocks and bushes scattered over the terrain
+#ifndef Scatter_hpp
+#define Scatter_hpp
+
+#include "Shader.hpp"
+#include "Vec.hpp"
+#include <vector>
+
+class Terrain;
+class Scene;
+
+// objects placed over the terrain in square tiles, by Poisson-disk
+// sampling, so no two are closer than a set spacing but there are no gaps.
+// Tiles are sampled in parallel, in four phases as in Wei, "Parallel
+// Poisson Disk Sampling": no two tiles of a phase touch, and each checks
+// its points against neighbors done in earlier phases, so the spacing
+// holds across tile edges and the result does not depend on thread timing.
+// Points then find the surface in one batched query per tile, and those
+// too steep or too high are dropped. The rest become trees, rocks or
+// bushes, each instance kept with its tile.
+// Each kind of object is drawn by one instanced draw call each frame: the
+// instances of tiles in view are copied together on the GPU, and read by
+// the vertex shader through a buffer texture. A tile's instances are only
+// sent to the GPU the first time it comes into view.
+class Scatter {
+// public types
+public:
+    // kinds of object, each drawn with its own mesh
+    enum Kind {TREE, ROCK, BUSH, NUM_KINDS};
+
+// private data
+private:
+    Terrain &terrain;           // surface scattered over, must outlive this
+    unsigned int numthreads;    // threads used to build
+
+    // tiles in rows over the square around the map
+    unsigned int tilesX, tilesY;
+    Vec2f origin;               // corner of tile 0
+    std::vector<Vec3f> tileLo, tileHi; // bounds of each tile's instances
+
+    // instances of each kind, 8 floats each: position, scale, cosine and
+    // sine of the turn about z, and surface normal x and y. Those of tile t
+    // are first[kind][t] up to first[kind][t+1]
+    std::vector<float> instance[NUM_KINDS];
+    std::vector<unsigned int> first[NUM_KINDS];
+    unsigned int numpoints;     // Poisson-disk points before rejection
+
+    // GL vertex array, meshes and shaders, made on first draw. Instances
+    // of each kind live in one buffer, filled in by tile, and those in view
+    // are copied each frame to a second, read as a buffer texture
+    enum {VERTEX_BUFFER, INDEX_BUFFER, NUM_MESH_BUFFERS};
+    unsigned int varrayID;
+    unsigned int meshIDs[NUM_MESH_BUFFERS];
+    unsigned int storeIDs[NUM_KINDS];   // all instances, by tile
+    unsigned int drawIDs[NUM_KINDS];    // instances in view this frame
+    unsigned int textureIDs[NUM_KINDS];
+    unsigned int meshFirst[NUM_KINDS], meshCount[NUM_KINDS]; // indices
+    std::vector<unsigned char> sent;    // 1 once a tile is on the GPU
+    bool waiting;               // tiles in view not yet sent last frame
+    unsigned int shaderID;      // 0 until first drawn
+    int colorUniform, leanUniform; // per-kind uniform locations
+    ShaderInfo shaderParts[2];
+
+// private methods
+private:
+    // Poisson-disk points in tile t, spaced from those in finished
+    // neighbors. Each tile has a grid of cells holding at most one point
+    void sampleTile(unsigned int t, std::vector<float> *x,
+                    std::vector<float> *y, std::vector<int> *grid,
+                    const std::vector<unsigned char> &done) const;
+
+    // vertex array, meshes, instance buffers and shaders
+    void buildGL();
+
+// public methods
+public:
+    // scatter objects over the terrain as it is now
+    Scatter(Terrain &terrain);
+
+    // clean up
+    ~Scatter();
+
+    // load/reload shaders
+    void updateShaders();
+
+    // draw the objects in tiles in view, one draw call for each kind
+    void draw(Scene &scene);
+
+    // true if some tiles in view were left to send on later frames
+    bool loading() const { return waiting; }
+
+    // instances of one kind, or of all
+    unsigned int instances(Kind kind) const {
+        return instance[kind].size() / 8;
+    }
+    unsigned int instances() const;
+
+    // Poisson-disk points, before those too steep or high were dropped
+    unsigned int points() const { return numpoints; }
+
+    // tiles, and threads used to build
+    unsigned int tiles() const { return tilesX * tilesY; }
+    unsigned int threads() const { return numthreads; }
+};
+
+#endif
@@ -42,6 +42,24 @@ Scene::Scene(GLFWwindow &win, const Terrain &terrain)
 	sdata.normRelief.y = 0; // do not use
 }
 
+//
+// create the initial view without a window
+//
+Scene::Scene(int width, int height, const Terrain &terrain)
+    : width(width), height(height), pan(0), tilt(-1.4f)
+{
+    bufferIDs[MATRIX_BUFFER] = 0;
+
+    position = vec3<float>(0,0,0);
+    terrain.setHeight(position, up);
+    project();
+    view();
+    sdata.fog = vec4<float>(1,1,1,0); // white fog, off
+
+	sdata.normRelief.x = 0; // do not use
+	sdata.normRelief.y = 0; // do not use
+}
+
 //
 // New view at position, with view defined by pan and tilt
 //
@@ -94,17 +112,52 @@ void Scene::viewport(GLFWwindow &win)
     // this viewport makes a 1 to 1 mapping of physical pixels to GL
     // "logical" pixels
     glViewport(0, 0, width, height);
+    project();
+}
 
-    // adjust 3D projection into this window
+//
+// adjust 3D projection to the current width and height
+//
+void Scene::project()
+{
     sdata.projection = perspective4fp(F_PI/4, (float)width/height, 1, 10000);
 }
 
 //
 // call before drawing each frame to update per-frame scene state
 //
-void Scene::update() const
+void Scene::update()
 {
     // update uniform block
     glBindBuffer(GL_UNIFORM_BUFFER, bufferIDs[MATRIX_BUFFER]);
     glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ShaderData), &sdata);
+
+    // frustum planes are sums and differences of the rows of the combined
+    // view/projection matrix, since clip space is inside when -w <= x,y,z <= w
+    Mat4f m = sdata.projection.matrix * sdata.viewmat.matrix;
+    Vec4f w = vec4<float>(m[0][3], m[1][3], m[2][3], m[3][3]);
+    for(int i=0; i < 3; ++i) {
+        Vec4f row = vec4<float>(m[0][i], m[1][i], m[2][i], m[3][i]);
+        frustum[2*i]   = w + row;
+        frustum[2*i+1] = w - row;
+    }
+
+    // start counting for this frame
+    stats.tilesDrawn = stats.frustumCulled = stats.horizonCulled = 0;
+    stats.triangles = 0;
+}
+
+//
+// world-space direction of the view ray through window point x,y
+//
+Vec3f Scene::pickRay(double x, double y) const
+{
+    // point on the far plane, from normalized device coordinates
+    Vec4f ndc = vec4<float>(float(2*x/width - 1), float(1 - 2*y/height), 1, 1);
+    Vec4f eye = sdata.projection.inverse * ndc;
+    eye = eye / eye.w;
+
+    // eye-space direction back to world space
+    Vec4f dir = sdata.viewmat.inverse * vec4<float>(eye.x, eye.y, eye.z, 0);
+    return normalize(dir.xyz);
 }
@@ -29,22 +29,45 @@ public:
     Vec3f position;            // character position
     Vec3f up;                  // up vector from normal
 
+    // world-space view frustum planes, inside where dot(plane, xyz1) >= 0
+    // left, right, bottom, top, near, far; updated in update()
+    Vec4f frustum[6];
+
+    // per-frame drawing statistics, reset in update()
+    struct Stats {
+        unsigned int tilesDrawn;    // tiles passing culling
+        unsigned int frustumCulled; // tiles outside the view frustum
+        unsigned int horizonCulled; // tiles hidden behind nearer terrain
+        unsigned int triangles;     // triangles sent to OpenGL
+    } stats;
+
 // public methods
 public:
     // create with initial window size and orbit location
     Scene(GLFWwindow &win, const Terrain &terrain);
 
+    // the same initial view at the given size, with no window or GL
+    // uniform buffer, for tracing; update() must not be called on it
+    Scene(int width, int height, const Terrain &terrain);
+
     // set up new window viewport and projection
     void viewport(GLFWwindow &win);
 
+    // projection for the current width and height
+    void project();
+
     // set view using pan and tilt angles
     void view();
     
     // set view using pan, tilt, and up vector
     void alignedView();
 
-    // update shader uniform state each frame
-    void update() const;
+    // update shader uniform state and frustum each frame
+    void update();
+
+    // world-space direction of the view ray from position through window
+    // point x,y, in pixels from the top left
+    Vec3f pickRay(double x, double y) const;
 };
 
 #endif
@@ -0,0 +1,158 @@
+// shallow water flowing over the terrain
+// pipe model after O'Brien and Hodgins, "Dynamic Simulation of Splashing
+// Fluids", as used by Mei et al., "Fast Hydraulic Erosion Simulation and
+// Visualization on GPU"
+
+#include "ShallowWater.hpp"
+#include "Parallel.hpp"
+#include "Simd.hpp"
+
+#include <algorithm>
+
+// settings, with heights in units of grid spacing and one time step as
+// the unit of time
+const float PIPE = 0.1f;            // flow gained per unit surface difference
+const float DAMPING = 0.995f;       // flow kept from one step to the next
+
+// water shallower than this is drawn as dry
+const float WET_DEPTH = 0.01f;
+
+//
+// dry grid of size x size cells, neighbors spacing apart
+//
+ShallowWater::ShallowWater(int size, float spacing)
+    : size(size), width(size + 2), spacing(spacing),
+      ground(width*width, 0.f), depth(width*width, 0.f),
+      mask(width*width, 0.f), scale(width*width, 0.f)
+{
+    for(int k=0; k < 6; ++k)
+        flow[k].resize(width*width, 0.f);
+
+    numthreads = parallelThreads();
+}
+
+//
+// set terrain cell c,r to world height h
+//
+void ShallowWater::setGround(int c, int r, float h)
+{
+    ground[index(c,r)] = h / spacing;
+    mask[index(c,r)] = 1;
+}
+
+//
+// add world depth of water to every terrain cell
+//
+void ShallowWater::rain(float amount)
+{
+    for(size_t i=0; i < depth.size(); ++i)
+        depth[i] += mask[i] * amount / spacing;
+}
+
+//
+// advance the flow by one time step
+// every cell first updates its outflows, then gathers its inflows, so
+// the rows can be split among threads, four cells at a time within a row
+//
+void ShallowWater::step()
+{
+    const int offset[6] = {1, -1, width, -width, width-1, -width+1};
+
+    parallelFor(size, numthreads, [&](int r) {
+        const float *g = &ground[index(0, r)], *d = &depth[index(0, r)];
+        const float *m = &mask[index(0, r)];
+        float *total = &scale[index(0, r)];
+
+        // flow speeds up toward lower water, and never runs backward
+        for(int c=0; c < size; ++c)
+            total[c] = 0;
+        for(int k=0; k < 6; ++k) {
+            float *out = &flow[k][index(0, r)];
+            const float *gn = g + offset[k], *dn = d + offset[k];
+            const float *mn = m + offset[k];
+            int c = 0;
+#if USE_SSE
+            __m128 damping4 = _mm_set1_ps(DAMPING), pipe4 = _mm_set1_ps(PIPE);
+            __m128 zero = _mm_setzero_ps();
+            for(; c + 4 <= size; c += 4) {
+                __m128 fall = _mm_sub_ps(_mm_sub_ps(_mm_add_ps(_mm_loadu_ps(g + c),
+                        _mm_loadu_ps(d + c)), _mm_loadu_ps(gn + c)), _mm_loadu_ps(dn + c));
+                __m128 F = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(out + c), damping4),
+                        _mm_mul_ps(pipe4, fall));
+                F = _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(m + c), _mm_loadu_ps(mn + c)),
+                        _mm_max_ps(F, zero));
+                _mm_storeu_ps(out + c, F);
+                _mm_storeu_ps(total + c, _mm_add_ps(_mm_loadu_ps(total + c), F));
+            }
+#endif
+            for(; c < size; ++c) {
+                out[c] = m[c] * mn[c] * std::max(out[c] * DAMPING
+                       + PIPE * (g[c] + d[c] - gn[c] - dn[c]), 0.f);
+                total[c] += out[c];
+            }
+        }
+
+        // scale outflows down to the water the cell holds
+        int c = 0;
+#if USE_SSE
+        __m128 tiny = _mm_set1_ps(1e-20f);
+        for(; c + 4 <= size; c += 4) {
+            __m128 D = _mm_loadu_ps(d + c);
+            _mm_storeu_ps(total + c, _mm_div_ps(D,
+                    _mm_max_ps(_mm_max_ps(_mm_loadu_ps(total + c), D), tiny)));
+        }
+#endif
+        for(; c < size; ++c)
+            total[c] = d[c] / std::max(std::max(total[c], d[c]), 1e-20f);
+        for(int k=0; k < 6; ++k) {
+            float *out = &flow[k][index(0, r)];
+            c = 0;
+#if USE_SSE
+            for(; c + 4 <= size; c += 4)
+                _mm_storeu_ps(out + c, _mm_mul_ps(_mm_loadu_ps(out + c),
+                        _mm_loadu_ps(total + c)));
+#endif
+            for(; c < size; ++c)
+                out[c] *= total[c];
+        }
+    });
+
+    parallelFor(size, numthreads, [&](int r) {
+        float *d = &depth[index(0, r)];
+        for(int k=0; k < 6; ++k) {
+            // what this cell sends, and what the neighbor sends back
+            const float *out = &flow[k][index(0, r)];
+            const float *in = &flow[k^1][index(0, r) + offset[k]];
+            int c = 0;
+#if USE_SSE
+            for(; c + 4 <= size; c += 4)
+                _mm_storeu_ps(d + c, _mm_add_ps(_mm_loadu_ps(d + c),
+                        _mm_sub_ps(_mm_loadu_ps(in + c), _mm_loadu_ps(out + c))));
+#endif
+            for(; c < size; ++c)
+                d[c] += in[c] - out[c];
+        }
+    });
+}
+
+//
+// world height of the water surface at cell c,r, or just under the
+// ground where it is dry
+//
+float ShallowWater::surface(int c, int r) const
+{
+    int i = index(c,r);
+    if (depth[i] < WET_DEPTH) return (ground[i] - 1) * spacing;
+    return (ground[i] + depth[i]) * spacing;
+}
+
+//
+// total water volume, in world units
+//
+double ShallowWater::volume() const
+{
+    double sum = 0;
+    for(size_t i=0; i < depth.size(); ++i)
+        sum += depth[i];
+    return sum * spacing * spacing * spacing;
+}
@@ -0,0 +1,62 @@
+// shallow water flowing over the terrain
+#ifndef ShallowWater_hpp
+#define ShallowWater_hpp
+
+#include <vector>
+
+// water depths on the terrain's triangular grid, in the same axial
+// coordinates as Erosion: cell (c,r) has neighbors (c+-1,r), (c,r+-1),
+// (c-1,r+1) and (c+1,r-1). Each cell is joined to its six neighbors by
+// virtual pipes whose flow speeds up with the difference in water surface
+// height (after Mei et al., "Fast Hydraulic Erosion Simulation and
+// Visualization on GPU"). Rows are split over threads, and each row is
+// stepped four cells at a time with SSE where available.
+class ShallowWater {
+// private data
+private:
+    int size;                   // cells across the axial square
+    int width;                  // row length with one cell padding each side
+    float spacing;              // world distance between neighbors
+    unsigned int numthreads;    // threads used by each step
+
+    // padded grid, heights in units of spacing
+    std::vector<float> ground;  // terrain height
+    std::vector<float> depth;   // water depth above the terrain
+    std::vector<float> mask;    // 1 for terrain cells, 0 elsewhere
+    std::vector<float> flow[6]; // outflow toward each neighbor
+    std::vector<float> scale;   // outflow scale so no cell goes below empty
+
+// private methods
+private:
+    // index of cell c,r in padded arrays
+    int index(int c, int r) const { return (r+1)*width + c+1; }
+
+// public methods
+public:
+    // dry grid of size x size cells, neighbors spacing apart
+    ShallowWater(int size, float spacing);
+
+    // set terrain cell c,r to world height h
+    void setGround(int c, int r, float h);
+
+    // add world depth of water to every terrain cell
+    void rain(float amount);
+
+    // advance the flow by one time step
+    void step();
+
+    // world height of the water surface at cell c,r, or just under the
+    // ground where it is dry, so depth testing hides it
+    float surface(int c, int r) const;
+
+    // total water volume, in world units
+    double volume() const;
+
+    // cells across the grid
+    int cells() const { return size; }
+
+    // threads used by each step
+    unsigned int threads() const { return numthreads; }
+};
+
+#endif
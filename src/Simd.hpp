@@ -0,0 +1,24 @@
+// SSE where the compiler offers it, with USE_SSE set to 1, or 0 without.
+// The default build does not optimize, so the compiler vectorizes nothing
+// on its own: hot loops over particles, rays and grid rows use these
+// intrinsics directly, keeping a plain loop for leftover elements and for
+// builds without SSE
+#ifndef Simd_hpp
+#define Simd_hpp
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86_FP)
+#define USE_SSE 1
+#include <xmmintrin.h>
+#else
+#define USE_SSE 0
+#endif
+
+#if USE_SSE
+// lanes of a where mask is set, and of b elsewhere
+static inline __m128 select(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+#endif
+
+#endif
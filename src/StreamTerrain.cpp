@@ -0,0 +1,444 @@
+// unbounded terrain streamed in tiles around the viewer
+
+#include "StreamTerrain.hpp"
+#include "Terrain.hpp"
+#include "Scene.hpp"
+#include "AppContext.hpp"
+#include "ImagePPM.hpp"
+#include "Vec.inl"
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+
+// grid quads across each tile, and world distance between samples
+const int TILE_QUADS = 64;
+const float SPACING = 4;
+
+// distance to load and draw tiles, and most bytes of resident tiles
+const float RADIUS = 1500;
+const size_t BUDGET = 64 << 20;
+
+// most tiles uploaded per frame, and spare buffers kept for reuse
+const unsigned int MAX_UPLOADS = 4;
+const unsigned int MAX_SPARE = 16;
+
+// most worker threads
+const unsigned int MAX_WORKERS = 4;
+
+// integer division rounding toward negative infinity
+static int floorDiv(int a, int b)
+{
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+// true if any part of box lo..hi may be inside the frustum planes
+static bool boxInFrustum(const Vec4f plane[6], Vec3f lo, Vec3f hi)
+{
+    for(int p=0; p < 6; ++p) {
+        Vec4f P = plane[p];
+        if (P.x * (P.x > 0 ? hi.x : lo.x) +
+            P.y * (P.y > 0 ? hi.y : lo.y) +
+            P.z * (P.z > 0 ? hi.z : lo.z) + P.w < 0)
+            return false;
+    }
+    return true;
+}
+
+//
+// start workers; tiles are requested on first draw
+//
+StreamTerrain::StreamTerrain(Vec3f size, int octaves)
+    : mapSize(size), octaves(octaves), spacing(SPACING),
+      tileSize(SPACING * TILE_QUADS), radius(RADIUS), budget(BUDGET),
+      frame(0), waiting(false), quit(false)
+{
+    // CPU heights plus GPU positions and normals
+    int n = TILE_QUADS + 1;
+    tileBytes = (n+2)*(n+2)*sizeof(float) + 2*n*n*sizeof(Vec3f);
+
+    // buffer objects to be used later
+    glGenTextures(NUM_TEXTURES, textureIDs);
+    glGenBuffers(NUM_BUFFERS, bufferIDs);
+    glGenVertexArrays(1, &varrayID);
+
+    // load color image into a named texture
+    ImagePPM textureImage("pebbles.ppm");
+    textureImage.loadTexture(textureIDs[COLOR_TEXTURE]);
+
+    // every tile shares the same grid triangles
+    std::vector<unsigned short> index;
+    for(int y=0; y < TILE_QUADS; ++y) {
+        for(int x=0; x < TILE_QUADS; ++x) {
+            unsigned short v00 = y*n + x, v10 = v00 + 1;
+            unsigned short v01 = v00 + n, v11 = v01 + 1;
+            index.push_back(v00); index.push_back(v10); index.push_back(v11);
+            index.push_back(v00); index.push_back(v11); index.push_back(v01);
+        }
+    }
+    numindex = int(index.size());
+
+    glBindVertexArray(varrayID);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferIDs[INDEX_BUFFER]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, index.size()*sizeof(unsigned short),
+            &index[0], GL_STATIC_DRAW);
+
+    // initial shader load
+    shaderParts[0].id = glCreateShader(GL_VERTEX_SHADER);
+    shaderParts[0].file = "stream.vert";
+    shaderParts[1].id = glCreateShader(GL_FRAGMENT_SHADER);
+    shaderParts[1].file = "terrain.frag";
+    shaderID = glCreateProgram();
+    updateShaders();
+
+    // leave a core for the render thread
+    unsigned int count = std::thread::hardware_concurrency();
+    count = std::min(std::max(count, 2u) - 1, MAX_WORKERS);
+    for(unsigned int i=0; i < count; ++i)
+        workers.push_back(std::thread(&StreamTerrain::worker, this));
+
+    printf("Streaming terrain: %d triangle tiles, %d worker threads\n",
+           2*TILE_QUADS*TILE_QUADS, int(count));
+}
+
+//
+// stop workers and clean up
+//
+StreamTerrain::~StreamTerrain()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wake.notify_all();
+    for(size_t i=0; i < workers.size(); ++i)
+        workers[i].join();
+
+    for(size_t i=0; i < finished.size(); ++i)
+        delete finished[i];
+    for(size_t i=0; i < uploads.size(); ++i)
+        delete uploads[i];
+    for(auto it = tiles.begin(); it != tiles.end(); ++it) {
+        glDeleteBuffers(1, &it->second->bufferID);
+        delete it->second;
+    }
+    if (! spareBuffers.empty())
+        glDeleteBuffers(GLsizei(spareBuffers.size()), &spareBuffers[0]);
+
+    glDeleteShader(shaderParts[0].id);
+    glDeleteShader(shaderParts[1].id);
+    glDeleteProgram(shaderID);
+    glDeleteTextures(NUM_TEXTURES, textureIDs);
+    glDeleteBuffers(NUM_BUFFERS, bufferIDs);
+    glDeleteVertexArrays(1, &varrayID);
+}
+
+//
+// load (or replace) terrain shaders
+//
+void StreamTerrain::updateShaders()
+{
+    loadShaders(shaderID, sizeof(shaderParts)/sizeof(*shaderParts),
+            shaderParts);
+    glUseProgram(shaderID);
+
+    // (re)connect view and projection matrices
+    glUniformBlockBinding(shaderID,
+            glGetUniformBlockIndex(shaderID,"SceneData"),
+            AppContext::SCENE_UNIFORMS);
+
+    // map shader name for textures to glActiveTexture number used in draw
+    glUniform1i(glGetUniformLocation(shaderID, "colorTexture"), 0);
+    glUniform2f(glGetUniformLocation(shaderID, "mapSize"),
+            mapSize.x, mapSize.y);
+
+    // attributes are pointed at each tile's buffer as it is drawn
+    positionAttrib = glGetAttribLocation(shaderID, "vPosition");
+    normalAttrib = glGetAttribLocation(shaderID, "vNormal");
+}
+
+//
+// terrain height at world xy from the height function
+//
+float StreamTerrain::heightAt(float x, float y) const
+{
+    Vec3f P = vec3<float>(x / mapSize.x, y / mapSize.y, 0);
+    return Terrain::elevation(P, octaves).z * mapSize.z;
+}
+
+//
+// worker thread loop: generate the nearest requested tile
+//
+void StreamTerrain::worker()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for(;;) {
+        while (! quit && requests.empty())
+            wake.wait(lock);
+        if (quit) return;
+
+        TileKey k = requests.back();
+        requests.pop_back();
+        working.insert(k);
+
+        lock.unlock();
+        Tile *tile = generate(int(k >> 32), int(k & 0xffffffff));
+        lock.lock();
+
+        // stays in working until collected, so it is not requested again
+        finished.push_back(tile);
+    }
+}
+
+//
+// generate heights and vertex data for one tile
+// normals come from central differences over the bordered heights, so
+// they match across tile edges
+//
+StreamTerrain::Tile *StreamTerrain::generate(int x, int y) const
+{
+    Tile *tile = new Tile;
+    tile->x = x;
+    tile->y = y;
+    tile->bufferID = 0;
+    tile->used = 0;
+
+    int n = TILE_QUADS + 1, b = n + 2;
+    float x0 = x * tileSize, y0 = y * tileSize;
+    tile->height.resize(b*b);
+    for(int j=0; j < b; ++j)
+        for(int i=0; i < b; ++i)
+            tile->height[j*b + i] = heightAt(x0 + (i-1)*spacing,
+                                             y0 + (j-1)*spacing);
+
+    tile->vert.resize(2*n*n);
+    tile->zmin = tile->height[b+1];
+    tile->zmax = tile->zmin;
+    for(int j=0; j < n; ++j) {
+        for(int i=0; i < n; ++i) {
+            const float *h = &tile->height[(j+1)*b + i+1];
+            tile->vert[j*n + i] = vec3<float>(x0 + i*spacing, y0 + j*spacing, *h);
+            tile->vert[n*n + j*n + i] = normalize(vec3<float>(
+                    h[-1] - h[1], h[-b] - h[b], 2*spacing));
+            tile->zmin = std::min(tile->zmin, *h);
+            tile->zmax = std::max(tile->zmax, *h);
+        }
+    }
+    return tile;
+}
+
+//
+// upload tile to a new or recycled buffer and add it to the cache
+//
+void StreamTerrain::upload(Tile *tile)
+{
+    size_t bytes = tile->vert.size() * sizeof(Vec3f);
+    if (! spareBuffers.empty()) {
+        tile->bufferID = spareBuffers.back();
+        spareBuffers.pop_back();
+        glBindBuffer(GL_ARRAY_BUFFER, tile->bufferID);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, &tile->vert[0]);
+    }
+    else {
+        glGenBuffers(1, &tile->bufferID);
+        glBindBuffer(GL_ARRAY_BUFFER, tile->bufferID);
+        glBufferData(GL_ARRAY_BUFFER, bytes, &tile->vert[0], GL_STATIC_DRAW);
+    }
+    std::vector<Vec3f>().swap(tile->vert);
+
+    TileKey k = key(tile->x, tile->y);
+    lru.push_front(k);
+    tile->lru = lru.begin();
+    tiles[k] = tile;
+}
+
+// for sorting (distance, key) pairs farthest first
+static bool fartherFirst(const std::pair<float, long long> &a,
+                         const std::pair<float, long long> &b)
+{
+    return a.first > b.first;
+}
+
+//
+// distance from P to the nearest point of tile x,y
+//
+float StreamTerrain::tileDistance(Vec3f P, int x, int y) const
+{
+    float dx = std::max(std::max(x*tileSize - P.x, P.x - (x+1)*tileSize), 0.f);
+    float dy = std::max(std::max(y*tileSize - P.y, P.y - (y+1)*tileSize), 0.f);
+    return sqrtf(dx*dx + dy*dy);
+}
+
+//
+// request, upload and evict tiles around the viewer
+//
+void StreamTerrain::update(Vec3f eye)
+{
+    ++frame;
+
+    // collect tiles the workers have finished
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(size_t i=0; i < finished.size(); ++i) {
+            TileKey k = key(finished[i]->x, finished[i]->y);
+            uploads.push_back(finished[i]);
+            ready.insert(k);
+            working.erase(k);
+        }
+        finished.clear();
+    }
+
+    // upload a few per frame, nearest first, dropping any now out of range
+    std::sort(uploads.begin(), uploads.end(), [&](Tile *a, Tile *b) {
+        return tileDistance(eye, a->x, a->y) > tileDistance(eye, b->x, b->y);
+    });
+    for(unsigned int n=0; n < MAX_UPLOADS && ! uploads.empty(); ) {
+        Tile *tile = uploads.back();
+        uploads.pop_back();
+        ready.erase(key(tile->x, tile->y));
+        if (tileDistance(eye, tile->x, tile->y) > radius)
+            delete tile;
+        else {
+            upload(tile);
+            ++n;
+        }
+    }
+
+    // touch loaded tiles in range, and list missing ones
+    std::vector<std::pair<float, TileKey> > wanted;
+    int r = int(ceilf(radius / tileSize));
+    int cx = int(floorf(eye.x / tileSize)), cy = int(floorf(eye.y / tileSize));
+    for(int y = cy-r; y <= cy+r; ++y) {
+        for(int x = cx-r; x <= cx+r; ++x) {
+            float d = tileDistance(eye, x, y);
+            if (d > radius) continue;
+
+            TileKey k = key(x, y);
+            auto found = tiles.find(k);
+            if (found != tiles.end()) {
+                Tile *tile = found->second;
+                tile->used = frame;
+                lru.splice(lru.begin(), lru, tile->lru);
+            }
+            else if (! ready.count(k))
+                wanted.push_back(std::make_pair(d, k));
+        }
+    }
+    std::sort(wanted.begin(), wanted.end(), fartherFirst);
+
+    // replace old requests, so tiles no longer wanted are never generated
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        requests.clear();
+        for(size_t i=0; i < wanted.size(); ++i)
+            if (! working.count(wanted[i].second))
+                requests.push_back(wanted[i].second);
+        waiting = ! wanted.empty();
+    }
+    wake.notify_all();
+
+    // evict least recently used tiles not wanted this frame while over budget
+    while (! lru.empty() && tiles.size() * tileBytes > budget) {
+        Tile *tile = tiles[lru.back()];
+        if (tile->used == frame) break;
+
+        if (spareBuffers.size() < MAX_SPARE)
+            spareBuffers.push_back(tile->bufferID);
+        else
+            glDeleteBuffers(1, &tile->bufferID);
+        tiles.erase(lru.back());
+        lru.pop_back();
+        delete tile;
+    }
+}
+
+//
+// set height of P and surface normal N from the tile containing it, or
+// from the height function if that tile is not loaded yet
+// matches the triangles drawn for the tile
+//
+bool StreamTerrain::setHeight(Vec3f &P, Vec3f &N) const
+{
+    float fx = P.x / spacing, fy = P.y / spacing;
+    int gx = int(floorf(fx)), gy = int(floorf(fy));
+    int tx = floorDiv(gx, TILE_QUADS), ty = floorDiv(gy, TILE_QUADS);
+    auto found = tiles.find(key(tx, ty));
+    const Tile *tile = found == tiles.end() ? 0 : found->second;
+
+    // bordered heights from the tile, or computed if not loaded
+    float h[4][4];
+    int b = TILE_QUADS + 3;
+    for(int j=0; j < 4; ++j) {
+        for(int i=0; i < 4; ++i) {
+            int x = gx - 1 + i, y = gy - 1 + j;
+            if (tile)
+                h[j][i] = tile->height[(y - ty*TILE_QUADS + 1)*b
+                                     + (x - tx*TILE_QUADS + 1)];
+            else
+                h[j][i] = heightAt(x * spacing, y * spacing);
+        }
+    }
+
+    // height from the same triangle split as the index buffer
+    float u = fx - gx, v = fy - gy;
+    float h00 = h[1][1], h10 = h[1][2], h01 = h[2][1], h11 = h[2][2];
+    if (u >= v)
+        P.z = h00 + u*(h10 - h00) + v*(h11 - h10);
+    else
+        P.z = h00 + v*(h01 - h00) + u*(h11 - h01);
+    P.z += 10; // viewer height above terrain
+
+    // normal blended from the four corner normals
+    N = vec3<float>(0,0,0);
+    for(int j=0; j < 2; ++j) {
+        for(int i=0; i < 2; ++i) {
+            float w = (i ? u : 1-u) * (j ? v : 1-v);
+            N += w * normalize(vec3<float>(
+                    h[j+1][i] - h[j+1][i+2], h[j][i+1] - h[j+2][i+1],
+                    2*spacing));
+        }
+    }
+    N = normalize(N);
+    return true;
+}
+
+//
+// draw loaded tiles around the scene viewer
+//
+void StreamTerrain::draw(Scene &scene)
+{
+    update(scene.position);
+
+    // enable shaders, vertex arrays and textures
+    glUseProgram(shaderID);
+    glBindVertexArray(varrayID);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, textureIDs[COLOR_TEXTURE]);
+    glEnableVertexAttribArray(positionAttrib);
+    glEnableVertexAttribArray(normalAttrib);
+
+    // tiles wanted this frame are at the front of the LRU list
+    int n = TILE_QUADS + 1;
+    for(auto it = lru.begin(); it != lru.end(); ++it) {
+        Tile *tile = tiles[*it];
+        if (tile->used != frame) break;
+
+        Vec3f lo = vec3<float>(tile->x * tileSize, tile->y * tileSize, tile->zmin);
+        Vec3f hi = vec3<float>(lo.x + tileSize, lo.y + tileSize, tile->zmax);
+        if (! boxInFrustum(scene.frustum, lo, hi)) {
+            ++scene.stats.frustumCulled;
+            continue;
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, tile->bufferID);
+        glVertexAttribPointer(positionAttrib, 3, GL_FLOAT, GL_FALSE, 0, 0);
+        glVertexAttribPointer(normalAttrib, 3, GL_FLOAT, GL_FALSE, 0,
+                (const void*)(n*n*sizeof(Vec3f)));
+        glDrawElements(GL_TRIANGLES, numindex, GL_UNSIGNED_SHORT, 0);
+
+        ++scene.stats.tilesDrawn;
+        scene.stats.triangles += numindex/3;
+    }
+}
@@ -0,0 +1,129 @@
+// unbounded terrain streamed in tiles around the viewer
+#ifndef StreamTerrain_hpp
+#define StreamTerrain_hpp
+
+#include "Vec.hpp"
+#include "Shader.hpp"
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class Scene;
+
+// square terrain tiles generated from the height function on worker
+// threads, nearest first. Finished tiles are uploaded a few per frame and
+// kept in a least-recently-used cache, evicting tiles the viewer has left
+// behind once the cache exceeds its memory budget.
+class StreamTerrain {
+// private types
+private:
+    typedef long long TileKey;  // packed tile x and y
+
+    struct Tile {
+        int x, y;               // tile coordinates, in tiles
+        std::vector<float> height; // heights, with one sample border
+        std::vector<Vec3f> vert;   // positions then normals, until upload
+        float zmin, zmax;       // height range
+        unsigned int bufferID;  // GL vertex buffer, 0 until uploaded
+        std::list<TileKey>::iterator lru; // position in LRU list
+        unsigned int used;      // last frame this tile was wanted
+    };
+
+// private data
+private:
+    Vec3f mapSize;              // scale of height function in world space
+    int octaves;                // noise octaves for height function
+    float spacing;              // world distance between samples
+    float tileSize;             // world width of a tile
+    float radius;               // distance to load and draw tiles
+    size_t budget;              // most bytes of resident tiles
+    size_t tileBytes;           // CPU and GPU bytes for each tile
+    unsigned int frame;         // frame counter for LRU
+    bool waiting;               // tiles outstanding after last update
+
+    // render thread only: uploaded tiles and generated ones waiting
+    std::unordered_map<TileKey, Tile*> tiles;
+    std::list<TileKey> lru;     // most recently used first
+    std::vector<Tile*> uploads; // generated, not yet uploaded
+    std::unordered_set<TileKey> ready; // keys of tiles in uploads
+    std::vector<unsigned int> spareBuffers; // from evicted tiles
+
+    // shared with workers, protected by mutex
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<TileKey> requests; // wanted tiles, nearest last
+    std::unordered_set<TileKey> working; // generated but not collected
+    std::vector<Tile*> finished;// generated since last frame
+    bool quit;                  // set to stop workers
+
+    std::vector<std::thread> workers;
+
+    // GL vertex array object IDs
+    unsigned int varrayID;
+
+    // GL texture IDs
+    enum {COLOR_TEXTURE, NUM_TEXTURES};
+    unsigned int textureIDs[NUM_TEXTURES];
+
+    // GL buffer object IDs
+    enum {INDEX_BUFFER, NUM_BUFFERS};
+    unsigned int bufferIDs[NUM_BUFFERS];
+    int numindex;               // indices in tile grid
+
+    // GL shaders
+    unsigned int shaderID;      // ID for shader program
+    ShaderInfo shaderParts[2];  // vertex & fragment shader info
+    int positionAttrib, normalAttrib;
+
+// private methods
+private:
+    static TileKey key(int x, int y) {
+        return TileKey((unsigned long long)unsigned(x) << 32 | unsigned(y));
+    }
+
+    // distance from P to the nearest point of tile x,y
+    float tileDistance(Vec3f P, int x, int y) const;
+
+    // terrain height at world xy from the height function
+    float heightAt(float x, float y) const;
+
+    // worker thread loop
+    void worker();
+
+    // generate heights and vertex data for one tile (worker threads)
+    Tile *generate(int x, int y) const;
+
+    // upload tile to a new or recycled buffer (render thread)
+    void upload(Tile *tile);
+
+    // request, upload and evict tiles around the viewer
+    void update(Vec3f eye);
+
+// public methods
+public:
+    // start workers; tiles are requested on first draw
+    StreamTerrain(Vec3f mapSize, int octaves);
+
+    // stop workers and clean up
+    ~StreamTerrain();
+
+    // load/reload shaders
+    void updateShaders();
+
+    // set height of P and surface normal N from the tile containing it,
+    // or from the height function if that tile is not loaded yet
+    // always succeeds, since the terrain has no edge
+    bool setHeight(Vec3f &P, Vec3f &N) const;
+
+    // true if tiles around the last viewer position are still arriving
+    bool loading() const { return waiting || ! uploads.empty(); }
+
+    // draw loaded tiles around the scene viewer
+    void draw(Scene &scene);
+};
+
+#endif
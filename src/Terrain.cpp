@@ -2,18 +2,51 @@
 
 #include "Terrain.hpp"
 #include "AppContext.hpp"
+#include "Scene.hpp"
 #include "ImagePPM.hpp"
 #include "Noise.hpp"
+#include "MeshSimplify.hpp"
+#include "GreedyTIN.hpp"
+#include "Erosion.hpp"
+#include "ShallowWater.hpp"
+#include "Drainage.hpp"
+#include "NavMesh.hpp"
+#include "NavHierarchy.hpp"
+#include "FlowFields.hpp"
+#include "Parallel.hpp"
+#include "Simd.hpp"
 #include "Vec.inl"
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <float.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 // enable half-edge search
 #define HALF_EDGE 1
 
+// error bounds for simplified levels of detail, in world units
+static const float LOD_ERRORS[] = {0.5f, 1, 2, 4, 8, 16};
+
+// height of the viewer's eye above the terrain, added by setHeight
+static const float VIEWER_HEIGHT = 10;
+
+// grid cells across the patch drawn over the height texture
+static const int HEIGHT_PATCH = 16;
+
+// shallow water steps run each frame
+static const int WATER_STEPS = 4;
+
+#ifndef F_PI
+#define F_PI 3.1415926f
+#endif
+
 #if HALF_EDGE
 ////////////////////////////////////////////////////////////////////////
 // for half-edge construction, map from pair of vertices to edge index
@@ -34,7 +67,8 @@ namespace std {
     struct hash<EdgeKey> {
         std::size_t operator()(const EdgeKey &e) const
         {
-            return std::hash<int>()(std::hash<int>()(e.v0) ^ e.v1);
+            // spread v0 across the bits so neighboring edges do not collide
+            return std::hash<size_t>()(size_t(e.v0) * 2654435761u + e.v1);
         }
     };
 }
@@ -85,7 +119,10 @@ static int addEdge(HalfEdge *edge, EdgeMap &edgeMap, int v0, int v1)
 //////////////////
 // build terrain
 
-static Vec3f elevation(Vec3f P, int octaves)
+//
+// terrain height function: fractal sum of noise octaves added to P.z
+//
+Vec3f Terrain::elevation(Vec3f P, int octaves)
 {
     float s = 1;
     for(int i=0; i < octaves; ++i, s *= 2) {
@@ -95,37 +132,92 @@ static Vec3f elevation(Vec3f P, int octaves)
 }
 
 //
-// load the terrain data
+// load the terrain data, with uniform rows across the whole hexagon
 //
 Terrain::Terrain(int level, int octaves)
-	: normalMap(false), reliefMap(false)
+	: level(level), octaves(octaves)
 {
-    // buffer objects to be used later
-    glGenTextures(NUM_TEXTURES, textureIDs);
-    glGenBuffers(NUM_BUFFERS, bufferIDs);
-    glGenVertexArrays(1, &varrayID);
+    // convenient size of coordinates, and size the whole world should appear
+    gridSize = vec3<float>(level+1, level+1, 1);
+    mapSize = vec3<float>(300, 300, 100);
 
-    // load color image into a named texture
-	ImagePPM textureImage("pebbles.ppm");
-	textureImage.loadTexture(textureIDs[COLOR_TEXTURE]);
-	ImagePPM normalTextureImage("pebbles-norm.ppm");
-	normalTextureImage.loadTexture(textureIDs[NORMAL_MAP_TEXTURE]);
+    buildGrid(octaves);
+    buildMesh();
+    printf("level %d: %d triangle terrain, %d octaves\n", level, numtri, octaves);
+}
 
-    // convenient size of coordinates, and size the whole world should appear
+//
+// load the terrain data, with triangles graded by distance from focus
+//
+Terrain::Terrain(int level, int octaves, Vec2f focus, float focusRadius)
+	: level(level), octaves(octaves)
+{
+    mapSize = vec3<float>(300, 300, 100);
+    buildGraded(octaves, focus, focusRadius);
+    buildMesh();
+    printf("level %d: %d triangle graded terrain around %g,%g, %d octaves\n",
+           level, numtri, focus.x, focus.y, octaves);
+}
+
+//
+// load the terrain data as a triangulated irregular network: a subset of
+// the uniform grid, where no grid vertex is more than maxError away
+//
+Terrain::Terrain(int level, int octaves, float maxError)
+	: level(level), octaves(octaves)
+{
     gridSize = vec3<float>(level+1, level+1, 1);
     mapSize = vec3<float>(300, 300, 100);
+    buildGrid(octaves);
+    unsigned int gridTris = numtri;
+    buildTIN(maxError);
+    buildMesh();
+    printf("level %d: %d triangle TIN terrain, %.1f%% of grid, %d octaves\n",
+           level, numtri, 100.f * numtri / gridTris, octaves);
+}
+
+//
+// uniform grid terrain on the CPU only, for tracing without a window
+//
+Terrain::Terrain(int level, int octaves, Headless)
+	: level(level), octaves(octaves), headless(true)
+{
+    gridSize = vec3<float>(level+1, level+1, 1);
+    mapSize = vec3<float>(300, 300, 100);
+
+    buildGrid(octaves);
+    buildMesh();
+    printf("level %d: %d triangle headless terrain, %d octaves\n",
+           level, numtri, octaves);
+}
+
+//
+// procedural terrain: the vertex shader computes the uniform grid, so
+// there are no vertices, triangles, tiles or half-edges on the CPU
+//
+Terrain::Terrain(int level, int octaves, Procedural)
+	: level(level), octaves(octaves), procedural(true), culling(false)
+{
+    mapSize = vec3<float>(300, 300, 100);
+    buildProcedural();
+    setDetail(level, octaves);
+}
 
+//
+// uniform grid vertices and triangles, in rows across the hexagon
+//
+void Terrain::buildGrid(int octaves)
+{
     // number of vertices: 1, 1+6, 1+6+12: 1 + 6*sum(i)
     numvert = 1 + 3*(level+1)*(level+2);
     vert = new Vec3f[numvert];
-    norm = new Vec3f[numvert];
-	normMap = new Vec3f[numvert];
-    texcoord = new Vec2f[numvert];
+    rowStart = new unsigned int[2*level + 4];
 
-    int idx = 0;
+    int idx = 0, row = 0;
     // increasing number of vertices from top row to middle
     for(int y=0;  y <= level+1;  ++y) {
         float rowY = sqrtf(0.75) * (y - float(level+1));
+        rowStart[row++] = idx;
         for(int x=-y-level-1; x<=y+level+1; x += 2, ++idx) {
             vert[idx] = elevation(vec3<float>(0.5 * x, rowY, 0) / gridSize, octaves) * mapSize;
         }
@@ -134,27 +226,12 @@ Terrain::Terrain(int level, int octaves)
     // decreasing number of vertices from middle to bottom
     for(int y = level;  y >= 0;  --y) {
         float rowY = sqrtf(0.75) * (float(level+1) - y);
+        rowStart[row++] = idx;
         for(int x=-y-level-1; x<=y+level+1; x += 2, ++idx) {
             vert[idx] = elevation(vec3<float>(0.5 * x, rowY, 0) / gridSize, octaves) * mapSize;
         }
     }
-
-    // texture coordinate from position
-    for(int i=0; i<numvert; ++i) {
-        texcoord[i] = (vert[i].xy / mapSize.xy) * 0.5f + 0.5f;
-        norm[i] = vec3<float>(0,0,0);
-
-		//normal map coordinate also from position
-		ImagePPM::color_type newColor = textureImage(texcoord[i].x, texcoord[i].y);
-		normMap[i].x = ((float)newColor.x) / 256. * 2 - 1;
-		normMap[i].y = ((float)newColor.y) / 256. * 2 - 1;
-		normMap[i].z = ((float)newColor.z) / 256. * 2 - 1;
-
-		if (i == 0)
-		{
-			printf("%f, %f, %f", normMap[i].x, normMap[i].y, normMap[i].z);
-		}
-    }
+    rowStart[row] = idx;
 
     // number of triangles: 6, 6*4, 6*9: 6*level^2
     numtri = 6 * ((level + 2)*level + 1);
@@ -199,6 +276,279 @@ Terrain::Terrain(int level, int octaves)
         toprow = bottomrow;
         bottomrow += level + y + 2;
     }
+}
+
+//
+// replace the uniform grid with a Delaunay triangulation of the grid
+// vertices chosen by greedy insertion, and forget the grid rows
+//
+void Terrain::buildTIN(float maxError)
+{
+    // grid x and y of each vertex, centered on the middle row
+    int (*grid)[2] = new int[numvert][2];
+    for(int row=0; row <= 2*level + 2; ++row) {
+        int y = level + 1 - abs(row - (level + 1));
+        for(int x = -(y + level + 1); x <= y + level + 1; x += 2) {
+            int v = gridVertex(row, x);
+            grid[v][0] = x;
+            grid[v][1] = row - (level + 1);
+        }
+    }
+
+    // hexagon corners, counter-clockwise from +x
+    int n = level + 1;
+    int corner[6] = {
+        gridVertex(n, 2*n), gridVertex(2*n, n), gridVertex(2*n, -n),
+        gridVertex(n, -2*n), gridVertex(0, -n), gridVertex(0, n) };
+
+    GreedyTIN tin(numvert, grid, vert, 6, corner, gridVertex(n, 0));
+    tin.refine(maxError);
+
+    std::vector<int> sample;
+    std::vector<unsigned int> triList;
+    tin.mesh(sample, triList);
+    delete[] grid;
+
+    Vec3f *tinVert = new Vec3f[sample.size()];
+    for(size_t i=0; i < sample.size(); ++i)
+        tinVert[i] = vert[sample[i]];
+    delete[] vert;
+    vert = tinVert;
+    numvert = sample.size();
+
+    delete[] indices;
+    numtri = triList.size() / 3;
+    indices = new unsigned int[numtri][3];
+    std::copy(triList.begin(), triList.end(), &indices[0][0]);
+
+    delete[] rowStart;
+    rowStart = 0;
+}
+
+// triangle of the graded mesh, in grid coordinates of the finest level
+struct GradedTri {
+    int x[3], y[3];
+    int depth;                  // times refined from the base hexagon
+};
+
+// key for a grid point of the graded mesh
+static long long gridKey(int x, int y)
+{
+    return (long long)x << 32 | (unsigned int)y;
+}
+
+// split a graded triangle into four at its edge midpoints
+static void splitGraded(const GradedTri &t, GradedTri child[4])
+{
+    int mx[3], my[3];
+    for(int i=0; i < 3; ++i) {
+        mx[i] = (t.x[i] + t.x[(i+1)%3]) / 2;
+        my[i] = (t.y[i] + t.y[(i+1)%3]) / 2;
+    }
+
+    // corner triangles keep each corner and the midpoints beside it
+    for(int i=0; i < 3; ++i) {
+        int j = (i+2)%3;
+        GradedTri &c = child[i];
+        c.x[0] = t.x[i]; c.x[1] = mx[i]; c.x[2] = mx[j];
+        c.y[0] = t.y[i]; c.y[1] = my[i]; c.y[2] = my[j];
+        c.depth = t.depth + 1;
+    }
+    GradedTri &c = child[3];
+    for(int i=0; i < 3; ++i) {
+        c.x[i] = mx[i];
+        c.y[i] = my[i];
+    }
+    c.depth = t.depth + 1;
+}
+
+//
+// graded vertices and triangles: the base hexagon is split into four
+// where triangles are larger than wanted at their distance from focus,
+// neighbors are kept within one split of each other, and triangles next
+// to a finer neighbor are bisected to meet it without cracks
+//
+void Terrain::buildGraded(int octaves, Vec2f focus, float focusRadius)
+{
+    // finest grid is a base hexagon split depth times, and no more than
+    // 1/8 finer than the uniform grid at this level
+    int depth = 5, base = level + 1;
+    for(; depth > 0; --depth) {
+        base = (level + (1 << depth)) >> depth;
+        if (8 * (base << depth) <= 9 * (level + 1)) break;
+    }
+    int side = base << depth, step = 1 << depth;
+    gridSize = vec3<float>(side, side, 1);
+    Vec2f scale = vec2<float>(0.5f, sqrtf(0.75)) * mapSize.xy / gridSize.xy;
+    float spacing = mapSize.x / side;
+
+    // base hexagon: up and down triangles above each grid point
+    std::vector<GradedTri> work, leaves;
+    for(int y = -base; y < base; ++y) {
+        for(int x = -2*base; x <= 2*base; ++x) {
+            if ((x + y) & 1) continue;
+            int corner[2][3][2] = {
+                {{x, y}, {x+2, y}, {x+1, y+1}},
+                {{x, y}, {x+1, y+1}, {x-1, y+1}} };
+            for(int t=0; t < 2; ++t) {
+                GradedTri tri;
+                bool inside = true;
+                for(int i=0; i < 3; ++i) {
+                    int cx = corner[t][i][0], cy = corner[t][i][1];
+                    inside = inside && abs(cy) <= base && abs(cx) <= 2*base - abs(cy);
+                    tri.x[i] = cx * step;
+                    tri.y[i] = cy * step;
+                }
+                tri.depth = 0;
+                if (inside) work.push_back(tri);
+            }
+        }
+    }
+
+    // split until edges are no longer than spacing, growing in proportion
+    // to distance beyond focusRadius
+    while (! work.empty()) {
+        GradedTri t = work.back();
+        work.pop_back();
+
+        Vec2f c = vec2<float>(0,0);
+        for(int i=0; i < 3; ++i)
+            c += vec2<float>(t.x[i], t.y[i]) * scale / 3.f;
+        float edge = spacing * (step >> t.depth);
+        float dist = std::max(length(c - focus) - edge, 0.f);
+        if (t.depth < depth && edge > spacing * std::max(dist / focusRadius, 1.f)) {
+            GradedTri child[4];
+            splitGraded(t, child);
+            work.insert(work.end(), child, child + 4);
+        }
+        else
+            leaves.push_back(t);
+    }
+
+    std::unordered_set<long long> points;
+    for(size_t t=0; t < leaves.size(); ++t)
+        for(int i=0; i < 3; ++i)
+            points.insert(gridKey(leaves[t].x[i], leaves[t].y[i]));
+
+    // split triangles with a neighbor two or more levels finer, or finer
+    // neighbors on two sides, until none are left
+    for(bool changed = true; changed; ) {
+        changed = false;
+        work.swap(leaves);
+        leaves.clear();
+        for(size_t n=0; n < work.size(); ++n) {
+            const GradedTri &t = work[n];
+            int hanging = 0;
+            bool deep = false;
+            for(int i=0; i < 3 && t.depth < depth; ++i) {
+                int j = (i+1)%3;
+                int mx = (t.x[i] + t.x[j]) / 2, my = (t.y[i] + t.y[j]) / 2;
+                if (! points.count(gridKey(mx, my))) continue;
+                ++hanging;
+                deep = deep || (t.depth + 1 < depth &&
+                    (points.count(gridKey((t.x[i] + mx)/2, (t.y[i] + my)/2)) ||
+                     points.count(gridKey((mx + t.x[j])/2, (my + t.y[j])/2))));
+            }
+
+            if (deep || hanging > 1) {
+                GradedTri child[4];
+                splitGraded(t, child);
+                for(int c=0; c < 4; ++c) {
+                    leaves.push_back(child[c]);
+                    for(int i=0; i < 3; ++i)
+                        points.insert(gridKey(child[c].x[i], child[c].y[i]));
+                }
+                changed = true;
+            }
+            else
+                leaves.push_back(t);
+        }
+    }
+
+    // vertices from the height function, and triangles bisected where
+    // they meet a finer neighbor
+    std::unordered_map<long long, unsigned int> vertIndex;
+    std::vector<Vec3f> vertList;
+    std::vector<unsigned int> triList;
+    for(size_t n=0; n < leaves.size(); ++n) {
+        const GradedTri &t = leaves[n];
+        int px[4], py[4], corners = 0, hang = -1;
+        for(int i=0; i < 3; ++i) {
+            px[corners] = t.x[i];
+            py[corners++] = t.y[i];
+            int j = (i+1)%3;
+            int mx = (t.x[i] + t.x[j]) / 2, my = (t.y[i] + t.y[j]) / 2;
+            if (t.depth < depth && points.count(gridKey(mx, my))) {
+                hang = corners;
+                px[corners] = mx;
+                py[corners++] = my;
+            }
+        }
+
+        unsigned int v[4];
+        for(int i=0; i < corners; ++i) {
+            auto found = vertIndex.find(gridKey(px[i], py[i]));
+            if (found != vertIndex.end()) {
+                v[i] = found->second;
+                continue;
+            }
+            v[i] = vertIndex[gridKey(px[i], py[i])] = vertList.size();
+            vertList.push_back(elevation(
+                vec3<float>(0.5f * px[i], sqrtf(0.75) * py[i], 0) / gridSize,
+                octaves) * mapSize);
+        }
+
+        // one hanging midpoint: fan from the corner opposite it
+        if (hang < 0)
+            triList.insert(triList.end(), v, v + 3);
+        else {
+            unsigned int a = v[hang-1], mid = v[hang], b = v[(hang+1)%4];
+            unsigned int c = v[(hang+2)%4];
+            unsigned int fan[6] = {a, mid, c, mid, b, c};
+            triList.insert(triList.end(), fan, fan + 6);
+        }
+    }
+
+    numvert = vertList.size();
+    vert = new Vec3f[numvert];
+    std::copy(vertList.begin(), vertList.end(), vert);
+    numtri = triList.size() / 3;
+    indices = new unsigned int[numtri][3];
+    std::copy(triList.begin(), triList.end(), &indices[0][0]);
+}
+
+//
+// normals, tiles and half-edges for the vertices and triangles built by
+// the constructor, then GPU data unless headless
+//
+void Terrain::buildMesh()
+{
+    // color image, also read for the normal map
+	ImagePPM textureImage("pebbles.ppm");
+
+    norm = new Vec3f[numvert];
+	normMap = new Vec3f[numvert];
+    texcoord = new Vec2f[numvert];
+
+    // texture coordinate from position
+    for(int i=0; i<numvert; ++i) {
+        texcoord[i] = (vert[i].xy / mapSize.xy) * 0.5f + 0.5f;
+        norm[i] = vec3<float>(0,0,0);
+
+		//normal map coordinate also from position
+		ImagePPM::color_type newColor = textureImage(texcoord[i].x, texcoord[i].y);
+		normMap[i].x = ((float)newColor.x) / 256. * 2 - 1;
+		normMap[i].y = ((float)newColor.y) / 256. * 2 - 1;
+		normMap[i].z = ((float)newColor.z) / 256. * 2 - 1;
+
+		if (i == 0)
+		{
+			printf("%f, %f, %f", normMap[i].x, normMap[i].y, normMap[i].z);
+		}
+    }
+
+    // group triangles into tiles before anything depends on their order
+    buildTiles();
 
     // compute face normals and sum into each vertex normal
     for(int i=0; i < numtri; ++i) {
@@ -218,40 +568,13 @@ Terrain::Terrain(int level, int octaves)
 		normMap[i] = normalize(normMap[i]);
     }
 
-    // load vertex and index array to GPU
-    glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[POSITION_BUFFER]);
-    glBufferData(GL_ARRAY_BUFFER, numvert*sizeof(Vec3f), vert, GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[NORMAL_BUFFER]);
-    glBufferData(GL_ARRAY_BUFFER, numvert*sizeof(Vec3f), norm, GL_STATIC_DRAW);
-
-	glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[NORMAL_MAP_BUFFER]);
-	glBufferData(GL_ARRAY_BUFFER, numvert * sizeof(Vec3f), normMap, GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[UV_BUFFER]);
-    glBufferData(GL_ARRAY_BUFFER, numvert*sizeof(Vec2f), texcoord, 
-            GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferIDs[INDEX_BUFFER]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 
-            numtri*sizeof(unsigned int[3]), indices, GL_STATIC_DRAW);
-
-    // initial shader load
-    shaderParts[0].id = glCreateShader(GL_VERTEX_SHADER);
-    shaderParts[0].file = "terrain.vert";
-    shaderParts[1].id = glCreateShader(GL_FRAGMENT_SHADER);
-    shaderParts[1].file = "terrain.frag";
-    shaderID = glCreateProgram();
-    updateShaders();
-
-    printf("level %d: %d triangle terrain, %d octaves\n", level, numtri, octaves);
-
 #if HALF_EDGE
     ////////
     // build half-edge data
 
     // three half-edges for each triangle, plus one for each boundary edge
-    numedge = 3 * numtri + 6 * (level + 1);
+    // the mesh is a disk, so by Euler's formula there are 2V-F-2 of those
+    numedge = 3 * numtri + 2 * numvert - numtri - 2;
     triEdge = new HalfEdge*[numtri];
     edge = new HalfEdge[numedge];
     EdgeMap edgeMap;
@@ -276,6 +599,104 @@ Terrain::Terrain(int level, int octaves)
         triEdge[i] = &edge[e0];
     }
 #endif
+
+    if (! headless)
+        buildBuffers();
+}
+
+//
+// textures, vertex and index buffers and shaders for the mesh
+//
+void Terrain::buildBuffers()
+{
+    // buffer objects to be used later
+    glGenTextures(NUM_TEXTURES, textureIDs);
+    glGenBuffers(NUM_BUFFERS, bufferIDs);
+    glGenVertexArrays(1, &varrayID);
+
+    // load color image into a named texture
+	ImagePPM textureImage("pebbles.ppm");
+	textureImage.loadTexture(textureIDs[COLOR_TEXTURE]);
+	ImagePPM normalTextureImage("pebbles-norm.ppm");
+	normalTextureImage.loadTexture(textureIDs[NORMAL_MAP_TEXTURE]);
+
+    // load vertex and index array to GPU
+    // position and normal can change with applyBrush
+    glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[POSITION_BUFFER]);
+    glBufferData(GL_ARRAY_BUFFER, numvert*sizeof(Vec3f), vert, GL_DYNAMIC_DRAW);
+
+    glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[NORMAL_BUFFER]);
+    glBufferData(GL_ARRAY_BUFFER, numvert*sizeof(Vec3f), norm, GL_DYNAMIC_DRAW);
+
+	glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[NORMAL_MAP_BUFFER]);
+	glBufferData(GL_ARRAY_BUFFER, numvert * sizeof(Vec3f), normMap, GL_STATIC_DRAW);
+
+    glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[UV_BUFFER]);
+    glBufferData(GL_ARRAY_BUFFER, numvert*sizeof(Vec2f), texcoord, 
+            GL_STATIC_DRAW);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferIDs[INDEX_BUFFER]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 
+            numtri*sizeof(unsigned int[3]), indices, GL_STATIC_DRAW);
+
+    // initial shader load
+    shaderParts[0].id = glCreateShader(GL_VERTEX_SHADER);
+    shaderParts[0].file = "terrain.vert";
+    shaderParts[1].id = glCreateShader(GL_FRAGMENT_SHADER);
+    shaderParts[1].file = "terrain.frag";
+    shaderID = glCreateProgram();
+    updateShaders();
+}
+
+//
+// textures, empty vertex array and shaders for procedural terrain
+//
+void Terrain::buildProcedural()
+{
+    glGenTextures(NUM_TEXTURES, textureIDs);
+    glGenVertexArrays(1, &varrayID);
+    for(int i=0; i < NUM_BUFFERS; ++i)
+        bufferIDs[i] = 0;
+
+    ImagePPM textureImage("pebbles.ppm");
+    textureImage.loadTexture(textureIDs[COLOR_TEXTURE]);
+    ImagePPM normalTextureImage("pebbles-norm.ppm");
+    normalTextureImage.loadTexture(textureIDs[NORMAL_MAP_TEXTURE]);
+
+    shaderParts[0].id = glCreateShader(GL_VERTEX_SHADER);
+    shaderParts[0].file = "procedural.vert";
+    shaderParts[1].id = glCreateShader(GL_FRAGMENT_SHADER);
+    shaderParts[1].file = "terrain.frag";
+    shaderID = glCreateProgram();
+    updateShaders();
+}
+
+//
+// change level and octaves of procedural terrain, without rebuilding
+//
+void Terrain::setDetail(int newLevel, int newOctaves)
+{
+    level = newLevel;
+    octaves = newOctaves;
+    gridSize = vec3<float>(level+1, level+1, 1);
+    numtri = 6 * ((level + 2)*level + 1);
+    detailUniforms();
+    printf("level %d: %d triangle procedural terrain, %d octaves\n",
+           level, numtri, octaves);
+}
+
+//
+// set level and octaves in the procedural shader
+//
+void Terrain::detailUniforms()
+{
+    glUseProgram(shaderID);
+    glUniform1i(glGetUniformLocation(shaderID, "level"), level);
+    glUniform1i(glGetUniformLocation(shaderID, "octaves"), octaves);
+    glUniform3f(glGetUniformLocation(shaderID, "gridSize"),
+                gridSize.x, gridSize.y, gridSize.z);
+    glUniform3f(glGetUniformLocation(shaderID, "mapSize"),
+                mapSize.x, mapSize.y, mapSize.z);
 }
 
 //
@@ -283,14 +704,36 @@ Terrain::Terrain(int level, int octaves)
 //
 Terrain::~Terrain()
 {
-    glDeleteShader(shaderParts[0].id);
-    glDeleteShader(shaderParts[1].id);
-    glDeleteProgram(shaderID);
-    glDeleteTextures(NUM_TEXTURES, textureIDs);
-    glDeleteBuffers(NUM_BUFFERS, bufferIDs);
-    glDeleteVertexArrays(1, &varrayID);
+    if (! headless) {
+        glDeleteShader(shaderParts[0].id);
+        glDeleteShader(shaderParts[1].id);
+        glDeleteProgram(shaderID);
+        glDeleteTextures(NUM_TEXTURES, textureIDs);
+        glDeleteBuffers(NUM_BUFFERS, bufferIDs);
+        glDeleteVertexArrays(1, &varrayID);
+        glDeleteShader(patchShaderParts[0].id);
+        glDeleteShader(patchShaderParts[1].id);
+        glDeleteProgram(patchShaderID);
+        glDeleteVertexArrays(1, &patchArrayID);
+        glDeleteShader(waterShaderParts[0].id);
+        glDeleteShader(waterShaderParts[1].id);
+        glDeleteProgram(waterShaderID);
+        glDeleteVertexArrays(1, &waterArrayID);
+    }
+    delete erosion;
+    delete water;
+    delete drainage;
+    delete navflows;
+    delete navclusters;
+    delete navmesh;
 
     delete[] indices;
+    delete[] tileStart;
+    delete[] tileOrigin;
+    delete[] tileBounds;
+    delete[] tileFloor;
+    freeLOD();
+    delete[] rowStart;
     delete[] texcoord;
     delete[] norm;
 	delete[] normMap;
@@ -322,6 +765,65 @@ void Terrain::updateShaders()
 	// map shader name for normal map to glActiveTexture number used in draw
 	glUniform1i(glGetUniformLocation(shaderID, "normalTexture"), 0);
 
+    // height texture patches have their own program and vertex array
+    if (patchShaderID) {
+        loadShaders(patchShaderID,
+                sizeof(patchShaderParts)/sizeof(*patchShaderParts),
+                patchShaderParts);
+        glUseProgram(patchShaderID);
+        glUniformBlockBinding(patchShaderID,
+                glGetUniformBlockIndex(patchShaderID,"SceneData"),
+                AppContext::SCENE_UNIFORMS);
+        glUniform1i(glGetUniformLocation(patchShaderID, "colorTexture"), 0);
+        glUniform1i(glGetUniformLocation(patchShaderID, "heightTexture"), 2);
+        glUniform1i(glGetUniformLocation(patchShaderID, "level"), level);
+        glUniform1i(glGetUniformLocation(patchShaderID, "patchSize"),
+                HEIGHT_PATCH);
+        glUniform3f(glGetUniformLocation(patchShaderID, "gridSize"),
+                gridSize.x, gridSize.y, gridSize.z);
+        glUniform3f(glGetUniformLocation(patchShaderID, "mapSize"),
+                mapSize.x, mapSize.y, mapSize.z);
+
+        glBindVertexArray(patchArrayID);
+        GLint gridAttrib = glGetAttribLocation(patchShaderID, "vGrid");
+        glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[PATCH_BUFFER]);
+        glVertexAttribPointer(gridAttrib, 2, GL_FLOAT, GL_FALSE, 0, 0);
+        glEnableVertexAttribArray(gridAttrib);
+        glUseProgram(shaderID);
+    }
+
+    // water uses the same patch grid, over a texture of surface heights
+    if (waterShaderID) {
+        loadShaders(waterShaderID,
+                sizeof(waterShaderParts)/sizeof(*waterShaderParts),
+                waterShaderParts);
+        glUseProgram(waterShaderID);
+        glUniformBlockBinding(waterShaderID,
+                glGetUniformBlockIndex(waterShaderID,"SceneData"),
+                AppContext::SCENE_UNIFORMS);
+        glUniform1i(glGetUniformLocation(waterShaderID, "heightTexture"), 3);
+        glUniform1i(glGetUniformLocation(waterShaderID, "level"), level);
+        glUniform1i(glGetUniformLocation(waterShaderID, "patchSize"),
+                HEIGHT_PATCH);
+        glUniform3f(glGetUniformLocation(waterShaderID, "gridSize"),
+                gridSize.x, gridSize.y, gridSize.z);
+        glUniform3f(glGetUniformLocation(waterShaderID, "mapSize"),
+                mapSize.x, mapSize.y, mapSize.z);
+
+        glBindVertexArray(waterArrayID);
+        GLint gridAttrib = glGetAttribLocation(waterShaderID, "vGrid");
+        glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[PATCH_BUFFER]);
+        glVertexAttribPointer(gridAttrib, 2, GL_FLOAT, GL_FALSE, 0, 0);
+        glEnableVertexAttribArray(gridAttrib);
+        glUseProgram(shaderID);
+    }
+
+    // procedural terrain has no attributes, just level and octaves
+    if (procedural) {
+        detailUniforms();
+        return;
+    }
+
     // re-connect attribute arrays
     glBindVertexArray(varrayID);
 
@@ -344,17 +846,52 @@ void Terrain::updateShaders()
     glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[UV_BUFFER]);
     glVertexAttribPointer(uvAttrib, 2, GL_FLOAT, GL_FALSE, 0, 0);
     glEnableVertexAttribArray(uvAttrib);
+
+    overlayAttributes();
 }
 
 //
-// this is called every time the terrain needs to be redrawn 
+// connect the drainage and viewshed attributes, each enabled only while
+// shown, so the shader otherwise sees 0
 //
-void Terrain::draw() const
+void Terrain::overlayAttributes()
 {
-    // enable shaders
-    glUseProgram(shaderID);
-
-    // enable vertex arrays
+    glBindVertexArray(varrayID);
+    if (drainage) {
+        GLint flowAttrib = glGetAttribLocation(shaderID, "vFlow");
+        glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[FLOW_BUFFER]);
+        glVertexAttribPointer(flowAttrib, 1, GL_FLOAT, GL_FALSE, 0, 0);
+        if (drainageShown)
+            glEnableVertexAttribArray(flowAttrib);
+        else
+            glDisableVertexAttribArray(flowAttrib);
+    }
+
+    if (! viewMask.empty()) {
+        GLint hiddenAttrib = glGetAttribLocation(shaderID, "vHidden");
+        glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[HIDDEN_BUFFER]);
+        glVertexAttribPointer(hiddenAttrib, 1, GL_UNSIGNED_BYTE, GL_TRUE, 0, 0);
+        if (viewshedShown)
+            glEnableVertexAttribArray(hiddenAttrib);
+        else
+            glDisableVertexAttribArray(hiddenAttrib);
+    }
+}
+
+//
+// this is called every time the terrain needs to be redrawn 
+//
+void Terrain::draw(Scene &scene)
+{
+    if (erosion)
+        erodeStep();
+    if (drainageShown && drainageStale)
+        updateDrainage();
+
+    // enable shaders
+    glUseProgram(shaderID);
+
+    // enable vertex arrays
     glBindVertexArray(varrayID);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, textureIDs[COLOR_TEXTURE]);
@@ -362,9 +899,178 @@ void Terrain::draw() const
 	glActiveTexture(GL_TEXTURE1);
 	glBindTexture(GL_TEXTURE_2D, textureIDs[NORMAL_MAP_TEXTURE]);
 
+    // procedural terrain: one triangle strip per band between grid rows,
+    // each long enough for the widest band at the middle of the hexagon
+    if (procedural) {
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4*level + 5, 2*level + 2);
+        scene.stats.triangles += numtri;
+        return;
+    }
+
+    // height texture patches, if this terrain has grid rows
+    if (heightTextured) {
+        if (buildHeightTexture()) {
+            drawHeightTexture(scene);
+            return;
+        }
+        heightTextured = false;
+    }
+
     // draw the triangles for each three indices
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferIDs[INDEX_BUFFER]);
-    glDrawElements(GL_TRIANGLES, 3*numtri, GL_UNSIGNED_INT, 0);
+    if (! culling && ! simplified) {
+        glDrawElements(GL_TRIANGLES, 3*numtri, GL_UNSIGNED_INT, 0);
+        scene.stats.tilesDrawn += numtile;
+        scene.stats.triangles += numtri;
+        return;
+    }
+
+    unsigned int numvis = numtile;
+    if (culling)
+        numvis = cullTiles(scene);
+    else
+        for(unsigned int t=0; t < numtile; ++t)
+            visible[t] = t;
+
+    // simplified tiles: coarsest level whose error is under pixelError
+    // on screen, using pixels per world unit at unit distance
+    float pixelScale = 0;
+    if (simplified) {
+        if (numlod == 0)
+            buildLOD(LOD_ERRORS, sizeof(LOD_ERRORS)/sizeof(*LOD_ERRORS));
+        else
+            updateLOD();
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferIDs[LOD_INDEX_BUFFER]);
+        pixelScale = 0.5f * scene.height * scene.sdata.projection.matrix[1][1];
+    }
+
+    // visible tiles in index order, merging neighbors into one range
+    std::sort(visible.begin(), visible.begin() + numvis);
+    unsigned int numdraw = 0, prevEnd = ~0u;
+    for(unsigned int i=0; i < numvis; ++i) {
+        unsigned int t = visible[i];
+        unsigned int first = tileStart[t], end = tileStart[t+1];
+        if (simplified) {
+            Vec3f d;
+            for(int a=0; a < 3; ++a)
+                d[a] = std::max(std::max(tileMin[a][t] - scene.position[a],
+                                         scene.position[a] - tileMax[a][t]), 0.f);
+            float dist = length(d);
+            int lod = numlod-1;
+            while (lod > 0 && lodError[lod] * pixelScale > pixelError * dist)
+                --lod;
+            first = lodStart[lod*numtile + t];
+            end = lodEnd[lod*numtile + t];
+        }
+
+        int count = 3 * (end - first);
+        if (first == prevEnd)
+            drawCount[numdraw-1] += count;
+        else {
+            drawCount[numdraw] = count;
+            drawOffset[numdraw] = (const void*)(first * sizeof(unsigned int[3]));
+            ++numdraw;
+        }
+        prevEnd = end;
+        scene.stats.triangles += count / 3;
+    }
+    scene.stats.tilesDrawn += numvis;
+
+    glMultiDrawElements(GL_TRIANGLES, &drawCount[0], GL_UNSIGNED_INT,
+            &drawOffset[0], numdraw);
+}
+
+//
+// height texture and patch grid from the uniform grid vertices
+// returns false for terrain without grid rows
+//
+bool Terrain::buildHeightTexture()
+{
+    if (! heightTexels.empty()) return true;
+    if (! rowStart) {
+        printf("height texture needs uniform terrain\n");
+        return false;
+    }
+
+    // grid heights, and the height function past the edges of the
+    // hexagon so normals there still have neighbors
+    int size = 2*level + 3;
+    heightTexels.resize(size*size);
+    for(int row=0; row < size; ++row) {
+        for(int c=0; c < size; ++c) {
+            int x = 2*c + row - 3*(level + 1);
+            int v = gridVertex(row, x);
+            Vec3f P = vec3<float>(0.5f * x, sqrtf(0.75f) * (row - (level+1)), 0);
+            heightTexels[row*size + c] = v >= 0 ? vert[v].z
+                : elevation(P / gridSize, octaves).z * mapSize.z;
+        }
+    }
+
+    glBindTexture(GL_TEXTURE_2D, textureIDs[HEIGHT_TEXTURE]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, size, size, 0, GL_RED, GL_FLOAT,
+            &heightTexels[0]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // patch: (HEIGHT_PATCH+1)^2 texel offsets, with each cell split along
+    // the diagonal parallel to the cut corners of the hexagon, so cells
+    // clamped onto an edge of the hexagon collapse
+    std::vector<Vec2f> grid;
+    for(int y=0; y <= HEIGHT_PATCH; ++y)
+        for(int x=0; x <= HEIGHT_PATCH; ++x)
+            grid.push_back(vec2<float>(float(x), float(y)));
+
+    std::vector<unsigned short> index;
+    for(int y=0; y < HEIGHT_PATCH; ++y) {
+        for(int x=0; x < HEIGHT_PATCH; ++x) {
+            unsigned short v00 = y*(HEIGHT_PATCH+1) + x, v10 = v00 + 1;
+            unsigned short v01 = v00 + HEIGHT_PATCH+1, v11 = v01 + 1;
+            index.push_back(v00); index.push_back(v10); index.push_back(v01);
+            index.push_back(v10); index.push_back(v11); index.push_back(v01);
+        }
+    }
+
+    glGenVertexArrays(1, &patchArrayID);
+    glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[PATCH_BUFFER]);
+    glBufferData(GL_ARRAY_BUFFER, grid.size()*sizeof(Vec2f), &grid[0],
+            GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferIDs[PATCH_INDEX_BUFFER]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, index.size()*sizeof(unsigned short),
+            &index[0], GL_STATIC_DRAW);
+
+    patchShaderParts[0].id = glCreateShader(GL_VERTEX_SHADER);
+    patchShaderParts[0].file = "heightmap.vert";
+    patchShaderParts[1].id = glCreateShader(GL_FRAGMENT_SHADER);
+    patchShaderParts[1].file = "terrain.frag";
+    patchShaderID = glCreateProgram();
+    updateShaders();
+
+    printf("height texture: %d KB for %d samples\n",
+           int(heightTexels.size()*sizeof(float) / 1024), numvert);
+    return true;
+}
+
+//
+// draw grid patches over the height texture
+//
+void Terrain::drawHeightTexture(Scene &scene)
+{
+    glUseProgram(patchShaderID);
+    glBindVertexArray(patchArrayID);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, textureIDs[COLOR_TEXTURE]);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, textureIDs[HEIGHT_TEXTURE]);
+
+    // enough patches to cover the square of texels
+    int patches = (2*level + 2 + HEIGHT_PATCH-1) / HEIGHT_PATCH;
+    glUniform1i(glGetUniformLocation(patchShaderID, "patches"), patches);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferIDs[PATCH_INDEX_BUFFER]);
+    glDrawElementsInstanced(GL_TRIANGLES, 6*HEIGHT_PATCH*HEIGHT_PATCH,
+            GL_UNSIGNED_SHORT, 0, patches*patches);
+    scene.stats.triangles += numtri;
 }
 
 // return barycentric coordinates for P relative to v0/v1/v2 triangle
@@ -382,15 +1088,86 @@ static Vec3f barycentric(Vec2f P, Vec2f v0, Vec2f v1, Vec2f v2) {
     );
 }
 
+//
+// face under P, walking from the last face found. Far from the last face,
+// the walk starts in the tile under P instead
+// returns -1 if the walk leaves the mesh, or on procedural terrain
+//
+int Terrain::locateFace(Vec2f P) const
+{
+    if (procedural || numtri == 0) return -1;
+    int start = prevFace;
+    if (numtile && length(vert[indices[start][0]].xy - P) > tileSize) {
+        int t = tileFace(P);
+        if (t >= 0) start = t;
+    }
+
+    int i = walkFace(P, start);
+    if (i >= 0) prevFace = i;
+    return i;
+}
+
+//
+// first face of the tile under P, by binary search of the tiles in row
+// order, or -1 if P is in no tile
+//
+int Terrain::tileFace(Vec2f P) const
+{
+    int lo = 0, hi = numtile;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        Vec2f o = tileOrigin[mid];
+        if (o.y + tileSize <= P.y || (o.y <= P.y && o.x + tileSize <= P.x))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < int(numtile) && tileOrigin[lo].x <= P.x && tileOrigin[lo].y <= P.y)
+        return tileStart[lo];
+    return -1;
+}
+
+//
+// face under P, walking from face start toward P across the edge P is
+// outside of. returns -1 if the walk leaves the mesh
+//
+int Terrain::walkFace(Vec2f P, int start) const
+{
+#if HALF_EDGE
+    // give up after visiting as many faces as there are, in case the
+    // walk cycles
+    int steps = 0;
+    for(int i = start; i >= 0 && steps < int(numtri); ++steps) {
+        Vec3f bary = barycentric(P, vert[indices[i][0]].xy,
+                                 vert[indices[i][1]].xy, vert[indices[i][2]].xy);
+
+        // found our triangle
+        if (bary.x >= 0 && bary.y >= 0 && bary.z >= 0)
+            return i;
+
+        // find a negative edge and try to cross it
+        if (bary.z < 0)
+            i = triEdge[i]->pair->face;
+        else if (bary.x < 0)
+            i = triEdge[i]->next->pair->face;
+        else if (bary.y < 0)
+            i = triEdge[i]->next->next->pair->face;
+    }
+#endif
+    return -1;
+}
+
 //
 // set viewer height at given xy position
 // returns true if over navigation mesh
 //
 bool Terrain::setHeight(Vec3f &P, Vec3f &N) const {
-#if HALF_EDGE
-    static int prevFace = 0;
+    if (procedural)
+        return proceduralHeight(P, N);
 
-    for(int i = prevFace; i >= 0; ) {
+#if HALF_EDGE
+    int i = locateFace(P.xy);
+    if (i >= 0) {
         int i0 = indices[i][0];
         int i1 = indices[i][1];
         int i2 = indices[i][2];
@@ -401,28 +1178,15 @@ bool Terrain::setHeight(Vec3f &P, Vec3f &N) const {
 
         Vec3f bary = barycentric(P.xy, v0.xy, v1.xy, v2.xy);
 
-        // found our triangle
-        if (bary.x >= 0 && bary.y >= 0 && bary.z >= 0) {
-            prevFace = i;
-
-            // update the z
-            P.z = bary.x * v0.z + bary.y * v1.z + bary.z * v2.z;
-            P.z += 10; // viewer height above terrain
-
-            // set normal
-            N = bary.x * norm[i0] + bary.y * norm[i1] + bary.z * norm[i2];
+        // update the z
+        P.z = bary.x * v0.z + bary.y * v1.z + bary.z * v2.z;
+        P.z += VIEWER_HEIGHT;
 
-            // return success
-            return true;
-        }
+        // set normal
+        N = bary.x * norm[i0] + bary.y * norm[i1] + bary.z * norm[i2];
 
-        // find a negative edge and try to cross it
-        if (bary.z < 0)
-            i = triEdge[i]->pair->face;
-        else if (bary.x < 0)
-            i = triEdge[i]->next->pair->face;
-        else if (bary.y < 0)
-            i = triEdge[i]->next->next->pair->face;
+        // return success
+        return true;
     }
 
 #else
@@ -436,7 +1200,7 @@ bool Terrain::setHeight(Vec3f &P, Vec3f &N) const {
 
         // update the z
         P.z = bary.x * v0.z + bary.y * v1.z + bary.z * v2.z;
-        P.z += 10; // viewer height above terrain
+        P.z += VIEWER_HEIGHT;
 
         // set normal
         N = bary.x * norm[indices[i][0]] + bary.y * norm[indices[i][1]] + bary.z * norm[indices[i][2]];
@@ -449,4 +1213,2096 @@ bool Terrain::setHeight(Vec3f &P, Vec3f &N) const {
     return false;
 }
 
+//
+// surface at a batch of points, each walking from its own starting face,
+// or when that is not known, from the face found for the point before it
+// if near, else from the tile under it. Nothing shared is written, so
+// several batches can run at once
+//
+unsigned int Terrain::surfaceQuery(const SurfaceBatch &batch) const
+{
+    unsigned int found = 0;
+    for(unsigned int k=0; k < batch.count; ++k) {
+        Vec2f P = vec2<float>(batch.x[k], batch.y[k]);
+        Vec3f height, normal;
+        if (procedural) {
+            height = vec3<float>(P.x, P.y, 0);
+            bool on = proceduralHeight(height, normal);
+            batch.face[k] = on ? 0 : -1;
+            if (! on) continue;
+            height.z -= VIEWER_HEIGHT;
+        }
+        else {
+            int start = batch.face[k];
+            if (start < 0 && k > 0 && batch.face[k-1] >= 0 && numtile &&
+                length(vert[indices[batch.face[k-1]][0]].xy - P) <= tileSize)
+                start = batch.face[k-1];
+            if (start < 0) start = numtile ? tileFace(P) : 0;
+            int i = start < 0 ? -1 : walkFace(P, start);
+            batch.face[k] = i;
+            if (i < 0) continue;
+
+            const unsigned int *v = indices[i];
+            Vec3f bary = barycentric(P, vert[v[0]].xy, vert[v[1]].xy, vert[v[2]].xy);
+            height.z = bary.x * vert[v[0]].z + bary.y * vert[v[1]].z
+                     + bary.z * vert[v[2]].z;
+            if (batch.nx || batch.ny || batch.nz)
+                normal = bary.x * norm[v[0]] + bary.y * norm[v[1]]
+                       + bary.z * norm[v[2]];
+        }
+
+        if (batch.z) batch.z[k] = height.z;
+        if (batch.nx) batch.nx[k] = normal.x;
+        if (batch.ny) batch.ny[k] = normal.y;
+        if (batch.nz) batch.nz[k] = normal.z;
+        ++found;
+    }
+    return found;
+}
+
+
+//
+// world position and normal at grid row and grid x coordinate, as
+// computed by procedural.vert: normal from central differences one grid
+// step away
+//
+Vec3f Terrain::gridPoint(int row, int x, Vec3f &N) const
+{
+    Vec3f g = vec3<float>(0.5f * x, sqrtf(0.75f) * (row - (level+1)), 0);
+    Vec3f dx = vec3<float>(1,0,0), dy = vec3<float>(0,1,0);
+    Vec2f step = mapSize.xy / gridSize.xy;
+    float hx = elevation((g - dx) / gridSize, octaves).z
+             - elevation((g + dx) / gridSize, octaves).z;
+    float hy = elevation((g - dy) / gridSize, octaves).z
+             - elevation((g + dy) / gridSize, octaves).z;
+    N = normalize(vec3<float>(hx * mapSize.z * step.y,
+                              hy * mapSize.z * step.x,
+                              2 * step.x * step.y));
+    return elevation(g / gridSize, octaves) * mapSize;
+}
+
+//
+// setHeight for procedural terrain
+// the triangle under P is one of the two in its band sharing the grid
+// column of P, so evaluate just their corners
+//
+bool Terrain::proceduralHeight(Vec3f &P, Vec3f &N) const
+{
+    // band between grid rows, and doubled grid x
+    float rowf = P.y / mapSize.y * gridSize.y / sqrtf(0.75f) + level + 1;
+    float xf = 2 * P.x / mapSize.x * gridSize.x;
+    if (rowf < 0 || rowf > 2*level + 2) return false;
+    int band = std::min(int(rowf), 2*level + 1);
+    int k = int(floorf(xf));
+
+    // the two rows hold alternate x, so the row of x is set by its parity
+    int y0 = level + 1 - abs(band - (level + 1));
+    for(int t=0; t < 2; ++t) {
+        int x[3], row[3];
+        Vec3f v[3], n[3];
+        bool inside = true;
+        for(int c=0; c < 3; ++c) {
+            x[c] = k - 1 + t + c;
+            row[c] = ((x[c] + y0 + level + 1) & 1) == 0 ? band : band + 1;
+            int y = level + 1 - abs(row[c] - (level + 1));
+            if (abs(x[c]) > y + level + 1) inside = false;
+        }
+        if (! inside) continue;
+
+        for(int c=0; c < 3; ++c)
+            v[c] = vec3<float>(0.5f * x[c] / gridSize.x * mapSize.x,
+                               sqrtf(0.75f) * (row[c] - (level+1))
+                                   / gridSize.y * mapSize.y, 0);
+        Vec3f bary = barycentric(P.xy, v[0].xy, v[1].xy, v[2].xy);
+        if (bary.x < 0 || bary.y < 0 || bary.z < 0) continue;
+
+        for(int c=0; c < 3; ++c)
+            v[c] = gridPoint(row[c], x[c], n[c]);
+        P.z = bary.x * v[0].z + bary.y * v[1].z + bary.z * v[2].z;
+        P.z += VIEWER_HEIGHT;
+        N = bary.x * n[0] + bary.y * n[1] + bary.z * n[2];
+        return true;
+    }
+    return false;
+}
+
+
+//////////////////
+// grid topology
+//
+// vertices are stored in 2*level+3 rows of increasing y. Row r is
+// y = level+1 - |r - (level+1)| rows in from the top or bottom edge, and
+// holds y+level+2 vertices at grid x = -(y+level+1), -(y+level+1)+2, ...
+// neighbors are x+-2 in the same row and x+-1 in the rows above and below
+
+//
+// vertex index at grid row and grid x coordinate, -1 if off the map
+//
+int Terrain::gridVertex(int row, int x) const
+{
+    if (row < 0 || row > 2*level + 2) return -1;
+    int y = level + 1 - abs(row - (level + 1));
+    int col = x + y + level + 1;
+    if (col < 0 || col > 2*(y + level + 1)) return -1;
+    return rowStart[row] + col/2;
+}
+
+//
+// range of grid rows within distance r of world y
+//
+void Terrain::gridRows(float y, float r, int &rowLo, int &rowHi) const
+{
+    float toRow = gridSize.y / (sqrtf(0.75) * mapSize.y);
+    rowLo = int(ceilf((y - r) * toRow)) + level + 1;
+    rowHi = int(floorf((y + r) * toRow)) + level + 1;
+    if (rowLo < 0) rowLo = 0;
+    if (rowHi > 2*level + 2) rowHi = 2*level + 2;
+}
+
+//
+// range of grid x within distance r of center in this row
+//
+bool Terrain::gridSpan(int row, Vec2f center, float r, int &xLo, int &xHi) const
+{
+    float dy = sqrtf(0.75) * (row - level - 1) * mapSize.y / gridSize.y
+        - center.y;
+    if (dy*dy > r*r) return false;
+    float halfWidth = sqrtf(r*r - dy*dy);
+
+    // grid x in this row all have the same parity as y+level+1
+    float toX = 2 * gridSize.x / mapSize.x;
+    int y = level + 1 - abs(row - (level + 1));
+    xLo = int(ceilf((center.x - halfWidth) * toX));
+    xHi = int(floorf((center.x + halfWidth) * toX));
+    if ((xLo + y + level + 1) & 1) ++xLo;
+    if ((xHi + y + level + 1) & 1) --xHi;
+    if (xLo < -(y + level + 1)) xLo = -(y + level + 1);
+    if (xHi > y + level + 1) xHi = y + level + 1;
+    return xLo <= xHi;
+}
+
+//
+// recompute one vertex normal from the faces around it
+// matches the face normal sum used when building the terrain
+//
+void Terrain::gridNormal(int row, int x)
+{
+    // neighbors in counter-clockwise order, starting at +x
+    static const int ring[6][2] = {
+        {0,2}, {1,1}, {1,-1}, {0,-2}, {-1,-1}, {-1,1}
+    };
+    int n[6];
+    for(int i=0; i < 6; ++i)
+        n[i] = gridVertex(row + ring[i][0], x + ring[i][1]);
+
+    // each pair of adjacent neighbors forms one face
+    int v = gridVertex(row, x);
+    Vec3f sum = vec3<float>(0,0,0);
+    for(int i=0; i < 6; ++i) {
+        int a = n[i], b = n[(i+1) % 6];
+        if (a < 0 || b < 0) continue;
+        sum += normalize((vert[a] - vert[v]) ^ (vert[b] - vert[v]));
+    }
+    norm[v] = normalize(sum);
+}
+
+// smooth brush falloff from 1 at center to 0 at t=1
+static float falloff(float t)
+{
+    float s = 1 - t*t;
+    return s*s;
+}
+
+// crater brush: bowl of depth 1 at center with a small raised rim
+static float crater(float t)
+{
+    return (2*t*t - 1) * (1 - t*t);
+}
+
+//
+// deform terrain heights within radius of center
+// only vertices within radius+one grid step are touched, and only
+// their range of the position and normal buffers is uploaded
+//
+void Terrain::applyBrush(Vec2f center, float radius, BrushProfile profile,
+                         float strength)
+{
+    // vertices closer than this in the buffer upload as one range, since
+    // a few extra bytes are cheaper than another glBufferSubData call
+    const unsigned int MERGE_GAP = 64;
+
+    // brushes find vertices by grid row, which graded terrain does not have
+    if (! rowStart) {
+        printf("brushes need uniform terrain\n");
+        return;
+    }
+
+    int rowLo, rowHi, xLo, xHi;
+
+    // flatten toward weighted average height under brush
+    float target = 0, weight = 0;
+    if (profile == BRUSH_FLATTEN) {
+        gridRows(center.y, radius, rowLo, rowHi);
+        for(int row = rowLo; row <= rowHi; ++row) {
+            if (! gridSpan(row, center, radius, xLo, xHi)) continue;
+            for(int x = xLo; x <= xHi; x += 2) {
+                int v = gridVertex(row, x);
+                float w = falloff(length(vert[v].xy - center) / radius);
+                target += w * vert[v].z;
+                weight += w;
+            }
+        }
+        if (weight > 0) target /= weight;
+    }
+
+    // update heights, tracking range of new heights
+    float zLo = FLT_MAX, zHi = -FLT_MAX;
+    gridRows(center.y, radius, rowLo, rowHi);
+    for(int row = rowLo; row <= rowHi; ++row) {
+        if (! gridSpan(row, center, radius, xLo, xHi)) continue;
+        for(int x = xLo; x <= xHi; x += 2) {
+            int v = gridVertex(row, x);
+            float t = length(vert[v].xy - center) / radius;
+            if (t >= 1) continue;
+
+            switch (profile) {
+            case BRUSH_RAISE:   vert[v].z += strength * falloff(t); break;
+            case BRUSH_LOWER:   vert[v].z -= strength * falloff(t); break;
+            case BRUSH_CRATER:  vert[v].z += strength * crater(t);  break;
+            case BRUSH_FLATTEN:
+                vert[v].z += (target - vert[v].z) * falloff(t);
+                break;
+            default: break;
+            }
+            zLo = std::min(zLo, vert[v].z);
+            zHi = std::max(zHi, vert[v].z);
+            if (erosion)
+                erosion->set(axialColumn(row, x), row, vert[v].z);
+            if (water)
+                water->setGround(axialColumn(row, x), row, vert[v].z);
+        }
+    }
+    drainageStale = true;
+    if (navmesh) {
+        // faces touching changed vertices all overlap this box
+        navDirty.push_back(center - radius);
+        navDirty.push_back(center + radius);
+    }
+    rayBounds.clear();
+
+    // changed heights as one texel rectangle, if drawing that way
+    if (! heightTexels.empty()) {
+        int size = 2*level + 3, cLo = size, cHi = -1;
+        gridRows(center.y, radius, rowLo, rowHi);
+        for(int row = rowLo; row <= rowHi; ++row) {
+            if (! gridSpan(row, center, radius, xLo, xHi)) continue;
+            for(int x = xLo; x <= xHi; x += 2)
+                heightTexels[heightTexel(row, x)] = vert[gridVertex(row, x)].z;
+            cLo = std::min(cLo, heightTexel(row, xLo) - row*size);
+            cHi = std::max(cHi, heightTexel(row, xHi) - row*size);
+        }
+        if (cHi >= cLo) {
+            glBindTexture(GL_TEXTURE_2D, textureIDs[HEIGHT_TEXTURE]);
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, size);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, cLo, rowLo, cHi - cLo + 1,
+                    rowHi - rowLo + 1, GL_RED, GL_FLOAT,
+                    &heightTexels[rowLo*size + cLo]);
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        }
+    }
+
+    // grow tile bounds and floors to keep culling conservative
+    float spacing = mapSize.x / gridSize.x;
+    for(unsigned int t=0; t < numtile; ++t) {
+        if (tileMin[0][t] <= center.x + radius && tileMax[0][t] >= center.x - radius &&
+            tileMin[1][t] <= center.y + radius && tileMax[1][t] >= center.y - radius) {
+            tileMin[2][t] = std::min(tileMin[2][t], zLo);
+            tileMax[2][t] = std::max(tileMax[2][t], zHi);
+        }
+
+        // floors and simplified levels also see the ring around the tile
+        Vec2f lo = tileOrigin[t] - spacing, hi = tileOrigin[t] + (tileSize + spacing);
+        if (lo.x <= center.x + radius && hi.x >= center.x - radius &&
+            lo.y <= center.y + radius && hi.y >= center.y - radius) {
+            if (tileFloor[t] > -FLT_MAX)
+                tileFloor[t] = std::min(tileFloor[t], zLo);
+            if (numlod) lodStale[t] = 1;
+        }
+    }
+
+    // normals change for changed vertices and their neighbors
+    // collect changed buffer ranges as we go: rows are in index order
+    std::vector<unsigned int> dirty;    // pairs of [start, end)
+    float ring = radius + spacing;
+    gridRows(center.y, ring, rowLo, rowHi);
+    for(int row = rowLo; row <= rowHi; ++row) {
+        if (! gridSpan(row, center, ring, xLo, xHi)) continue;
+        for(int x = xLo; x <= xHi; x += 2)
+            gridNormal(row, x);
+
+        unsigned int start = gridVertex(row, xLo), end = gridVertex(row, xHi)+1;
+        if (! dirty.empty() && start - dirty.back() <= MERGE_GAP)
+            dirty.back() = end;
+        else {
+            dirty.push_back(start);
+            dirty.push_back(end);
+        }
+    }
+
+    uploadVertices(dirty);
+}
+
+//
+// send positions and normals of vertex ranges to the GPU
+// dirty holds pairs of [start, end) vertex indices
+//
+void Terrain::uploadVertices(const std::vector<unsigned int> &dirty)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[POSITION_BUFFER]);
+    for(size_t i=0; i < dirty.size(); i += 2)
+        glBufferSubData(GL_ARRAY_BUFFER, dirty[i]*sizeof(Vec3f),
+                (dirty[i+1] - dirty[i])*sizeof(Vec3f), vert + dirty[i]);
+
+    glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[NORMAL_BUFFER]);
+    for(size_t i=0; i < dirty.size(); i += 2)
+        glBufferSubData(GL_ARRAY_BUFFER, dirty[i]*sizeof(Vec3f),
+                (dirty[i+1] - dirty[i])*sizeof(Vec3f), norm + dirty[i]);
+}
+
+//////////////////
+// erosion
+
+//
+// erode heights for the next iterations frames, or add iterations if
+// already eroding
+//
+void Terrain::erode(int iterations, int kinds)
+{
+    // erosion finds neighbors by grid row, like brushes
+    if (! rowStart) {
+        printf("erosion needs uniform terrain\n");
+        return;
+    }
+
+    if (! erosion) {
+        erosion = new Erosion(2*level + 3, mapSize.x / gridSize.x);
+        for(int row=0; row <= 2*level + 2; ++row) {
+            int y = level + 1 - abs(row - (level + 1));
+            unsigned int v = rowStart[row];
+            for(int x = -(y + level + 1); x <= y + level + 1; x += 2, ++v)
+                erosion->set(axialColumn(row, x), row, vert[v].z);
+        }
+        erosionDone = 0;
+        erosionTime = 0;
+    }
+    erosionKinds = kinds;
+    erosionLeft += iterations;
+}
+
+//
+// run one erosion iteration, then update normals, tile bounds, and the
+// GPU copies of just the rows that changed
+//
+void Terrain::erodeStep()
+{
+    double start = glfwGetTime();
+    erosion->iterate(erosionKinds);
+    erosionTime += glfwGetTime() - start;
+    ++erosionDone;
+
+    // copy heights back, noting changed rows and the deepest drop
+    int rows = 2*level + 3;
+    std::vector<char> changed(rows, 0);
+    float drop = 0;
+    for(int row=0; row < rows; ++row) {
+        int y = level + 1 - abs(row - (level + 1));
+        unsigned int v = rowStart[row];
+        for(int x = -(y + level + 1); x <= y + level + 1; x += 2, ++v) {
+            float z = erosion->get(axialColumn(row, x), row);
+            if (z == vert[v].z) continue;
+            drop = std::max(drop, vert[v].z - z);
+            vert[v].z = z;
+            if (water)
+                water->setGround(axialColumn(row, x), row, z);
+            changed[row] = 1;
+        }
+    }
+
+    // normals of changed rows and their neighbors, uploaded as merged
+    // row ranges
+    std::vector<unsigned int> dirty;    // pairs of [start, end)
+    int rowLo = rows, rowHi = -1;
+    for(int row=0; row < rows; ++row) {
+        if (! changed[row] && ! (row > 0 && changed[row-1]) &&
+            ! (row+1 < rows && changed[row+1]))
+            continue;
+        int y = level + 1 - abs(row - (level + 1));
+        for(int x = -(y + level + 1); x <= y + level + 1; x += 2)
+            gridNormal(row, x);
+
+        if (! dirty.empty() && dirty.back() == rowStart[row])
+            dirty.back() = rowStart[row+1];
+        else {
+            dirty.push_back(rowStart[row]);
+            dirty.push_back(rowStart[row+1]);
+        }
+        rowLo = std::min(rowLo, row);
+        rowHi = std::max(rowHi, row);
+    }
+    uploadVertices(dirty);
+    drainageStale = true;
+    navStale = true;
+    rayBounds.clear();
+
+    // exact tile height ranges; floors only need to stay below the terrain
+    for(unsigned int t=0; t < numtile; ++t) {
+        float zLo = FLT_MAX, zHi = -FLT_MAX;
+        for(unsigned int i = tileStart[t]; i < tileStart[t+1]; ++i) {
+            for(int k=0; k < 3; ++k) {
+                zLo = std::min(zLo, vert[indices[i][k]].z);
+                zHi = std::max(zHi, vert[indices[i][k]].z);
+            }
+        }
+        tileMin[2][t] = zLo;
+        tileMax[2][t] = zHi;
+        if (tileFloor[t] > -FLT_MAX)
+            tileFloor[t] -= drop;
+    }
+
+    // height texture rows, if drawing that way
+    if (! heightTexels.empty() && rowHi >= rowLo) {
+        for(int row = rowLo; row <= rowHi; ++row) {
+            int y = level + 1 - abs(row - (level + 1));
+            unsigned int v = rowStart[row];
+            for(int x = -(y + level + 1); x <= y + level + 1; x += 2, ++v)
+                heightTexels[heightTexel(row, x)] = vert[v].z;
+        }
+        glBindTexture(GL_TEXTURE_2D, textureIDs[HEIGHT_TEXTURE]);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, rowLo, rows, rowHi - rowLo + 1,
+                GL_RED, GL_FLOAT, &heightTexels[rowLo*rows]);
+    }
+
+    if (--erosionLeft > 0) return;
+
+    printf("erosion: %d iterations in %.2f s, %.1f per second on %u threads\n",
+           erosionDone, erosionTime, erosionDone / erosionTime,
+           erosion->threads());
+    delete erosion;
+    erosion = 0;
+
+    // simplified tiles no longer match the surface, rebuild when drawn
+    freeLOD();
+}
+
+//////////////////
+// drainage
+
+//
+// show or hide the drainage overlay
+//
+void Terrain::toggleDrainage()
+{
+    if (procedural) {
+        printf("drainage needs mesh terrain\n");
+        return;
+    }
+#if HALF_EDGE
+    drainageShown = !drainageShown;
+    if (! drainage) {
+        drainage = new Drainage(numvert, vert, numtri, indices, numedge, edge);
+        glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[FLOW_BUFFER]);
+        glBufferData(GL_ARRAY_BUFFER, numvert*sizeof(float), 0,
+                GL_DYNAMIC_DRAW);
+        drainageStale = true;
+    }
+    overlayAttributes();
+
+    // report once when shown, rather than on every recompute after edits
+    if (drainageShown) {
+        double start = glfwGetTime();
+        float largest = updateDrainage();
+        double time = glfwGetTime() - start;
+        printf("drainage: %d vertices, %u pits, largest basin %.1f%% of the map, "
+               "%.1f ms on %u threads\n", numvert, drainage->pits(),
+               100 * largest, 1000 * time, drainage->threads());
+    }
+#else
+    printf("drainage needs half-edge connectivity\n");
+#endif
+}
+
+//
+// flow directions and areas for the current heights, sent to the GPU as
+// the fraction of the map draining through each vertex
+//
+float Terrain::updateDrainage()
+{
+    drainage->update();
+
+    std::vector<float> flow(numvert);
+    float largest = 0;
+    for(unsigned int v=0; v < numvert; ++v) {
+        flow[v] = drainage->area(v) / drainage->total();
+        if (drainage->downstream(v) < 0)
+            largest = std::max(largest, flow[v]);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[FLOW_BUFFER]);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, numvert*sizeof(float), &flow[0]);
+    drainageStale = false;
+    return largest;
+}
+
+//////////////////
+// navigation
+
+// goals kept with flow fields at once
+const unsigned int FLOW_FIELDS = 4;
+
+//
+// face graph for path queries, built on first use, with centroids and
+// slopes updated if heights changed since the last call
+//
+const NavMesh *Terrain::navigation()
+{
+    if (procedural) {
+        printf("navigation needs mesh terrain\n");
+        return 0;
+    }
+#if HALF_EDGE
+    if (! navmesh) {
+        navmesh = new NavMesh(vert, numtri, indices, numedge, edge);
+        navStale = false;
+        navDirty.clear();
+    }
 
+    if (navStale) {
+        navmesh->update();
+        if (navclusters) navclusters->update();
+        if (navflows) navflows->clear();
+    }
+    else if (! navDirty.empty()) {
+        std::vector<unsigned int> faces;
+        for(size_t i=0; i < navDirty.size(); i += 2) {
+            trianglesInBox(navDirty[i], navDirty[i+1], faces);
+            navmesh->update(faces);
+            if (navclusters) navclusters->update(faces);
+            if (navflows) navflows->changed(faces);
+        }
+    }
+    navStale = false;
+    navDirty.clear();
+    return navmesh;
+#else
+    printf("navigation needs half-edge connectivity\n");
+    return 0;
+#endif
+}
+
+//
+// clusters of the face graph, built on first use, and rebuilt where
+// heights changed since the last call
+//
+const NavHierarchy *Terrain::navigationHierarchy()
+{
+    const NavMesh *nav = navigation();
+    if (nav && ! navclusters) {
+        double start = glfwGetTime();
+        navclusters = new NavHierarchy(*nav);
+        printf("navigation: %u clusters, %u portals, built in %.1f ms on %u "
+               "threads\n", navclusters->clusterCount(), navclusters->portals(),
+               1000 * (glfwGetTime() - start), navclusters->threads());
+    }
+    return navclusters;
+}
+
+//
+// flow fields over the clusters, made on first use. Fields themselves are
+// built as goals are asked for
+//
+FlowFields *Terrain::flowFields()
+{
+    const NavHierarchy *tree = navigationHierarchy();
+    if (tree && ! navflows)
+        navflows = new FlowFields(*navmesh, *tree, FLOW_FIELDS);
+    return navflows;
+}
+
+//
+// face under P for anything that needs to look up faces, such as flow
+// fields
+//
+int Terrain::faceAt(Vec2f P) const
+{
+    return procedural ? -1 : locateFace(P);
+}
+
+//////////////////
+// viewshed
+
+// angular sectors swept in parallel by the viewshed
+const int VIEWSHED_SECTORS = 64;
+
+// most horizon bins around the viewshed observer
+const int VIEWSHED_BINS = 1 << 16;
+
+//
+// mark vertices within radius of observer.xy that it can see
+// returns the number visible
+//
+unsigned int Terrain::viewshed(Vec3f observer, float radius)
+{
+    if (procedural) {
+        printf("viewshed needs mesh terrain\n");
+        return 0;
+    }
+    double start = glfwGetTime();
+
+    // enough horizon bins for one grid spacing at the radius, in whole
+    // sectors; each vertex blocks the bins one spacing wide around it
+    float spacing = mapSize.x / gridSize.x;
+    int perSector = int(ceilf(2*F_PI * radius / spacing / VIEWSHED_SECTORS));
+    perSector = std::max(1, std::min(perSector, VIEWSHED_BINS / VIEWSHED_SECTORS));
+    int bins = perSector * VIEWSHED_SECTORS;
+    float binScale = bins / (2*F_PI);
+
+    // sort vertices into every sector they block, noting distance and
+    // bins. Vertices beyond the radius are hidden
+    struct Sample {
+        float dist;             // xy distance from observer
+        unsigned int vert;      // vertex index
+        int center, lo, hi;     // bin of vertex, and bins it blocks
+        bool operator<(const Sample &s) const { return dist < s.dist; }
+    };
+    std::vector<std::vector<Sample> > sector(VIEWSHED_SECTORS);
+    viewMask.assign(numvert, 0);
+    for(unsigned int v=0; v < numvert; ++v) {
+        Vec2f d = vert[v].xy - observer.xy;
+        Sample s;
+        s.dist = length(d);
+        s.vert = v;
+        if (s.dist > radius) continue;
+
+        float angle = atan2f(d.y, d.x) + F_PI;
+        float half = s.dist > 0.5f*spacing ? asinf(0.5f*spacing / s.dist) : F_PI;
+        s.center = std::min(int(angle * binScale), bins - 1);
+        s.lo = int(floorf((angle - half) * binScale));
+        s.hi = std::min(int(floorf((angle + half) * binScale)), s.lo + bins - 1);
+
+        // bins lo..hi may wrap once past either end
+        for(int w = -bins; w <= bins; w += bins) {
+            int k0 = std::max(s.lo - w, 0), k1 = std::min(s.hi - w, bins - 1);
+            for(int k = k0 / perSector; k0 <= k1 && k <= k1 / perSector; ++k)
+                sector[k].push_back(s);
+        }
+    }
+
+    // sweep each sector outward: a vertex is visible if its elevation
+    // angle clears everything nearer in its bin, then it raises the
+    // horizon across the bins it blocks
+    std::atomic<unsigned int> visible(0);
+    parallelFor(VIEWSHED_SECTORS, parallelThreads(), [&](int i) {
+        std::vector<Sample> &list = sector[i];
+        std::sort(list.begin(), list.end());
+        std::vector<float> horizon(perSector, -FLT_MAX);
+        int base = i * perSector;
+        unsigned int count = 0;
+        for(size_t j=0; j < list.size(); ++j) {
+            const Sample &s = list[j];
+            float slope = (vert[s.vert].z - observer.z) / std::max(s.dist, 1e-6f);
+            if (s.center >= base && s.center < base + perSector &&
+                slope >= horizon[s.center - base] && ! viewMask[s.vert]) {
+                viewMask[s.vert] = 1;
+                ++count;
+            }
+
+            for(int w = -bins; w <= bins; w += bins) {
+                int k0 = std::max(s.lo - w, base);
+                int k1 = std::min(s.hi - w, base + perSector - 1);
+                for(int k = k0; k <= k1; ++k)
+                    horizon[k - base] = std::max(horizon[k - base], slope);
+            }
+        }
+        visible += count;
+    });
+
+    glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[HIDDEN_BUFFER]);
+    std::vector<unsigned char> hidden(numvert);
+    for(unsigned int v=0; v < numvert; ++v)
+        hidden[v] = 255 * (1 - viewMask[v]);
+    glBufferData(GL_ARRAY_BUFFER, numvert, &hidden[0], GL_DYNAMIC_DRAW);
+    viewshedShown = true;
+    overlayAttributes();
+
+    printf("viewshed: %u of %u vertices visible, %d bins, %.1f ms\n",
+           (unsigned int)visible, numvert, bins, 1000*(glfwGetTime() - start));
+    return visible;
+}
+
+//
+// true if nothing on the terrain blocks the segment from a to b
+//
+bool Terrain::lineOfSight(Vec3f a, Vec3f b) const
+{
+    // procedural terrain has no triangles to cast against: sample at half
+    // the grid spacing, so no grid triangle is skipped
+    if (procedural) {
+        float spacing = mapSize.x / gridSize.x;
+        int steps = int(ceilf(2 * length(b.xy - a.xy) / spacing));
+        for(int i=1; i < steps; ++i) {
+            float t = float(i) / steps;
+            Vec3f P = a + t * (b - a), N;
+            float z = P.z;
+            if (setHeight(P, N) && P.z - VIEWER_HEIGHT > z)
+                return false;
+        }
+        return true;
+    }
+
+    // only hits before b count
+    RayHit hit;
+    hit.t = 1;
+    if (! rowStart) return ! raycastTiles(a, b - a, hit);
+    prepareRaycasts();
+    return ! raycastGrid(a, b - a, hit);
+}
+
+//
+// stop tinting hidden vertices
+//
+void Terrain::hideViewshed()
+{
+    viewshedShown = false;
+    if (! procedural)
+        overlayAttributes();
+}
+
+//////////////////
+// raycasts
+
+// rays handed to a thread at a time by the batched raycast
+const int RAY_BLOCK = 256;
+
+// entry and exit t for a ray through box lo..hi, in as many dimensions as
+// given. returns false if it misses or the box is entirely behind
+template <int N>
+static bool rayBox(const float *o, const float *inv, const float *lo,
+                   const float *hi, float &t0, float &t1)
+{
+    for(int a=0; a < N; ++a) {
+        float ta = (lo[a] - o[a]) * inv[a], tb = (hi[a] - o[a]) * inv[a];
+        if (ta > tb) std::swap(ta, tb);
+        if (ta != ta) continue;     // ray in the plane of a face: 0 * inf
+        t0 = std::max(t0, ta);
+        t1 = std::min(t1, tb);
+    }
+    return t0 <= t1;
+}
+
+// fill in hit at t along o + t*d, on triangle i with barycentric weights
+// 1-u-v, u and v
+static void setHit(Vec3f o, Vec3f d, float t, const Vec3f *vert,
+                   const Vec3f *norm, const unsigned int i[3], float u, float v,
+                   Terrain::RayHit &hit)
+{
+    hit.t = t;
+    hit.position = o + t*d;
+    hit.normal = normalize((vert[i[1]] - vert[i[0]]) ^ (vert[i[2]] - vert[i[0]]));
+    if (hit.normal.z < 0) hit.normal = -hit.normal;
+    hit.vertexNormal = normalize((1 - u - v) * norm[i[0]] + u * norm[i[1]]
+                                 + v * norm[i[2]]);
+}
+
+// hit of ray o + t*d with triangle i, if 0 <= t < hit.t
+// Moller and Trumbore, "Fast, Minimum Storage Ray/Triangle Intersection"
+static bool rayTriangle(Vec3f o, Vec3f d, const Vec3f *vert, const Vec3f *norm,
+                        const unsigned int i[3], Terrain::RayHit &hit)
+{
+    Vec3f v0 = vert[i[0]];
+    Vec3f e1 = vert[i[1]] - v0, e2 = vert[i[2]] - v0;
+    Vec3f p = d ^ e2;
+    float det = dot(e1, p);
+    if (det == 0) return false;
+    float inv = 1 / det;
+    Vec3f s = o - v0;
+    float u = dot(s, p) * inv;
+    if (u < 0 || u > 1) return false;
+    Vec3f q = s ^ e1;
+    float v = dot(d, q) * inv;
+    if (v < 0 || u + v > 1) return false;
+    float t = dot(e2, q) * inv;
+    if (t < 0 || t >= hit.t) return false;
+
+    setHit(o, d, t, vert, norm, i, u, v, hit);
+    return true;
+}
+
+//
+// vertices of the mesh triangles in axial grid cell c,r, returning how many
+// cell c,r has corners c..c+1 by r..r+1, split into triangles c,r c+1,r
+// c,r+1 and c+1,r c+1,r+1 c,r+1, exactly the grid triangles there
+//
+int Terrain::cellTriangles(int c, int r, unsigned int tri[2][3]) const
+{
+    int v[4];
+    for(int k=0; k < 4; ++k) {
+        int cc = c + (k & 1), rr = r + (k >> 1);
+        v[k] = gridVertex(rr, 2*cc + rr - 3*(level + 1));
+    }
+
+    int count = 0;
+    if (v[0] >= 0 && v[1] >= 0 && v[2] >= 0) {
+        tri[count][0] = v[0]; tri[count][1] = v[1]; tri[count][2] = v[2];
+        ++count;
+    }
+    if (v[1] >= 0 && v[3] >= 0 && v[2] >= 0) {
+        tri[count][0] = v[1]; tri[count][1] = v[3]; tri[count][2] = v[2];
+        ++count;
+    }
+    return count;
+}
+
+//
+// min/max height pyramid over the cells of the axial grid
+//
+void Terrain::buildRayBounds() const
+{
+    int cells = 2*level + 2;
+    for(rayLevels = 1; (1 << (rayLevels-1)) < cells; ++rayLevels) {}
+    rayLevelStart.resize(rayLevels + 1);
+    rayLevelStart[0] = 0;
+    for(int l=0; l < rayLevels; ++l) {
+        int across = 1 << (rayLevels - 1 - l);
+        rayLevelStart[l+1] = rayLevelStart[l] + across*across;
+    }
+    rayBounds.assign(rayLevelStart[rayLevels], vec2<float>(FLT_MAX, -FLT_MAX));
+
+    // finest level from the triangles with all corners on the mesh
+    int across = 1 << (rayLevels - 1);
+    for(int r=0; r < cells; ++r) {
+        for(int c=0; c < cells; ++c) {
+            unsigned int tri[2][3];
+            int count = cellTriangles(c, r, tri);
+            Vec2f &b = rayBounds[r*across + c];
+            for(int t=0; t < count; ++t) {
+                for(int k=0; k < 3; ++k) {
+                    b.x = std::min(b.x, vert[tri[t][k]].z);
+                    b.y = std::max(b.y, vert[tri[t][k]].z);
+                }
+            }
+        }
+    }
+
+    // each coarser node bounds its four children
+    for(int l=1; l < rayLevels; ++l) {
+        int n = 1 << (rayLevels - 1 - l);
+        const Vec2f *child = &rayBounds[rayLevelStart[l-1]];
+        Vec2f *node = &rayBounds[rayLevelStart[l]];
+        for(int j=0; j < n; ++j) {
+            for(int i=0; i < n; ++i) {
+                Vec2f &b = node[j*n + i];
+                for(int k=0; k < 4; ++k) {
+                    const Vec2f &cb = child[(2*j + (k>>1))*2*n + 2*i + (k&1)];
+                    b.x = std::min(b.x, cb.x);
+                    b.y = std::max(b.y, cb.y);
+                }
+            }
+        }
+    }
+}
+
+//
+// nearest grid hit closer than hit.t, descending the min/max pyramid front
+// to back, so the first cell with a hit holds the nearest one
+//
+bool Terrain::raycastGrid(Vec3f o, Vec3f d, RayHit &hit) const
+{
+    // ray in axial cell coordinates, with the same t
+    float toCell = gridSize.x / mapSize.x;
+    float toRow = toCell / sqrtf(0.75f), shear = 0.5f * toRow;
+    int n = level + 1;
+    float oa[2] = {o.x*toCell - o.y*shear + n, o.y*toRow + n};
+    float da[2] = {d.x*toCell - d.y*shear, d.y*toRow};
+    float inv[2] = {1/da[0], 1/da[1]};
+
+    // nodes still to visit, nearest on top: at most two siblings wait at
+    // each level
+    struct Node { int level, i, j; float t0, t1; };
+    Node stack[4*32];
+    int top = 0;
+    Node root = {rayLevels - 1, 0, 0, 0, hit.t};
+    float lo[2] = {0, 0}, hi[2] = {float(1 << root.level), float(1 << root.level)};
+    if (! rayBox<2>(oa, inv, lo, hi, root.t0, root.t1)) return false;
+    stack[top++] = root;
+
+    while (top > 0) {
+        Node nd = stack[--top];
+        if (nd.t0 >= hit.t) continue;
+
+        if (nd.level == 0) {
+            unsigned int tri[2][3];
+            int count = cellTriangles(nd.i, nd.j, tri);
+            bool found = false;
+            for(int k=0; k < count; ++k)
+                found |= rayTriangle(o, d, vert, norm, tri[k], hit);
+            if (found) return true;
+            continue;
+        }
+
+        // the ray crosses the middle lines of the node at tm, splitting
+        // t0..t1 into up to three pieces, each in one child. Children the
+        // ray passes entirely above or below are skipped, the rest pushed
+        // farthest first
+        int l = nd.level - 1, across = 1 << (rayLevels-1 - l);
+        float mid[2] = {float((2*nd.i + 1) << l), float((2*nd.j + 1) << l)};
+        float tm[2];
+        int side[2];
+        for(int k=0; k < 2; ++k) {
+            if (da[k] == 0) {
+                tm[k] = FLT_MAX;
+                side[k] = oa[k] >= mid[k];
+            }
+            else {
+                tm[k] = (mid[k] - oa[k]) * inv[k];
+                side[k] = (da[k] > 0) == (tm[k] <= nd.t0);
+            }
+        }
+        int first = tm[0] < tm[1] ? 0 : 1;
+        float cut[4] = {nd.t0, std::min(tm[first], nd.t1),
+                        std::min(tm[1-first], nd.t1), nd.t1};
+        Node piece[3];
+        for(int k=0; k < 3; ++k) {
+            piece[k].level = l;
+            piece[k].i = 2*nd.i + side[0];
+            piece[k].j = 2*nd.j + side[1];
+            piece[k].t0 = std::max(cut[k], nd.t0);
+            piece[k].t1 = cut[k+1];
+            int axis = k ? 1-first : first;
+            if (k < 2 && tm[axis] > nd.t0) side[axis] ^= 1;
+        }
+        const Vec2f *bounds = &rayBounds[rayLevelStart[l]];
+        for(int k=2; k >= 0; --k) {
+            const Node &c = piece[k];
+            if (c.t0 >= c.t1) continue;
+            const Vec2f &b = bounds[c.j*across + c.i];
+            float z0 = o.z + d.z*c.t0, z1 = o.z + d.z*c.t1;
+            if (std::min(z0, z1) > b.y || std::max(z0, z1) < b.x) continue;
+            stack[top++] = c;
+        }
+    }
+    return false;
+}
+
+#if USE_SSE
+//
+// nearest grid hits of four rays from one origin, walking the pyramid
+// together: a node is entered while any ray still meets it below its hit
+// so far, and leaf triangles are tested against all four rays at once.
+// Children are visited in one order for every ray, so the rays must agree
+// in the signs of their axial directions
+// returns a bit for each ray that hits, or -1 if the signs differ
+//
+int Terrain::raycastGrid4(Vec3f o, const Vec3f d[4], RayHit hit[4]) const
+{
+    // rays in axial cell coordinates; directions too close to an axis are
+    // nudged off it so slab times stay finite
+    float toCell = gridSize.x / mapSize.x;
+    float toRow = toCell / sqrtf(0.75f), shear = 0.5f * toRow;
+    int n = level + 1;
+    float oa[2] = {o.x*toCell - o.y*shear + n, o.y*toRow + n};
+    float inv[2][4], dz[4];
+    int signs = 0;
+    for(int k=0; k < 4; ++k) {
+        float da[2] = {d[k].x*toCell - d[k].y*shear, d[k].y*toRow};
+        int s = 0;
+        for(int a=0; a < 2; ++a) {
+            if (fabsf(da[a]) < 1e-20f) da[a] = da[a] < 0 ? -1e-20f : 1e-20f;
+            inv[a][k] = 1 / da[a];
+            s |= (da[a] < 0) << a;
+        }
+        if (k > 0 && s != signs) return -1;
+        signs = s;
+        dz[k] = d[k].z;
+    }
+    __m128 invA = _mm_loadu_ps(inv[0]), invB = _mm_loadu_ps(inv[1]);
+    __m128 oA = _mm_set1_ps(oa[0]), oB = _mm_set1_ps(oa[1]);
+    __m128 dZ = _mm_loadu_ps(dz), oZ = _mm_set1_ps(o.z);
+    __m128 dX = _mm_setr_ps(d[0].x, d[1].x, d[2].x, d[3].x);
+    __m128 dY = _mm_setr_ps(d[0].y, d[1].y, d[2].y, d[3].y);
+    __m128 none = _mm_set1_ps(FLT_MAX);
+
+    // nearest hit so far for each ray: t, weights and triangle
+    __m128 hitT = none;
+    alignas(16) float hitU[4] = {0, 0, 0, 0}, hitV[4] = {0, 0, 0, 0};
+    unsigned int hitTri[4][3];
+
+    // t range in square lo..lo+size, within t0..t1, for each ray
+    auto slab = [&](float loA, float loB, float size, __m128 t0, __m128 t1,
+                    __m128 &c0, __m128 &c1) {
+        __m128 a0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(loA), oA), invA);
+        __m128 a1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(loA + size), oA), invA);
+        __m128 b0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(loB), oB), invB);
+        __m128 b1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(loB + size), oB), invB);
+        c0 = _mm_max_ps(_mm_max_ps(_mm_min_ps(a0, a1), _mm_min_ps(b0, b1)), t0);
+        c1 = _mm_min_ps(_mm_min_ps(_mm_max_ps(a0, a1), _mm_max_ps(b0, b1)), t1);
+    };
+
+    struct Node { __m128 t0, t1; int level, i, j; };
+    Node stack[4*32];
+    int top = 0;
+    Node root;
+    root.level = rayLevels - 1;
+    root.i = root.j = 0;
+    slab(0, 0, float(1 << root.level), _mm_setzero_ps(), hitT, root.t0, root.t1);
+    if (! _mm_movemask_ps(_mm_cmplt_ps(root.t0, root.t1))) return 0;
+    stack[top++] = root;
+
+    // near child first, then the two beside it, then the far one
+    int order[4] = {signs, signs ^ 1, signs ^ 2, signs ^ 3};
+
+    while (top > 0) {
+        Node nd = stack[--top];
+        __m128 live = _mm_and_ps(_mm_cmplt_ps(nd.t0, nd.t1),
+                                 _mm_cmplt_ps(nd.t0, hitT));
+        if (! _mm_movemask_ps(live)) continue;
+
+        if (nd.level == 0) {
+            unsigned int tri[2][3];
+            int count = cellTriangles(nd.i, nd.j, tri);
+            for(int k=0; k < count; ++k) {
+                // edges and the origin's offset are shared by every ray
+                Vec3f v0 = vert[tri[k][0]];
+                Vec3f e1 = vert[tri[k][1]] - v0, e2 = vert[tri[k][2]] - v0;
+                Vec3f s = o - v0, q = s ^ e1;
+
+                __m128 px = _mm_sub_ps(_mm_mul_ps(dY, _mm_set1_ps(e2.z)),
+                                       _mm_mul_ps(dZ, _mm_set1_ps(e2.y)));
+                __m128 py = _mm_sub_ps(_mm_mul_ps(dZ, _mm_set1_ps(e2.x)),
+                                       _mm_mul_ps(dX, _mm_set1_ps(e2.z)));
+                __m128 pz = _mm_sub_ps(_mm_mul_ps(dX, _mm_set1_ps(e2.y)),
+                                       _mm_mul_ps(dY, _mm_set1_ps(e2.x)));
+                __m128 det = _mm_add_ps(_mm_add_ps(
+                    _mm_mul_ps(px, _mm_set1_ps(e1.x)),
+                    _mm_mul_ps(py, _mm_set1_ps(e1.y))),
+                    _mm_mul_ps(pz, _mm_set1_ps(e1.z)));
+                __m128 rdet = _mm_div_ps(_mm_set1_ps(1), det);
+                __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(
+                    _mm_mul_ps(px, _mm_set1_ps(s.x)),
+                    _mm_mul_ps(py, _mm_set1_ps(s.y))),
+                    _mm_mul_ps(pz, _mm_set1_ps(s.z))), rdet);
+                __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(
+                    _mm_mul_ps(dX, _mm_set1_ps(q.x)),
+                    _mm_mul_ps(dY, _mm_set1_ps(q.y))),
+                    _mm_mul_ps(dZ, _mm_set1_ps(q.z))), rdet);
+                __m128 t = _mm_mul_ps(_mm_set1_ps(dot(e2, q)), rdet);
+
+                // NaN from a zero determinant fails every comparison
+                __m128 zero = _mm_setzero_ps();
+                __m128 ok = _mm_and_ps(live, _mm_and_ps(
+                    _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero)),
+                    _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1))));
+                ok = _mm_and_ps(ok, _mm_and_ps(_mm_cmpge_ps(t, zero),
+                                               _mm_cmplt_ps(t, hitT)));
+                int mask = _mm_movemask_ps(ok);
+                if (! mask) continue;
+
+                hitT = select(ok, t, hitT);
+                _mm_store_ps(hitU, select(ok, u, _mm_load_ps(hitU)));
+                _mm_store_ps(hitV, select(ok, v, _mm_load_ps(hitV)));
+                for(int r=0; r < 4; ++r)
+                    if (mask & (1 << r))
+                        std::copy(tri[k], tri[k] + 3, hitTri[r]);
+            }
+            continue;
+        }
+
+        // children the rays meet without passing entirely above or below
+        // their heights, pushed farthest first
+        int l = nd.level - 1, size = 1 << l, across = 1 << (rayLevels-1 - l);
+        const Vec2f *bounds = &rayBounds[rayLevelStart[l]];
+        for(int k=3; k >= 0; --k) {
+            Node c;
+            c.level = l;
+            c.i = 2*nd.i + (order[k] & 1);
+            c.j = 2*nd.j + (order[k] >> 1);
+            const Vec2f &b = bounds[c.j*across + c.i];
+            if (b.x > b.y) continue;
+            slab(float(c.i * size), float(c.j * size), float(size),
+                 nd.t0, nd.t1, c.t0, c.t1);
+            __m128 z0 = _mm_add_ps(oZ, _mm_mul_ps(dZ, c.t0));
+            __m128 z1 = _mm_add_ps(oZ, _mm_mul_ps(dZ, c.t1));
+            __m128 meet = _mm_and_ps(
+                _mm_and_ps(live, _mm_cmplt_ps(c.t0, c.t1)),
+                _mm_and_ps(_mm_cmple_ps(_mm_min_ps(z0, z1), _mm_set1_ps(b.y)),
+                           _mm_cmpge_ps(_mm_max_ps(z0, z1), _mm_set1_ps(b.x))));
+            if (! _mm_movemask_ps(meet)) continue;
+            c.t0 = select(meet, c.t0, none);
+            stack[top++] = c;
+        }
+    }
+
+    alignas(16) float t[4];
+    _mm_store_ps(t, hitT);
+    int found = 0;
+    for(int r=0; r < 4; ++r) {
+        hit[r].t = FLT_MAX;
+        if (t[r] == FLT_MAX) continue;
+        setHit(o, d[r], t[r], vert, norm, hitTri[r], hitU[r], hitV[r], hit[r]);
+        found |= 1 << r;
+    }
+    return found;
+}
+#endif
+
+//
+// nearest hit closer than hit.t over the tiles, for terrain without grid
+// rows
+//
+bool Terrain::raycastTiles(Vec3f o, Vec3f d, RayHit &hit) const
+{
+    float inv[3] = {1/d.x, 1/d.y, 1/d.z};
+    bool found = false;
+    for(unsigned int t=0; t < numtile; ++t) {
+        float lo[3] = {tileMin[0][t], tileMin[1][t], tileMin[2][t]};
+        float hi[3] = {tileMax[0][t], tileMax[1][t], tileMax[2][t]};
+        float t0 = 0, t1 = hit.t;
+        if (! rayBox<3>(&o.x, inv, lo, hi, t0, t1)) continue;
+        for(unsigned int i = tileStart[t]; i < tileStart[t+1]; ++i)
+            found |= rayTriangle(o, d, vert, norm, indices[i], hit);
+    }
+    return found;
+}
+
+//
+// build the min/max pyramid raycasts descend, if not already built since
+// the last edit. Call before raycasting from several threads
+//
+void Terrain::prepareRaycasts() const
+{
+    if (rowStart && ! procedural && rayBounds.empty()) buildRayBounds();
+}
+
+//
+// nearest point where the ray origin + t*dir meets the terrain, t >= 0
+// returns false if it misses
+//
+bool Terrain::raycast(Vec3f origin, Vec3f dir, RayHit &hit) const
+{
+    prepareRaycasts();
+    return raycastPrepared(origin, dir, hit);
+}
+
+//
+// raycast without building anything, so safe from worker threads. Terrain
+// whose pyramid is not built falls back to testing tiles
+//
+bool Terrain::raycastPrepared(Vec3f origin, Vec3f dir, RayHit &hit) const
+{
+    hit.t = FLT_MAX;
+    if (procedural) return false;
+    if (! rowStart || rayBounds.empty()) return raycastTiles(origin, dir, hit);
+    return raycastGrid(origin, dir, hit);
+}
+
+//
+// raycast for each of count rays, split among threads
+// returns the number that hit; misses have hit.t == FLT_MAX
+//
+unsigned int Terrain::raycast(unsigned int count, const Vec3f *origin,
+                              const Vec3f *dir, RayHit *hit) const
+{
+    // build shared data before the threads start
+    prepareRaycasts();
+
+    std::atomic<unsigned int> hits(0);
+    int blocks = (count + RAY_BLOCK - 1) / RAY_BLOCK;
+    parallelFor(blocks, parallelThreads(), [&](int b) {
+        unsigned int end = std::min((b+1) * RAY_BLOCK, int(count)), found = 0;
+        for(unsigned int i = b * RAY_BLOCK; i < end; ++i)
+            found += raycastPrepared(origin[i], dir[i], hit[i]);
+        hits += found;
+    });
+    return hits;
+}
+
+//
+// raycast four rays from one origin together, as for neighboring pixels
+// returns a bit for each ray that hits. Never builds the pyramid, so
+// prepareRaycasts must be called first
+//
+int Terrain::raycastPacket(Vec3f origin, const Vec3f dir[4], RayHit hit[4]) const
+{
+#if USE_SSE
+    if (rowStart && ! procedural && ! rayBounds.empty()) {
+        int found = raycastGrid4(origin, dir, hit);
+        if (found >= 0) return found;
+    }
+#endif
+
+    // one at a time if the rays point different ways, or without a grid
+    int found = 0;
+    for(int r=0; r < 4; ++r)
+        found |= raycastPrepared(origin, dir[r], hit[r]) << r;
+    return found;
+}
+
+//////////////////
+// region queries
+
+// z of the cross product of a and b
+static float cross2(Vec2f a, Vec2f b)
+{
+    return a.x * b.y - a.y * b.x;
+}
+
+// true if P is inside or on triangle a,b,c of either winding
+static bool inTriangle(Vec2f P, Vec2f a, Vec2f b, Vec2f c)
+{
+    float d0 = cross2(b - a, P - a), d1 = cross2(c - b, P - b);
+    float d2 = cross2(a - c, P - c);
+    return (d0 >= 0 && d1 >= 0 && d2 >= 0) || (d0 <= 0 && d1 <= 0 && d2 <= 0);
+}
+
+// squared distance from P to segment a,b
+static float segmentDistance2(Vec2f P, Vec2f a, Vec2f b)
+{
+    Vec2f ab = b - a, aP = P - a;
+    float len2 = dot(ab, ab);
+    float t = len2 > 0 ? std::min(std::max(dot(aP, ab) / len2, 0.f), 1.f) : 0;
+    Vec2f d = aP - t * ab;
+    return dot(d, d);
+}
+
+// true if segments a,b and c,d touch
+static bool segmentsCross(Vec2f a, Vec2f b, Vec2f c, Vec2f d)
+{
+    float d0 = cross2(b - a, c - a), d1 = cross2(b - a, d - a);
+    float d2 = cross2(d - c, a - c), d3 = cross2(d - c, b - c);
+    if (((d0 > 0 && d1 < 0) || (d0 < 0 && d1 > 0)) &&
+        ((d2 > 0 && d3 < 0) || (d2 < 0 && d3 > 0)))
+        return true;
+
+    // collinear or touching at an end
+    return (d0 == 0 && segmentDistance2(c, a, b) == 0) ||
+           (d1 == 0 && segmentDistance2(d, a, b) == 0) ||
+           (d2 == 0 && segmentDistance2(a, c, d) == 0) ||
+           (d3 == 0 && segmentDistance2(b, c, d) == 0);
+}
+
+// circle, box or polygon for region queries, with its bounding box
+struct Terrain::Region {
+    enum Shape {CIRCLE, BOX, POLYGON} shape;
+    Vec2f lo, hi;               // bounds of the region
+    Vec2f center;               // circle center
+    float radius;               // circle radius
+    const Vec2f *corner;        // polygon corners, in order
+    unsigned int count;         // number of polygon corners
+
+    Region(Vec2f center, float radius)
+        : shape(CIRCLE), lo(center - radius), hi(center + radius),
+          center(center), radius(radius), corner(0), count(0) {}
+
+    Region(Vec2f lo, Vec2f hi)
+        : shape(BOX), lo(lo), hi(hi), center(0.5f * (lo + hi)), radius(0),
+          corner(0), count(0) {}
+
+    Region(const Vec2f *corner, unsigned int count)
+        : shape(POLYGON), lo(vec2<float>(FLT_MAX, FLT_MAX)),
+          hi(vec2<float>(-FLT_MAX, -FLT_MAX)), radius(0),
+          corner(corner), count(count)
+    {
+        for(unsigned int i=0; i < count; ++i) {
+            lo = vec2<float>(std::min(lo.x, corner[i].x), std::min(lo.y, corner[i].y));
+            hi = vec2<float>(std::max(hi.x, corner[i].x), std::max(hi.y, corner[i].y));
+        }
+        center = 0.5f * (lo + hi);
+    }
+
+    // points in the region to start the flood from, so regions partly off
+    // the terrain are still found: the center, then for polygons their
+    // corners, and otherwise the point nearest the middle of the map
+    // followed by box corners, or the ends of the circle's axes
+    unsigned int seeds() const { return shape == POLYGON ? count + 1 : 6; }
+    Vec2f seed(unsigned int i) const {
+        if (i == 0) return center;
+        if (shape == POLYGON) return corner[i-1];
+        if (i == 1) {
+            if (shape == BOX)
+                return vec2<float>(std::min(std::max(0.f, lo.x), hi.x),
+                                   std::min(std::max(0.f, lo.y), hi.y));
+            float d = length(center);
+            return d > radius ? center * (1 - radius / d) : vec2<float>(0, 0);
+        }
+        if (shape == BOX)
+            return vec2<float>(i & 1 ? hi.x : lo.x, i & 2 ? hi.y : lo.y);
+        Vec2f axis[4] = {vec2<float>(radius, 0), vec2<float>(-radius, 0),
+                         vec2<float>(0, radius), vec2<float>(0, -radius)};
+        return center + axis[i-2];
+    }
+
+    // true if P is in the region or on its edge
+    bool contains(Vec2f P) const {
+        if (P.x < lo.x || P.x > hi.x || P.y < lo.y || P.y > hi.y)
+            return false;
+        if (shape == CIRCLE) {
+            Vec2f d = P - center;
+            return dot(d, d) <= radius * radius;
+        }
+        if (shape == BOX) return true;
+
+        // even-odd crossings of a ray toward +x
+        bool inside = false;
+        for(unsigned int i=0, j=count-1; i < count; j = i++) {
+            Vec2f a = corner[j], b = corner[i];
+            if ((a.y > P.y) != (b.y > P.y) &&
+                P.x < a.x + (P.y - a.y) * (b.x - a.x) / (b.y - a.y))
+                inside = ! inside;
+        }
+        return inside;
+    }
+
+    // true if triangle a,b,c and the region share any point
+    bool overlaps(Vec2f a, Vec2f b, Vec2f c) const {
+        if (std::max(std::max(a.x, b.x), c.x) < lo.x ||
+            std::min(std::min(a.x, b.x), c.x) > hi.x ||
+            std::max(std::max(a.y, b.y), c.y) < lo.y ||
+            std::min(std::min(a.y, b.y), c.y) > hi.y)
+            return false;
+
+        if (shape == CIRCLE) {
+            // faces inside the circle are the common case, so try corners
+            // before edges
+            float r2 = radius * radius;
+            return contains(a) || contains(b) || contains(c) ||
+                   inTriangle(center, a, b, c) ||
+                   segmentDistance2(center, a, b) <= r2 ||
+                   segmentDistance2(center, b, c) <= r2 ||
+                   segmentDistance2(center, c, a) <= r2;
+        }
+
+        if (shape == BOX) {
+            // bounds overlap, so only the triangle edges can separate them
+            const Vec2f v[3] = {a, b, c};
+            for(int e=0; e < 3; ++e) {
+                Vec2f p = v[e], edge = v[(e+1)%3] - p;
+                float side = cross2(edge, v[(e+2)%3] - p);
+                int outside = 0;
+                for(int k=0; k < 4; ++k) {
+                    Vec2f q = vec2<float>(k & 1 ? hi.x : lo.x, k & 2 ? hi.y : lo.y);
+                    if (cross2(edge, q - p) * side < 0) ++outside;
+                }
+                if (outside == 4) return false;
+            }
+            return true;
+        }
+
+        // polygon: one holds a corner of the other, or their edges cross
+        if (contains(a) || contains(b) || contains(c)) return true;
+        for(unsigned int i=0, j=count-1; i < count; j = i++) {
+            Vec2f p = corner[j], q = corner[i];
+            if (inTriangle(q, a, b, c) || segmentsCross(p, q, a, b) ||
+                segmentsCross(p, q, b, c) || segmentsCross(p, q, c, a))
+                return true;
+        }
+        return false;
+    }
+};
+
+//
+// faces overlapping the region, and optionally the vertices of those
+// faces inside it. tris doubles as the flood queue: faces join it once
+// they are known to overlap, and each one pulls in its unmarked
+// neighbors, so only the region and a ring of faces around it are tested
+//
+unsigned int Terrain::regionQuery(const Region &region,
+                                  std::vector<unsigned int> &tris,
+                                  std::vector<unsigned int> *verts) const
+{
+    tris.clear();
+    if (verts) verts->clear();
+    // procedural terrain has a triangle count but no mesh to flood
+    if (procedural || numtri == 0 ||
+        (region.shape == Region::POLYGON && region.count < 3))
+        return 0;
+
+#if HALF_EDGE
+    // new marks for this query, clearing them all only when first used
+    // and when the stamp wraps around
+    if (triMark.size() != numtri || ++regionStamp == 0) {
+        triMark.assign(numtri, 0);
+        vertMark.assign(numvert, 0);
+        regionStamp = 1;
+    }
+
+    // first seed point over a face touching the region
+    int seed = -1;
+    for(unsigned int i=0; seed < 0 && i < region.seeds(); ++i) {
+        int f = locateFace(region.seed(i));
+        if (f >= 0 && region.overlaps(vert[indices[f][0]].xy,
+                vert[indices[f][1]].xy, vert[indices[f][2]].xy))
+            seed = f;
+    }
+    if (seed < 0) return 0;
+
+    triMark[seed] = regionStamp;
+    tris.push_back(seed);
+    for(unsigned int k=0; k < tris.size(); ++k) {
+        unsigned int t = tris[k];
+        HalfEdge *e = triEdge[t];
+        for(int i=0; i < 3; ++i, e = e->next) {
+            int f = e->pair->face;
+            if (f < 0 || triMark[f] == regionStamp) continue;
+            triMark[f] = regionStamp;
+            if (region.overlaps(vert[indices[f][0]].xy,
+                    vert[indices[f][1]].xy, vert[indices[f][2]].xy))
+                tris.push_back(f);
+        }
+
+        if (verts) {
+            for(int i=0; i < 3; ++i) {
+                unsigned int v = indices[t][i];
+                if (vertMark[v] == regionStamp) continue;
+                vertMark[v] = regionStamp;
+                if (region.contains(vert[v].xy))
+                    verts->push_back(v);
+            }
+        }
+    }
+#endif
+
+    return verts ? verts->size() : tris.size();
+}
+
+//
+// triangles touching the circle of radius around center
+//
+unsigned int Terrain::trianglesInCircle(Vec2f center, float radius,
+                                        std::vector<unsigned int> &tris) const
+{
+    return regionQuery(Region(center, radius), tris, 0);
+}
+
+//
+// triangles touching the box from lo to hi
+//
+unsigned int Terrain::trianglesInBox(Vec2f lo, Vec2f hi,
+                                     std::vector<unsigned int> &tris) const
+{
+    return regionQuery(Region(lo, hi), tris, 0);
+}
+
+//
+// triangles touching the polygon with count corners
+//
+unsigned int Terrain::trianglesInPolygon(const Vec2f *corner, unsigned int count,
+                                         std::vector<unsigned int> &tris) const
+{
+    return regionQuery(Region(corner, count), tris, 0);
+}
+
+//
+// vertices inside the circle of radius around center
+//
+unsigned int Terrain::verticesInCircle(Vec2f center, float radius,
+                                       std::vector<unsigned int> &verts) const
+{
+    return regionQuery(Region(center, radius), regionTris, &verts);
+}
+
+//
+// vertices inside the box from lo to hi
+//
+unsigned int Terrain::verticesInBox(Vec2f lo, Vec2f hi,
+                                    std::vector<unsigned int> &verts) const
+{
+    return regionQuery(Region(lo, hi), regionTris, &verts);
+}
+
+//
+// vertices inside the polygon with count corners
+//
+unsigned int Terrain::verticesInPolygon(const Vec2f *corner, unsigned int count,
+                                        std::vector<unsigned int> &verts) const
+{
+    return regionQuery(Region(corner, count), regionTris, &verts);
+}
+
+//////////////////
+// water
+
+//
+// rain world depth of water over the terrain, starting the flow if there
+// is no water yet
+//
+void Terrain::rain(float amount)
+{
+    // water finds terrain cells by grid row, like erosion
+    if (! rowStart) {
+        printf("water needs uniform terrain\n");
+        return;
+    }
+
+    if (! water) {
+        water = new ShallowWater(2*level + 3, mapSize.x / gridSize.x);
+        for(int row=0; row <= 2*level + 2; ++row) {
+            int y = level + 1 - abs(row - (level + 1));
+            unsigned int v = rowStart[row];
+            for(int x = -(y + level + 1); x <= y + level + 1; x += 2, ++v)
+                water->setGround(axialColumn(row, x), row, vert[v].z);
+        }
+        waterSteps = 0;
+        waterTime = 0;
+    }
+    water->rain(amount);
+}
+
+//
+// remove the water, reporting how fast it ran
+//
+void Terrain::drain()
+{
+    if (! water) return;
+
+    int cells = water->cells();
+    if (waterTime > 0)
+        printf("water: %d steps of %dx%d cells, %.1f million cell updates "
+               "per second on %u threads\n", waterSteps, cells, cells,
+               1e-6 * cells * cells * waterSteps / waterTime, water->threads());
+    delete water;
+    water = 0;
+}
+
+//
+// texture, vertex array and shaders for water, sharing the patch grid
+// of the height texture
+// returns false for terrain without grid rows
+//
+bool Terrain::buildWater()
+{
+    if (waterShaderID) return true;
+    if (! buildHeightTexture()) return false;
+
+    int size = 2*level + 3;
+    waterTexels.resize(size*size);
+    glBindTexture(GL_TEXTURE_2D, textureIDs[WATER_TEXTURE]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, size, size, 0, GL_RED, GL_FLOAT,
+            0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glGenVertexArrays(1, &waterArrayID);
+    waterShaderParts[0].id = glCreateShader(GL_VERTEX_SHADER);
+    waterShaderParts[0].file = "heightmap.vert";
+    waterShaderParts[1].id = glCreateShader(GL_FRAGMENT_SHADER);
+    waterShaderParts[1].file = "water.frag";
+    waterShaderID = glCreateProgram();
+    updateShaders();
+    return true;
+}
+
+//
+// advance the water, then draw it over the terrain already drawn
+//
+void Terrain::drawWater(Scene &scene)
+{
+    if (! water || ! buildWater()) return;
+
+    double start = glfwGetTime();
+    for(int i=0; i < WATER_STEPS; ++i)
+        water->step();
+    waterTime += glfwGetTime() - start;
+    waterSteps += WATER_STEPS;
+
+    // the whole surface changes, so send the whole texture
+    int size = 2*level + 3;
+    for(int r=0; r < size; ++r)
+        for(int c=0; c < size; ++c)
+            waterTexels[r*size + c] = water->surface(c, r);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, textureIDs[WATER_TEXTURE]);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, size, size, GL_RED, GL_FLOAT,
+            &waterTexels[0]);
+
+    // blended over the terrain, without writing depth
+    glUseProgram(waterShaderID);
+    glBindVertexArray(waterArrayID);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glDepthMask(GL_FALSE);
+
+    int patches = (2*level + 2 + HEIGHT_PATCH-1) / HEIGHT_PATCH;
+    glUniform1i(glGetUniformLocation(waterShaderID, "patches"), patches);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferIDs[PATCH_INDEX_BUFFER]);
+    glDrawElementsInstanced(GL_TRIANGLES, 6*HEIGHT_PATCH*HEIGHT_PATCH,
+            GL_UNSIGNED_SHORT, 0, patches*patches);
+    scene.stats.triangles += numtri;
+
+    glDepthMask(GL_TRUE);
+    glDisable(GL_BLEND);
+}
+
+//////////////////
+// tiles and culling
+
+// number of directions tracked by the horizon test, must be a power of 2
+// so bin numbers can wrap with a mask
+const int HORIZON_BINS = 256;
+
+// true if xy is inside the terrain hexagon of the given size
+static bool insideHexagon(Vec2f P, Vec2f size)
+{
+    float x = fabsf(P.x / size.x), y = fabsf(P.y / size.y);
+    return y <= sqrtf(0.75) && sqrtf(3)*x + y <= sqrtf(3);
+}
+
+// nearest and farthest distance from P to rectangle lo..hi
+static void rectDistance(Vec2f P, Vec2f lo, Vec2f hi,
+                         float &nearest, float &farthest)
+{
+    Vec2f dn = vec2<float>(
+        std::max(std::max(lo.x - P.x, P.x - hi.x), 0.f),
+        std::max(std::max(lo.y - P.y, P.y - hi.y), 0.f));
+    Vec2f df = vec2<float>(
+        std::max(fabsf(P.x - lo.x), fabsf(P.x - hi.x)),
+        std::max(fabsf(P.y - lo.y), fabsf(P.y - hi.y)));
+    nearest = length(dn);
+    farthest = length(df);
+}
+
+// horizon bins touched by rectangle lo..hi as seen from P outside it
+// bins anyLo..anyHi overlap the rectangle, allLo..allHi are entirely
+// behind it. Bin numbers may be out of range and need to wrap.
+static void rectBins(Vec2f P, Vec2f lo, Vec2f hi,
+                     int &anyLo, int &anyHi, int &allLo, int &allHi)
+{
+    // corner angles relative to rectangle center, so they do not wrap
+    float center = atan2f(0.5f*(lo.y + hi.y) - P.y, 0.5f*(lo.x + hi.x) - P.x);
+    float a0 = 0, a1 = 0;
+    for(int i=0; i < 4; ++i) {
+        Vec2f c = vec2<float>(i&1 ? hi.x : lo.x, i&2 ? hi.y : lo.y) - P;
+        float a = atan2f(c.y, c.x) - center;
+        if (a > F_PI) a -= 2*F_PI;
+        if (a < -F_PI) a += 2*F_PI;
+        a0 = std::min(a0, a);
+        a1 = std::max(a1, a);
+    }
+
+    float scale = HORIZON_BINS / (2*F_PI);
+    float b0 = (center + a0 + F_PI) * scale, b1 = (center + a1 + F_PI) * scale;
+    anyLo = int(floorf(b0));
+    anyHi = int(floorf(b1));
+    allLo = int(ceilf(b0));
+    allHi = int(floorf(b1)) - 1;
+}
+
+//
+// sort triangles into square tiles and compute their bounds
+//
+void Terrain::buildTiles()
+{
+    // tiles are at most 1/32 of the map across, but at least 8 triangles
+    float spacing = mapSize.x / gridSize.x;
+    tileSize = std::max(2*mapSize.x / 32, 8*spacing);
+    int tilesX = int(ceilf(2*mapSize.x / tileSize));
+    int tilesY = int(ceilf(2*mapSize.y / tileSize));
+    int numcell = tilesX * tilesY;
+
+    // count triangles in each cell, by centroid
+    unsigned int *cell = new unsigned int[numtri];
+    unsigned int *cellStart = new unsigned int[numcell + 1]();
+    for(unsigned int i=0; i < numtri; ++i) {
+        Vec3f c = (vert[indices[i][0]] + vert[indices[i][1]] + vert[indices[i][2]]) / 3.f;
+        int tx = std::min(tilesX-1, std::max(0, int((c.x + mapSize.x) / tileSize)));
+        int ty = std::min(tilesY-1, std::max(0, int((c.y + mapSize.y) / tileSize)));
+        cell[i] = ty*tilesX + tx;
+        ++cellStart[cell[i] + 1];
+    }
+    for(int c=0; c < numcell; ++c)
+        cellStart[c+1] += cellStart[c];
+
+    // counting sort of triangles by cell
+    unsigned int *cellNext = new unsigned int[numcell];
+    std::copy(cellStart, cellStart + numcell, cellNext);
+    unsigned int (*sorted)[3] = new unsigned int[numtri][3];
+    for(unsigned int i=0; i < numtri; ++i) {
+        unsigned int j = cellNext[cell[i]]++;
+        sorted[j][0] = indices[i][0];
+        sorted[j][1] = indices[i][1];
+        sorted[j][2] = indices[i][2];
+    }
+    delete[] indices;
+    indices = sorted;
+
+    // keep only non-empty cells as tiles
+    int *cellTile = new int[numcell];
+    numtile = 0;
+    for(int c=0; c < numcell; ++c)
+        cellTile[c] = cellStart[c+1] > cellStart[c] ? numtile++ : -1;
+
+    tileStart = new unsigned int[numtile + 1];
+    tileOrigin = new Vec2f[numtile];
+    for(int c=0; c < numcell; ++c) {
+        int t = cellTile[c];
+        if (t < 0) continue;
+        tileStart[t] = cellStart[c];
+        tileOrigin[t] = vec2<float>((c % tilesX) * tileSize - mapSize.x,
+                                    (c / tilesX) * tileSize - mapSize.y);
+    }
+    tileStart[numtile] = numtri;
+
+    // bounding boxes, padded to a multiple of four tiles
+    unsigned int padded = (numtile + 3) & ~3u;
+    tileBounds = new float[6*padded]();
+    for(int i=0; i < 3; ++i) {
+        tileMin[i] = tileBounds + i*padded;
+        tileMax[i] = tileBounds + (i+3)*padded;
+    }
+    for(unsigned int t=0; t < numtile; ++t) {
+        Vec3f lo = vert[indices[tileStart[t]][0]], hi = lo;
+        for(unsigned int i = tileStart[t]; i < tileStart[t+1]; ++i) {
+            for(int k=0; k < 3; ++k) {
+                Vec3f v = vert[indices[i][k]];
+                for(int a=0; a < 3; ++a) {
+                    lo[a] = std::min(lo[a], v[a]);
+                    hi[a] = std::max(hi[a], v[a]);
+                }
+            }
+        }
+        for(int a=0; a < 3; ++a) {
+            tileMin[a][t] = lo[a];
+            tileMax[a][t] = hi[a];
+        }
+    }
+
+    // floor height for tile squares entirely inside the map: any triangle
+    // overlapping the square has its vertices within one triangle edge,
+    // so the lowest of those vertices bounds the surface from below
+    float edgeLength = 0;
+    for(unsigned int i=0; i < numtri; ++i)
+        for(int k=0; k < 3; ++k)
+            edgeLength = std::max(edgeLength, length(
+                vert[indices[i][k]].xy - vert[indices[i][(k+1)%3]].xy));
+    tileFloor = new float[numtile];
+    for(unsigned int t=0; t < numtile; ++t) {
+        Vec2f lo = tileOrigin[t], hi = lo + tileSize;
+        bool inside = insideHexagon(lo, mapSize.xy) &&
+            insideHexagon(hi, mapSize.xy) &&
+            insideHexagon(vec2<float>(lo.x, hi.y), mapSize.xy) &&
+            insideHexagon(vec2<float>(hi.x, lo.y), mapSize.xy);
+        tileFloor[t] = inside ? FLT_MAX : -FLT_MAX;
+    }
+    for(unsigned int v=0; v < numvert; ++v) {
+        int tx0 = std::max(0, int((vert[v].x - edgeLength + mapSize.x) / tileSize));
+        int tx1 = std::min(tilesX-1, int((vert[v].x + edgeLength + mapSize.x) / tileSize));
+        int ty0 = std::max(0, int((vert[v].y - edgeLength + mapSize.y) / tileSize));
+        int ty1 = std::min(tilesY-1, int((vert[v].y + edgeLength + mapSize.y) / tileSize));
+        for(int ty = ty0; ty <= ty1; ++ty) {
+            for(int tx = tx0; tx <= tx1; ++tx) {
+                int t = cellTile[ty*tilesX + tx];
+                if (t >= 0 && tileFloor[t] > -FLT_MAX)
+                    tileFloor[t] = std::min(tileFloor[t], vert[v].z);
+            }
+        }
+    }
+
+    delete[] cellTile;
+    delete[] cellNext;
+    delete[] cellStart;
+    delete[] cell;
+
+    // per-frame scratch space
+    visible.resize(numtile);
+    occluders.resize(numtile);
+    tileNear.resize(numtile);
+    tileFar.resize(numtile);
+    drawCount.resize(numtile);
+    drawOffset.resize(numtile);
+}
+
+//
+// find tiles visible from scene view, list them in visible[]
+//
+unsigned int Terrain::cullTiles(Scene &scene)
+{
+    // frustum test: a box is outside a plane if the corner farthest along
+    // the plane normal is outside. That is the same corner for every box,
+    // so test four boxes at once
+    unsigned int numvis = 0;
+    for(unsigned int t=0; t < numtile; t += 4) {
+        int outside = 0;        // one bit per tile
+        for(int p=0; p < 6; ++p) {
+            Vec4f P = scene.frustum[p];
+            const float *x = (P.x > 0 ? tileMax[0] : tileMin[0]) + t;
+            const float *y = (P.y > 0 ? tileMax[1] : tileMin[1]) + t;
+            const float *z = (P.z > 0 ? tileMax[2] : tileMin[2]) + t;
+#if USE_SSE
+            __m128 d = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(_mm_set1_ps(P.x), _mm_loadu_ps(x)),
+                           _mm_mul_ps(_mm_set1_ps(P.y), _mm_loadu_ps(y))),
+                _mm_add_ps(_mm_mul_ps(_mm_set1_ps(P.z), _mm_loadu_ps(z)),
+                           _mm_set1_ps(P.w)));
+            outside |= _mm_movemask_ps(_mm_cmplt_ps(d, _mm_setzero_ps()));
+#else
+            for(int i=0; i < 4; ++i)
+                if (P.x*x[i] + P.y*y[i] + P.z*z[i] + P.w < 0)
+                    outside |= 1 << i;
+#endif
+        }
+        for(unsigned int i=0; i < 4 && t+i < numtile; ++i) {
+            if (outside & (1 << i))
+                ++scene.stats.frustumCulled;
+            else
+                visible[numvis++] = t+i;
+        }
+    }
+
+    // horizon test: walk tiles from near to far, tracking the steepest
+    // slope (rise over distance) the terrain is known to reach in each
+    // direction. A tile is hidden if its highest point is below that
+    // slope in every direction it covers.
+    Vec3f eye = scene.position;
+    for(unsigned int i=0; i < numvis; ++i) {
+        unsigned int t = visible[i];
+        rectDistance(eye.xy,
+            vec2<float>(tileMin[0][t], tileMin[1][t]),
+            vec2<float>(tileMax[0][t], tileMax[1][t]),
+            tileNear[t], tileFar[t]);
+    }
+    const float *dnear = &tileNear[0];
+    std::sort(visible.begin(), visible.begin() + numvis,
+        [dnear](unsigned int a, unsigned int b) { return dnear[a] < dnear[b]; });
+
+    // tiles only join the horizon once they are entirely closer than the
+    // tile being tested: keep a heap of pending ones by far distance
+    const float *dfar = &tileFar[0];
+    auto fartherFirst = [dfar](unsigned int a, unsigned int b) {
+        return dfar[a] > dfar[b];
+    };
+
+    float horizon[HORIZON_BINS];
+    std::fill(horizon, horizon + HORIZON_BINS, -FLT_MAX);
+    unsigned int numocc = 0, numdrawn = 0;
+    int anyLo, anyHi, allLo, allHi;
+    for(unsigned int i=0; i < numvis; ++i) {
+        unsigned int t = visible[i];
+        Vec2f lo = vec2<float>(tileMin[0][t], tileMin[1][t]);
+        Vec2f hi = vec2<float>(tileMax[0][t], tileMax[1][t]);
+
+        // add pending occluders that are now entirely in front
+        while (numocc > 0 && tileFar[occluders[0]] <= tileNear[t]) {
+            std::pop_heap(occluders.begin(), occluders.begin() + numocc,
+                          fartherFirst);
+            unsigned int o = occluders[--numocc];
+
+            // lowest slope to the floor anywhere over the square
+            Vec2f olo = tileOrigin[o], ohi = olo + tileSize;
+            float onear, ofar;
+            rectDistance(eye.xy, olo, ohi, onear, ofar);
+            float rise = tileFloor[o] - eye.z;
+            float slope = rise / (rise > 0 ? ofar : onear);
+
+            rectBins(eye.xy, olo, ohi, anyLo, anyHi, allLo, allHi);
+            for(int b = allLo; b <= allHi; ++b) {
+                float &h = horizon[b & (HORIZON_BINS-1)];
+                h = std::max(h, slope);
+            }
+        }
+
+        // never hide the tile we're standing on
+        bool hidden = tileNear[t] > 0;
+        if (hidden) {
+            // steepest slope to the top of the tile box
+            float rise = tileMax[2][t] - eye.z;
+            float slope = rise / (rise > 0 ? tileNear[t] : tileFar[t]);
+
+            rectBins(eye.xy, lo, hi, anyLo, anyHi, allLo, allHi);
+            for(int b = anyLo; b <= anyHi && hidden; ++b)
+                hidden = slope < horizon[b & (HORIZON_BINS-1)];
+        }
+
+        if (hidden)
+            ++scene.stats.horizonCulled;
+        else
+            visible[numdrawn++] = t;
+
+        // squares entirely inside the map can hide tiles behind them
+        // tileFar is done for this tile's own test, so reuse it to hold
+        // the square's far distance for the occluder heap
+        Vec2f slo = tileOrigin[t], shi = slo + tileSize;
+        if (tileFloor[t] > -FLT_MAX &&
+            (eye.x < slo.x || eye.x > shi.x || eye.y < slo.y || eye.y > shi.y)) {
+            float snear;
+            rectDistance(eye.xy, slo, shi, snear, tileFar[t]);
+            occluders[numocc++] = t;
+            std::push_heap(occluders.begin(), occluders.begin() + numocc,
+                           fartherFirst);
+        }
+    }
+
+    return numdrawn;
+}
+
+//////////////////
+// simplified levels of detail
+
+//
+// simplify each tile with tile edges locked and upload the chain of
+// index ranges, level-major so neighboring tiles that fill their slots
+// can still draw as one range. Slots of simplified levels leave room for
+// a quarter more triangles, so brushes seldom force a rebuild
+//
+void Terrain::buildLOD(const float *errors, int count)
+{
+    // lock vertices on the mesh boundary or shared between tiles
+    lodLocked = new bool[numvert]();
+    int *vertTile = new int[numvert];
+    std::fill(vertTile, vertTile + numvert, -1);
+    for(unsigned int t=0; t < numtile; ++t) {
+        for(unsigned int i = tileStart[t]; i < tileStart[t+1]; ++i) {
+            for(int k=0; k < 3; ++k) {
+                unsigned int v = indices[i][k];
+                if (vertTile[v] >= 0 && vertTile[v] != int(t))
+                    lodLocked[v] = true;
+                vertTile[v] = t;
+            }
+        }
+    }
+    delete[] vertTile;
+
+#if HALF_EDGE
+    for(unsigned int e=0; e < numedge; ++e) {
+        if (edge[e].vert >= 0 && edge[e].face < 0) {
+            lodLocked[edge[e].vert] = true;
+            lodLocked[edge[e].pair->vert] = true;
+        }
+    }
+#else
+    count = 0;  // simplification needs half-edge connectivity
+#endif
+
+    numlod = count + 1;
+    lodError = new float[numlod];
+    for(int lod=0; lod < numlod; ++lod)
+        lodError[lod] = lod > 0 ? errors[lod-1] : 0;
+
+    // tiles are independent with their edges locked
+    std::vector<std::vector<unsigned int> > levels(numtile * count);
+    parallelFor(numtile, parallelThreads(), [&](int t) {
+        simplifyTile(t, &levels[t * count]);
+    });
+
+    lodStart = new unsigned int[numlod*numtile + 1];
+    lodEnd = new unsigned int[numlod*numtile];
+    lodStale.assign(numtile, 0);
+    std::vector<unsigned int> lodIndex;
+    for(int lod=0; lod < numlod; ++lod) {
+        unsigned int first = lodIndex.size() / 3;
+        for(unsigned int t=0; t < numtile; ++t) {
+            unsigned int full = tileStart[t+1] - tileStart[t];
+            unsigned int slot = lod*numtile + t;
+            lodStart[slot] = lodIndex.size() / 3;
+            if (lod == 0) {
+                lodIndex.insert(lodIndex.end(), &indices[tileStart[t]][0],
+                                &indices[tileStart[t+1]][0]);
+                lodEnd[slot] = lodStart[slot] + full;
+                continue;
+            }
+            const std::vector<unsigned int> &tri = levels[t * count + lod-1];
+            unsigned int used = tri.size() / 3;
+            lodIndex.insert(lodIndex.end(), tri.begin(), tri.end());
+            lodIndex.resize(3 * (lodStart[slot] + std::min(full, used + used/4 + 16)));
+            lodEnd[slot] = lodStart[slot] + used;
+        }
+
+        unsigned int tris = 0;
+        for(unsigned int t=0; t < numtile; ++t)
+            tris += lodEnd[lod*numtile + t] - lodStart[lod*numtile + t];
+        printf("LOD %d: error %g, %u triangles, %.1f%% of full, %u slots\n",
+               lod, lodError[lod], tris, 100.f * tris / numtri,
+               unsigned(lodIndex.size() / 3 - first));
+    }
+    lodStart[numlod*numtile] = lodIndex.size() / 3;
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferIDs[LOD_INDEX_BUFFER]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, lodIndex.size()*sizeof(unsigned int),
+            &lodIndex[0], GL_DYNAMIC_DRAW);
+}
+
+//
+// simplify tile t alone, its edges locked, one level after another
+//
+void Terrain::simplifyTile(unsigned int t, std::vector<unsigned int> *levels) const
+{
+#if HALF_EDGE
+    MeshSimplify mesh(vert, indices, triEdge, tileStart[t], tileStart[t+1],
+                      lodLocked);
+    for(int lod=1; lod < numlod; ++lod) {
+        mesh.simplify(lodError[lod]);
+        mesh.triangles(levels[lod-1]);
+    }
+#endif
+}
+
+//
+// simplify tiles changed since they were last simplified, and send each
+// level to the tile's slot. Rebuilds the whole chain instead if any level
+// of a tile no longer fits its slot
+//
+void Terrain::updateLOD()
+{
+    std::vector<unsigned int> stale;
+    for(unsigned int t=0; t < numtile; ++t) {
+        if (lodStale[t]) stale.push_back(t);
+        lodStale[t] = 0;
+    }
+    if (stale.empty()) return;
+
+    int count = numlod - 1;
+    std::vector<std::vector<unsigned int> > levels(stale.size() * count);
+    parallelFor(stale.size(), parallelThreads(), [&](int i) {
+        simplifyTile(stale[i], &levels[i * count]);
+    });
+
+    for(size_t i=0; i < stale.size(); ++i) {
+        for(int lod=1; lod < numlod; ++lod) {
+            unsigned int slot = lod*numtile + stale[i];
+            if (levels[i * count + lod-1].size() / 3 >
+                lodStart[slot+1] - lodStart[slot]) {
+                freeLOD();
+                buildLOD(LOD_ERRORS, sizeof(LOD_ERRORS)/sizeof(*LOD_ERRORS));
+                return;
+            }
+        }
+    }
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferIDs[LOD_INDEX_BUFFER]);
+    for(size_t i=0; i < stale.size(); ++i) {
+        for(int lod=1; lod < numlod; ++lod) {
+            unsigned int slot = lod*numtile + stale[i];
+            const std::vector<unsigned int> &tri = levels[i * count + lod-1];
+            if (! tri.empty())
+                glBufferSubData(GL_ELEMENT_ARRAY_BUFFER,
+                        lodStart[slot] * sizeof(unsigned int[3]),
+                        tri.size() * sizeof(unsigned int), &tri[0]);
+            lodEnd[slot] = lodStart[slot] + tri.size() / 3;
+        }
+    }
+}
+
+//
+// discard the chain of simplified levels
+//
+void Terrain::freeLOD()
+{
+    delete[] lodError;
+    delete[] lodStart;
+    delete[] lodEnd;
+    delete[] lodLocked;
+    lodError = 0;
+    lodStart = 0;
+    lodEnd = 0;
+    lodLocked = 0;
+    lodStale.clear();
+    numlod = 0;
+}
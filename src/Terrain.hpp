@@ -5,69 +5,514 @@
 #include "Vec.hpp"
 #include "HalfEdge.hpp"
 #include "Shader.hpp"
+#include <vector>
+
+class Scene;
+class Erosion;
+class ShallowWater;
+class Drainage;
+class NavMesh;
+class NavHierarchy;
+class FlowFields;
 
 // terrain data and rendering methods
 class Terrain {
+// public types
+public:
+    // nearest terrain point along a ray
+    struct RayHit {
+        float t;                // distance along the ray, in units of dir
+        Vec3f position;         // world space hit point
+        Vec3f normal;           // upward face normal of the hit triangle
+        Vec3f vertexNormal;     // vertex normals interpolated at the hit
+    };
+
+    // points for surfaceQuery, as separate arrays so callers keeping
+    // structure-of-arrays state can pass theirs in place. Outputs other
+    // than face may be null
+    struct SurfaceBatch {
+        unsigned int count;     // points in the batch
+        const float *x, *y;     // world xy of each point
+        float *z;               // surface height
+        float *nx, *ny, *nz;    // vertex normals interpolated there
+        int *face;              // face under each point, -1 off the mesh.
+                                // On input, where to start looking for it,
+                                // or -1 if not known, to start near the
+                                // point before. Procedural terrain has no
+                                // faces, and gives 0 on the terrain
+    };
+
 // private data
 private:
     Vec3f gridSize;             // elevation grid size
     Vec3f mapSize;              // size of terrain in world space
+    int level;                  // grid rows in each half of the hexagon
+    int octaves;                // noise octaves for height function
+    bool procedural = false;    // positions computed in the vertex shader
+    bool headless = false;      // no GL objects, for use without a window
+
+    unsigned int *rowStart = 0; // first vertex in each grid row, plus end
+                                // null for graded and TIN terrain
+
+    unsigned int numvert = 0;   // total vertices
+    Vec3f *vert = 0;            // per-vertex position
+    Vec3f *norm = 0;            // per-vertex normal
+	Vec3f *normMap = 0;				// per-vertex normal map
+    Vec2f *texcoord = 0;        // per-vertex texture coordinate
+
+    unsigned int numtri = 0;    // total triangles
+    unsigned int (*indices)[3] = 0; // 3 vertex indices per triangle
+    HalfEdge **triEdge = 0;     // first edge for each triangle
+
+    unsigned int numedge = 0;   // total number of half edges
+    HalfEdge *edge = 0;         // array of edges
+    mutable int prevFace = 0;   // where setHeight starts its search
+
+    // triangles are sorted into square tiles for culling, so each tile
+    // is one contiguous range of the index buffer
+    unsigned int numtile = 0;   // total non-empty tiles
+    float tileSize;             // world-space width of each tile square
+    unsigned int *tileStart = 0; // first triangle in each tile, plus end
+    Vec2f *tileOrigin = 0;      // low corner of each tile square
+    float *tileBounds = 0;      // storage for tileMin and tileMax
+    float *tileMin[3], *tileMax[3]; // bounding boxes, one array per axis
+    float *tileFloor = 0;       // lowest terrain anywhere in tile square
+    bool culling = true;        // cull tiles before drawing
+
+    // per-frame culling scratch space, one entry per tile
+    std::vector<unsigned int> visible, occluders;
+    std::vector<float> tileNear, tileFar;
+    std::vector<int> drawCount;
+    std::vector<const void*> drawOffset;
+
+    // simplified levels of detail for each tile, sharing the vertex
+    // buffers. Built when first drawn, with a slot for each level of each
+    // tile with room to grow, so tiles changed by brushes are simplified
+    // again into their slots when next drawn. Discarded when all heights
+    // change, or a tile no longer fits
+    int numlod = 0;             // levels in chain, 0 if not built
+    float *lodError = 0;        // error bound of each level, world units
+    unsigned int *lodStart = 0; // first triangle by level then tile, plus end
+    unsigned int *lodEnd = 0;   // end of the triangles used in each slot
+    bool *lodLocked = 0;        // vertices on tile edges, never removed
+    std::vector<unsigned char> lodStale; // 1 for tiles changed since built
+    bool simplified = false;    // draw LOD chain by distance
+    float pixelError = 2;       // screen-space error allowed for LOD choice
+
 
-    unsigned int numvert;       // total vertices
-    Vec3f *vert;                // per-vertex position
-    Vec3f *norm;                // per-vertex normal
-	Vec3f *normMap;				// per-vertex normal map
-    Vec2f *texcoord;            // per-vertex texture coordinate
+	bool normalMap = false; //true if we're using the normal map, updated in Input
+	bool reliefMap = false; //true if we're using the relief map, updated in Input
 
-    unsigned int numtri;        // total triangles
-    unsigned int (*indices)[3]; // 3 vertex indices per triangle
-    HalfEdge **triEdge;         // first edge for each triangle
+    // heights in an R32F texture, drawn as one small grid patch instanced
+    // across it. Texel (c,row) is grid x = 2c + row - 3(level+1), so the
+    // hexagon fills the square but for two corners. Built when first
+    // drawn, and updated by brushes
+    bool heightTextured = false; // draw patches from the height texture
+    std::vector<float> heightTexels; // copy of texture, empty if not built
+    unsigned int patchArrayID = 0; // vertex array for the patch grid
+    unsigned int patchShaderID = 0; // program for patches, 0 if not built
+    ShaderInfo patchShaderParts[2] = {};
 
-    unsigned int numedge;       // total number of half edges
-    HalfEdge *edge;             // array of edges
+    // erosion in progress, one iteration per frame, null if none
+    Erosion *erosion = 0;
+    int erosionKinds = 0;       // Erosion::Kind bits to run
+    int erosionLeft = 0;        // iterations still to run
+    int erosionDone = 0;        // iterations run so far
+    double erosionTime = 0;     // seconds spent in iterations
 
+    // shallow water over the grid, null if none. Drawn with the height
+    // texture patch grid over a texture of water surface heights, sent
+    // whole every frame
+    ShallowWater *water = 0;
+    int waterSteps = 0;         // steps run so far
+    double waterTime = 0;       // seconds spent in steps
+    std::vector<float> waterTexels; // copy of water surface texture
+    unsigned int waterArrayID = 0; // vertex array for water patches
+    unsigned int waterShaderID = 0; // program for water, 0 if not built
+    ShaderInfo waterShaderParts[2] = {};
 
-	bool normalMap; //true if we're using the normal map, updated in Input
-	bool reliefMap; //true if we're using the relief map, updated in Input
+    // steepest descent flow and upstream area of each vertex, built when
+    // first shown, and sent as a per-vertex attribute
+    Drainage *drainage = 0;     // null if never shown
+    bool drainageShown = false; // tint the terrain by upstream area
+    bool drainageStale = true;  // heights changed since last update
+
+    // face graph for paths and its clusters for long paths, each built on
+    // first use, and updated for changed heights when next asked for
+    NavMesh *navmesh = 0;       // null if never used
+    NavHierarchy *navclusters = 0; // null if never used
+    FlowFields *navflows = 0;   // fields toward recent goals, or null
+    bool navStale = false;      // all heights changed since last update
+    std::vector<Vec2f> navDirty; // low and high corners of changed boxes
+
+    // vertices seen from the last viewshed observer, 1 if visible
+    std::vector<unsigned char> viewMask;
+    bool viewshedShown = false; // tint vertices hidden from the observer
+
+    // min/max heights over squares of axial grid cells for raycasts, finest
+    // level first, built on first use and cleared when heights change
+    mutable std::vector<Vec2f> rayBounds;
+    mutable std::vector<int> rayLevelStart; // first node of each level
+    mutable int rayLevels = 0;              // levels, coarsest is one node
+
+    // region query marks: a face or vertex was seen by the current query
+    // when its mark equals regionStamp, so nothing is cleared between
+    // queries. Sized on first use, like the scratch list of faces used by
+    // vertex queries
+    mutable std::vector<unsigned int> triMark, vertMark;
+    mutable unsigned int regionStamp = 0;
+    mutable std::vector<unsigned int> regionTris;
 
     // GL vertex array object IDs
     unsigned int varrayID;
 
     // GL texture IDs
-    enum {COLOR_TEXTURE, NORMAL_MAP_TEXTURE, NUM_TEXTURES};
+    enum {COLOR_TEXTURE, NORMAL_MAP_TEXTURE, HEIGHT_TEXTURE, WATER_TEXTURE,
+          NUM_TEXTURES};
     unsigned int textureIDs[NUM_TEXTURES];
 
     // GL buffer object IDs
-    enum {POSITION_BUFFER, NORMAL_BUFFER, UV_BUFFER, INDEX_BUFFER, NORMAL_MAP_BUFFER, NUM_BUFFERS};
+    enum {POSITION_BUFFER, NORMAL_BUFFER, UV_BUFFER, INDEX_BUFFER, NORMAL_MAP_BUFFER,
+          LOD_INDEX_BUFFER, PATCH_BUFFER, PATCH_INDEX_BUFFER, FLOW_BUFFER,
+          HIDDEN_BUFFER, NUM_BUFFERS};
     unsigned int bufferIDs[NUM_BUFFERS];
 
     // GL shaders
     unsigned int shaderID;      // ID for shader program
     ShaderInfo shaderParts[2];  // vertex & fragment shader info
 
+// private methods
+private:
+    // uniform grid vertices and triangles, in rows across the hexagon
+    void buildGrid(int octaves);
+
+    // replace the uniform grid with a Delaunay triangulation of the grid
+    // vertices chosen by greedy insertion, and forget the grid rows
+    void buildTIN(float maxError);
+
+    // graded vertices and triangles for the focus constructor
+    void buildGraded(int octaves, Vec2f focus, float focusRadius);
+
+    // normals, tiles and half-edges for the vertices and triangles built
+    // by the constructor, then GPU data unless headless
+    void buildMesh();
+
+    // textures, vertex and index buffers and shaders for the mesh
+    void buildBuffers();
+
+    // textures, empty vertex array and shaders for procedural terrain
+    void buildProcedural();
+
+    // set level and octaves in the procedural shader
+    void detailUniforms();
+
+    // world position and normal at grid row and grid x coordinate, as
+    // computed by the procedural shader
+    Vec3f gridPoint(int row, int x, Vec3f &N) const;
+
+    // setHeight for procedural terrain, from the grid triangle under P
+    bool proceduralHeight(Vec3f &P, Vec3f &N) const;
+
+    // height texture and patch grid from the uniform grid vertices
+    // returns false for terrain without grid rows
+    bool buildHeightTexture();
+
+    // column c of grid row and grid x coordinate in the axial square used
+    // by the height texture and erosion, where x = 2c + row - 3(level+1)
+    int axialColumn(int row, int x) const {
+        return (x - row + 3*(level + 1))/2;
+    }
+
+    // index of the height texel at grid row and grid x coordinate
+    int heightTexel(int row, int x) const {
+        return row*(2*level + 3) + axialColumn(row, x);
+    }
+
+    // send positions and normals of vertex ranges to the GPU
+    // dirty holds pairs of [start, end) vertex indices
+    void uploadVertices(const std::vector<unsigned int> &dirty);
+
+    // run one erosion iteration and update everything that depends on
+    // the heights
+    void erodeStep();
+
+    // draw grid patches over the height texture
+    void drawHeightTexture(Scene &scene);
+
+    // connect the drainage and viewshed attributes, enabled only while
+    // shown
+    void overlayAttributes();
+
+    // flow directions and areas for the current heights, sent to the GPU
+    // returns the fraction of the map in the largest basin
+    float updateDrainage();
+
+    // texture, vertex array and shaders for water
+    // returns false for terrain without grid rows
+    bool buildWater();
+
+    // vertices of the mesh triangles in axial grid cell c,r
+    // returns how many, from 0 to 2
+    int cellTriangles(int c, int r, unsigned int tri[2][3]) const;
+
+    // min/max pyramid over the axial grid cells for raycasts
+    void buildRayBounds() const;
+
+    // raycast without building the pyramid first
+    bool raycastPrepared(Vec3f origin, Vec3f dir, RayHit &hit) const;
+
+    // hit closer than hit.t by descending the pyramid, for terrain with
+    // grid rows
+    bool raycastGrid(Vec3f origin, Vec3f dir, RayHit &hit) const;
+
+    // nearest grid hits of four rays from one origin, walking the pyramid
+    // together with SSE. Returns a bit for each ray that hits, or -1 if
+    // the rays point into different quadrants of the grid
+    int raycastGrid4(Vec3f origin, const Vec3f dir[4], RayHit hit[4]) const;
+
+    // hit closer than hit.t through the tile bounds, for terrain without
+    // grid rows
+    bool raycastTiles(Vec3f origin, Vec3f dir, RayHit &hit) const;
+
+    // shape for region queries, defined with them
+    struct Region;
+
+    // face under P by walking from the last face found, -1 if off the mesh
+    int locateFace(Vec2f P) const;
+
+    // first face of the tile under P, -1 if none
+    int tileFace(Vec2f P) const;
+
+    // face under P by walking from face start, -1 if off the mesh
+    int walkFace(Vec2f P, int start) const;
+
+    // faces overlapping region into tris by flooding across half-edges
+    // from the face under one of its seed points, and if verts is not
+    // null, the vertices of those faces inside the region into verts
+    unsigned int regionQuery(const Region &region,
+                             std::vector<unsigned int> &tris,
+                             std::vector<unsigned int> *verts) const;
+
+    // vertex index at grid row and grid x coordinate, -1 if off the map
+    int gridVertex(int row, int x) const;
+
+    // range of grid rows within distance r of world y
+    void gridRows(float y, float r, int &rowLo, int &rowHi) const;
+
+    // range of grid x within distance r of center in this row
+    // returns false if no vertices in the row are that close
+    bool gridSpan(int row, Vec2f center, float r, int &xLo, int &xHi) const;
+
+    // recompute one vertex normal from the faces around it
+    void gridNormal(int row, int x);
+
+    // sort triangles into tiles and compute their bounds
+    void buildTiles();
+
+    // find tiles visible from scene view, list them in visible[]
+    // returns number of visible tiles
+    unsigned int cullTiles(Scene &scene);
+
+    // simplify each tile with tile edges locked, so neighbors at
+    // different levels still meet, and upload the chain of index ranges
+    // errors are increasing world-space bounds for levels after the first
+    void buildLOD(const float *errors, int count);
+
+    // simplified triangles of tile t for each level after the first
+    void simplifyTile(unsigned int t, std::vector<unsigned int> *levels) const;
+
+    // simplify stale tiles again into their slots
+    void updateLOD();
+
+    // discard the chain, to be built again when drawn
+    void freeLOD();
+
 // public methods
 public:
+    // brush shapes for applyBrush
+    enum BrushProfile {BRUSH_RAISE, BRUSH_LOWER, BRUSH_FLATTEN, BRUSH_CRATER,
+                       NUM_BRUSHES};
+
     // load terrain, given triangle size and surface texture
     Terrain(int level, int octaves);
 
+    // load terrain with full level detail within focusRadius of focus,
+    // and triangles growing in proportion to distance beyond that
+    // brushes only work on uniform terrain
+    Terrain(int level, int octaves, Vec2f focus, float focusRadius);
+
+    // load terrain as a triangulated irregular network using just enough
+    // of the uniform grid vertices to be within maxError of all of them
+    // brushes only work on uniform terrain
+    Terrain(int level, int octaves, float maxError);
+
+    // tag for the procedural terrain constructor
+    enum Procedural {PROCEDURAL};
+
+    // terrain of the same shape as Terrain(level, octaves), computed
+    // in the vertex shader with no vertex or index buffers. Heights for
+    // setHeight come from the same function on the CPU.
+    // brushes, culling and simplified tiles only work on mesh terrain
+    Terrain(int level, int octaves, Procedural);
+
+    // tag for the headless terrain constructor
+    enum Headless {HEADLESS};
+
+    // the mesh of Terrain(level, octaves) with no GL objects, so it needs
+    // no window. Raycasts, height and region queries work; drawing does not
+    Terrain(int level, int octaves, Headless);
+
+    // terrain height function, shared by all terrain representations
+    // P.xy is in map units, -1 to 1 across the map; returns P with z added
+    static Vec3f elevation(Vec3f P, int octaves);
+
+    // size of terrain in world space
+    Vec3f size() const { return mapSize; }
+
+    // true if built by the procedural constructor
+    bool isProcedural() const { return procedural; }
+
+    // change level and octaves of procedural terrain, without rebuilding
+    void setDetail(int level, int octaves);
+
     // clean up allocated memory
     ~Terrain();
 
     // load/reload shaders
     void updateShaders();
 
-    // draw this terrain object
-    void draw() const;
+    // draw this terrain object, culling tiles against the scene view
+    void draw(Scene &scene);
 
     // set normal and position.z at given position.xy position
     // returns true if over navigation mesh
     bool setHeight(Vec3f &position, Vec3f &normal) const;
 
+    // surface height and normal at a batch of points, without the viewer
+    // height setHeight adds. Each point's walk starts from the face given
+    // for it, so points that move a little each call find their face in a
+    // step or two, and batches may run on several threads at once.
+    // Returns the number of points on the terrain; others are unchanged
+    unsigned int surfaceQuery(const SurfaceBatch &batch) const;
+
+    // deform terrain within radius of center.xy by up to strength units
+    // updates normals around the change and the GPU copy of just that area
+    void applyBrush(Vec2f center, float radius, BrushProfile profile,
+                    float strength = 10);
+
 	//toggles the use or lack of the normal map
 	void toggleNormal() { normalMap = !normalMap; }
 
 	//toggles the use or lack of the relief map
 	void toggleRelief() { reliefMap = !reliefMap; }
+
+    // erode heights for the next iterations frames, with kinds of
+    // Erosion::Kind bits, or add iterations if already eroding
+    // erosion only works on uniform terrain
+    void erode(int iterations, int kinds);
+
+    // true while erosion iterations remain
+    bool eroding() const { return erosion != 0; }
+
+    // show or hide drainage channels, tinted by upstream area
+    // drainage only works on mesh terrain
+    void toggleDrainage();
+
+    // mark vertices within radius of observer.xy that it can see, by a
+    // radial sweep of the highest elevation angle in each direction, and
+    // tint the hidden ones. Returns the number visible
+    // viewsheds only work on mesh terrain
+    unsigned int viewshed(Vec3f observer, float radius);
+
+    // true if nothing on the terrain blocks the segment from a to b
+    bool lineOfSight(Vec3f a, Vec3f b) const;
+
+    // nearest point where origin + t*dir meets the terrain, for t >= 0
+    // returns false on a miss; raycasts only work on mesh terrain
+    bool raycast(Vec3f origin, Vec3f dir, RayHit &hit) const;
+
+    // raycast each of count rays, split among threads
+    // returns the number that hit; misses have hit.t == FLT_MAX
+    unsigned int raycast(unsigned int count, const Vec3f *origin,
+                         const Vec3f *dir, RayHit *hit) const;
+
+    // build what raycasts share, if an edit cleared it. Call once before
+    // raycasting from several threads; raycasts may then run together
+    void prepareRaycasts() const;
+
+    // raycast four rays from one origin together, as for neighboring
+    // pixels. Returns a bit for each ray that hits. Builds nothing, so
+    // call prepareRaycasts first
+    int raycastPacket(Vec3f origin, const Vec3f dir[4], RayHit hit[4]) const;
+
+    // triangles touching a circle, axis-aligned box or polygon in xy, and
+    // vertices inside them. Results replace the contents of the list,
+    // keeping its storage, and the count is returned. Each query floods
+    // out from the face under the region, so costs grow with the region
+    // rather than the map, but regions whose seed points, such as the
+    // center, the point nearest the middle of the map and the corners,
+    // are all off the terrain find nothing. Polygons may be concave, but
+    // not self-intersecting. Region queries only work on mesh terrain.
+    // Queries share visit marks and the face walk kept in the terrain, so
+    // run only one at a time, never from several threads at once
+    unsigned int trianglesInCircle(Vec2f center, float radius,
+                                   std::vector<unsigned int> &tris) const;
+    unsigned int trianglesInBox(Vec2f lo, Vec2f hi,
+                                std::vector<unsigned int> &tris) const;
+    unsigned int trianglesInPolygon(const Vec2f *corner, unsigned int count,
+                                    std::vector<unsigned int> &tris) const;
+    unsigned int verticesInCircle(Vec2f center, float radius,
+                                  std::vector<unsigned int> &verts) const;
+    unsigned int verticesInBox(Vec2f lo, Vec2f hi,
+                               std::vector<unsigned int> &verts) const;
+    unsigned int verticesInPolygon(const Vec2f *corner, unsigned int count,
+                                   std::vector<unsigned int> &verts) const;
+
+    // face graph of the mesh for path queries, with centroids and slopes
+    // for the current heights; null for procedural terrain
+    const NavMesh *navigation();
+
+    // clusters of the face graph for long paths, kept up to date as for
+    // navigation(); null for procedural terrain
+    const NavHierarchy *navigationHierarchy();
+
+    // flow fields over the clusters, kept up to date as for navigation(),
+    // and emptied when all heights change; null for procedural terrain
+    FlowFields *flowFields();
+
+    // face under P, -1 if off the mesh or for procedural terrain
+    int faceAt(Vec2f P) const;
+
+    // per-vertex result of the last viewshed, 1 where visible
+    const std::vector<unsigned char> &viewshedMask() const { return viewMask; }
+
+    // true while the viewshed tint is shown
+    bool viewshedVisible() const { return viewshedShown; }
+
+    // stop tinting hidden vertices
+    void hideViewshed();
+
+    // rain world depth of water over the terrain, to flow from then on
+    // water only works on uniform terrain
+    void rain(float amount);
+
+    // remove all water, and report how fast it ran
+    void drain();
+
+    // true while there is water
+    bool flowing() const { return water != 0; }
+
+    // advance the water, then draw it over the terrain already drawn
+    void drawWater(Scene &scene);
+
+    // toggle tile culling
+    void toggleCulling() { culling = !culling; }
+
+    // toggle drawing patches from a height texture instead of the mesh
+    void toggleHeightTexture() { heightTextured = !heightTextured; }
+
+    // toggle drawing simplified tiles chosen by distance
+    void toggleSimplified() { simplified = !simplified; }
 };
 
 #endif
@@ -0,0 +1,332 @@
+// continuous distance-based level of detail terrain
+// after Strugar, "Continuous Distance-Dependent Level of Detail for
+// Rendering Heightmaps" (CDLOD)
+
+#include "TerrainLOD.hpp"
+#include "Terrain.hpp"
+#include "Scene.hpp"
+#include "AppContext.hpp"
+#include "ImagePPM.hpp"
+#include "Vec.inl"
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <float.h>
+#include <stdio.h>
+
+// height samples and node patch size: both powers of two
+const int HEIGHT_SIZE = 2048;
+const int PATCH_SIZE = 32;
+
+// LOD range as a multiple of node size, and where morphing starts and
+// ends as a fraction of the way from the previous level's range
+// ranges must be large enough that a node is fully morphed wherever it
+// meets the next coarser level, which needs RANGE_RATIO*MORPH_START node
+// sizes to be comfortably more than the node's diagonal
+const float RANGE_RATIO = 4;
+const float MORPH_START = 0.5f;
+const float MORPH_END = 0.95f;
+
+// most nodes in one batch, must match node array size in terrainlod.vert
+const unsigned int MAX_NODES = 1024;
+
+//
+// build height texture and quadtree from the terrain height function
+//
+TerrainLOD::TerrainLOD(Vec3f size, int octaves)
+    : mapSize(size), heightSize(HEIGHT_SIZE), patchSize(PATCH_SIZE)
+{
+    // buffer objects to be used later
+    glGenTextures(NUM_TEXTURES, textureIDs);
+    glGenBuffers(NUM_BUFFERS, bufferIDs);
+    glGenVertexArrays(1, &varrayID);
+
+    // load color image into a named texture
+    ImagePPM textureImage("pebbles.ppm");
+    textureImage.loadTexture(textureIDs[COLOR_TEXTURE]);
+
+    // sample heights over the square enclosing the map
+    int n = heightSize + 1;
+    float *height = new float[n*n];
+    for(int y=0; y < n; ++y) {
+        for(int x=0; x < n; ++x) {
+            Vec3f P = vec3<float>(2.f*x/heightSize - 1, 2.f*y/heightSize - 1, 0);
+            height[y*n + x] = Terrain::elevation(P, octaves).z * mapSize.z;
+        }
+    }
+
+    glBindTexture(GL_TEXTURE_2D, textureIDs[HEIGHT_TEXTURE]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, n, n, 0, GL_RED, GL_FLOAT, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // height range of finest nodes from samples, including shared edges
+    int nodes = heightSize / patchSize;
+    bounds[0].resize(nodes*nodes);
+    for(int ny=0; ny < nodes; ++ny) {
+        for(int nx=0; nx < nodes; ++nx) {
+            Vec2f b = vec2<float>(FLT_MAX, -FLT_MAX);
+            for(int y = ny*patchSize; y <= (ny+1)*patchSize; ++y) {
+                for(int x = nx*patchSize; x <= (nx+1)*patchSize; ++x) {
+                    b.x = std::min(b.x, height[y*n + x]);
+                    b.y = std::max(b.y, height[y*n + x]);
+                }
+            }
+            bounds[0][ny*nodes + nx] = b;
+        }
+    }
+    delete[] height;
+
+    // coarser levels combine four children
+    for(numlod = 1; nodes > 1; ++numlod) {
+        int children = nodes;
+        nodes /= 2;
+        std::vector<Vec2f> &b = bounds[numlod], &c = bounds[numlod-1];
+        b.resize(nodes*nodes);
+        for(int y=0; y < nodes; ++y) {
+            for(int x=0; x < nodes; ++x) {
+                Vec2f c00 = c[(2*y  )*children + 2*x], c01 = c[(2*y  )*children + 2*x+1];
+                Vec2f c10 = c[(2*y+1)*children + 2*x], c11 = c[(2*y+1)*children + 2*x+1];
+                b[y*nodes + x] = vec2<float>(
+                    std::min(std::min(c00.x, c01.x), std::min(c10.x, c11.x)),
+                    std::max(std::max(c00.y, c01.y), std::max(c10.y, c11.y)));
+            }
+        }
+    }
+
+    // LOD ranges double with each level; the root covers everything
+    float nodeSize = 2*mapSize.x * patchSize / heightSize;
+    for(int lod=0; lod < numlod; ++lod, nodeSize *= 2)
+        range[lod] = RANGE_RATIO * nodeSize;
+    range[numlod-1] = FLT_MAX;
+
+    // node patch: (patchSize+1)^2 grid vertices
+    std::vector<Vec2f> grid;
+    for(int y=0; y <= patchSize; ++y)
+        for(int x=0; x <= patchSize; ++x)
+            grid.push_back(vec2<float>(float(x), float(y)) / float(patchSize));
+
+    // triangles ordered by quarter, so each quarter can draw on its own
+    // when the rest of its node is drawn by finer children
+    std::vector<unsigned short> index;
+    int half = patchSize/2;
+    for(int q=0; q < 4; ++q) {
+        int qx = (q & 1) * half, qy = (q >> 1) * half;
+        for(int y = qy; y < qy + half; ++y) {
+            for(int x = qx; x < qx + half; ++x) {
+                unsigned short v00 = y*(patchSize+1) + x, v10 = v00 + 1;
+                unsigned short v01 = v00 + patchSize+1, v11 = v01 + 1;
+                index.push_back(v00); index.push_back(v10); index.push_back(v11);
+                index.push_back(v00); index.push_back(v11); index.push_back(v01);
+            }
+        }
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[GRID_BUFFER]);
+    glBufferData(GL_ARRAY_BUFFER, grid.size()*sizeof(Vec2f), &grid[0],
+            GL_STATIC_DRAW);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferIDs[INDEX_BUFFER]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, index.size()*sizeof(unsigned short),
+            &index[0], GL_STATIC_DRAW);
+
+    glBindBuffer(GL_UNIFORM_BUFFER, bufferIDs[NODE_BUFFER]);
+    glBufferData(GL_UNIFORM_BUFFER, MAX_NODES*sizeof(Vec4f), 0,
+            GL_STREAM_DRAW);
+
+    // initial shader load
+    shaderParts[0].id = glCreateShader(GL_VERTEX_SHADER);
+    shaderParts[0].file = "terrainlod.vert";
+    shaderParts[1].id = glCreateShader(GL_FRAGMENT_SHADER);
+    shaderParts[1].file = "terrain.frag";
+    shaderID = glCreateProgram();
+    updateShaders();
+
+    printf("LOD terrain: %d levels of %d triangle nodes, %d octaves\n",
+           numlod, 2*patchSize*patchSize, octaves);
+}
+
+//
+// Delete terrain data
+//
+TerrainLOD::~TerrainLOD()
+{
+    glDeleteShader(shaderParts[0].id);
+    glDeleteShader(shaderParts[1].id);
+    glDeleteProgram(shaderID);
+    glDeleteTextures(NUM_TEXTURES, textureIDs);
+    glDeleteBuffers(NUM_BUFFERS, bufferIDs);
+    glDeleteVertexArrays(1, &varrayID);
+}
+
+//
+// load (or replace) terrain shaders
+//
+void TerrainLOD::updateShaders()
+{
+    loadShaders(shaderID, sizeof(shaderParts)/sizeof(*shaderParts),
+            shaderParts);
+    glUseProgram(shaderID);
+
+    // (re)connect view and projection matrices, and node list
+    glUniformBlockBinding(shaderID,
+            glGetUniformBlockIndex(shaderID,"SceneData"),
+            AppContext::SCENE_UNIFORMS);
+    glUniformBlockBinding(shaderID,
+            glGetUniformBlockIndex(shaderID,"NodeData"),
+            AppContext::NODE_UNIFORMS);
+
+    // map shader name for textures to glActiveTexture number used in draw
+    glUniform1i(glGetUniformLocation(shaderID, "colorTexture"), 0);
+    glUniform1i(glGetUniformLocation(shaderID, "heightTexture"), 1);
+
+    // height texture placement and patch size
+    glUniform4f(glGetUniformLocation(shaderID, "heightMap"),
+            -mapSize.x, -mapSize.y, 2*mapSize.x, float(heightSize));
+    glUniform1f(glGetUniformLocation(shaderID, "patchSize"), float(patchSize));
+    nodeBaseUniform = glGetUniformLocation(shaderID, "nodeBase");
+
+    // morph range for each level as start and 1/length
+    Vec2f morph[MAX_LOD];
+    for(int lod=0; lod < numlod; ++lod) {
+        float prev = lod > 0 ? range[lod-1] : 0;
+        float start = prev + MORPH_START * (range[lod] - prev);
+        float end = prev + MORPH_END * (range[lod] - prev);
+        morph[lod] = vec2<float>(start, 1 / (end - start));
+    }
+    morph[numlod-1] = vec2<float>(FLT_MAX, 0); // root never morphs
+    glUniform2fv(glGetUniformLocation(shaderID, "morph"), numlod, &morph[0].x);
+
+    // re-connect attribute arrays
+    glBindVertexArray(varrayID);
+
+    GLint gridAttrib = glGetAttribLocation(shaderID, "vGrid");
+    glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[GRID_BUFFER]);
+    glVertexAttribPointer(gridAttrib, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(gridAttrib);
+}
+
+//
+// world-space bounding box of a node
+//
+void TerrainLOD::nodeBox(int lod, int x, int y, Vec3f &lo, Vec3f &hi) const
+{
+    int nodes = (heightSize / patchSize) >> lod;
+    float size = 2*mapSize.x / nodes;
+    Vec2f b = bounds[lod][y*nodes + x];
+    lo = vec3<float>(x*size - mapSize.x, y*size - mapSize.y, b.x);
+    hi = vec3<float>(lo.x + size, lo.y + size, b.y);
+}
+
+// true if any part of box lo..hi is within distance r of P
+static bool boxInRange(Vec3f P, float r, Vec3f lo, Vec3f hi)
+{
+    float d2 = 0;
+    for(int i=0; i < 3; ++i) {
+        float d = std::max(std::max(lo[i] - P[i], P[i] - hi[i]), 0.f);
+        d2 += d*d;
+    }
+    return d2 <= r*r;
+}
+
+// true if any part of box lo..hi may be inside the frustum planes
+static bool boxInFrustum(const Vec4f plane[6], Vec3f lo, Vec3f hi)
+{
+    for(int p=0; p < 6; ++p) {
+        Vec4f P = plane[p];
+        if (P.x * (P.x > 0 ? hi.x : lo.x) +
+            P.y * (P.y > 0 ? hi.y : lo.y) +
+            P.z * (P.z > 0 ? hi.z : lo.z) + P.w < 0)
+            return false;
+    }
+    return true;
+}
+
+//
+// select node or its children for drawing
+// returns false if the node is beyond its level's range entirely, so
+// its parent should draw that area at the parent's resolution
+//
+bool TerrainLOD::select(Scene &scene, int lod, int x, int y)
+{
+    Vec3f lo, hi;
+    nodeBox(lod, x, y, lo, hi);
+    if (! boxInRange(scene.position, range[lod], lo, hi))
+        return false;
+
+    // culled, but handled: parent should not draw it either
+    if (! boxInFrustum(scene.frustum, lo, hi)) {
+        ++scene.stats.frustumCulled;
+        return true;
+    }
+
+    Vec4f node = vec4<float>(lo.x, lo.y, hi.x - lo.x, float(lod));
+
+    // whole node at this level if no part needs more detail
+    if (lod == 0 || ! boxInRange(scene.position, range[lod-1], lo, hi)) {
+        selected[WHOLE].push_back(node);
+        return true;
+    }
+
+    // otherwise children, drawing any quarters they leave at this level
+    for(int q=0; q < 4; ++q) {
+        if (! select(scene, lod-1, 2*x + (q & 1), 2*y + (q >> 1)))
+            selected[q].push_back(node);
+    }
+    return true;
+}
+
+//
+// draw nodes selected for the current scene view
+//
+void TerrainLOD::draw(Scene &scene)
+{
+    for(int p=0; p < NUM_PARTS; ++p)
+        selected[p].clear();
+    select(scene, numlod-1, 0, 0);
+
+    // enable shaders, vertex arrays and textures
+    glUseProgram(shaderID);
+    glBindVertexArray(varrayID);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, textureIDs[COLOR_TEXTURE]);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, textureIDs[HEIGHT_TEXTURE]);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferIDs[INDEX_BUFFER]);
+    glBindBufferBase(GL_UNIFORM_BUFFER, AppContext::NODE_UNIFORMS,
+            bufferIDs[NODE_BUFFER]);
+
+    // all parts packed in one list, with index range for each part
+    int first[NUM_PARTS + 1];
+    packed.clear();
+    for(int p=0; p < NUM_PARTS; ++p) {
+        first[p] = int(packed.size());
+        packed.insert(packed.end(), selected[p].begin(), selected[p].end());
+    }
+    first[NUM_PARTS] = int(packed.size());
+
+    int quarter = 6 * (patchSize/2) * (patchSize/2);
+    for(int start=0; start < first[NUM_PARTS]; start += MAX_NODES) {
+        int end = std::min(first[NUM_PARTS], start + int(MAX_NODES));
+        glBindBuffer(GL_UNIFORM_BUFFER, bufferIDs[NODE_BUFFER]);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, (end - start)*sizeof(Vec4f),
+                &packed[start]);
+
+        // one instanced draw per part in this batch
+        for(int p=0; p < NUM_PARTS; ++p) {
+            int lo = std::max(first[p], start), hi = std::min(first[p+1], end);
+            if (lo >= hi) continue;
+
+            int count = p == WHOLE ? 4*quarter : quarter;
+            size_t offset = p == WHOLE ? 0 : p * quarter * sizeof(unsigned short);
+            glUniform1i(nodeBaseUniform, lo - start);
+            glDrawElementsInstanced(GL_TRIANGLES, count, GL_UNSIGNED_SHORT,
+                    (const void*)offset, hi - lo);
+            scene.stats.triangles += count/3 * (hi - lo);
+        }
+    }
+    scene.stats.tilesDrawn += first[NUM_PARTS];
+}
@@ -0,0 +1,75 @@
+// continuous distance-based level of detail terrain
+#ifndef TerrainLOD_hpp
+#define TerrainLOD_hpp
+
+#include "Vec.hpp"
+#include "Shader.hpp"
+#include <vector>
+
+class Scene;
+
+// quadtree of square nodes over a height texture. Every node draws the
+// same grid patch, so nodes farther from the viewer cover more area with
+// the same number of triangles. Vertices morph toward the next coarser
+// level as they approach the edge of their LOD range to avoid popping.
+class TerrainLOD {
+// private data
+private:
+    enum {MAX_LOD = 16};        // most levels the shaders support
+
+    Vec3f mapSize;              // size of terrain in world space
+    int heightSize;             // height texture samples across, minus 1
+    int patchSize;              // grid quads across each node patch
+    int numlod;                 // quadtree levels, 0 is finest
+
+    // height range of each node, by level then row-major node position
+    std::vector<Vec2f> bounds[MAX_LOD];
+    float range[MAX_LOD];       // view distance covered by each level
+
+    // nodes selected for this frame: xy = low corner, z = size, w = level
+    // split by which part of the patch they draw: quarters 0-3, or all
+    enum {WHOLE = 4, NUM_PARTS};
+    std::vector<Vec4f> selected[NUM_PARTS];
+    std::vector<Vec4f> packed;  // all parts together for upload
+
+    // GL vertex array object IDs
+    unsigned int varrayID;
+
+    // GL texture IDs
+    enum {COLOR_TEXTURE, HEIGHT_TEXTURE, NUM_TEXTURES};
+    unsigned int textureIDs[NUM_TEXTURES];
+
+    // GL buffer object IDs
+    enum {GRID_BUFFER, INDEX_BUFFER, NODE_BUFFER, NUM_BUFFERS};
+    unsigned int bufferIDs[NUM_BUFFERS];
+
+    // GL shaders
+    unsigned int shaderID;      // ID for shader program
+    ShaderInfo shaderParts[2];  // vertex & fragment shader info
+    int nodeBaseUniform;        // location of first node index uniform
+
+// private methods
+private:
+    // world-space bounding box of a node
+    void nodeBox(int lod, int x, int y, Vec3f &lo, Vec3f &hi) const;
+
+    // select node or its children for drawing
+    // returns false if the node is beyond its level's range entirely
+    bool select(Scene &scene, int lod, int x, int y);
+
+// public methods
+public:
+    // build height texture and quadtree from the terrain height function
+    TerrainLOD(Vec3f mapSize, int octaves);
+
+    // clean up allocated memory
+    ~TerrainLOD();
+
+    // load/reload shaders
+    void updateShaders();
+
+    // draw nodes selected for the current scene view
+    void draw(Scene &scene);
+};
+
+#endif
@@ -0,0 +1,559 @@
+// view-dependent terrain refined by triangle split and merge
+// after Duchaineau et al., "ROAMing Terrain: Real-time Optimally Adapting
+// Meshes"
+
+#include "TerrainROAM.hpp"
+#include "Terrain.hpp"
+#include "Scene.hpp"
+#include "AppContext.hpp"
+#include "ImagePPM.hpp"
+#include "Vec.inl"
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+
+// most triangles drawn, and most splits and merges in one frame
+const unsigned int BUDGET = 50000;
+const unsigned int MAX_OPS = 2000;
+
+// split while screen error is over this many pixels; diamonds under half
+// of it are merged even when there is budget to spare
+const float PIXEL_ERROR = 1;
+
+//
+// build error tables and the two base triangles
+//
+TerrainROAM::TerrainROAM(Vec3f size, int octaves)
+    : mapSize(size), octaves(octaves), budget(BUDGET), maxOps(MAX_OPS),
+      pixelError(PIXEL_ERROR), busy(false), numleaf(0), pixelScale(0)
+{
+    // buffer objects to be used later
+    glGenTextures(NUM_TEXTURES, textureIDs);
+    glGenBuffers(NUM_BUFFERS, bufferIDs);
+    glGenVertexArrays(1, &varrayID);
+
+    // load color image into a named texture
+    ImagePPM textureImage("pebbles.ppm");
+    textureImage.loadTexture(textureIDs[COLOR_TEXTURE]);
+
+    // heights at every vertex the trees can reach
+    int n = GRID + 1;
+    height.resize(n*n);
+    for(int y=0; y < n; ++y)
+        for(int x=0; x < n; ++x)
+            height[y*n + x] = heightAt(gridX(x), gridY(y));
+
+    // nested error bounds for the two trees, split along the diagonal
+    int v0[3][2] = {{GRID, 0}, {GRID, GRID}, {0, 0}};
+    int v1[3][2] = {{0, GRID}, {0, 0}, {GRID, GRID}};
+    for(int r=0; r < 2; ++r)
+        error[r].resize(size_t(2) << MAX_DEPTH);
+    buildError(0, 1, v0, 0);
+    buildError(1, 1, v1, 0);
+
+    // GL buffers hold the budget plus the most one split can overshoot
+    capacity = budget + 2*MAX_DEPTH + 4;
+    index.resize(3*capacity);
+    slotTri.resize(capacity);
+
+    glBindVertexArray(varrayID);
+    glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[POSITION_BUFFER]);
+    glBufferData(GL_ARRAY_BUFFER, capacity*sizeof(Vec3f), 0, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[NORMAL_BUFFER]);
+    glBufferData(GL_ARRAY_BUFFER, capacity*sizeof(Vec3f), 0, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferIDs[INDEX_BUFFER]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 3*capacity*sizeof(unsigned int), 0,
+            GL_DYNAMIC_DRAW);
+
+    // two base triangles, each other's base neighbor
+    int c00 = newVertex(0, 0), c10 = newVertex(GRID, 0);
+    int c11 = newVertex(GRID, GRID), c01 = newVertex(0, GRID);
+    int t0 = newTriangle(-1, c10, c11, c00, 0, 1);
+    int t1 = newTriangle(-1, c01, c00, c11, 1, 1);
+    tri[t0].base = t1;
+    tri[t1].base = t0;
+    addLeaf(t0);
+    addLeaf(t1);
+
+    // initial shader load
+    shaderParts[0].id = glCreateShader(GL_VERTEX_SHADER);
+    shaderParts[0].file = "stream.vert";
+    shaderParts[1].id = glCreateShader(GL_FRAGMENT_SHADER);
+    shaderParts[1].file = "terrain.frag";
+    shaderID = glCreateProgram();
+    updateShaders();
+
+    printf("ROAM terrain: %d triangle budget, %dx%d finest grid\n",
+           budget, GRID, GRID);
+}
+
+//
+// clean up
+//
+TerrainROAM::~TerrainROAM()
+{
+    glDeleteShader(shaderParts[0].id);
+    glDeleteShader(shaderParts[1].id);
+    glDeleteProgram(shaderID);
+    glDeleteTextures(NUM_TEXTURES, textureIDs);
+    glDeleteBuffers(NUM_BUFFERS, bufferIDs);
+    glDeleteVertexArrays(1, &varrayID);
+}
+
+//
+// load (or replace) terrain shaders
+//
+void TerrainROAM::updateShaders()
+{
+    loadShaders(shaderID, sizeof(shaderParts)/sizeof(*shaderParts),
+            shaderParts);
+    glUseProgram(shaderID);
+
+    // (re)connect view and projection matrices
+    glUniformBlockBinding(shaderID,
+            glGetUniformBlockIndex(shaderID,"SceneData"),
+            AppContext::SCENE_UNIFORMS);
+
+    // map shader name for textures to glActiveTexture number used in draw
+    glUniform1i(glGetUniformLocation(shaderID, "colorTexture"), 0);
+    glUniform2f(glGetUniformLocation(shaderID, "mapSize"),
+            mapSize.x, mapSize.y);
+
+    // re-connect attribute arrays
+    glBindVertexArray(varrayID);
+
+    GLint positionAttrib = glGetAttribLocation(shaderID, "vPosition");
+    glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[POSITION_BUFFER]);
+    glVertexAttribPointer(positionAttrib, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(positionAttrib);
+
+    GLint normalAttrib = glGetAttribLocation(shaderID, "vNormal");
+    glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[NORMAL_BUFFER]);
+    glVertexAttribPointer(normalAttrib, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(normalAttrib);
+}
+
+//
+// terrain height at world xy from the height function
+//
+float TerrainROAM::heightAt(float x, float y) const
+{
+    Vec3f P = vec3<float>(x / mapSize.x, y / mapSize.y, 0);
+    return Terrain::elevation(P, octaves).z * mapSize.z;
+}
+
+//
+// nested error bound of a triangle and all of its descendants: the
+// largest vertical distance from any finer vertex to this triangle
+//
+float TerrainROAM::buildError(int root, int id, const int v[3][2], int depth)
+{
+    if (depth == MAX_DEPTH)
+        return error[root][id] = 0;
+
+    int n = GRID + 1;
+    int m[2] = {(v[1][0] + v[2][0]) / 2, (v[1][1] + v[2][1]) / 2};
+    float e = fabsf(height[m[1]*n + m[0]] -
+                    0.5f * (height[v[1][1]*n + v[1][0]] +
+                            height[v[2][1]*n + v[2][0]]));
+
+    int c0[3][2] = {{m[0], m[1]}, {v[0][0], v[0][1]}, {v[1][0], v[1][1]}};
+    int c1[3][2] = {{m[0], m[1]}, {v[2][0], v[2][1]}, {v[0][0], v[0][1]}};
+    e = std::max(e, buildError(root, 2*id, c0, depth+1));
+    e = std::max(e, buildError(root, 2*id+1, c1, depth+1));
+    return error[root][id] = e;
+}
+
+//
+// new vertex at grid point x,y, with height from the height function
+// and normal from central differences at the finest grid spacing
+//
+int TerrainROAM::newVertex(int x, int y)
+{
+    int v;
+    if (! freeVert.empty()) {
+        v = freeVert.back();
+        freeVert.pop_back();
+    }
+    else {
+        v = int(vert.size());
+        vert.resize(v+1);
+        norm.resize(v+1);
+        grid.resize(2*(v+1));
+    }
+
+    float wx = gridX(x), wy = gridY(y);
+    float dx = mapSize.x / GRID, dy = mapSize.y / GRID;
+    vert[v] = vec3<float>(wx, wy, heightAt(wx, wy));
+    norm[v] = normalize(vec3<float>(
+        (heightAt(wx - dx, wy) - heightAt(wx + dx, wy)) * dy,
+        (heightAt(wx, wy - dy) - heightAt(wx, wy + dy)) * dx,
+        2 * dx * dy));
+    grid[2*v] = x;
+    grid[2*v+1] = y;
+    changedVert.push_back(v);
+    return v;
+}
+
+//
+// new or recycled triangle, with no neighbors or children yet
+//
+int TerrainROAM::newTriangle(int parent, int v0, int v1, int v2,
+                             int root, int id)
+{
+    int t;
+    if (! freeTri.empty()) {
+        t = freeTri.back();
+        freeTri.pop_back();
+    }
+    else {
+        t = int(tri.size());
+        tri.resize(t+1);
+    }
+
+    BinTri &T = tri[t];
+    T.vert[0] = v0; T.vert[1] = v1; T.vert[2] = v2;
+    T.base = T.next = T.prev = -1;
+    T.child[0] = T.child[1] = -1;
+    T.parent = parent;
+    T.root = root;
+    T.id = id;
+    T.slot = -1;
+    return t;
+}
+
+//
+// add leaf triangle to the end of the index buffer
+//
+void TerrainROAM::addLeaf(int t)
+{
+    unsigned int s = numleaf++;
+    tri[t].slot = s;
+    slotTri[s] = t;
+    for(int k=0; k < 3; ++k)
+        index[3*s + k] = tri[t].vert[k];
+    changedSlot.push_back(s);
+}
+
+//
+// remove leaf triangle, moving the last leaf into its slot so the drawn
+// triangles stay packed
+//
+void TerrainROAM::removeLeaf(int t)
+{
+    unsigned int s = tri[t].slot, last = --numleaf;
+    tri[t].slot = -1;
+    if (s == last) return;
+
+    int moved = slotTri[last];
+    tri[moved].slot = s;
+    slotTri[s] = moved;
+    for(int k=0; k < 3; ++k)
+        index[3*s + k] = index[3*last + k];
+    changedSlot.push_back(s);
+}
+
+//
+// point neighbor n's link to old at replacement instead
+//
+void TerrainROAM::relink(int n, int old, int replacement)
+{
+    if (n < 0) return;
+    BinTri &N = tri[n];
+    if (N.base == old) N.base = replacement;
+    else if (N.next == old) N.next = replacement;
+    else if (N.prev == old) N.prev = replacement;
+}
+
+//
+// split one triangle of a diamond, sharing midpoint vertex m
+// children take the two legs as their hypotenuses; the caller links the
+// children on either side of the old hypotenuse
+//
+void TerrainROAM::splitHalf(int t, int m)
+{
+    int v0 = tri[t].vert[0], v1 = tri[t].vert[1], v2 = tri[t].vert[2];
+    int root = tri[t].root, id = tri[t].id;
+    int c0 = newTriangle(t, m, v0, v1, root, 2*id);
+    int c1 = newTriangle(t, m, v2, v0, root, 2*id+1);
+
+    BinTri &T = tri[t];
+    T.child[0] = c0;
+    T.child[1] = c1;
+    tri[c0].base = T.next;
+    tri[c1].base = T.prev;
+    tri[c0].next = c1;
+    tri[c1].prev = c0;
+    relink(T.next, t, c0);
+    relink(T.prev, t, c1);
+
+    removeLeaf(t);
+    addLeaf(c0);
+    addLeaf(c1);
+}
+
+//
+// split t, first splitting its base neighbor if that is coarser so the
+// mesh stays crack-free
+//
+void TerrainROAM::split(int t)
+{
+    if (tri[t].child[0] >= 0) return;
+    int b = tri[t].base;
+    if (b >= 0 && tri[b].base != t) {
+        split(b);
+        b = tri[t].base;
+    }
+
+    int m = newVertex((grid[2*tri[t].vert[1]] + grid[2*tri[t].vert[2]]) / 2,
+                      (grid[2*tri[t].vert[1]+1] + grid[2*tri[t].vert[2]+1]) / 2);
+    splitHalf(t, m);
+    if (b >= 0) {
+        splitHalf(b, m);
+        tri[tri[t].child[0]].prev = tri[b].child[1];
+        tri[tri[b].child[1]].next = tri[t].child[0];
+        tri[tri[t].child[1]].next = tri[b].child[0];
+        tri[tri[b].child[0]].prev = tri[t].child[1];
+    }
+
+    // new leaves may need splitting, and this diamond may merge again
+    queueSplit(tri[t].child[0]);
+    queueSplit(tri[t].child[1]);
+    if (b >= 0) {
+        queueSplit(tri[b].child[0]);
+        queueSplit(tri[b].child[1]);
+    }
+    queueMerge(t);
+}
+
+//
+// undo splitHalf: t takes back its children's outer neighbors
+//
+void TerrainROAM::mergeHalf(int t)
+{
+    int c0 = tri[t].child[0], c1 = tri[t].child[1];
+    tri[t].next = tri[c0].base;
+    tri[t].prev = tri[c1].base;
+    relink(tri[c0].base, c0, t);
+    relink(tri[c1].base, c1, t);
+
+    removeLeaf(c0);
+    removeLeaf(c1);
+    tri[c0].root = tri[c1].root = -1;
+    freeTri.push_back(c0);
+    freeTri.push_back(c1);
+    tri[t].child[0] = tri[t].child[1] = -1;
+    addLeaf(t);
+}
+
+//
+// merge t and its base neighbor back to unsplit triangles
+//
+void TerrainROAM::merge(int t)
+{
+    int b = tri[t].base;
+    int m = tri[tri[t].child[0]].vert[0];
+    mergeHalf(t);
+    if (b >= 0) mergeHalf(b);
+    freeVert.push_back(m);
+
+    // merged triangles may split again, and their parents may now merge
+    queueSplit(t);
+    if (tri[t].parent >= 0) queueMerge(tri[t].parent);
+    if (b >= 0) {
+        queueSplit(b);
+        if (tri[b].parent >= 0) queueMerge(tri[b].parent);
+    }
+}
+
+//
+// true if t and its base neighbor are split into leaves
+//
+bool TerrainROAM::mergeable(int t) const
+{
+    const BinTri &T = tri[t];
+    if (T.root < 0 || T.child[0] < 0 ||
+        tri[T.child[0]].child[0] >= 0 || tri[T.child[1]].child[0] >= 0)
+        return false;
+    if (T.base < 0) return true;
+
+    const BinTri &B = tri[T.base];
+    return B.base == t && B.child[0] >= 0 &&
+        tri[B.child[0]].child[0] < 0 && tri[B.child[1]].child[0] < 0;
+}
+
+//
+// screen-space error of t from the current view: its error bound
+// projected at the nearest distance of its bounding sphere, or zero if
+// the sphere is outside the view
+//
+float TerrainROAM::screenError(int t) const
+{
+    const BinTri &T = tri[t];
+    float e = error[T.root][T.id];
+    if (e <= 0) return 0;
+
+    // hypotenuse midpoint is the center of a right triangle
+    Vec3f a = vert[T.vert[0]], b = vert[T.vert[1]], c = vert[T.vert[2]];
+    Vec3f center = 0.5f * (b + c);
+    float r = std::max(length(a - center), length(b - center)) + e;
+
+    for(int p=0; p < 6; ++p)
+        if (dot(plane[p].xyz, center) + plane[p].w < -r)
+            return 0;
+
+    float dist = std::max(length(center - eye) - r, 0.1f);
+    return e * pixelScale / dist;
+}
+
+//
+// queue t for splitting if it is a leaf above the finest level
+//
+void TerrainROAM::queueSplit(int t)
+{
+    if (tri[t].child[0] >= 0 || tri[t].id >= 1 << MAX_DEPTH) return;
+    Entry e = {screenError(t), t};
+    splitQueue.push(e);
+}
+
+//
+// queue the diamond of t for merging; each diamond is queued from its
+// lower numbered triangle
+//
+void TerrainROAM::queueMerge(int t)
+{
+    int b = tri[t].base;
+    if ((b >= 0 && b < t) || ! mergeable(t)) return;
+    float p = screenError(t);
+    if (b >= 0) p = std::max(p, screenError(b));
+    Entry e = {p, t};
+    mergeQueue.push(e);
+}
+
+//
+// refine toward the view: split the largest errors while under budget,
+// merge the smallest when over it, and trade merges for splits while the
+// largest split beats the smallest merge
+//
+void TerrainROAM::update(Scene &scene)
+{
+    eye = scene.position;
+    pixelScale = 0.5f * scene.height * scene.sdata.projection.matrix[1][1];
+    for(int p=0; p < 6; ++p)
+        plane[p] = scene.frustum[p] / length(scene.frustum[p].xyz);
+
+    // priorities change with the view, so queue everything again
+    splitQueue = std::priority_queue<Entry>();
+    mergeQueue = std::priority_queue<Entry, std::vector<Entry>,
+                                     std::greater<Entry> >();
+    for(unsigned int s=0; s < numleaf; ++s) {
+        int t = slotTri[s], parent = tri[t].parent;
+        queueSplit(t);
+        if (parent >= 0 && tri[parent].child[0] == t)
+            queueMerge(parent);
+    }
+
+    unsigned int ops;
+    for(ops=0; ops < maxOps; ++ops) {
+        // drop entries that no longer apply or were queued with an old
+        // priority, then peek at both ends
+        while (! splitQueue.empty()) {
+            Entry e = splitQueue.top();
+            if (tri[e.tri].root >= 0 && tri[e.tri].child[0] < 0 &&
+                e.priority == screenError(e.tri))
+                break;
+            splitQueue.pop();
+        }
+        while (! mergeQueue.empty() && ! mergeable(mergeQueue.top().tri))
+            mergeQueue.pop();
+
+        float splitError = splitQueue.empty() ? 0 : splitQueue.top().priority;
+        float mergeError = mergeQueue.empty() ? 0 : mergeQueue.top().priority;
+        bool canMerge = ! mergeQueue.empty();
+
+        if (numleaf > budget || (canMerge && mergeError < 0.5f * pixelError)) {
+            if (! canMerge) break;
+            int t = mergeQueue.top().tri;
+            mergeQueue.pop();
+            merge(t);
+        }
+        else if (splitError > pixelError && numleaf < budget) {
+            int t = splitQueue.top().tri;
+            splitQueue.pop();
+            split(t);
+        }
+        else if (splitError > pixelError && canMerge && mergeError < splitError) {
+            int t = mergeQueue.top().tri;
+            mergeQueue.pop();
+            merge(t);
+        }
+        else
+            break;
+    }
+    busy = ops == maxOps;
+}
+
+//
+// send changed vertices and triangles to the GL buffers, as merged ranges
+//
+void TerrainROAM::upload()
+{
+    // slots closer than this upload as one range, since a few extra bytes
+    // are cheaper than another glBufferSubData call
+    const unsigned int MERGE_GAP = 64;
+
+    std::vector<unsigned int> *changed[2] = {&changedVert, &changedSlot};
+    for(int c=0; c < 2; ++c) {
+        std::vector<unsigned int> &list = *changed[c];
+        std::sort(list.begin(), list.end());
+
+        std::vector<unsigned int> dirty;
+        for(size_t i=0; i < list.size(); ++i) {
+            if (! dirty.empty() && list[i] - dirty.back() <= MERGE_GAP)
+                dirty.back() = list[i] + 1;
+            else {
+                dirty.push_back(list[i]);
+                dirty.push_back(list[i] + 1);
+            }
+        }
+        list.clear();
+
+        for(size_t i=0; i < dirty.size(); i += 2) {
+            unsigned int first = dirty[i], count = dirty[i+1] - dirty[i];
+            if (c == 0) {
+                glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[POSITION_BUFFER]);
+                glBufferSubData(GL_ARRAY_BUFFER, first*sizeof(Vec3f),
+                        count*sizeof(Vec3f), &vert[first]);
+                glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[NORMAL_BUFFER]);
+                glBufferSubData(GL_ARRAY_BUFFER, first*sizeof(Vec3f),
+                        count*sizeof(Vec3f), &norm[first]);
+            }
+            else {
+                glBufferSubData(GL_ELEMENT_ARRAY_BUFFER,
+                        3*first*sizeof(unsigned int),
+                        3*count*sizeof(unsigned int), &index[3*first]);
+            }
+        }
+    }
+}
+
+//
+// refine and draw from the scene view
+//
+void TerrainROAM::draw(Scene &scene)
+{
+    update(scene);
+
+    // enable shaders, vertex arrays and textures
+    glUseProgram(shaderID);
+    glBindVertexArray(varrayID);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, textureIDs[COLOR_TEXTURE]);
+
+    upload();
+    glDrawElements(GL_TRIANGLES, 3*numleaf, GL_UNSIGNED_INT, 0);
+    scene.stats.triangles += numleaf;
+}
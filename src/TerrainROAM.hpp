@@ -0,0 +1,175 @@
+// view-dependent terrain refined by triangle split and merge
+#ifndef TerrainROAM_hpp
+#define TerrainROAM_hpp
+
+#include "Vec.hpp"
+#include "Shader.hpp"
+#include <vector>
+#include <queue>
+#include <functional>
+
+class Scene;
+
+// binary triangle tree over the terrain square, after Duchaineau et al.,
+// "ROAMing Terrain: Real-time Optimally Adapting Meshes". Each frame
+// splits the triangles with the largest screen-space error and merges the
+// diamonds with the smallest, keeping the mesh crack-free and under a
+// fixed triangle budget. Only vertices and triangles that changed are
+// uploaded, and the work per frame is capped so frame time stays steady
+// however rough the surface is.
+class TerrainROAM {
+// private types
+private:
+    // deepest triangles; every vertex lies on a grid of 2^(MAX_DEPTH/2)
+    // intervals across the square
+    enum {MAX_DEPTH = 18, GRID = 1 << (MAX_DEPTH/2)};
+
+    // triangle with right angle at vert[0] and hypotenuse vert[1]-vert[2],
+    // counter-clockwise. Neighbors are -1 at the edge of the square.
+    struct BinTri {
+        int vert[3];
+        int base;               // neighbor across vert[1]-vert[2]
+        int next;               // neighbor across vert[0]-vert[1]
+        int prev;               // neighbor across vert[2]-vert[0]
+        int child[2];           // split halves, -1 for a leaf
+        int parent;
+        int root, id;           // tree and heap index into error table
+        int slot;               // triangle slot in index buffer if a leaf
+    };
+
+    // queued split or merge, ordered by priority
+    struct Entry {
+        float priority;
+        int tri;
+        bool operator<(const Entry &e) const { return priority < e.priority; }
+        bool operator>(const Entry &e) const { return priority > e.priority; }
+    };
+
+// private data
+private:
+    Vec3f mapSize;              // half width and height of terrain square
+    int octaves;                // noise octaves for height function
+    unsigned int budget;        // most triangles drawn
+    unsigned int maxOps;        // most splits and merges per frame
+    float pixelError;           // stop splitting under this error in pixels
+    bool busy;                  // last update stopped at maxOps
+
+    std::vector<float> height;  // height at each grid point, for errors
+    std::vector<float> error[2];// nested error bound of each triangle
+
+    std::vector<BinTri> tri;    // all triangles in both trees
+    std::vector<int> freeTri;   // unused entries in tri
+
+    // per-vertex data, in GL buffer order
+    std::vector<Vec3f> vert, norm;
+    std::vector<int> grid;      // x and y grid position of each vertex
+    std::vector<int> freeVert;  // unused vertex slots
+    unsigned int capacity;      // vertex and triangle slots in GL buffers
+
+    // leaf triangles, packed at the start of the index buffer
+    std::vector<unsigned int> index;
+    std::vector<int> slotTri;   // leaf triangle in each slot
+    unsigned int numleaf;
+
+    // slots changed since the last upload
+    std::vector<unsigned int> changedVert, changedSlot;
+
+    // per-frame view data, and queues built from it
+    Vec4f plane[6];             // normalized frustum planes
+    Vec3f eye;
+    float pixelScale;           // pixels per world unit at unit distance
+    std::priority_queue<Entry> splitQueue;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry> >
+        mergeQueue;
+
+    // GL vertex array object IDs
+    unsigned int varrayID;
+
+    // GL texture IDs
+    enum {COLOR_TEXTURE, NUM_TEXTURES};
+    unsigned int textureIDs[NUM_TEXTURES];
+
+    // GL buffer object IDs
+    enum {POSITION_BUFFER, NORMAL_BUFFER, INDEX_BUFFER, NUM_BUFFERS};
+    unsigned int bufferIDs[NUM_BUFFERS];
+
+    // GL shaders
+    unsigned int shaderID;      // ID for shader program
+    ShaderInfo shaderParts[2];  // vertex & fragment shader info
+
+// private methods
+private:
+    // terrain height at world xy from the height function
+    float heightAt(float x, float y) const;
+
+    // world position of grid point x,y
+    float gridX(int x) const { return (2.f * x / GRID - 1) * mapSize.x; }
+    float gridY(int y) const { return (2.f * y / GRID - 1) * mapSize.y; }
+
+    // nested error bound of a triangle and all of its descendants
+    float buildError(int root, int id, const int v[3][2], int depth);
+
+    // new vertex at grid point x,y
+    int newVertex(int x, int y);
+
+    // new or recycled triangle
+    int newTriangle(int parent, int v0, int v1, int v2, int root, int id);
+
+    // add leaf triangle to the end of the index buffer
+    void addLeaf(int t);
+
+    // remove leaf triangle, filling its slot from the end
+    void removeLeaf(int t);
+
+    // point neighbor n's link to old at replacement instead
+    void relink(int n, int old, int replacement);
+
+    // split one triangle of a diamond, sharing midpoint vertex m
+    void splitHalf(int t, int m);
+
+    // split t, first splitting its base neighbor if that is coarser
+    void split(int t);
+
+    // undo splitHalf
+    void mergeHalf(int t);
+
+    // merge t and its base neighbor back to unsplit triangles
+    void merge(int t);
+
+    // true if t and its base neighbor are split into leaves
+    bool mergeable(int t) const;
+
+    // screen-space error of t from the current view
+    float screenError(int t) const;
+
+    // queue t for splitting if it can be
+    void queueSplit(int t);
+
+    // queue the diamond of t for merging if it can be
+    void queueMerge(int t);
+
+    // refine toward the view, within budget and operation limits
+    void update(Scene &scene);
+
+    // send changed vertices and triangles to the GL buffers
+    void upload();
+
+// public methods
+public:
+    // build error tables and the two base triangles
+    TerrainROAM(Vec3f mapSize, int octaves);
+
+    // clean up
+    ~TerrainROAM();
+
+    // load/reload shaders
+    void updateShaders();
+
+    // true if the last frame ran out of operations before converging
+    bool refining() const { return busy; }
+
+    // refine and draw from the scene view
+    void draw(Scene &scene);
+};
+
+#endif
@@ -0,0 +1,168 @@
+// terrain drawn by ray marching a height texture
+// after Tevs, Ihrke and Seidel, "Maximum Mipmaps for Fast, Accurate, and
+// Scalable Dynamic Height Field Rendering"
+
+#include "TerrainRaymarch.hpp"
+#include "Terrain.hpp"
+#include "Scene.hpp"
+#include "AppContext.hpp"
+#include "ImagePPM.hpp"
+#include "Vec.inl"
+
+#include <GL/glew.h>
+#include <algorithm>
+#include <vector>
+#include <stdio.h>
+#include <math.h>
+
+// height texture cells across the map square: power of two
+const int HEIGHT_SIZE = 2048;
+
+// maximum for cells entirely off the terrain, so every ray skips them
+const float NO_TERRAIN = -1e30f;
+
+// lower bound on distance outside the terrain hexagon, in map units
+// each term is the distance to the line through one pair of edges
+static float hexagonDistance(Vec2f P)
+{
+    float x = fabsf(P.x), y = fabsf(P.y);
+    return std::max(y - sqrtf(0.75f), 0.5f * (sqrtf(3) * x + y) - sqrtf(0.75f));
+}
+
+//
+// build height texture and maximum pyramid from the height function
+//
+TerrainRaymarch::TerrainRaymarch(Vec3f size, int octaves)
+    : mapSize(size), heightSize(HEIGHT_SIZE)
+{
+    for(maxLevel = 0; (1 << maxLevel) < heightSize; ++maxLevel) {}
+
+    // buffer objects to be used later
+    glGenTextures(NUM_TEXTURES, textureIDs);
+    glGenVertexArrays(1, &varrayID);
+
+    // load color image into a named texture
+    ImagePPM textureImage("pebbles.ppm");
+    textureImage.loadTexture(textureIDs[COLOR_TEXTURE]);
+
+    // heights at cell corners over the square enclosing the map, filtered
+    // linearly so the surface is bilinear in each cell
+    int n = heightSize + 1;
+    std::vector<float> height(n*n);
+    for(int y=0; y < n; ++y) {
+        for(int x=0; x < n; ++x) {
+            Vec3f P = vec3<float>(2.f*x/heightSize - 1, 2.f*y/heightSize - 1, 0);
+            height[y*n + x] = Terrain::elevation(P, octaves).z * mapSize.z;
+        }
+    }
+
+    glBindTexture(GL_TEXTURE_2D, textureIDs[HEIGHT_TEXTURE]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, n, n, 0, GL_RED, GL_FLOAT,
+            &height[0]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // finest maximum level: highest corner of each cell that may touch
+    // the hexagon, which bounds the bilinear surface inside it
+    std::vector<float> maxHeight(heightSize*heightSize);
+    float radius = sqrtf(2.f) / heightSize;
+    for(int y=0; y < heightSize; ++y) {
+        for(int x=0; x < heightSize; ++x) {
+            Vec2f center = vec2<float>(2.f*(x + 0.5f)/heightSize - 1,
+                                       2.f*(y + 0.5f)/heightSize - 1);
+            float h = NO_TERRAIN;
+            if (hexagonDistance(center) <= radius)
+                h = std::max(std::max(height[y*n + x], height[y*n + x+1]),
+                             std::max(height[(y+1)*n + x], height[(y+1)*n + x+1]));
+            maxHeight[y*heightSize + x] = h;
+        }
+    }
+
+    // coarser levels take the maximum of four children
+    glBindTexture(GL_TEXTURE_2D, textureIDs[MAX_TEXTURE]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, maxLevel);
+    for(int level=0, cells=heightSize; level <= maxLevel; ++level, cells /= 2) {
+        if (level > 0) {
+            for(int y=0; y < cells; ++y)
+                for(int x=0; x < cells; ++x)
+                    maxHeight[y*cells + x] = std::max(
+                        std::max(maxHeight[(2*y  )*2*cells + 2*x],
+                                 maxHeight[(2*y  )*2*cells + 2*x+1]),
+                        std::max(maxHeight[(2*y+1)*2*cells + 2*x],
+                                 maxHeight[(2*y+1)*2*cells + 2*x+1]));
+        }
+        glTexImage2D(GL_TEXTURE_2D, level, GL_R32F, cells, cells, 0, GL_RED,
+                GL_FLOAT, &maxHeight[0]);
+    }
+
+    // initial shader load
+    shaderParts[0].id = glCreateShader(GL_VERTEX_SHADER);
+    shaderParts[0].file = "raymarch.vert";
+    shaderParts[1].id = glCreateShader(GL_FRAGMENT_SHADER);
+    shaderParts[1].file = "raymarch.frag";
+    shaderID = glCreateProgram();
+    updateShaders();
+
+    printf("ray marched terrain: %d cells across, %d max levels, %d octaves\n",
+           heightSize, maxLevel+1, octaves);
+}
+
+//
+// Delete terrain data
+//
+TerrainRaymarch::~TerrainRaymarch()
+{
+    glDeleteShader(shaderParts[0].id);
+    glDeleteShader(shaderParts[1].id);
+    glDeleteProgram(shaderID);
+    glDeleteTextures(NUM_TEXTURES, textureIDs);
+    glDeleteVertexArrays(1, &varrayID);
+}
+
+//
+// load (or replace) terrain shaders
+//
+void TerrainRaymarch::updateShaders()
+{
+    loadShaders(shaderID, sizeof(shaderParts)/sizeof(*shaderParts),
+            shaderParts);
+    glUseProgram(shaderID);
+
+    // (re)connect view and projection matrices
+    glUniformBlockBinding(shaderID,
+            glGetUniformBlockIndex(shaderID,"SceneData"),
+            AppContext::SCENE_UNIFORMS);
+
+    // map shader name for textures to glActiveTexture number used in draw
+    glUniform1i(glGetUniformLocation(shaderID, "colorTexture"), 0);
+    glUniform1i(glGetUniformLocation(shaderID, "heightTexture"), 1);
+    glUniform1i(glGetUniformLocation(shaderID, "maxTexture"), 2);
+
+    // texture placement
+    glUniform3f(glGetUniformLocation(shaderID, "mapSize"),
+            mapSize.x, mapSize.y, mapSize.z);
+    glUniform1i(glGetUniformLocation(shaderID, "cells"), heightSize);
+    glUniform1i(glGetUniformLocation(shaderID, "maxLevel"), maxLevel);
+}
+
+//
+// draw one full-screen triangle; the fragment shader does the rest
+//
+void TerrainRaymarch::draw(Scene &scene)
+{
+    glUseProgram(shaderID);
+    glBindVertexArray(varrayID);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, textureIDs[COLOR_TEXTURE]);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, textureIDs[HEIGHT_TEXTURE]);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, textureIDs[MAX_TEXTURE]);
+
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    scene.stats.triangles += 1;
+}
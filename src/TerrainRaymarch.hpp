@@ -0,0 +1,48 @@
+// terrain drawn by ray marching a height texture
+#ifndef TerrainRaymarch_hpp
+#define TerrainRaymarch_hpp
+
+#include "Vec.hpp"
+#include "Shader.hpp"
+
+class Scene;
+
+// full-screen pass that marches each pixel's view ray through a height
+// texture, skipping empty space with a pyramid of maximum heights (after
+// Tevs et al., "Maximum Mipmaps for Fast, Accurate, and Scalable Dynamic
+// Height Field Rendering"). Cost depends on pixels rather than triangles,
+// and depth is written from the hit point so it composites with geometry.
+class TerrainRaymarch {
+// private data
+private:
+    Vec3f mapSize;              // size of terrain in world space
+    int heightSize;             // height texture cells across
+    int maxLevel;               // coarsest level of maximum pyramid
+
+    // GL vertex array object IDs, empty for the full-screen triangle
+    unsigned int varrayID;
+
+    // GL texture IDs
+    enum {COLOR_TEXTURE, HEIGHT_TEXTURE, MAX_TEXTURE, NUM_TEXTURES};
+    unsigned int textureIDs[NUM_TEXTURES];
+
+    // GL shaders
+    unsigned int shaderID;      // ID for shader program
+    ShaderInfo shaderParts[2];  // vertex & fragment shader info
+
+// public methods
+public:
+    // build height texture and maximum pyramid from the height function
+    TerrainRaymarch(Vec3f mapSize, int octaves);
+
+    // clean up
+    ~TerrainRaymarch();
+
+    // load/reload shaders
+    void updateShaders();
+
+    // draw the terrain for the scene view
+    void draw(Scene &scene);
+};
+
+#endif
@@ -0,0 +1,128 @@
+// terrain drawn on the CPU by tracing rays
+// packets of coherent rays after Wald et al., "Interactive Rendering with
+// Coherent Ray Tracing"
+
+#include "TerrainTracer.hpp"
+#include "Scene.hpp"
+#include "Parallel.hpp"
+#include "Xform.inl"
+
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <math.h>
+
+// pixels across each square tile handed to a thread: even, so tiles hold
+// whole 2x2 packets
+const int TILE = 16;
+
+//
+// load the surface texture used by terrain.frag
+//
+TerrainTracer::TerrainTracer(const Terrain &terrain)
+    : terrain(terrain), texture("pebbles.ppm"), numthreads(parallelThreads())
+{}
+
+//
+// bilinear texture color at uv, repeating as the GL texture does
+//
+Vec3f TerrainTracer::texel(Vec2f uv) const
+{
+    float x = uv.x * texture.width - 0.5f, y = uv.y * texture.height - 0.5f;
+    float fx = floorf(x), fy = floorf(y);
+    int x0 = int(fx), y0 = int(fy);
+    fx = x - fx;
+    fy = y - fy;
+
+    Vec3f color = vec3<float>(0, 0, 0);
+    for(int k=0; k < 4; ++k) {
+        int tx = (x0 + (k & 1)) % int(texture.width);
+        int ty = (y0 + (k >> 1)) % int(texture.height);
+        if (tx < 0) tx += texture.width;
+        if (ty < 0) ty += texture.height;
+        ImagePPM::color_type c = texture(tx, ty);
+        float w = (k & 1 ? fx : 1 - fx) * (k >> 1 ? fy : 1 - fy);
+        color += w * vec3<float>(c.r, c.g, c.b) / 255.f;
+    }
+    return color;
+}
+
+//
+// terrain.frag shading for one ray: texture times diffuse, faded to the
+// background with fog, or just the background on a miss
+//
+ImagePPM::color_type TerrainTracer::shade(const Scene &scene, Vec3f light,
+        bool found, const Terrain::RayHit &hit) const
+{
+    const Vec4f &fog = scene.sdata.fog;
+    Vec3f color = fog.rgb;
+    if (found) {
+        Vec3f size = terrain.size();
+        Vec2f uv = vec2<float>(hit.position.x / size.x, hit.position.y / size.y)
+                 * 0.5f + 0.5f;
+        float diff = std::max(0.f, dot(hit.vertexNormal, light));
+        color = texel(uv) * diff;
+
+        if (fog.a != 0) {
+            Vec4f eye = scene.sdata.viewmat.matrix * vec4<float>(
+                hit.position.x, hit.position.y, hit.position.z, 1);
+            float f = exp2f(.005f * eye.z);
+            color = f * color + (1 - f) * fog.rgb;
+        }
+    }
+
+    ImagePPM::color_type c;
+    for(int i=0; i < 3; ++i)
+        c[i] = (unsigned char)(255 * std::min(std::max(color[i], 0.f), 1.f) + 0.5f);
+    return c;
+}
+
+//
+// trace the scene view into image, one 2x2 packet of pixels at a time
+//
+double TerrainTracer::render(const Scene &scene, ImagePPM &image) const
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // build shared raycast data before the threads start
+    terrain.prepareRaycasts();
+
+    // terrain.frag lights from a fixed view-space direction
+    Vec4f light = scene.sdata.viewmat.inverse * vec4<float>(-1, 1, 1, 0);
+    Vec3f L = normalize(light.xyz);
+
+    // pixel centers scaled to the scene window, so the view matches
+    int w = image.width, h = image.height;
+    double sx = double(scene.width) / w, sy = double(scene.height) / h;
+
+    int tilesX = (w + TILE - 1) / TILE, tilesY = (h + TILE - 1) / TILE;
+    parallelFor(tilesX * tilesY, numthreads, [&](int tile) {
+        int x0 = (tile % tilesX) * TILE, y0 = (tile / tilesX) * TILE;
+        for(int y = y0; y < std::min(y0 + TILE, h); y += 2) {
+            for(int x = x0; x < std::min(x0 + TILE, w); x += 2) {
+                // pixels past the image edge repeat the last row or column
+                Vec3f dir[4];
+                for(int k=0; k < 4; ++k) {
+                    int px = std::min(x + (k & 1), w - 1);
+                    int py = std::min(y + (k >> 1), h - 1);
+                    dir[k] = scene.pickRay((px + 0.5) * sx, (py + 0.5) * sy);
+                }
+
+                Terrain::RayHit hit[4];
+                int found = terrain.raycastPacket(scene.position, dir, hit);
+                for(int k=0; k < 4; ++k) {
+                    int px = x + (k & 1), py = y + (k >> 1);
+                    if (px < w && py < h)
+                        image(px, py) = shade(scene, L, (found >> k) & 1, hit[k]);
+                }
+            }
+        }
+    });
+
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    double rate = w * h / seconds;
+    printf("traced %dx%d pixels in %.3f s on %u threads: %.2f Mrays/s\n",
+           w, h, seconds, numthreads, rate * 1e-6);
+    return rate;
+}
@@ -0,0 +1,45 @@
+// terrain drawn on the CPU by tracing rays
+#ifndef TerrainTracer_hpp
+#define TerrainTracer_hpp
+
+#include "Vec.hpp"
+#include "ImagePPM.hpp"
+#include "Terrain.hpp"
+
+class Scene;
+
+// renders the view of a terrain mesh into an image with no GPU, for
+// headless image generation with "GLapp --trace". Rays go out four at a
+// time, one 2x2 block of pixels per packet, through the terrain's min/max
+// height pyramid, and are shaded with the texture and diffuse lighting of
+// terrain.frag. The image is split into square tiles handed out to
+// threads as they finish.
+class TerrainTracer {
+// private data
+private:
+    const Terrain &terrain;     // terrain to trace
+    ImagePPM texture;           // surface color, as in terrain.frag
+    unsigned int numthreads;    // threads used for each image
+
+// private methods
+private:
+    // bilinear texture color at texture coordinate uv, from 0 to 1
+    Vec3f texel(Vec2f uv) const;
+
+    // color for one ray, given the world-space light direction
+    ImagePPM::color_type shade(const Scene &scene, Vec3f light,
+                               bool found, const Terrain::RayHit &hit) const;
+
+// public methods
+public:
+    // tracer for the given terrain, which must outlive it
+    TerrainTracer(const Terrain &terrain);
+
+    // trace the scene view into image, returning rays per second
+    double render(const Scene &scene, ImagePPM &image) const;
+
+    // threads used for each image
+    unsigned int threads() const { return numthreads; }
+};
+
+#endif